@@ -0,0 +1,225 @@
+#include "Corpus.hpp"
+#include "Regression.hpp"
+#include <parser.hpp>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+using Clock = std::chrono::steady_clock;
+
+const char* phaseNames[] = { "lex", "parse", "eval" };
+constexpr int phaseCount = 3;
+
+struct Result {
+    std::string caseName;
+    const char* phase;
+    long statements;
+    size_t bytes;
+    std::vector<uint64_t> samplesNs;
+
+    double medianNs() const {
+        std::vector<uint64_t> sorted = samplesNs;
+        std::sort(sorted.begin(), sorted.end());
+        size_t mid = sorted.size() / 2;
+        return sorted.size() % 2 == 1 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2.0;
+    }
+
+    double nsPerOp() const {
+        return medianNs() / statements;
+    }
+
+    double megabytesPerSecond() const {
+        return bytes / medianNs() * 1e9 / (1024.0 * 1024.0);
+    }
+};
+
+uint64_t nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Runs every phase of one case, appending one sample per phase to results.
+// Each phase works on the previous phase's output, so parse and eval never
+// include lexing time, and eval starts from an empty variable table.
+void runCase(const BenchCase& benchCase, Result* results) {
+    auto start = Clock::now();
+    auto tokens = parseTokens(benchCase.source);
+    results[0].samplesNs.push_back(nanosSince(start));
+
+    start = Clock::now();
+    auto nodes = parseScript(std::move(tokens));
+    results[1].samplesNs.push_back(nanosSince(start));
+
+    variables.clear();
+    start = Clock::now();
+    for (auto& node : nodes)
+        evalAST(node);
+    results[2].samplesNs.push_back(nanosSince(start));
+}
+
+void writeTable(std::ostream& out, const std::vector<Result>& results, int repetitions) {
+    out << "median of " << repetitions << " runs\n";
+    out << std::left << std::setw(14) << "case" << std::setw(8) << "phase" << std::right
+        << std::setw(12) << "ns/op" << std::setw(14) << "ops/s" << std::setw(10) << "MB/s" << "\n";
+
+    out << std::fixed;
+    for (auto& result : results) {
+        out << std::left << std::setw(14) << result.caseName << std::setw(8) << result.phase << std::right
+            << std::setprecision(1) << std::setw(12) << result.nsPerOp()
+            << std::setprecision(0) << std::setw(14) << 1e9 / result.nsPerOp()
+            << std::setprecision(2) << std::setw(10) << result.megabytesPerSecond() << "\n";
+    }
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results, uint32_t seed, long scale, int repetitions) {
+    out << "{\n"
+        << "  \"seed\": " << seed << ",\n"
+        << "  \"scale\": " << scale << ",\n"
+        << "  \"repetitions\": " << repetitions << ",\n"
+        << "  \"benchmarks\": [\n";
+
+    out << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        out << "    {\"name\": \"" << result.caseName << "/" << result.phase << "\""
+            << ", \"statements\": " << result.statements
+            << ", \"bytes\": " << result.bytes
+            << ", \"ns_per_op\": " << result.nsPerOp()
+            << ", \"mb_per_s\": " << result.megabytesPerSecond()
+            << ", \"samples_ns\": [";
+        for (size_t s = 0; s < result.samplesNs.size(); s++)
+            out << (s > 0 ? ", " : "") << result.samplesNs[s];
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+}
+
+// Compares this run against a stored baseline, so a regression can fail
+// the build's benchmark suite.
+bool checkBaseline(const std::string& baselinePath, const std::vector<Result>& results, const RegressionOptions& options) {
+    std::vector<BenchRecord> current;
+    for (auto& result : results)
+        current.push_back(BenchRecord { result.caseName + "/" + result.phase, result.statements, result.samplesNs });
+
+    std::cout << "\ncompared with " << baselinePath << "\n";
+    return compareBenchResults(readBenchResults(baselinePath), current, options, std::cout);
+}
+
+void printUsage() {
+    std::cerr << "usage: iodine_bench [--json[=file]] [--repetitions=n] [--scale=n] [--seed=n] [--filter=text]\n"
+              << "                    [--phase=lex|parse|eval] [--baseline=file [--threshold=percent]]\n";
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    std::string jsonPath;
+    int repetitions = 7;
+    long scale = 2000;
+    uint32_t seed = 1;
+    std::string filter;
+    std::string phaseFilter;
+    std::string baselinePath;
+    RegressionOptions regressionOptions;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json = true;
+            jsonPath = argv[i] + 7;
+        } else if (strncmp(argv[i], "--repetitions=", 14) == 0) {
+            repetitions = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--scale=", 8) == 0) {
+            scale = atol(argv[i] + 8);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = (uint32_t)strtoul(argv[i] + 7, nullptr, 10);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else if (strncmp(argv[i], "--phase=", 8) == 0) {
+            phaseFilter = argv[i] + 8;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baselinePath = argv[i] + 11;
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            regressionOptions.threshold = atof(argv[i] + 12) / 100.0;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (repetitions <= 0 || scale <= 3) {
+        printUsage();
+        return 1;
+    }
+
+    functions["identity"] = Function { true, "identity", [](FuncArgs args) {
+        if (args.size() != 1) throw std::runtime_error("Incorrect number of arguments");
+        return args[0]->getValue();
+    }};
+
+    functions["length"] = Function { true, "length", [](FuncArgs args) {
+        if (args.size() != 1) throw std::runtime_error("Incorrect number of arguments");
+
+        Value val = args[0]->getValue();
+        if (val.type != DataType::String) throw std::runtime_error("length expects a string");
+        return Value((int)val.strVal.size());
+    }};
+
+    std::vector<Result> results;
+
+    try {
+        for (auto& benchCase : generateCorpus(seed, scale)) {
+            if (!filter.empty() && benchCase.name.find(filter) == std::string::npos)
+                continue;
+
+            Result caseResults[phaseCount];
+            for (int p = 0; p < phaseCount; p++)
+                caseResults[p] = Result { benchCase.name, phaseNames[p], benchCase.statements, benchCase.source.size(), {} };
+
+            // One untimed run to warm caches and the string table.
+            Result warmup[phaseCount];
+            runCase(benchCase, warmup);
+
+            for (int r = 0; r < repetitions; r++)
+                runCase(benchCase, caseResults);
+
+            for (auto& result : caseResults) {
+                if (phaseFilter.empty() || phaseFilter == result.phase)
+                    results.push_back(result);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    if (!json) {
+        writeTable(std::cout, results, repetitions);
+    } else if (jsonPath.empty()) {
+        writeJson(std::cout, results, seed, scale, repetitions);
+    } else {
+        std::ofstream out(jsonPath);
+        writeJson(out, results, seed, scale, repetitions);
+        writeTable(std::cout, results, repetitions);
+    }
+
+    if (!baselinePath.empty()) {
+        try {
+            if (!checkBaseline(baselinePath, results, regressionOptions))
+                return 1;
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#include "Regression.hpp"
+#include <string.h>
+#include <iostream>
+
+using namespace iodine;
+
+void printUsage() {
+    std::cerr << "usage: iodine_bench_compare <baseline.json> <current.json> [--threshold=percent] [--noise=factor]\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    RegressionOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            options.threshold = atof(argv[i] + 12) / 100.0;
+        } else if (strncmp(argv[i], "--noise=", 8) == 0) {
+            options.noiseFactor = atof(argv[i] + 8);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.size() != 2) {
+        printUsage();
+        return 2;
+    }
+
+    try {
+        auto baseline = readBenchResults(paths[0]);
+        auto current = readBenchResults(paths[1]);
+
+        return compareBenchResults(baseline, current, options, std::cout) ? 0 : 1;
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,121 @@
+#include "Corpus.hpp"
+#include <random>
+
+namespace iodine {
+    namespace {
+        // std::mt19937 produces the same sequence everywhere, unlike the
+        // standard distributions, so scripts are drawn from it directly.
+        class CorpusRandom {
+        public:
+            explicit CorpusRandom(uint32_t seed) : engine(seed) {}
+
+            int below(int bound) {
+                return (int)(engine() % (uint32_t)bound);
+            }
+
+            std::string digit() {
+                return std::to_string(below(10));
+            }
+
+            std::string word(int length) {
+                std::string word;
+                for (int i = 0; i < length; i++)
+                    word += (char)('a' + below(26));
+                return word;
+            }
+
+        private:
+            std::mt19937 engine;
+        };
+
+        const char* additive[] = { " + ", " - " };
+
+        // Long flat chains of additions with a single multiplication, so
+        // values stay small under the parser's right associativity.
+        BenchCase arithmetic(CorpusRandom& random, long scale) {
+            std::string source = "i32 x = 0;\n";
+            for (long i = 1; i < scale; i++) {
+                int terms = 24 + random.below(16);
+                int product = random.below(terms);
+
+                source += "x = " + random.digit();
+                for (int t = 1; t < terms; t++)
+                    source += (t == product ? " * " : additive[random.below(2)]) + random.digit();
+                source += ";\n";
+            }
+            return { "arithmetic", source, scale };
+        }
+
+        BenchCase parentheses(CorpusRandom& random, long scale) {
+            std::string source = "i32 x = 0;\n";
+            for (long i = 1; i < scale; i++) {
+                int depth = 16 + random.below(32);
+
+                source += "x = " + std::string(depth, '(') + random.digit();
+                for (int d = 0; d < depth; d++)
+                    source += additive[random.below(2)] + random.digit() + ")";
+                source += ";\n";
+            }
+            return { "parentheses", source, scale };
+        }
+
+        BenchCase variables(CorpusRandom& random, long scale) {
+            long declared = scale / 4 > 1 ? scale / 4 : 1;
+
+            std::string source;
+            for (long i = 0; i < declared; i++)
+                source += "i32 v" + std::to_string(i) + " = " + random.digit() + ";\n";
+
+            auto var = [&]() { return "v" + std::to_string(random.below((int)declared)); };
+            for (long i = declared; i < scale; i++)
+                source += var() + " = " + var() + additive[random.below(2)] + var() + ";\n";
+
+            return { "variables", source, scale };
+        }
+
+        BenchCase strings(CorpusRandom& random, long scale) {
+            std::string source = "i32 n = 0;\n";
+            for (long i = 1; i < scale; i++) {
+                int parts = 2 + random.below(6);
+
+                source += "n = length(\"" + random.word(4 + random.below(24)) + "\"";
+                for (int p = 1; p < parts; p++)
+                    source += " + \"" + random.word(1 + random.below(12)) + "\"";
+                source += ");\n";
+            }
+            return { "strings", source, scale };
+        }
+
+        BenchCase calls(CorpusRandom& random, long scale) {
+            std::string source =
+                "fn add(i32 a, i32 b) { return a + b; }\n"
+                "fn twice(i32 a) { return add(a, a); }\n"
+                "i32 x = 0;\n";
+
+            const char* callees[] = { "add(", "twice(", "identity(" };
+            const int arity[] = { 2, 1, 1 };
+
+            for (long i = 3; i < scale; i++) {
+                int callee = random.below(3);
+
+                source += std::string("x = ") + callees[callee] + random.digit();
+                for (int a = 1; a < arity[callee]; a++)
+                    source += ", " + std::string(callees[random.below(3) == 0 ? 2 : 1]) + random.digit() + ")";
+                source += ");\n";
+            }
+            return { "calls", source, scale };
+        }
+    }
+
+    std::vector<BenchCase> generateCorpus(uint32_t seed, long scale) {
+        CorpusRandom random(seed);
+
+        std::vector<BenchCase> corpus;
+        corpus.push_back(arithmetic(random, scale));
+        corpus.push_back(parentheses(random, scale));
+        corpus.push_back(variables(random, scale));
+        corpus.push_back(strings(random, scale));
+        corpus.push_back(calls(random, scale));
+        return corpus;
+    }
+}
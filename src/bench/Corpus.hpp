@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    // A generated script exercising one part of the lexer, parser or
+    // evaluator. Statements is what "per op" figures are normalized by.
+    struct BenchCase {
+        std::string name;
+        std::string source;
+        long statements;
+    };
+
+    // Generates the benchmark corpus. The output depends only on the seed
+    // and scale, so results from different machines and builds compare.
+    // Scale is the number of statements in each case.
+    std::vector<BenchCase> generateCorpus(uint32_t seed, long scale);
+}
@@ -0,0 +1,66 @@
+#include <parser.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Lexes, parses and runs a script, printing the time spent in each phase
+// normalized to the number of loop iterations it represents.
+void runScript(const char* label, const std::string& script, long iterations) {
+    variables.clear();
+
+    auto start = Clock::now();
+    auto tokens = parseTokens(script);
+    double lexTime = secondsSince(start);
+
+    start = Clock::now();
+    auto nodes = parseScript(tokens);
+    double parseTime = secondsSince(start);
+
+    start = Clock::now();
+    for (auto& node : nodes)
+        evalAST(node);
+    double evalTime = secondsSince(start);
+
+    double total = lexTime + parseTime + evalTime;
+    std::cout << label << ": " << iterations << " iterations\n"
+              << "  lex   " << lexTime * 1000.0 << " ms\n"
+              << "  parse " << parseTime * 1000.0 << " ms\n"
+              << "  eval  " << evalTime * 1000.0 << " ms\n"
+              << "  total " << total * 1000.0 << " ms, " << total * 1e9 / iterations << " ns/iteration\n"
+              << "  x = " << variables.at("x").val.intVal << "\n";
+}
+
+int main(int argc, char** argv) {
+    // The unrolled script holds a full AST per iteration, so it's kept
+    // smaller by default and compared per iteration.
+    long loopIterations = argc > 1 ? std::stol(argv[1]) : 10000000;
+    long unrolledIterations = argc > 2 ? std::stol(argv[2]) : 1000000;
+
+    std::string header = "i32 x = 0;\n";
+
+    runScript("counted for loop", header
+        + "for (i32 i = 0; i < " + std::to_string(loopIterations) + "; i = i + 1) { x = i * 2; }\n",
+        loopIterations);
+
+    runScript("while loop", header
+        + "i32 i = 0;\nwhile (i < " + std::to_string(loopIterations) + ") { x = i * 2; i = i + 1; }\n",
+        loopIterations);
+
+    std::string unrolled = header;
+    for (long i = 0; i < unrolledIterations; i++)
+        unrolled += "x = " + std::to_string(i) + " * 2;\n";
+
+    runScript("unrolled script", unrolled, unrolledIterations);
+}
@@ -0,0 +1,115 @@
+#include <Reactive.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+using Clock = std::chrono::steady_clock;
+
+double microsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// A script deriving values from inputs in0..in<k-1>, which it never
+// declares. Value v<j> depends on input j % k and on v<j-k>, so changing
+// one input affects one in k of the derived values.
+std::string makeScript(int statements, int inputs) {
+    std::string script = "fn scale(f64 x) { if (x > 100.0) { return x * 0.5; } return x * 1.5; }\n";
+    for (int j = 0; j < statements; j++) {
+        std::string input = "in" + std::to_string(j % inputs);
+        if (j < inputs)
+            script += "f64 v" + std::to_string(j) + " = " + input + " * 2.0;\n";
+        else
+            script += "f64 v" + std::to_string(j) + " = scale(v" + std::to_string(j - inputs) + ") + " + input + ";\n";
+    }
+    return script;
+}
+
+bool sameGlobals(const std::unordered_map<std::string, Variable>& a, const std::unordered_map<std::string, Variable>& b) {
+    if (a.size() != b.size())
+        return false;
+    for (auto& [name, var] : a) {
+        auto it = b.find(name);
+        if (it == b.end() || it->second.type != var.type || it->second.val.type != var.val.type)
+            return false;
+        if (var.val.type == DataType::F64 && it->second.val.doubleVal != var.val.doubleVal)
+            return false;
+    }
+    return true;
+}
+
+// Compares rerunning a whole script after changing one input with
+// ReactiveScript::update(), and checks that both leave the same globals.
+int main(int argc, char** argv) {
+    int statements = 10000;
+    int inputs = 100;
+    int updates = 100;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--statements=", 13) == 0) {
+            statements = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--inputs=", 9) == 0) {
+            inputs = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--updates=", 10) == 0) {
+            updates = atoi(argv[i] + 10);
+        } else {
+            std::cerr << "Usage: iodine_reactive_bench [--statements=10000] [--inputs=100] [--updates=100]\n";
+            return 1;
+        }
+    }
+    if (inputs <= 0 || statements < inputs || updates <= 0) {
+        std::cerr << "Need at least one input, one update, and no fewer statements than inputs\n";
+        return 1;
+    }
+
+    auto nodes = parseScript(parseTokens(makeScript(statements, inputs)));
+    ReactiveScript script(nodes);
+    for (int i = 0; i < inputs; i++)
+        script.setInput("in" + std::to_string(i), Value((double)i));
+
+    auto start = Clock::now();
+    script.run();
+    double initialRun = microsSince(start);
+
+    double fullTotal = 0;
+    double updateTotal = 0;
+    size_t rerun = 0;
+
+    for (int u = 0; u < updates; u++) {
+        std::string input = "in" + std::to_string(u % inputs);
+        Value value((double)(u * 7 % 300));
+
+        start = Clock::now();
+        script.setInput(input, value);
+        rerun += script.update();
+        updateTotal += microsSince(start);
+        auto updated = variables;
+
+        // The same inputs from scratch.
+        for (auto& [name, var] : updated) {
+            if (name.compare(0, 2, "in") != 0)
+                variables.erase(name);
+        }
+        start = Clock::now();
+        for (auto& node : nodes)
+            evalAST(node);
+        fullTotal += microsSince(start);
+
+        if (!sameGlobals(updated, variables)) {
+            std::cerr << "Update " << u << " left different globals than a full run\n";
+            return 1;
+        }
+    }
+
+    std::cout << statements << " statements, " << inputs << " inputs, " << updates << " updates\n"
+              << "  initial run " << initialRun << " us\n"
+              << "  full rerun  " << fullTotal / updates << " us\n"
+              << "  update      " << updateTotal / updates << " us, " << (double)rerun / updates << " statements rerun\n";
+}
@@ -0,0 +1,241 @@
+#include "Regression.hpp"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace iodine {
+    namespace {
+        // Just enough JSON to read iodine_bench output back: objects, arrays,
+        // strings without escapes beyond \" and \\, numbers and literals.
+        class JsonReader {
+        public:
+            JsonReader(const std::string& text, const std::string& path) : text(text), path(path) {}
+
+            void expect(char c) {
+                skipWhitespace();
+                if (pos >= text.size() || text[pos] != c)
+                    fail(std::string("expected '") + c + "'");
+                pos++;
+            }
+
+            // Consumes c if it's the next character.
+            bool accept(char c) {
+                skipWhitespace();
+                if (pos < text.size() && text[pos] == c) {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+
+            std::string readString() {
+                expect('"');
+                std::string str;
+                while (pos < text.size() && text[pos] != '"') {
+                    if (text[pos] == '\\')
+                        pos++;
+                    if (pos < text.size())
+                        str += text[pos++];
+                }
+                expect('"');
+                return str;
+            }
+
+            double readNumber() {
+                skipWhitespace();
+                size_t start = pos;
+                while (pos < text.size() && (isdigit(text[pos]) || strchr("+-.eE", text[pos]) != nullptr))
+                    pos++;
+                if (start == pos)
+                    fail("expected a number");
+                return atof(text.substr(start, pos - start).c_str());
+            }
+
+            void skipValue() {
+                skipWhitespace();
+                if (pos >= text.size())
+                    fail("unexpected end of file");
+
+                char c = text[pos];
+                if (c == '"') {
+                    readString();
+                } else if (c == '{') {
+                    readObject([this](const std::string&) { skipValue(); });
+                } else if (c == '[') {
+                    readArray([this]() { skipValue(); });
+                } else if (isalpha(c)) {
+                    while (pos < text.size() && isalpha(text[pos]))
+                        pos++;
+                } else {
+                    readNumber();
+                }
+            }
+
+            template<typename F>
+            void readObject(F onKey) {
+                expect('{');
+                if (accept('}'))
+                    return;
+                do {
+                    std::string key = readString();
+                    expect(':');
+                    onKey(key);
+                } while (accept(','));
+                expect('}');
+            }
+
+            template<typename F>
+            void readArray(F onElement) {
+                expect('[');
+                if (accept(']'))
+                    return;
+                do {
+                    onElement();
+                } while (accept(','));
+                expect(']');
+            }
+
+        private:
+            const std::string& text;
+            const std::string& path;
+            size_t pos = 0;
+
+            void skipWhitespace() {
+                while (pos < text.size() && isspace(text[pos]))
+                    pos++;
+            }
+
+            [[noreturn]] void fail(const std::string& message) {
+                throw std::runtime_error(path + ": " + message + " at offset " + std::to_string(pos));
+            }
+        };
+
+        double median(std::vector<double> values) {
+            std::sort(values.begin(), values.end());
+            size_t mid = values.size() / 2;
+            return values.size() % 2 == 1 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+        }
+
+        struct Summary {
+            double median;
+            // Median absolute deviation from the median.
+            double mad;
+        };
+
+        // Summarizes a benchmark's samples in ns per statement.
+        Summary summarize(const BenchRecord& record) {
+            std::vector<double> perOp;
+            for (auto sample : record.samplesNs)
+                perOp.push_back((double)sample / record.statements);
+
+            Summary summary;
+            summary.median = median(perOp);
+
+            std::vector<double> deviations;
+            for (auto value : perOp)
+                deviations.push_back(fabs(value - summary.median));
+            summary.mad = median(deviations);
+
+            return summary;
+        }
+    }
+
+    std::vector<BenchRecord> readBenchResults(const std::string& path) {
+        std::ifstream in(path);
+        if (!in.good())
+            throw std::runtime_error("Couldn't open " + path);
+
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        std::string text = buffer.str();
+
+        std::vector<BenchRecord> records;
+        JsonReader reader(text, path);
+
+        reader.readObject([&](const std::string& key) {
+            if (key != "benchmarks") {
+                reader.skipValue();
+                return;
+            }
+
+            reader.readArray([&]() {
+                BenchRecord record;
+                reader.readObject([&](const std::string& field) {
+                    if (field == "name")
+                        record.name = reader.readString();
+                    else if (field == "statements")
+                        record.statements = (long)reader.readNumber();
+                    else if (field == "samples_ns")
+                        reader.readArray([&]() { record.samplesNs.push_back((uint64_t)reader.readNumber()); });
+                    else
+                        reader.skipValue();
+                });
+
+                if (record.name.empty() || record.statements <= 0 || record.samplesNs.empty())
+                    throw std::runtime_error(path + ": incomplete benchmark entry " + record.name);
+                records.push_back(record);
+            });
+        });
+
+        return records;
+    }
+
+    bool compareBenchResults(const std::vector<BenchRecord>& baseline, const std::vector<BenchRecord>& current,
+                             const RegressionOptions& options, std::ostream& out) {
+        std::unordered_map<std::string, const BenchRecord*> baselineByName;
+        for (auto& record : baseline)
+            baselineByName[record.name] = &record;
+
+        out << std::left << std::setw(20) << "benchmark" << std::right
+            << std::setw(14) << "base ns/op" << std::setw(14) << "new ns/op"
+            << std::setw(10) << "change" << std::setw(12) << "noise" << "  verdict\n";
+        out << std::fixed;
+
+        bool passed = true;
+        int compared = 0;
+        for (auto& record : current) {
+            auto it = baselineByName.find(record.name);
+            if (it == baselineByName.end()) {
+                out << std::left << std::setw(20) << record.name << std::right << "  (not in baseline)\n";
+                continue;
+            }
+
+            Summary before = summarize(*it->second);
+            Summary after = summarize(record);
+
+            // 1.4826 * MAD estimates the standard deviation for normally
+            // distributed noise without being thrown off by outliers.
+            double noise = options.noiseFactor * 1.4826 * std::max(before.mad, after.mad);
+            double difference = after.median - before.median;
+            double change = difference / before.median;
+
+            const char* verdict = "ok";
+            if (difference > noise && change > options.threshold) {
+                verdict = "REGRESSION";
+                passed = false;
+            } else if (-difference > noise && -change > options.threshold) {
+                verdict = "improved";
+            }
+
+            out << std::left << std::setw(20) << record.name << std::right
+                << std::setprecision(1) << std::setw(14) << before.median << std::setw(14) << after.median
+                << std::showpos << std::setw(9) << change * 100.0 << "%" << std::noshowpos
+                << std::setw(12) << noise << "  " << verdict << "\n";
+            compared++;
+        }
+
+        if (compared == 0) {
+            out << "No benchmarks in common with the baseline\n";
+            return false;
+        }
+
+        return passed;
+    }
+}
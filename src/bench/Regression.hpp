@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    // One benchmark as stored in iodine_bench's JSON output.
+    struct BenchRecord {
+        std::string name;
+        long statements = 0;
+        std::vector<uint64_t> samplesNs;
+    };
+
+    // Reads the benchmarks array of a file written by iodine_bench --json.
+    // Throws std::runtime_error if the file can't be read or parsed.
+    std::vector<BenchRecord> readBenchResults(const std::string& path);
+
+    struct RegressionOptions {
+        // Slowdowns smaller than this fraction of the baseline median are
+        // never reported, however quiet the measurements are.
+        double threshold = 0.2;
+        // How many robust standard deviations (1.4826 * MAD) a difference
+        // has to exceed before it counts as more than noise.
+        double noiseFactor = 3.0;
+    };
+
+    // Compares the per-statement medians of every benchmark present in both
+    // sets and prints one line each. Returns false if any benchmark slowed
+    // down by more than both the threshold and the noise band.
+    bool compareBenchResults(const std::vector<BenchRecord>& baseline, const std::vector<BenchRecord>& current,
+                             const RegressionOptions& options, std::ostream& out);
+}
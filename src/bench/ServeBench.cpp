@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator for `scriptrunner --serve`. Every connection runs on its
+// own thread and sends the same request back to back, waiting for each
+// answer before sending the next, and the latencies of all of them are
+// reported together.
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    int connectTo(const std::string& path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Socket path too long: " + path);
+        strcpy(address.sun_path, path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+            std::string message = std::string("Couldn't connect to ") + path + ": " + strerror(errno);
+            if (fd >= 0)
+                close(fd);
+            throw std::runtime_error(message);
+        }
+        return fd;
+    }
+
+    class Connection {
+    public:
+        Connection(const std::string& path) : fd(connectTo(path)) {}
+        ~Connection() { close(fd); }
+
+        void send(const std::string& data) {
+            size_t sent = 0;
+            while (sent < data.size()) {
+                ssize_t bytes = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (bytes < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::runtime_error(std::string("send failed: ") + strerror(errno));
+                }
+                sent += bytes;
+            }
+        }
+
+        // Reads one answer and returns whether it was OK.
+        bool receive() {
+            std::string header = line();
+            if (header.compare(0, 3, "OK ") != 0)
+                return false;
+
+            size_t outputBytes = strtoul(header.c_str() + 3, nullptr, 10);
+            size_t results = strtoul(header.c_str() + header.rfind(' ') + 1, nullptr, 10);
+
+            fill(outputBytes);
+            buffer.erase(0, outputBytes);
+            for (size_t i = 0; i < results; i++)
+                line();
+            return true;
+        }
+
+    private:
+        int fd;
+        std::string buffer;
+
+        void fill(size_t bytes) {
+            char chunk[16384];
+            while (buffer.size() < bytes) {
+                ssize_t got = read(fd, chunk, sizeof(chunk));
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got <= 0)
+                    throw std::runtime_error("Server closed the connection");
+                buffer.append(chunk, got);
+            }
+        }
+
+        std::string line() {
+            size_t end;
+            while ((end = buffer.find('\n')) == std::string::npos)
+                fill(buffer.size() + 1);
+
+            std::string result = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            return result;
+        }
+    };
+
+    double percentile(const std::vector<double>& sorted, double p) {
+        size_t index = std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()));
+        return sorted[index];
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string socketPath;
+    std::string script;
+    std::vector<std::string> bindings;
+    int connections = 4;
+    int requests = 1000;
+    int warmup = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0) {
+            socketPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--script=", 9) == 0) {
+            script = argv[i] + 9;
+        } else if (strncmp(argv[i], "--bind=", 7) == 0) {
+            // type:name:value, sent as "type name value".
+            std::string binding = argv[i] + 7;
+            size_t typeEnd = binding.find(':');
+            size_t nameEnd = typeEnd == std::string::npos ? std::string::npos : binding.find(':', typeEnd + 1);
+            if (nameEnd == std::string::npos) {
+                std::cerr << "Bindings look like i32:x:5\n";
+                return 1;
+            }
+            binding[typeEnd] = ' ';
+            binding[nameEnd] = ' ';
+            bindings.push_back(binding);
+        } else if (strncmp(argv[i], "--connections=", 14) == 0) {
+            connections = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--requests=", 11) == 0) {
+            requests = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+            warmup = atoi(argv[i] + 9);
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
+    if (socketPath.empty() || script.empty() || connections <= 0 || requests <= 0) {
+        std::cerr << "Usage: iodine_serve_bench --socket=path --script=path [--bind=type:name:value]... "
+                     "[--connections=4] [--requests=1000] [--warmup=10]\n";
+        return 1;
+    }
+
+    std::string request = "EVAL " + script + " " + std::to_string(bindings.size()) + "\n";
+    for (auto& binding : bindings)
+        request += binding + "\n";
+
+    std::vector<std::vector<double>> latencies(connections);
+    std::atomic<int> failures { 0 };
+    std::vector<std::thread> threads;
+    std::string error;
+    std::atomic<bool> failed { false };
+
+    auto start = Clock::now();
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            try {
+                Connection connection(socketPath);
+
+                for (int i = 0; i < warmup; i++) {
+                    connection.send(request);
+                    connection.receive();
+                }
+
+                latencies[c].reserve(requests);
+                for (int i = 0; i < requests; i++) {
+                    auto sent = Clock::now();
+                    connection.send(request);
+                    if (!connection.receive())
+                        failures++;
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+                }
+            } catch (std::exception& e) {
+                if (!failed.exchange(true))
+                    error = e.what();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (failed) {
+        std::cerr << "Error: " << error << "\n";
+        return 1;
+    }
+
+    std::vector<double> all;
+    for (auto& connectionLatencies : latencies)
+        all.insert(all.end(), connectionLatencies.begin(), connectionLatencies.end());
+    std::sort(all.begin(), all.end());
+
+    std::cout << all.size() << " requests over " << connections << " connections in " << seconds << " s, "
+              << all.size() / seconds << " requests/s\n"
+              << "  p50   " << percentile(all, 50) << " us\n"
+              << "  p90   " << percentile(all, 90) << " us\n"
+              << "  p99   " << percentile(all, 99) << " us\n"
+              << "  p99.9 " << percentile(all, 99.9) << " us\n"
+              << "  max   " << all.back() << " us\n";
+
+    if (failures > 0) {
+        std::cout << failures << " requests answered with ERR\n";
+        return 1;
+    }
+}
@@ -0,0 +1,86 @@
+#include "LMC.hpp"
+#include <stdexcept>
+#include <unordered_map>
+
+namespace iodine {
+    EnumNames<LMCOpcode> lmcOpcodeNames {
+        "HLT",
+        "ADD",
+        "SUB",
+        "STA",
+        "LDA",
+        "BRA",
+        "BRZ",
+        "BRP",
+        "INP",
+        "OUT",
+        "DAT"
+    };
+
+    namespace {
+        // Hundreds digit of each opcode; the rest is the mailbox address.
+        int opcodeBase(LMCOpcode opcode) {
+            switch (opcode) {
+            case LMCOpcode::Add: return 100;
+            case LMCOpcode::Sub: return 200;
+            case LMCOpcode::Sta: return 300;
+            case LMCOpcode::Lda: return 500;
+            case LMCOpcode::Bra: return 600;
+            case LMCOpcode::Brz: return 700;
+            case LMCOpcode::Brp: return 800;
+            case LMCOpcode::Inp: return 901;
+            case LMCOpcode::Out: return 902;
+            default: return 0;
+            }
+        }
+    }
+
+    void writeLMCAssembly(std::ostream& out, const LMCProgram& program) {
+        for (auto& instruction : program.instructions) {
+            out << instruction.label << "\t" << lmcOpcodeNames[instruction.opcode];
+            if (instruction.opcode == LMCOpcode::Dat)
+                out << "\t" << instruction.value;
+            else if (!instruction.operand.empty())
+                out << "\t" << instruction.operand;
+            out << "\n";
+        }
+    }
+
+    LMCImage assembleLMC(const LMCProgram& program) {
+        if (program.instructions.size() > (size_t)lmcMailboxCount)
+            throw std::runtime_error("Program needs " + std::to_string(program.instructions.size())
+                + " mailboxes but LMC only has " + std::to_string(lmcMailboxCount));
+
+        std::unordered_map<std::string, int> addresses;
+        for (size_t i = 0; i < program.instructions.size(); i++) {
+            auto& label = program.instructions[i].label;
+            if (!label.empty() && !addresses.emplace(label, (int)i).second)
+                throw std::runtime_error("Label " + label + " defined twice");
+        }
+
+        LMCImage image;
+        image.used = (int)program.instructions.size();
+
+        for (size_t i = 0; i < program.instructions.size(); i++) {
+            auto& instruction = program.instructions[i];
+            image.lines[i] = instruction.line;
+
+            if (instruction.opcode == LMCOpcode::Dat) {
+                image.mailboxes[i] = instruction.value;
+                continue;
+            }
+
+            int address = 0;
+            if (!instruction.operand.empty()) {
+                auto it = addresses.find(instruction.operand);
+                if (it == addresses.end())
+                    throw std::runtime_error("Undefined label " + instruction.operand);
+                address = it->second;
+            }
+
+            image.mailboxes[i] = opcodeBase(instruction.opcode) + address;
+        }
+
+        return image;
+    }
+}
@@ -0,0 +1,694 @@
+#include "LMC.hpp"
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace iodine {
+    namespace {
+        class LMCCompiler {
+        public:
+            LMCCompiler(const LMCOptions& options) : options(options) {}
+
+            LMCProgram compile(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+                for (auto& statement : statements)
+                    compileStatement(statement.get());
+
+                emit(LMCOpcode::Hlt);
+                emitData();
+                resolveAliases();
+
+                return program;
+            }
+
+        private:
+            LMCOptions options;
+            LMCProgram program;
+            std::unordered_map<std::string, std::string> variables;
+            std::vector<std::string> variableOrder;
+            std::map<int, std::string> constants;
+            int temporaryCount = 0;
+            int labelCount = 0;
+            int line = 0;
+
+            // A label placed where another is already waiting for the next
+            // instruction becomes an alias of it, since LMC allows only one
+            // label per mailbox.
+            std::string pendingLabel;
+            std::unordered_map<std::string, std::string> aliases;
+
+            [[noreturn]] void fail(const std::string& message) {
+                throw std::runtime_error("line " + std::to_string(line) + ": " + message);
+            }
+
+            void emit(LMCOpcode opcode, const std::string& operand = "") {
+                LMCInstruction instruction;
+                instruction.opcode = opcode;
+                instruction.operand = operand;
+                instruction.label = pendingLabel;
+                instruction.line = line;
+                program.instructions.push_back(instruction);
+                pendingLabel.clear();
+            }
+
+            std::string newLabel() {
+                return "L" + std::to_string(labelCount++);
+            }
+
+            void placeLabel(const std::string& label) {
+                if (pendingLabel.empty())
+                    pendingLabel = label;
+                else
+                    aliases[label] = pendingLabel;
+            }
+
+            std::string newTemporary() {
+                return "t" + std::to_string(temporaryCount++);
+            }
+
+            std::string constant(int value) {
+                if (value < lmcMinValue || value > lmcMaxValue)
+                    fail("constant " + std::to_string(value) + " doesn't fit in a mailbox");
+
+                auto& label = constants[value];
+                if (label.empty())
+                    label = value < 0 ? "kn" + std::to_string(-value) : "k" + std::to_string(value);
+                return label;
+            }
+
+            std::string variable(const std::string& name) {
+                auto it = variables.find(name);
+                if (it == variables.end())
+                    fail("Reference to undefined variable " + name);
+                return it->second;
+            }
+
+            void compileBlock(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+                for (auto& statement : statements)
+                    compileStatement(statement.get());
+            }
+
+            void compileStatement(ASTNode* node) {
+                if (node->line > 0)
+                    line = node->line;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node);
+                    if (assign->createNew) {
+                        if (assign->type != DataType::Int32)
+                            fail("only i32 variables are supported, " + assign->varName + " is " + dataTypeNames[assign->type]);
+                        if (variables.find(assign->varName) == variables.end()) {
+                            variables[assign->varName] = "v" + assign->varName;
+                            variableOrder.push_back(assign->varName);
+                        }
+                    }
+
+                    std::string target = variable(assign->varName);
+                    compileExpression(assign->valNode.get());
+                    emit(LMCOpcode::Sta, target);
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                    compileCall(static_cast<FunctionCallNode*>(node));
+                    break;
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+
+                    std::string end = newLabel();
+                    compileCondition(ifNode->condition.get(), end);
+                    compileBlock(ifNode->nodes);
+                    placeLabel(end);
+                    break;
+                }
+                case ASTNodeType::While:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    std::string top = newLabel();
+                    std::string end = newLabel();
+
+                    placeLabel(top);
+                    compileCondition(loop->condition.get(), end);
+                    compileBlock(loop->nodes);
+                    emit(LMCOpcode::Bra, top);
+                    placeLabel(end);
+                    break;
+                }
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<ForNode*>(node);
+                    std::string top = newLabel();
+                    std::string end = newLabel();
+
+                    if (loop->init != nullptr)
+                        compileStatement(loop->init.get());
+
+                    placeLabel(top);
+                    if (loop->condition != nullptr)
+                        compileCondition(loop->condition.get(), end);
+                    compileBlock(loop->nodes);
+                    if (loop->step != nullptr)
+                        compileStatement(loop->step.get());
+                    emit(LMCOpcode::Bra, top);
+                    placeLabel(end);
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                    fail("function definitions aren't supported");
+                case ASTNodeType::Return:
+                    fail("return isn't supported");
+                default:
+                    // A bare expression; evaluate it for its side effects.
+                    compileExpression(static_cast<ProducesValueNode*>(node));
+                    break;
+                }
+            }
+
+            // Evaluates node at compile time if it's built from integer
+            // constants only.
+            bool constantValue(ProducesValueNode* node, int& value) {
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                {
+                    auto& val = static_cast<ConstValNode*>(node)->val;
+                    if (val.type != DataType::Int32)
+                        return false;
+                    value = val.intVal;
+                    return true;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    if (!constantValue(unary->valNode.get(), value))
+                        return false;
+                    if (unary->operation == UnaryOperation::Minus)
+                        value = -value;
+                    return true;
+                }
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    int a, b;
+                    if (!constantValue(arith->a.get(), a) || !constantValue(arith->b.get(), b))
+                        return false;
+
+                    switch (arith->operation) {
+                    case ArithmeticOperation::Add: value = a + b; return true;
+                    case ArithmeticOperation::Subtract: value = a - b; return true;
+                    case ArithmeticOperation::Multiply: value = a * b; return true;
+                    case ArithmeticOperation::Divide:
+                        if (b == 0)
+                            return false;
+                        value = a / b;
+                        return true;
+                    default:
+                        return false;
+                    }
+                }
+                case ASTNodeType::LoopInvariant:
+                    return constantValue(static_cast<LoopInvariantNode*>(node)->expr.get(), value);
+                default:
+                    return false;
+                }
+            }
+
+            // Whether evaluating node can be skipped when its value isn't
+            // needed; only input() has side effects in an expression.
+            bool hasSideEffects(ProducesValueNode* node) {
+                switch (node->type) {
+                case ASTNodeType::FunctionCall:
+                    return true;
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    return hasSideEffects(arith->a.get()) || hasSideEffects(arith->b.get());
+                }
+                case ASTNodeType::UnaryOp:
+                    return hasSideEffects(static_cast<UnaryOpNode*>(node)->valNode.get());
+                case ASTNodeType::LoopInvariant:
+                    return hasSideEffects(static_cast<LoopInvariantNode*>(node)->expr.get());
+                case ASTNodeType::Comparison:
+                {
+                    auto comp = static_cast<ComparisonNode*>(node);
+                    return hasSideEffects(comp->lhs.get()) || hasSideEffects(comp->rhs.get());
+                }
+                default:
+                    return false;
+                }
+            }
+
+            // Leaves the value of node in the accumulator.
+            void compileExpression(ProducesValueNode* node) {
+                int folded;
+                if (options.optimize && node->type != ASTNodeType::ConstVal && constantValue(node, folded)
+                    && folded >= lmcMinValue && folded <= lmcMaxValue) {
+                    emit(LMCOpcode::Lda, constant(folded));
+                    return;
+                }
+
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                {
+                    auto& val = static_cast<ConstValNode*>(node)->val;
+                    if (val.type != DataType::Int32 && val.type != DataType::Boolean)
+                        fail(std::string("only i32 values are supported, not ") + dataTypeNames[val.type]);
+                    emit(LMCOpcode::Lda, constant(val.type == DataType::Boolean ? (int)val.boolVal : val.intVal));
+                    break;
+                }
+                case ASTNodeType::VariableReference:
+                    emit(LMCOpcode::Lda, variable(static_cast<VariableReferenceNode*>(node)->varName));
+                    break;
+                case ASTNodeType::InductionVariable:
+                    emit(LMCOpcode::Lda, variable(static_cast<InductionVariableNode*>(node)->varName));
+                    break;
+                case ASTNodeType::LoopInvariant:
+                    compileExpression(static_cast<LoopInvariantNode*>(node)->expr.get());
+                    break;
+                case ASTNodeType::CommonValue:
+                    compileExpression(static_cast<CommonValueNode*>(node)->expr.get());
+                    break;
+                case ASTNodeType::Arithmetic:
+                    compileArithmetic(static_cast<ArithmeticNode*>(node));
+                    break;
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    if (unary->operation == UnaryOperation::Plus) {
+                        compileExpression(unary->valNode.get());
+                    } else {
+                        std::string operand = operandMailbox(unary->valNode.get());
+                        emit(LMCOpcode::Lda, constant(0));
+                        emit(LMCOpcode::Sub, operand);
+                    }
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                    compileCall(static_cast<FunctionCallNode*>(node));
+                    break;
+                case ASTNodeType::Comparison:
+                {
+                    // Materialize a comparison as 0 or 1.
+                    std::string isFalse = newLabel();
+                    std::string end = newLabel();
+                    compileCondition(node, isFalse);
+                    emit(LMCOpcode::Lda, constant(1));
+                    emit(LMCOpcode::Bra, end);
+                    placeLabel(isFalse);
+                    emit(LMCOpcode::Lda, constant(0));
+                    placeLabel(end);
+                    break;
+                }
+                default:
+                    fail(std::string("expressions of type ") + nodeTypeNames[node->type] + " aren't supported");
+                }
+            }
+
+            // Returns a mailbox holding the value of node. Variables and
+            // constants are used in place; anything else is computed into
+            // a new temporary.
+            std::string operandMailbox(ProducesValueNode* node) {
+                if (node->type == ASTNodeType::VariableReference)
+                    return variable(static_cast<VariableReferenceNode*>(node)->varName);
+                if (node->type == ASTNodeType::InductionVariable)
+                    return variable(static_cast<InductionVariableNode*>(node)->varName);
+                int value;
+                if ((node->type == ASTNodeType::ConstVal || options.optimize) && constantValue(node, value)
+                    && value >= lmcMinValue && value <= lmcMaxValue)
+                    return constant(value);
+
+                compileExpression(node);
+                std::string temporary = newTemporary();
+                emit(LMCOpcode::Sta, temporary);
+                return temporary;
+            }
+
+            void compileArithmetic(ArithmeticNode* node) {
+                switch (node->operation) {
+                case ArithmeticOperation::Add:
+                case ArithmeticOperation::Subtract:
+                {
+                    std::string b = operandMailbox(node->b.get());
+                    compileExpression(node->a.get());
+                    emit(node->operation == ArithmeticOperation::Add ? LMCOpcode::Add : LMCOpcode::Sub, b);
+                    break;
+                }
+                case ArithmeticOperation::Multiply:
+                    compileMultiply(node);
+                    break;
+                case ArithmeticOperation::Divide:
+                    compileDivide(node);
+                    break;
+                default:
+                    fail("unsupported arithmetic operation");
+                }
+            }
+
+            // Copies a value into a fresh temporary the routine below can
+            // modify.
+            std::string scratchCopy(ProducesValueNode* node) {
+                compileExpression(node);
+                std::string temporary = newTemporary();
+                emit(LMCOpcode::Sta, temporary);
+                return temporary;
+            }
+
+            // Negates the value in a mailbox in place.
+            void negate(const std::string& mailbox) {
+                emit(LMCOpcode::Lda, constant(0));
+                emit(LMCOpcode::Sub, mailbox);
+                emit(LMCOpcode::Sta, mailbox);
+            }
+
+            // Negates the accumulator.
+            void negateAccumulator() {
+                std::string temporary = newTemporary();
+                emit(LMCOpcode::Sta, temporary);
+                emit(LMCOpcode::Lda, constant(0));
+                emit(LMCOpcode::Sub, temporary);
+            }
+
+            // x * c as a sequence of additions: either c - 1 additions of x,
+            // or double-and-add over the bits of c, whichever is shorter.
+            void multiplyByConstant(ProducesValueNode* x, int c) {
+                int magnitude = c < 0 ? -c : c;
+                if (magnitude == 0) {
+                    if (hasSideEffects(x))
+                        compileExpression(x);
+                    emit(LMCOpcode::Lda, constant(0));
+                    return;
+                }
+
+                std::string operand = operandMailbox(x);
+
+                int highBit = 0;
+                while ((magnitude >> (highBit + 1)) != 0)
+                    highBit++;
+
+                int repeatedSize = magnitude;
+                int binarySize = 1;
+                for (int bit = highBit - 1; bit >= 0; bit--)
+                    binarySize += 2 + ((magnitude >> bit) & 1);
+
+                emit(LMCOpcode::Lda, operand);
+                if (repeatedSize <= binarySize) {
+                    for (int i = 1; i < magnitude; i++)
+                        emit(LMCOpcode::Add, operand);
+                } else {
+                    std::string doubled = newTemporary();
+                    for (int bit = highBit - 1; bit >= 0; bit--) {
+                        emit(LMCOpcode::Sta, doubled);
+                        emit(LMCOpcode::Add, doubled);
+                        if ((magnitude >> bit) & 1)
+                            emit(LMCOpcode::Add, operand);
+                    }
+                }
+
+                if (c < 0)
+                    negateAccumulator();
+            }
+
+            // Repeated addition, after making the counter non-negative.
+            void compileMultiply(ArithmeticNode* node) {
+                int c;
+                if (options.optimize && constantValue(node->b.get(), c)) {
+                    multiplyByConstant(node->a.get(), c);
+                    return;
+                }
+                if (options.optimize && constantValue(node->a.get(), c)) {
+                    multiplyByConstant(node->b.get(), c);
+                    return;
+                }
+
+                std::string a = scratchCopy(node->a.get());
+                std::string count = scratchCopy(node->b.get());
+                std::string result = newTemporary();
+                std::string loop = newLabel();
+                std::string end = newLabel();
+
+                std::string positive = newLabel();
+                emit(LMCOpcode::Brp, positive);
+                negate(count);
+                negate(a);
+                placeLabel(positive);
+
+                emit(LMCOpcode::Lda, constant(0));
+                emit(LMCOpcode::Sta, result);
+                placeLabel(loop);
+                emit(LMCOpcode::Lda, count);
+                emit(LMCOpcode::Brz, end);
+                emit(LMCOpcode::Sub, constant(1));
+                emit(LMCOpcode::Sta, count);
+                emit(LMCOpcode::Lda, result);
+                emit(LMCOpcode::Add, a);
+                emit(LMCOpcode::Sta, result);
+                emit(LMCOpcode::Bra, loop);
+                placeLabel(end);
+                emit(LMCOpcode::Lda, result);
+            }
+
+            // x / c for a constant c. The divisor's sign and zero checks go
+            // away. Optimizing for speed adds a subtraction loop per decimal
+            // digit of the quotient, so at most nine iterations each instead
+            // of up to 999 iterations of one loop.
+            void divideByConstant(ProducesValueNode* x, int c) {
+                int magnitude = c < 0 ? -c : c;
+                if (magnitude == 1) {
+                    compileExpression(x);
+                    if (c < 0)
+                        negateAccumulator();
+                    return;
+                }
+
+                std::string dividend = scratchCopy(x);
+                std::string quotient = newTemporary();
+                std::string negative = newTemporary();
+
+                emit(LMCOpcode::Lda, constant(0));
+                emit(LMCOpcode::Sta, quotient);
+                emit(LMCOpcode::Lda, constant(c < 0 ? 1 : 0));
+                emit(LMCOpcode::Sta, negative);
+
+                std::string dividendPositive = newLabel();
+                emit(LMCOpcode::Lda, dividend);
+                emit(LMCOpcode::Brp, dividendPositive);
+                negate(dividend);
+                emit(LMCOpcode::Lda, constant(1));
+                emit(LMCOpcode::Sub, negative);
+                emit(LMCOpcode::Sta, negative);
+                placeLabel(dividendPositive);
+
+                // Subtracts |c| * 10^k while it fits, then |c| * 10^(k-1), and
+                // so on, like long division by hand.
+                int increment = 1;
+                if (options.optimizeForSpeed) {
+                    while (magnitude * increment * 10 <= lmcMaxValue)
+                        increment *= 10;
+                }
+
+                for (; increment >= 1; increment /= 10) {
+                    std::string loop = newLabel();
+                    std::string fits = newLabel();
+                    std::string done = newLabel();
+                    placeLabel(loop);
+                    emit(LMCOpcode::Lda, dividend);
+                    emit(LMCOpcode::Sub, constant(magnitude * increment));
+                    emit(LMCOpcode::Brp, fits);
+                    emit(LMCOpcode::Bra, done);
+                    placeLabel(fits);
+                    emit(LMCOpcode::Sta, dividend);
+                    emit(LMCOpcode::Lda, quotient);
+                    emit(LMCOpcode::Add, constant(increment));
+                    emit(LMCOpcode::Sta, quotient);
+                    emit(LMCOpcode::Bra, loop);
+                    placeLabel(done);
+                }
+
+                std::string end = newLabel();
+                emit(LMCOpcode::Lda, negative);
+                emit(LMCOpcode::Brz, end);
+                negate(quotient);
+                placeLabel(end);
+                emit(LMCOpcode::Lda, quotient);
+            }
+
+            // Repeated subtraction on magnitudes, truncating toward zero
+            // like the evaluator. Dividing by zero halts.
+            void compileDivide(ArithmeticNode* node) {
+                int c;
+                if (options.optimize && constantValue(node->b.get(), c) && c != 0) {
+                    divideByConstant(node->a.get(), c);
+                    return;
+                }
+
+                std::string divisor = scratchCopy(node->b.get());
+                std::string dividend = scratchCopy(node->a.get());
+                std::string quotient = newTemporary();
+                std::string negative = newTemporary();
+
+                emit(LMCOpcode::Lda, constant(0));
+                emit(LMCOpcode::Sta, quotient);
+                emit(LMCOpcode::Sta, negative);
+
+                std::string dividendPositive = newLabel();
+                emit(LMCOpcode::Lda, dividend);
+                emit(LMCOpcode::Brp, dividendPositive);
+                negate(dividend);
+                emit(LMCOpcode::Lda, constant(1));
+                emit(LMCOpcode::Sta, negative);
+                placeLabel(dividendPositive);
+
+                std::string divisorPositive = newLabel();
+                std::string divideByZero = newLabel();
+                emit(LMCOpcode::Lda, divisor);
+                emit(LMCOpcode::Brz, divideByZero);
+                emit(LMCOpcode::Brp, divisorPositive);
+                negate(divisor);
+                emit(LMCOpcode::Lda, constant(1));
+                emit(LMCOpcode::Sub, negative);
+                emit(LMCOpcode::Sta, negative);
+                emit(LMCOpcode::Bra, divisorPositive);
+                placeLabel(divideByZero);
+                emit(LMCOpcode::Hlt);
+                placeLabel(divisorPositive);
+
+                std::string loop = newLabel();
+                std::string fits = newLabel();
+                std::string done = newLabel();
+                placeLabel(loop);
+                emit(LMCOpcode::Lda, dividend);
+                emit(LMCOpcode::Sub, divisor);
+                emit(LMCOpcode::Brp, fits);
+                emit(LMCOpcode::Bra, done);
+                placeLabel(fits);
+                emit(LMCOpcode::Sta, dividend);
+                emit(LMCOpcode::Lda, quotient);
+                emit(LMCOpcode::Add, constant(1));
+                emit(LMCOpcode::Sta, quotient);
+                emit(LMCOpcode::Bra, loop);
+                placeLabel(done);
+
+                std::string end = newLabel();
+                emit(LMCOpcode::Lda, negative);
+                emit(LMCOpcode::Brz, end);
+                negate(quotient);
+                placeLabel(end);
+                emit(LMCOpcode::Lda, quotient);
+            }
+
+            void compileCall(FunctionCallNode* call) {
+                if (call->functionName == "println") {
+                    if (call->args.size() != 1)
+                        fail("println takes one argument");
+                    compileExpression(call->args[0].get());
+                    emit(LMCOpcode::Out);
+                } else if (call->functionName == "input") {
+                    if (!call->args.empty())
+                        fail("input takes no arguments");
+                    emit(LMCOpcode::Inp);
+                } else {
+                    fail("function " + call->functionName + " isn't available on LMC");
+                }
+            }
+
+            // Falls through when the condition holds and branches to
+            // falseLabel when it doesn't. BRP branches on zero too, so each
+            // comparison is arranged as a difference that's non-negative
+            // exactly when one outcome happens.
+            void compileCondition(ProducesValueNode* node, const std::string& falseLabel) {
+                if (node->type != ASTNodeType::Comparison) {
+                    if (node->type == ASTNodeType::ConstVal && static_cast<ConstValNode*>(node)->val.type == DataType::Boolean) {
+                        if (!static_cast<ConstValNode*>(node)->val.boolVal)
+                            emit(LMCOpcode::Bra, falseLabel);
+                        return;
+                    }
+
+                    // Any other value is true when it's non-zero.
+                    compileExpression(node);
+                    emit(LMCOpcode::Brz, falseLabel);
+                    return;
+                }
+
+                auto comp = static_cast<ComparisonNode*>(node);
+                ProducesValueNode* lhs = comp->lhs.get();
+                ProducesValueNode* rhs = comp->rhs.get();
+
+                // a > b and a <= b test b - a instead of a - b.
+                bool swapped = comp->compType == ComparisonType::GreaterThan
+                    || comp->compType == ComparisonType::LessThanOrEqual;
+                if (swapped)
+                    std::swap(lhs, rhs);
+
+                std::string subtrahend = operandMailbox(rhs);
+                compileExpression(lhs);
+                emit(LMCOpcode::Sub, subtrahend);
+
+                std::string isTrue = newLabel();
+                switch (comp->compType) {
+                case ComparisonType::Equal:
+                    emit(LMCOpcode::Brz, isTrue);
+                    emit(LMCOpcode::Bra, falseLabel);
+                    placeLabel(isTrue);
+                    break;
+                case ComparisonType::LessThan:
+                case ComparisonType::GreaterThan:
+                    // a - b >= 0 means a < b is false.
+                    emit(LMCOpcode::Brp, falseLabel);
+                    break;
+                case ComparisonType::GreaterThanOrEqual:
+                case ComparisonType::LessThanOrEqual:
+                    emit(LMCOpcode::Brp, isTrue);
+                    emit(LMCOpcode::Bra, falseLabel);
+                    placeLabel(isTrue);
+                    break;
+                }
+            }
+
+            void emitData() {
+                auto emitCell = [this](const std::string& label, int value, LMCCellKind kind) {
+                    LMCInstruction cell;
+                    cell.opcode = LMCOpcode::Dat;
+                    cell.label = label;
+                    cell.value = value;
+                    cell.kind = kind;
+                    program.instructions.push_back(cell);
+                };
+
+                for (auto& name : variableOrder)
+                    emitCell(variables[name], 0, LMCCellKind::Variable);
+                for (int i = 0; i < temporaryCount; i++)
+                    emitCell("t" + std::to_string(i), 0, LMCCellKind::Temporary);
+                for (auto& constant : constants)
+                    emitCell(constant.second, constant.first, LMCCellKind::Constant);
+            }
+
+            void resolveAliases() {
+                for (auto& instruction : program.instructions) {
+                    auto it = aliases.find(instruction.operand);
+                    if (it != aliases.end())
+                        instruction.operand = it->second;
+                }
+            }
+        };
+    }
+
+    int LMCProgram::countCells(LMCCellKind kind) const {
+        int count = 0;
+        for (auto& instruction : instructions) {
+            if (instruction.kind == kind)
+                count++;
+        }
+        return count;
+    }
+
+    LMCProgram compileToLMC(const std::vector<std::shared_ptr<ASTNode>>& statements, const LMCOptions& options) {
+        LMCProgram program = LMCCompiler(options).compile(statements);
+
+        if (options.optimize)
+            optimizeLMC(program);
+
+        return program;
+    }
+}
@@ -0,0 +1,179 @@
+#include "LMC.hpp"
+#include <stdexcept>
+
+namespace iodine {
+    LMCMachine::LMCMachine(const LMCImage& image) {
+        for (int i = 0; i < lmcMailboxCount; i++) {
+            memory[i] = image.mailboxes[i];
+            lines[i] = image.lines[i];
+            decode(i);
+        }
+        decoded[lmcMailboxCount] = { Op::PastEnd, 0 };
+    }
+
+    void LMCMachine::decode(int address) {
+        int word = memory[address];
+        Decoded& instruction = decoded[address];
+        instruction.operand = (uint8_t)(word >= 0 ? word % 100 : 0);
+
+        switch (word < 0 ? -1 : word / 100) {
+        case 0: instruction.op = Op::Hlt; break;
+        case 1: instruction.op = Op::Add; break;
+        case 2: instruction.op = Op::Sub; break;
+        case 3: instruction.op = Op::Sta; break;
+        case 5: instruction.op = Op::Lda; break;
+        case 6: instruction.op = Op::Bra; break;
+        case 7: instruction.op = Op::Brz; break;
+        case 8: instruction.op = Op::Brp; break;
+        case 9:
+            instruction.op = word == 901 ? Op::Inp : word == 902 ? Op::Out : Op::Invalid;
+            break;
+        default:
+            instruction.op = Op::Invalid;
+            break;
+        }
+    }
+
+    LMCStatus LMCMachine::run(uint64_t maxCycles) {
+        uint64_t remaining = maxCycles;
+        int acc = accumulator;
+        int pc = counter;
+        LMCStatus status = LMCStatus::OutOfCycles;
+        const char* error = nullptr;
+
+// Each handler ends by dispatching the next instruction itself, which
+// gives the branch predictor one indirect jump per handler to learn.
+#if defined(__GNUC__)
+        static void* const handlers[] = {
+            &&hlt, &&add, &&sub, &&sta, &&lda, &&bra, &&brz, &&brp, &&inp, &&out, &&invalid, &&pastEnd
+        };
+#define LMC_HANDLER(name, op) name:
+#define LMC_NEXT() \
+        do { \
+            if (remaining == 0) goto stop; \
+            remaining--; \
+            counts[pc]++; \
+            goto *handlers[(int)decoded[pc].op]; \
+        } while (0)
+#else
+#define LMC_HANDLER(name, op) case Op::op:
+#define LMC_NEXT() \
+        do { \
+            if (remaining == 0) goto stop; \
+            remaining--; \
+            counts[pc]++; \
+            goto dispatch; \
+        } while (0)
+#endif
+
+        LMC_NEXT();
+
+#if !defined(__GNUC__)
+    dispatch:
+        switch (decoded[pc].op) {
+#endif
+        LMC_HANDLER(hlt, Hlt)
+            status = LMCStatus::Halted;
+            goto stop;
+        LMC_HANDLER(add, Add)
+            acc += memory[decoded[pc].operand];
+            if (acc < lmcMinValue || acc > lmcMaxValue) {
+                error = "Accumulator overflowed";
+                goto stop;
+            }
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(sub, Sub)
+            acc -= memory[decoded[pc].operand];
+            if (acc < lmcMinValue || acc > lmcMaxValue) {
+                error = "Accumulator overflowed";
+                goto stop;
+            }
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(sta, Sta)
+            memory[decoded[pc].operand] = acc;
+            decode(decoded[pc].operand);
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(lda, Lda)
+            acc = memory[decoded[pc].operand];
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(bra, Bra)
+            pc = decoded[pc].operand;
+            LMC_NEXT();
+        LMC_HANDLER(brz, Brz)
+            pc = acc == 0 ? decoded[pc].operand : pc + 1;
+            LMC_NEXT();
+        LMC_HANDLER(brp, Brp)
+            pc = acc >= 0 ? decoded[pc].operand : pc + 1;
+            LMC_NEXT();
+        LMC_HANDLER(inp, Inp)
+            if (input.empty()) {
+                // Not executed yet; resuming retries it.
+                counts[pc]--;
+                remaining++;
+                status = LMCStatus::NeedsInput;
+                goto stop;
+            }
+            acc = input.front();
+            input.pop_front();
+            if (acc < lmcMinValue || acc > lmcMaxValue) {
+                error = "Input doesn't fit in the accumulator";
+                goto stop;
+            }
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(out, Out)
+            output.push_back(acc);
+            pc++;
+            LMC_NEXT();
+        LMC_HANDLER(invalid, Invalid)
+            error = "Invalid instruction";
+            goto stop;
+        LMC_HANDLER(pastEnd, PastEnd)
+            error = "Program counter ran past the last mailbox";
+            goto stop;
+#if !defined(__GNUC__)
+        }
+#endif
+
+#undef LMC_HANDLER
+#undef LMC_NEXT
+
+    stop:
+        accumulator = acc;
+        counter = pc;
+        cycles += maxCycles - remaining;
+
+        if (error != nullptr)
+            throw std::runtime_error(std::string(error) + " at mailbox " + std::to_string(pc));
+
+        return status;
+    }
+
+    std::map<int, uint64_t> LMCMachine::lineCycles() const {
+        std::map<int, uint64_t> result;
+        for (int i = 0; i < lmcMailboxCount; i++) {
+            if (counts[i] != 0)
+                result[lines[i]] += counts[i];
+        }
+        return result;
+    }
+
+    LMCRunResult runLMC(const LMCImage& image, const std::vector<int>& input, uint64_t maxCycles) {
+        LMCMachine machine(image);
+        machine.input.assign(input.begin(), input.end());
+
+        LMCStatus status = machine.run(maxCycles);
+        if (status == LMCStatus::NeedsInput)
+            throw std::runtime_error("Program read past the end of its input at mailbox " + std::to_string(machine.counter));
+
+        LMCRunResult result;
+        result.output.assign(machine.output.begin(), machine.output.end());
+        result.cycles = machine.cycles;
+        result.halted = status == LMCStatus::Halted;
+        return result;
+    }
+}
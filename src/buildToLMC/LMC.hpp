@@ -0,0 +1,169 @@
+#pragma once
+#include <parser.hpp>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    // Little Man Computer: 100 mailboxes of three decimal digits, one
+    // accumulator, and these instructions. ADD, SUB, STA, LDA and the
+    // branches take a mailbox address.
+    enum class LMCOpcode {
+        Hlt,
+        Add,
+        Sub,
+        Sta,
+        Lda,
+        Bra,
+        Brz,
+        Brp,
+        Inp,
+        Out,
+        Dat,
+        Count
+    };
+
+    extern EnumNames<LMCOpcode> lmcOpcodeNames;
+
+    constexpr int lmcMailboxCount = 100;
+    constexpr int lmcMinValue = -999;
+    constexpr int lmcMaxValue = 999;
+
+    // What a DAT cell holds, for reporting and for the optimizer.
+    enum class LMCCellKind {
+        Code,
+        Variable,
+        Temporary,
+        Constant
+    };
+
+    // One line of symbolic assembly. Operands refer to labels; DAT cells
+    // carry their initial value instead.
+    struct LMCInstruction {
+        LMCOpcode opcode;
+        std::string operand;
+        std::string label;
+        int value = 0;
+        LMCCellKind kind = LMCCellKind::Code;
+        // Source line of the statement this was generated for.
+        int line = 0;
+    };
+
+    struct LMCProgram {
+        std::vector<LMCInstruction> instructions;
+
+        int countCells(LMCCellKind kind) const;
+    };
+
+    struct LMCOptions {
+        // Fold constant expressions, lower * and / by constants to
+        // additions, and run optimizeLMC over the result.
+        bool optimize = true;
+        // Divide by constants a decimal digit at a time, which needs a few
+        // more mailboxes than one subtraction loop.
+        bool optimizeForSpeed = false;
+    };
+
+    // Compiles top-level statements to LMC assembly. Supports i32
+    // variables, + - * /, unary minus, comparisons, if, while, for,
+    // println(x) (OUT) and input() (INP). Throws std::runtime_error for
+    // anything else, naming the source line.
+    LMCProgram compileToLMC(const std::vector<std::shared_ptr<ASTNode>>& statements, const LMCOptions& options = {});
+
+    // Rewrites the program in place: removes redundant loads and stores,
+    // branches to the next instruction, unreachable code and stores to
+    // dead temporaries, then shares temporary mailboxes whose live ranges
+    // don't overlap and drops cells nothing refers to.
+    void optimizeLMC(LMCProgram& program);
+
+    // Writes the program in the usual LABEL OPCODE OPERAND form.
+    void writeLMCAssembly(std::ostream& out, const LMCProgram& program);
+
+    // Machine code: mailbox contents plus the source line each mailbox was
+    // generated for.
+    struct LMCImage {
+        int mailboxes[lmcMailboxCount] = {};
+        int lines[lmcMailboxCount] = {};
+        int used = 0;
+    };
+
+    // Resolves labels and encodes every instruction. Throws if the program
+    // needs more than 100 mailboxes or a label is undefined.
+    LMCImage assembleLMC(const LMCProgram& program);
+
+    enum class LMCStatus {
+        Halted,
+        OutOfCycles,
+        NeedsInput
+    };
+
+    // Runs assembled programs. Mailboxes are decoded once into an opcode
+    // and operand and dispatched with computed gotos where the compiler
+    // supports them; a store into a mailbox decodes it again, so programs
+    // that modify their own code still work.
+    class LMCMachine {
+    public:
+        LMCMachine(const LMCImage& image);
+
+        // INP takes from the front of input; OUT appends to output.
+        std::deque<int> input;
+        std::deque<int> output;
+
+        int accumulator = 0;
+        int counter = 0;
+        uint64_t cycles = 0;
+
+        // Runs until HLT, an INP with no input queued, or maxCycles more
+        // instructions, and can be called again to carry on. Throws if the
+        // accumulator leaves -999..999 or an invalid instruction runs.
+        LMCStatus run(uint64_t maxCycles = UINT64_MAX);
+
+        // Instructions executed from a mailbox, and summed per source line.
+        uint64_t mailboxCycles(int address) const { return counts[address]; }
+        std::map<int, uint64_t> lineCycles() const;
+
+    private:
+        enum class Op : uint8_t {
+            Hlt,
+            Add,
+            Sub,
+            Sta,
+            Lda,
+            Bra,
+            Brz,
+            Brp,
+            Inp,
+            Out,
+            Invalid,
+            PastEnd
+        };
+
+        struct Decoded {
+            Op op;
+            uint8_t operand;
+        };
+
+        int memory[lmcMailboxCount];
+        int lines[lmcMailboxCount];
+        // One extra entry so running off the last mailbox is just another
+        // instruction rather than a check on every step.
+        Decoded decoded[lmcMailboxCount + 1];
+        uint64_t counts[lmcMailboxCount + 1] = {};
+
+        void decode(int address);
+    };
+
+    struct LMCRunResult {
+        std::vector<int> output;
+        uint64_t cycles = 0;
+        bool halted = false;
+    };
+
+    // Runs a program on the given input until HLT or maxCycles instructions.
+    // Throws like LMCMachine::run, and if the program reads past its input.
+    LMCRunResult runLMC(const LMCImage& image, const std::vector<int>& input, uint64_t maxCycles = 100000000);
+}
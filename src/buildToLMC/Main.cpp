@@ -1,236 +1,223 @@
-#include <memory>
-#include <math.h>
+#include "LMC.hpp"
+#include <stdlib.h>
 #include <string.h>
-#include <parser.hpp>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <unordered_map>
 
 using namespace iodine;
 
-void printIndents(int indents) {
-    for (int i = 0; i < indents; i++) {
-        std::cout << "  ";
-    }
-}
-
-std::string valueToStr(const Value& val) {
-    switch (val.type) {
-        case DataType::F32:
-            return std::to_string(val.floatVal);
-            break;
-        case DataType::F64:
-            return std::to_string(val.doubleVal);
-        case DataType::Int32:
-            return std::to_string(val.intVal);
-            break;
-        case DataType::Null:
-            return "(null)";
-            break;
-        case DataType::Boolean:
-            return std::to_string(val.boolVal);
-            break;
-        default:
-            return "";
-    }
-}
-
 std::unordered_map<std::string, Variable> iodine::variables;
 std::unordered_map<std::string, Function> iodine::functions;
 
-void printASTNode(std::shared_ptr<ASTNode> node, int indentDepth = 0) {
-    printIndents(indentDepth);
-        std::cout << "Node type: " << nodeTypeNames[node->type] << "\n";
-    switch (node->type) {
-        case ASTNodeType::ConstVal:
-            printIndents(indentDepth);
-            std::cout << "val: " << valueToStr(std::static_pointer_cast<ConstValNode>(node)->val) << "\n";
-            break;
-        case ASTNodeType::Arithmetic:
-        {
-            auto aNode = std::static_pointer_cast<ArithmeticNode>(node);
-            printIndents(indentDepth);
-            std::cout << "a: \n";
-            printASTNode(aNode->a, indentDepth + 1);
-
-            printIndents(indentDepth);
-            std::cout << "b: \n";
-            printASTNode(aNode->b, indentDepth + 1);
-
-            printIndents(indentDepth);
-            std::cout << "operation: " << arithOperationNames[aNode->operation] << "\n";
-            break;
-        }
-        case ASTNodeType::UnaryOp:
-        {
-            printIndents(indentDepth);
-            auto uNode = std::static_pointer_cast<UnaryOpNode>(node);
-            std::cout << "operation: " << unaryOperationNames[uNode->operation] << "\n";
-            printIndents(indentDepth);
-            std::cout << "child:\n";
-            printASTNode(uNode->valNode, indentDepth + 1);
-            break;
-        }
-        case ASTNodeType::VarAssignment:
-        {
-            printIndents(indentDepth);
-            auto assignmentNode = std::static_pointer_cast<VarAssignmentNode>(node);
-
-            std::cout << "variable name: " << assignmentNode->varName << "\n";
-
-            printIndents(indentDepth);
-            std::cout << "value:\n";
-            printASTNode(assignmentNode->valNode);
-            break;
-        }
-        case ASTNodeType::VariableReference:
-        {
-            printIndents(indentDepth);
-            auto refNode = std::static_pointer_cast<VariableReferenceNode>(node);
-            std::cout << "varname: " << refNode->varName << "\n";
-            printIndents(indentDepth);
-            auto it = variables.find(refNode->varName);
-
-            if (it != variables.end()) {
-                std::cout << "varinfo:" << (int)variables.at(refNode->varName).type << "\n";
-            }
-            break;
-        }
-        case ASTNodeType::FunctionCall:
-        {
-            printIndents(indentDepth);
-            auto functionCall = std::static_pointer_cast<FunctionCallNode>(node);
-            std::cout << "func name: " << functionCall->functionName << "\n";
-
-            for (size_t i = 0; i < functionCall->args.size(); i++) {
-                printIndents(indentDepth);
-                std::cout << "arg " << i << ":\n";
+// Prints the program's size and, if it fits and runs to completion on the
+// given input, how many instructions it executed.
+void printReport(const char* name, const LMCProgram& program, const std::vector<int>& input) {
+    int code = program.countCells(LMCCellKind::Code);
+    int variableCells = program.countCells(LMCCellKind::Variable);
+    int temporaries = program.countCells(LMCCellKind::Temporary);
+    int constants = program.countCells(LMCCellKind::Constant);
+
+    std::cerr << name << ": "
+              << code << " instructions, "
+              << variableCells << " variables, "
+              << temporaries << " temporaries, "
+              << constants << " constants: "
+              << program.instructions.size() << "/" << lmcMailboxCount << " mailboxes, ";
+
+    if (program.instructions.size() > (size_t)lmcMailboxCount) {
+        std::cerr << "cycles n/a\n";
+        return;
+    }
 
-                printASTNode(functionCall->args[i], indentDepth + 1);
-            }
-        }
-        default:
-            break;
+    try {
+        LMCRunResult result = runLMC(assembleLMC(program), input);
+        if (result.halted)
+            std::cerr << result.cycles << " cycles\n";
+        else
+            std::cerr << "didn't halt within " << result.cycles << " cycles\n";
+    } catch (std::exception& e) {
+        std::cerr << "cycles n/a (" << e.what() << ")\n";
     }
 }
 
-Value evalAST(std::shared_ptr<ASTNode> exprRoot) {
-    if (exprRoot->type == ASTNodeType::VarAssignment) {
-        auto assignNode = std::static_pointer_cast<VarAssignmentNode>(exprRoot);
-
-        auto val = assignNode->valNode->getValue();
-        if (assignNode->createNew) {
-            Variable var;
-            var.name = assignNode->varName;
-            var.type = val.type;
-            var.val = val;
-            variables[assignNode->varName] = var;
-        } else {
-            auto varIt = variables.find(assignNode->varName);
-            if (varIt == variables.end()) 
-                throw std::runtime_error("Reference to undefined variable " + assignNode->varName);
-            if (val.type != varIt->second.type) {
-                std::string msg = "Assignment to variable "
-                    + assignNode->varName + " (" + dataTypeNames[varIt->second.type] + ")"
-                    + " with wrong type " + dataTypeNames[val.type];
-                throw std::runtime_error(msg);
-            }
-            variables.at(assignNode->varName).val = val;
-        }
-        return Value{};
+std::vector<int> parseInput(const char* text) {
+    std::vector<int> input;
+    while (*text != '\0') {
+        char* end;
+        input.push_back((int)strtol(text, &end, 10));
+        if (end == text)
+            throw std::runtime_error("--input takes comma separated numbers");
+        text = *end == ',' ? end + 1 : end;
     }
-    return std::static_pointer_cast<ProducesValueNode>(exprRoot)->getValue();
+    return input;
 }
 
-std::vector<Variable> getVarList(std::vector<std::shared_ptr<ASTNode>> nodes) {
-    std::vector<Variable> vars;
-    for (auto& n : nodes) {
-        if (n->type != ASTNodeType::VarAssignment) continue;
+// Runs the script with the tree-walking evaluator, with input() reading
+// from input, and collects what it prints the way OUT would show it.
+std::vector<int> evaluateScript(const std::string& txt, const std::vector<int>& input) {
+    std::vector<int> output;
+    size_t nextInput = 0;
+
+    Function println {true, "println", [&output](FuncArgs args) {
+        if (args.size() != 1) throw std::runtime_error("Incorrect number of arguments");
 
-        auto varAssign = std::static_pointer_cast<VarAssignmentNode>(n);
+        Value value = args[0]->getValue();
+        if (value.type == DataType::Int32)
+            output.push_back(value.intVal);
+        else if (value.type == DataType::Boolean)
+            output.push_back(value.boolVal ? 1 : 0);
+        else
+            throw std::runtime_error(std::string("println of a ") + dataTypeNames[value.type] + " has no LMC equivalent");
+        return Value();
+    }};
 
-        if (!varAssign->createNew) continue;
+    Function inputFunc {true, "input", [&input, &nextInput](FuncArgs args) {
+        if (!args.empty()) throw std::runtime_error("Incorrect number of arguments");
+        if (nextInput >= input.size()) throw std::runtime_error("Script read past the end of its input");
 
-        vars.push_back(Variable {varAssign->varName}); 
-    }
+        return Value(input[nextInput++]);
+    }};
+
+    functions.insert({ "println", println });
+    functions.insert({ "input", inputFunc });
+
+    for (auto& statement : parseScript(parseTokens(txt)))
+        evalAST(statement);
+
+    functions.clear();
+    variables.clear();
+    return output;
 }
 
-void printTokens(std::vector<Token>& tokens) {
-    for (auto& token : tokens) {
-        std::cout << "Token: " << tokenNames[token.type];
-        std::cout << " (" << token.val << ")";
-        std::cout << "\n";
+void printLineCycles(const LMCMachine& machine, const std::vector<std::string>& sourceLines) {
+    std::cerr << "line\tcycles\t%\tsource\n";
+    for (auto& entry : machine.lineCycles()) {
+        std::cerr << entry.first << "\t" << entry.second << "\t"
+                  << (100.0 * entry.second / machine.cycles) << "\t";
+        if (entry.first > 0 && (size_t)entry.first <= sourceLines.size())
+            std::cerr << sourceLines[entry.first - 1];
+        std::cerr << "\n";
     }
 }
 
 int main(int argc, char** argv) {
-    bool doPrintTokens = false;
-    bool printAST = false;
+    const char* scriptPath = "script.iod";
+    const char* outputPath = nullptr;
+    const char* inputText = "";
+    LMCOptions options;
+    bool run = false;
+    bool check = false;
+    uint64_t maxCycles = 100000000;
 
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--print-tokens") == 0) {
-            doPrintTokens = true;
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            options.optimize = false;
+        } else if (strcmp(argv[i], "--speed") == 0) {
+            options.optimizeForSpeed = true;
+        } else if (strncmp(argv[i], "--input=", 8) == 0) {
+            inputText = argv[i] + 8;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        } else if (strncmp(argv[i], "--max-cycles=", 13) == 0) {
+            maxCycles = strtoull(argv[i] + 13, nullptr, 10);
+        } else if (argv[i][0] == '-') {
+            std::cerr << "usage: tolmc [-o output.lmc] [-O0] [--speed] [--input=1,2,...] [--run] [--check] [--max-cycles=n] [script.iod]\n";
+            return 1;
+        } else {
+            scriptPath = argv[i];
         }
+    }
 
-        if (strcmp(argv[i], "--print-ast") == 0) {
-            printAST = true;
-        }
+    std::ifstream scriptStream(scriptPath);
+    if (!scriptStream.good()) {
+        std::cerr << "Couldn't open " << scriptPath << "\n";
+        return 1;
     }
 
-    Function sqrt {true, "sqrt", [](std::vector<std::shared_ptr<ProducesValueNode>> args) {
-        if (args.size() != 1) {
-            throw std::runtime_error("incorrect num args");
-        }
+    std::string txt;
+    std::vector<std::string> sourceLines;
+    while (scriptStream.good()) {
+        std::string line;
+        std::getline(scriptStream, line);
+        txt += line + "\n";
+        sourceLines.push_back(line);
+    }
 
-        auto arg = args[0];
+    try {
+        std::vector<int> input = parseInput(inputText);
+        auto statements = parseScript(parseTokens(txt));
+        LMCProgram program = compileToLMC(statements, options);
 
-        if (arg->getValue().type == DataType::F32) {
-            return Value(sqrtf(arg->getValue().as<float>()));
-        } else {
-            return Value(::sqrt(arg->getValue().as<double>()));
+        if (outputPath != nullptr) {
+            std::ofstream out(outputPath);
+            writeLMCAssembly(out, program);
+        } else if (!run && !check) {
+            writeLMCAssembly(std::cout, program);
         }
-    }};
 
-    Function println {true, "println", [](FuncArgs args) {
-        if (args.size() != 1) throw std::runtime_error("Incorrect number of arguments");
-
-        std::cout << valueToStr(args[0]->getValue()) << "\n"; 
-        return Value();
-    }};
+        if (options.optimize) {
+            LMCOptions unoptimized;
+            unoptimized.optimize = false;
+            printReport("unoptimized", compileToLMC(statements, unoptimized), input);
+            printReport("optimized", program, input);
+        } else {
+            printReport("unoptimized", program, input);
+        }
 
-    functions.insert({ "sqrt", sqrt });
-    functions.insert({ "println", println });
+        // Catches programs that don't fit.
+        LMCImage image = assembleLMC(program);
 
-    while (true) {
-        std::string line;
+        if (run || check) {
+            LMCMachine machine(image);
+            machine.input.assign(input.begin(), input.end());
 
-        std::cout << ">";
+            auto start = std::chrono::steady_clock::now();
+            LMCStatus status = machine.run(maxCycles);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-        std::getline(std::cin, line);
+            if (status == LMCStatus::NeedsInput)
+                throw std::runtime_error("Program read past the end of its input");
+            if (status == LMCStatus::OutOfCycles)
+                throw std::runtime_error("Program didn't halt within " + std::to_string(maxCycles) + " cycles");
 
-        if (std::cin.eof())
-            break;
+            if (run) {
+                for (int value : machine.output)
+                    std::cout << value << "\n";
 
-        try {
-            if (*(line.end() - 1) == '\n') {
-                line = line.substr(0, line.size() - 1);
+                printLineCycles(machine, sourceLines);
+                std::cerr << machine.cycles << " cycles in " << seconds * 1000 << " ms ("
+                          << machine.cycles / seconds / 1e6 << " million/s)\n";
             }
-            std::vector<Token> tokens = parseTokens(line);
-
-            std::shared_ptr<ASTNode> n = parseScript(tokens);
 
-            if (n == nullptr) {
-                std::cout << "AST is empty\n";
-            } else {
-                if (doPrintTokens)
-                    printTokens(tokens);
-
-                if (printAST)
-                    printASTNode(n);
-                std::cout << valueToStr(evalAST(n)) << "\n";
+            if (check) {
+                std::vector<int> expected = evaluateScript(txt, input);
+                std::vector<int> actual(machine.output.begin(), machine.output.end());
+
+                size_t i = 0;
+                while (i < expected.size() && i < actual.size() && expected[i] == actual[i])
+                    i++;
+
+                if (i == expected.size() && i == actual.size()) {
+                    std::cerr << "LMC output matches the evaluator (" << i << " values)\n";
+                } else {
+                    std::cerr << "LMC output differs from the evaluator at value " << i << ": expected ";
+                    std::cerr << (i < expected.size() ? std::to_string(expected[i]) : "end of output") << ", got ";
+                    std::cerr << (i < actual.size() ? std::to_string(actual[i]) : "end of output") << "\n";
+                    return 1;
+                }
             }
-        } catch (std::exception& e) {
-            std::cout << "Error: " << e.what() << "\n";
         }
-    } 
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,425 @@
+#include "LMC.hpp"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        class LMCOptimizer {
+        public:
+            LMCOptimizer(LMCProgram& program) : instructions(program.instructions) {}
+
+            void run() {
+                bool changed = true;
+                while (changed) {
+                    changed = removeUnreachable();
+                    changed |= threadJumps();
+                    changed |= removeRedundantLoadsAndStores();
+                    changed |= removeDeadCode();
+                }
+
+                shareTemporaries();
+                removeUnusedCells();
+            }
+
+        private:
+            std::vector<LMCInstruction>& instructions;
+
+            // Code always comes before the data cells.
+            size_t codeEnd() const {
+                size_t end = 0;
+                while (end < instructions.size() && instructions[end].opcode != LMCOpcode::Dat)
+                    end++;
+                return end;
+            }
+
+            std::unordered_map<std::string, size_t> labelIndices() const {
+                std::unordered_map<std::string, size_t> indices;
+                for (size_t i = 0; i < instructions.size(); i++) {
+                    if (!instructions[i].label.empty())
+                        indices[instructions[i].label] = i;
+                }
+                return indices;
+            }
+
+            // Instructions control can reach directly from instruction i.
+            std::vector<size_t> successors(size_t i, const std::unordered_map<std::string, size_t>& labels, size_t end) const {
+                std::vector<size_t> result;
+                auto& instruction = instructions[i];
+
+                if (instruction.opcode == LMCOpcode::Hlt)
+                    return result;
+
+                if (instruction.opcode == LMCOpcode::Bra || instruction.opcode == LMCOpcode::Brz || instruction.opcode == LMCOpcode::Brp) {
+                    auto it = labels.find(instruction.operand);
+                    if (it != labels.end() && it->second < end)
+                        result.push_back(it->second);
+                    if (instruction.opcode == LMCOpcode::Bra)
+                        return result;
+                }
+
+                if (i + 1 < end)
+                    result.push_back(i + 1);
+                return result;
+            }
+
+            // Removes an instruction, handing its label to the next one or
+            // redirecting references to the label already there.
+            void removeAt(size_t i) {
+                std::string label = instructions[i].label;
+                instructions.erase(instructions.begin() + i);
+                if (label.empty())
+                    return;
+
+                if (i < instructions.size() && instructions[i].label.empty()) {
+                    instructions[i].label = label;
+                    return;
+                }
+
+                std::string replacement = i < instructions.size() ? instructions[i].label : "";
+                for (auto& instruction : instructions) {
+                    if (instruction.operand == label)
+                        instruction.operand = replacement;
+                }
+            }
+
+            bool removeUnreachable() {
+                size_t end = codeEnd();
+                if (end == 0)
+                    return false;
+
+                auto labels = labelIndices();
+                std::vector<bool> reached(end, false);
+                std::vector<size_t> pending { 0 };
+                reached[0] = true;
+                while (!pending.empty()) {
+                    size_t i = pending.back();
+                    pending.pop_back();
+                    for (size_t next : successors(i, labels, end)) {
+                        if (!reached[next]) {
+                            reached[next] = true;
+                            pending.push_back(next);
+                        }
+                    }
+                }
+
+                bool changed = false;
+                for (size_t i = end; i-- > 0;) {
+                    if (!reached[i]) {
+                        removeAt(i);
+                        changed = true;
+                    }
+                }
+                return changed;
+            }
+
+            // Branches to a BRA go straight to its target, a BRA to a HLT
+            // becomes a HLT, and branches to the next instruction go away.
+            bool threadJumps() {
+                bool changed = false;
+                auto labels = labelIndices();
+
+                for (size_t i = 0; i < codeEnd(); i++) {
+                    auto& instruction = instructions[i];
+                    if (instruction.opcode != LMCOpcode::Bra && instruction.opcode != LMCOpcode::Brz && instruction.opcode != LMCOpcode::Brp)
+                        continue;
+
+                    for (size_t hops = 0; hops < instructions.size(); hops++) {
+                        auto it = labels.find(instruction.operand);
+                        if (it == labels.end() || instructions[it->second].opcode != LMCOpcode::Bra
+                            || instructions[it->second].operand == instruction.operand)
+                            break;
+                        instruction.operand = instructions[it->second].operand;
+                        changed = true;
+                    }
+
+                    auto it = labels.find(instruction.operand);
+                    if (it == labels.end())
+                        continue;
+
+                    if (instruction.opcode == LMCOpcode::Bra && instructions[it->second].opcode == LMCOpcode::Hlt) {
+                        instruction.opcode = LMCOpcode::Hlt;
+                        instruction.operand.clear();
+                        changed = true;
+                    } else if (it->second == i + 1) {
+                        removeAt(i);
+                        labels = labelIndices();
+                        i--;
+                        changed = true;
+                    }
+                }
+                return changed;
+            }
+
+            // Within straight-line code, tracks which mailbox the accumulator
+            // is known to equal, and drops loads and stores of that mailbox.
+            bool removeRedundantLoadsAndStores() {
+                bool changed = false;
+                std::string accumulatorHolds;
+
+                for (size_t i = 0; i < codeEnd(); i++) {
+                    auto& instruction = instructions[i];
+                    if (!instruction.label.empty())
+                        accumulatorHolds.clear();
+
+                    switch (instruction.opcode) {
+                    case LMCOpcode::Lda:
+                    case LMCOpcode::Sta:
+                        if (instruction.operand == accumulatorHolds) {
+                            removeAt(i);
+                            i--;
+                            changed = true;
+                        } else {
+                            accumulatorHolds = instruction.operand;
+                        }
+                        break;
+                    case LMCOpcode::Add:
+                    case LMCOpcode::Sub:
+                    case LMCOpcode::Inp:
+                        accumulatorHolds.clear();
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                return changed;
+            }
+
+            // Backward liveness over the control flow graph. Location 0 is
+            // the accumulator; each data cell gets its own location after it.
+            // Variables are live at HLT so their final values stay in memory.
+            struct Liveness {
+                std::unordered_map<std::string, size_t> cells;
+                std::vector<std::vector<bool>> liveIn;
+                std::vector<std::vector<bool>> liveOut;
+            };
+
+            Liveness computeLiveness() const {
+                Liveness liveness;
+                size_t end = codeEnd();
+                for (size_t i = end; i < instructions.size(); i++)
+                    liveness.cells[instructions[i].label] = i - end + 1;
+
+                size_t locations = instructions.size() - end + 1;
+                std::vector<bool> atExit(locations, false);
+                for (size_t i = end; i < instructions.size(); i++) {
+                    if (instructions[i].kind == LMCCellKind::Variable)
+                        atExit[i - end + 1] = true;
+                }
+
+                liveness.liveIn.assign(end, std::vector<bool>(locations, false));
+                liveness.liveOut.assign(end, std::vector<bool>(locations, false));
+
+                auto labels = labelIndices();
+                std::vector<std::vector<size_t>> next(end);
+                for (size_t i = 0; i < end; i++)
+                    next[i] = successors(i, labels, end);
+
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (size_t i = end; i-- > 0;) {
+                        auto& instruction = instructions[i];
+
+                        std::vector<bool> out = instruction.opcode == LMCOpcode::Hlt ? atExit : std::vector<bool>(locations, false);
+                        for (size_t successor : next[i]) {
+                            for (size_t l = 0; l < locations; l++) {
+                                if (liveness.liveIn[successor][l])
+                                    out[l] = true;
+                            }
+                        }
+
+                        std::vector<bool> in = out;
+                        auto cell = liveness.cells.find(instruction.operand);
+                        size_t operand = cell != liveness.cells.end() ? cell->second : 0;
+
+                        switch (instruction.opcode) {
+                        case LMCOpcode::Add:
+                        case LMCOpcode::Sub:
+                            in[0] = true;
+                            if (operand != 0)
+                                in[operand] = true;
+                            break;
+                        case LMCOpcode::Lda:
+                            in[0] = false;
+                            if (operand != 0)
+                                in[operand] = true;
+                            break;
+                        case LMCOpcode::Sta:
+                            if (operand != 0)
+                                in[operand] = false;
+                            in[0] = true;
+                            break;
+                        case LMCOpcode::Brz:
+                        case LMCOpcode::Brp:
+                        case LMCOpcode::Out:
+                            in[0] = true;
+                            break;
+                        case LMCOpcode::Inp:
+                            in[0] = false;
+                            break;
+                        default:
+                            break;
+                        }
+
+                        if (in != liveness.liveIn[i] || out != liveness.liveOut[i]) {
+                            liveness.liveIn[i] = std::move(in);
+                            liveness.liveOut[i] = std::move(out);
+                            changed = true;
+                        }
+                    }
+                }
+
+                return liveness;
+            }
+
+            // Drops loads and arithmetic whose result is never used and
+            // stores to mailboxes that are never read again.
+            bool removeDeadCode() {
+                Liveness liveness = computeLiveness();
+                bool changed = false;
+
+                for (size_t i = liveness.liveOut.size(); i-- > 0;) {
+                    auto& instruction = instructions[i];
+                    auto& out = liveness.liveOut[i];
+                    bool dead = false;
+
+                    switch (instruction.opcode) {
+                    case LMCOpcode::Lda:
+                    case LMCOpcode::Add:
+                    case LMCOpcode::Sub:
+                        dead = !out[0];
+                        break;
+                    case LMCOpcode::Sta:
+                    {
+                        auto cell = liveness.cells.find(instruction.operand);
+                        dead = cell != liveness.cells.end() && !out[cell->second];
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+
+                    if (dead) {
+                        removeAt(i);
+                        changed = true;
+                    }
+                }
+                return changed;
+            }
+
+            // Colours the interference graph of the temporaries greedily so
+            // temporaries that are never live at the same time share a
+            // mailbox.
+            void shareTemporaries() {
+                Liveness liveness = computeLiveness();
+                size_t end = codeEnd();
+
+                std::vector<std::string> temporaries;
+                std::unordered_map<size_t, size_t> temporaryIndex;
+                for (size_t i = end; i < instructions.size(); i++) {
+                    if (instructions[i].kind == LMCCellKind::Temporary) {
+                        temporaryIndex[liveness.cells[instructions[i].label]] = temporaries.size();
+                        temporaries.push_back(instructions[i].label);
+                    }
+                }
+                if (temporaries.empty())
+                    return;
+
+                std::vector<std::unordered_set<size_t>> interferes(temporaries.size());
+                auto addEdge = [&](size_t a, size_t b) {
+                    if (a != b) {
+                        interferes[a].insert(b);
+                        interferes[b].insert(a);
+                    }
+                };
+
+                for (size_t i = 0; i < end; i++) {
+                    if (instructions[i].opcode != LMCOpcode::Sta)
+                        continue;
+                    auto cell = liveness.cells.find(instructions[i].operand);
+                    if (cell == liveness.cells.end() || temporaryIndex.count(cell->second) == 0)
+                        continue;
+
+                    size_t stored = temporaryIndex[cell->second];
+                    for (auto& other : temporaryIndex) {
+                        if (liveness.liveOut[i][other.first])
+                            addEdge(stored, other.second);
+                    }
+                }
+
+                // A temporary read before any store relies on starting at
+                // zero, so it can't share with anything.
+                if (end > 0) {
+                    for (auto& temporary : temporaryIndex) {
+                        if (liveness.liveIn[0][temporary.first]) {
+                            for (size_t other = 0; other < temporaries.size(); other++)
+                                addEdge(temporary.second, other);
+                        }
+                    }
+                }
+
+                std::vector<int> colours(temporaries.size(), -1);
+                int colourCount = 0;
+                for (size_t t = 0; t < temporaries.size(); t++) {
+                    std::unordered_set<int> taken;
+                    for (size_t other : interferes[t]) {
+                        if (colours[other] >= 0)
+                            taken.insert(colours[other]);
+                    }
+
+                    int colour = 0;
+                    while (taken.count(colour) != 0)
+                        colour++;
+                    colours[t] = colour;
+                    if (colour + 1 > colourCount)
+                        colourCount = colour + 1;
+                }
+
+                std::unordered_map<std::string, std::string> renamed;
+                for (size_t t = 0; t < temporaries.size(); t++)
+                    renamed[temporaries[t]] = "t" + std::to_string(colours[t]);
+
+                for (size_t i = 0; i < end; i++) {
+                    auto it = renamed.find(instructions[i].operand);
+                    if (it != renamed.end())
+                        instructions[i].operand = it->second;
+                }
+
+                std::vector<LMCInstruction> data;
+                bool placed = false;
+                for (size_t i = end; i < instructions.size(); i++) {
+                    if (instructions[i].kind != LMCCellKind::Temporary) {
+                        data.push_back(instructions[i]);
+                    } else if (!placed) {
+                        for (int colour = 0; colour < colourCount; colour++) {
+                            LMCInstruction cell = instructions[i];
+                            cell.label = "t" + std::to_string(colour);
+                            data.push_back(cell);
+                        }
+                        placed = true;
+                    }
+                }
+
+                instructions.resize(end);
+                instructions.insert(instructions.end(), data.begin(), data.end());
+            }
+
+            void removeUnusedCells() {
+                std::unordered_set<std::string> referenced;
+                for (auto& instruction : instructions) {
+                    if (!instruction.operand.empty())
+                        referenced.insert(instruction.operand);
+                }
+
+                for (size_t i = instructions.size(); i-- > codeEnd();) {
+                    if (referenced.count(instructions[i].label) == 0)
+                        instructions.erase(instructions.begin() + i);
+                }
+            }
+        };
+    }
+
+    void optimizeLMC(LMCProgram& program) {
+        LMCOptimizer(program).run();
+    }
+}
@@ -0,0 +1,159 @@
+#include "LintCache.hpp"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace iodine;
+
+namespace {
+    // Bump when the analysis or the entry format changes. Entries are also
+    // tied to the linter's executable, see executableId.
+    const char* linterVersion = "2";
+
+    uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Hash of the running executable, so rebuilding anything linked into
+    // it, the analysis in the parser library included, makes a new
+    // version.
+    std::string executableId() {
+        std::ifstream in("/proc/self/exe", std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Couldn't read /proc/self/exe");
+
+        uint64_t hash = fnv1a(nullptr, 0);
+        char buffer[1 << 16];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+            hash = fnv1a(buffer, in.gcount(), hash);
+
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx", (unsigned long long)hash);
+        return id;
+    }
+
+    void makeDirectories(const std::string& path) {
+        for (size_t i = 1; i <= path.size(); i++) {
+            if (i == path.size() || path[i] == '/')
+                mkdir(path.substr(0, i).c_str(), 0755);
+        }
+
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+            throw std::runtime_error("Couldn't create " + path);
+    }
+
+    // Entries are line based.
+    std::string oneLine(std::string text) {
+        for (char& c : text) {
+            if (c == '\n' || c == '\t')
+                c = ' ';
+        }
+        return text;
+    }
+}
+
+LintCache::LintCache(const std::string& dir, const std::string& optionsKey)
+    : dir(dir)
+    , version(std::string(linterVersion) + " " + executableId() + " " + optionsKey) {
+    makeDirectories(dir);
+}
+
+std::string LintCache::defaultDir() {
+    if (const char* dir = getenv("IODINE_LINT_CACHE"))
+        return dir;
+    if (const char* dir = getenv("XDG_CACHE_HOME"))
+        return std::string(dir) + "/iodine/lint";
+    if (const char* home = getenv("HOME"))
+        return std::string(home) + "/.cache/iodine/lint";
+    return "/tmp/iodine-lint";
+}
+
+std::string LintCache::pathFor(const std::string& source) const {
+    char hash[17];
+    std::string key = version + "\n" + source;
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)fnv1a(key.data(), key.size()));
+    return dir + "/" + hash + ".lint";
+}
+
+// An entry is the version, the size of the script, then either "error"
+// and the message or one line per finding: kind, line and message,
+// separated by tabs. Type errors are of kind "type".
+bool LintCache::load(const std::string& source, LintResult& result) const {
+    std::ifstream in(pathFor(source));
+    std::string entryVersion;
+    size_t size;
+    if (!std::getline(in, entryVersion) || entryVersion != version || !(in >> size) || size != source.size())
+        return false;
+    in.ignore();
+
+    LintResult loaded;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        std::getline(fields, kind, '\t');
+        if (kind == "error") {
+            std::getline(fields, loaded.error);
+            continue;
+        }
+        if (kind == "type") {
+            TypeError typeError;
+            if (!(fields >> typeError.line))
+                return false;
+            fields.ignore();
+            std::getline(fields, typeError.message);
+            loaded.typeErrors.push_back(typeError);
+            continue;
+        }
+
+        DeadCode dead;
+        dead.kind = (DeadCodeKind)atoi(kind.c_str());
+        if (!(fields >> dead.line))
+            return false;
+        fields.ignore();
+        std::getline(fields, dead.message);
+        loaded.found.push_back(dead);
+    }
+
+    result = std::move(loaded);
+    return true;
+}
+
+void LintCache::store(const std::string& source, const LintResult& result) const {
+    std::string path = pathFor(source);
+
+    // Written under a name of its own and renamed, so nobody reads half an
+    // entry.
+    std::ostringstream threadId;
+    threadId << std::this_thread::get_id();
+    std::string tempPath = path + "." + std::to_string(getpid()) + "." + threadId.str();
+
+    {
+        std::ofstream out(tempPath);
+        out << version << "\n" << source.size() << "\n";
+        if (!result.error.empty())
+            out << "error\t" << oneLine(result.error) << "\n";
+        for (auto& dead : result.found)
+            out << (int)dead.kind << "\t" << dead.line << "\t" << oneLine(dead.message) << "\n";
+        for (auto& typeError : result.typeErrors)
+            out << "type\t" << typeError.line << "\t" << oneLine(typeError.message) << "\n";
+        if (!out.good()) {
+            unlink(tempPath.c_str());
+            return;
+        }
+    }
+
+    if (rename(tempPath.c_str(), path.c_str()) != 0)
+        unlink(tempPath.c_str());
+}
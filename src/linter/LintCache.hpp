@@ -0,0 +1,40 @@
+#pragma once
+#include <DeadCode.hpp>
+#include <TypeCheck.hpp>
+#include <string>
+#include <vector>
+
+// What linting one script found.
+struct LintResult {
+    // Why the script couldn't be linted, if it couldn't; the rest is
+    // empty then.
+    std::string error;
+    std::vector<iodine::DeadCode> found;
+    std::vector<iodine::TypeError> typeErrors;
+};
+
+// Lint results on disk, one file per script contents, so scripts that
+// haven't changed aren't parsed again. Entries are keyed by a hash of the
+// contents together with the linter's version and options, and a rebuilt
+// linter counts as a new version. Several threads and processes can use
+// the same directory at once.
+class LintCache {
+public:
+    // Throws std::runtime_error if dir can't be created or the linter's
+    // executable can't be read.
+    LintCache(const std::string& dir, const std::string& optionsKey);
+
+    // $IODINE_LINT_CACHE, or iodine/lint under the user's cache directory.
+    static std::string defaultDir();
+
+    // Fills result and returns true if source was linted before.
+    bool load(const std::string& source, LintResult& result) const;
+    // Failing to write an entry only means it's linted again next time.
+    void store(const std::string& source, const LintResult& result) const;
+
+private:
+    std::string dir;
+    std::string version;
+
+    std::string pathFor(const std::string& source) const;
+};
@@ -1,6 +1,21 @@
-/*#include "parser.hpp"
-#include <string>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <parser.hpp>
+#include <DeadCode.hpp>
+#include <TypeCheck.hpp>
+#include "LintCache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 using namespace iodine;
@@ -8,24 +23,201 @@ using namespace iodine;
 std::unordered_map<std::string, Variable> iodine::variables;
 std::unordered_map<std::string, Function> iodine::functions;
 
+// Scripts are never run here, so builtins are only declared, for what
+// they promise about their effects and types.
+void declareBuiltins() {
+    Function sqrt { true, "sqrt" };
+    sqrt.isPure = true;
+    sqrt.resultType = [](const std::vector<DataType>& args) {
+        if (args.size() != 1)
+            throw std::runtime_error("incorrect num args");
+        if (args[0] == DataType::F32 || args[0] == DataType::Count)
+            return args[0];
+        if (!isNumberType(args[0]) && args[0] != DataType::Boolean)
+            throw std::runtime_error("Invalid cast");
+        return DataType::F64;
+    };
+    functions.insert({ "sqrt", sqrt });
+
+    Function println { true, "println" };
+    println.resultType = [](const std::vector<DataType>& args) {
+        if (args.size() != 1)
+            throw std::runtime_error("Incorrect number of arguments");
+        return DataType::Null;
+    };
+    functions.insert({ "println", println });
+}
+
+// Adds the .iod files under path, or path itself if it isn't a directory,
+// in a stable order.
+void collectScripts(const std::string& path, std::vector<std::string>& scripts) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        scripts.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        scripts.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (auto& name : names) {
+        std::string child = path + (path.back() == '/' ? "" : "/") + name;
+        if (stat(child.c_str(), &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode))
+            collectScripts(child, scripts);
+        else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".iod") == 0)
+            scripts.push_back(child);
+    }
+}
+
+LintResult lintSource(const std::string& source, const DeadCodeOptions& options) {
+    LintResult result;
+    try {
+        auto statements = parseScript(parseTokens(source));
+        result.found = findDeadCode(statements, options);
+        result.typeErrors = checkTypes(statements);
+    } catch (std::exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+
+struct ScriptReport {
+    LintResult result;
+    size_t bytes = 0;
+    bool cached = false;
+};
+
 int main(int argc, char** argv) {
-    // get file name
-    std::string fileName = argv[1];
+    DeadCodeOptions options;
+    // Scripts report results with println, so by default a global's final
+    // value doesn't count as used.
+    options.keepGlobals = false;
+    int jobs = 0;
+    bool useCache = true;
+    std::string cacheDir;
+    std::vector<std::string> paths;
+    const char* usage = "Usage: iodine-linter [--keep-globals] [--jobs=N] [--cache-dir=DIR | --no-cache] path...\n";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keep-globals") == 0) {
+            options.keepGlobals = true;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            cacheDir = argv[i] + 12;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            useCache = false;
+        } else if (argv[i][0] == '-') {
+            std::cerr << usage;
+            return 2;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty()) {
+        std::cerr << usage;
+        return 2;
+    }
+
+    declareBuiltins();
+
+    std::vector<std::string> scripts;
+    for (auto& path : paths)
+        collectScripts(path, scripts);
+
+    std::unique_ptr<LintCache> cache;
+    if (useCache) {
+        try {
+            cache.reset(new LintCache(cacheDir.empty() ? LintCache::defaultDir() : cacheDir,
+                options.keepGlobals ? "keep-globals" : "default"));
+        } catch (std::exception& e) {
+            std::cerr << e.what() << "; linting without a cache\n";
+        }
+    }
 
-    std::ifstream stream(fileName);
+    if (jobs <= 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<size_t>(jobs, std::max<size_t>(scripts.size(), 1));
 
-    std::vector<std::string> lines;
+    // Workers take the next script until there are none left. Reports
+    // are printed in order once everything is done.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ScriptReport> reports(scripts.size());
+    std::atomic<size_t> next { 0 };
+    auto work = [&] {
+        for (size_t i = next++; i < scripts.size(); i = next++) {
+            ScriptReport& report = reports[i];
+            std::ifstream stream(scripts[i]);
+            if (!stream) {
+                report.result.error = "cannot open";
+                continue;
+            }
 
-    while (stream.good()) {
-        std::string line;
-        std::getline(stream, line);
+            std::stringstream text;
+            text << stream.rdbuf();
+            std::string source = text.str();
+            report.bytes = source.size();
 
-        std::shared_ptr<ASTNode> node = parseScript(parseTokens(line));
+            if (cache != nullptr && cache->load(source, report.result)) {
+                report.cached = true;
+                continue;
+            }
 
-        if (!line.empty()) {
-            lines.push_back(line);
+            report.result = lintSource(source, options);
+            if (cache != nullptr)
+                cache->store(source, report.result);
         }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < jobs; i++)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
+    bool clean = true;
+    size_t bytes = 0;
+    size_t hits = 0;
+    for (size_t i = 0; i < scripts.size(); i++) {
+        auto& report = reports[i];
+        bytes += report.bytes;
+        hits += report.cached;
+
+        if (!report.result.error.empty()) {
+            std::cerr << scripts[i] << ": error: " << report.result.error << "\n";
+            clean = false;
+        }
+        for (auto& dead : report.result.found) {
+            std::cout << scripts[i] << ":" << dead.line << ": " << dead.message << "\n";
+            clean = false;
+        }
+        for (auto& typeError : report.result.typeErrors) {
+            std::cout << scripts[i] << ":" << typeError.line << ": error: " << typeError.message << "\n";
+            clean = false;
+        }
     }
-} */
-int main() { return 0; }
+
+    std::cerr << "Linted " << scripts.size() << " scripts (" << bytes / 1024 << " KiB) in " << seconds * 1000 << " ms on "
+              << jobs << " threads: " << scripts.size() / seconds << " scripts/s, " << bytes / seconds / (1024 * 1024) << " MiB/s";
+    if (cache != nullptr)
+        std::cerr << ", " << hits << " cached (" << (scripts.empty() ? 0 : 100.0 * hits / scripts.size()) << "%)";
+    std::cerr << "\n";
+
+    return clean ? 0 : 1;
+}
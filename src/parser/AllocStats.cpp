@@ -0,0 +1,148 @@
+#include "AllocStats.hpp"
+#include "parser.hpp"
+#include <stdlib.h>
+#include <iomanip>
+#include <new>
+
+namespace iodine {
+    namespace {
+        struct AtomicCounts {
+            std::atomic<uint64_t> allocations { 0 };
+            std::atomic<uint64_t> bytes { 0 };
+            std::atomic<uint64_t> frees { 0 };
+
+            void recordAllocation(size_t size) {
+                allocations.fetch_add(1, std::memory_order_relaxed);
+                bytes.fetch_add(size, std::memory_order_relaxed);
+            }
+
+            AllocCounts load() const {
+                AllocCounts counts;
+                counts.allocations = allocations.load(std::memory_order_relaxed);
+                counts.bytes = bytes.load(std::memory_order_relaxed);
+                counts.frees = frees.load(std::memory_order_relaxed);
+                return counts;
+            }
+
+            void reset() {
+                allocations.store(0, std::memory_order_relaxed);
+                bytes.store(0, std::memory_order_relaxed);
+                frees.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        const char* phaseNames[] = { "other", "lex", "parse", "optimize", "eval" };
+
+        std::atomic<bool> trackingEnabled { false };
+        AtomicCounts phaseCounts[(int)AllocPhase::Count];
+        AtomicCounts statementCounts[(int)ASTNodeType::Count];
+
+        void recordAllocation(size_t size) {
+            AllocPhase phase = currentAllocPhase;
+            phaseCounts[(int)phase].recordAllocation(size);
+
+            if (phase == AllocPhase::Eval) {
+                const ASTNode* statement = currentStatement.load(std::memory_order_relaxed);
+                if (statement != nullptr)
+                    statementCounts[(int)statement->type].recordAllocation(size);
+            }
+        }
+
+        void* trackedAllocate(size_t size) {
+            if (trackingEnabled.load(std::memory_order_relaxed))
+                recordAllocation(size);
+
+            return malloc(size == 0 ? 1 : size);
+        }
+
+        void trackedFree(void* ptr) {
+            if (ptr != nullptr && trackingEnabled.load(std::memory_order_relaxed))
+                phaseCounts[(int)currentAllocPhase].frees.fetch_add(1, std::memory_order_relaxed);
+
+            free(ptr);
+        }
+    }
+
+    void enableAllocTracking() {
+        trackingEnabled.store(true, std::memory_order_relaxed);
+    }
+
+    void disableAllocTracking() {
+        trackingEnabled.store(false, std::memory_order_relaxed);
+    }
+
+    void resetAllocStats() {
+        for (auto& counts : phaseCounts)
+            counts.reset();
+        for (auto& counts : statementCounts)
+            counts.reset();
+    }
+
+    AllocCounts allocStats(AllocPhase phase) {
+        return phaseCounts[(int)phase].load();
+    }
+
+    AllocCounts allocStats(ASTNodeType statementType) {
+        return statementCounts[(int)statementType].load();
+    }
+
+    void writeAllocStats(std::ostream& out) {
+        auto writeRow = [&out](const char* name, const AllocCounts& counts) {
+            out << std::left << std::setw(20) << name << std::right
+                << std::setw(12) << counts.allocations << std::setw(14) << counts.bytes
+                << std::setw(12) << counts.frees << "\n";
+        };
+
+        out << std::left << std::setw(20) << "phase" << std::right
+            << std::setw(12) << "allocs" << std::setw(14) << "bytes" << std::setw(12) << "frees" << "\n";
+        for (int phase = 0; phase < (int)AllocPhase::Count; phase++)
+            writeRow(phaseNames[phase], allocStats((AllocPhase)phase));
+
+        out << "\n" << std::left << std::setw(20) << "eval by statement" << std::right
+            << std::setw(12) << "allocs" << std::setw(14) << "bytes" << "\n";
+        for (int type = 0; type < (int)ASTNodeType::Count; type++) {
+            AllocCounts counts = allocStats((ASTNodeType)type);
+            if (counts.allocations > 0) {
+                out << std::left << std::setw(20) << nodeTypeNames[(ASTNodeType)type] << std::right
+                    << std::setw(12) << counts.allocations << std::setw(14) << counts.bytes << "\n";
+            }
+        }
+    }
+}
+
+// Replacements for the global allocation functions. Over-aligned
+// allocations keep the standard library's implementation and aren't counted.
+void* operator new(size_t size) {
+    void* ptr = iodine::trackedAllocate(size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return iodine::trackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return iodine::trackedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    iodine::trackedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    iodine::trackedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    iodine::trackedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    iodine::trackedFree(ptr);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <ostream>
+
+namespace iodine {
+    enum class ASTNodeType;
+
+    enum class AllocPhase {
+        None,
+        Lex,
+        Parse,
+        Optimize,
+        Eval,
+        Count
+    };
+
+    // The pipeline phase allocations on this thread are attributed to. The
+    // library's entry points (parseTokens, parseScript, optimizeLoops,
+    // evalAST, ...) set it themselves, so embedders don't have to.
+    inline thread_local AllocPhase currentAllocPhase = AllocPhase::None;
+
+    class AllocPhaseScope {
+    public:
+        AllocPhaseScope(AllocPhase phase) : saved(currentAllocPhase) {
+            currentAllocPhase = phase;
+        }
+
+        ~AllocPhaseScope() {
+            currentAllocPhase = saved;
+        }
+
+    private:
+        AllocPhase saved;
+    };
+
+    struct AllocCounts {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+        uint64_t frees = 0;
+    };
+
+    // Allocation tracking replaces the global operator new and delete, so
+    // these live in the separate iodine_alloc_stats library and only
+    // programs linking it pay anything: one relaxed load per allocation
+    // until tracking is enabled.
+    //
+    // While evaluating, allocations are also attributed to the kind of the
+    // statement being executed, taken from currentStatement.
+    void enableAllocTracking();
+    void disableAllocTracking();
+    void resetAllocStats();
+
+    AllocCounts allocStats(AllocPhase phase);
+    AllocCounts allocStats(ASTNodeType statementType);
+
+    // Writes allocations and bytes per phase, then per statement kind.
+    void writeAllocStats(std::ostream& out);
+}
@@ -0,0 +1,555 @@
+#include "DeadCode.hpp"
+#include "Effects.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        // Same as the loop optimizer's: locals are keyed by slot.
+        std::string variableKey(const std::string& name, int localSlot) {
+            if (localSlot >= 0)
+                return "#" + std::to_string(localSlot);
+            return name;
+        }
+
+        bool isLocalKey(const std::string& key) {
+            return key[0] == '#';
+        }
+
+        // Variables whose values the rest of the code might still need, at
+        // some point of it.
+        struct Live {
+            // Might be read before they're assigned again.
+            std::unordered_set<std::string> values;
+            // Assigned without a declaration before they're declared again,
+            // which needs the declaration before.
+            std::unordered_set<std::string> declared;
+            // Every global's value is needed.
+            bool globals = false;
+
+            bool valueLive(const std::string& key) const {
+                return values.count(key) != 0 || (globals && !isLocalKey(key));
+            }
+
+            void merge(const Live& other) {
+                values.insert(other.values.begin(), other.values.end());
+                declared.insert(other.declared.begin(), other.declared.end());
+                globals |= other.globals;
+            }
+
+            bool operator==(const Live& other) const {
+                return values == other.values && declared == other.declared && globals == other.globals;
+            }
+        };
+
+        // True if condition is a constant, or a comparison of two, setting
+        // taken to its value.
+        bool constantCondition(ProducesValueNode* condition, bool& taken) {
+            if (condition == nullptr)
+                return false;
+
+            auto isConstant = [](ProducesValueNode* node) {
+                return node->type == ASTNodeType::ConstVal && isNumberType(static_cast<ConstValNode*>(node)->val.type);
+            };
+
+            try {
+                if (condition->type == ASTNodeType::ConstVal) {
+                    taken = static_cast<ConstValNode*>(condition)->val.as<bool>();
+                    return true;
+                }
+                if (condition->type == ASTNodeType::Comparison) {
+                    auto comparison = static_cast<ComparisonNode*>(condition);
+                    if (isConstant(comparison->lhs.get()) && isConstant(comparison->rhs.get())) {
+                        taken = comparison->getValue().boolVal;
+                        return true;
+                    }
+                }
+            } catch (const std::runtime_error&) {
+            }
+            return false;
+        }
+
+        class DeadCodeFinder {
+        public:
+            DeadCodeFinder(const std::vector<std::shared_ptr<ASTNode>>& statements, const DeadCodeOptions& options, bool remove)
+                : summaries(summarizeFunctions(statements))
+                , options(options)
+                , remove(remove) {
+                for (auto& node : statements) {
+                    if (node->type == ASTNodeType::FunctionDefinition) {
+                        auto def = static_cast<FunctionDefinitionNode*>(node.get());
+                        scriptFunctions.insert(def->name);
+                        for (auto& child : def->body)
+                            readKeys(child.get(), globalReads, false);
+                    } else {
+                        readKeys(node.get(), globalReads, false);
+                    }
+                }
+            }
+
+            std::vector<DeadCode> found;
+            size_t removed = 0;
+
+            void script(std::vector<std::shared_ptr<ASTNode>>& statements) {
+                for (auto& node : statements) {
+                    if (node->type == ASTNodeType::FunctionDefinition)
+                        function(static_cast<FunctionDefinitionNode*>(node.get()));
+                }
+
+                scope = "";
+                exit = Live();
+                exit.globals = options.keepGlobals;
+                Live live = exit;
+                block(statements, live, true);
+            }
+
+        private:
+            std::unordered_map<std::string, Effects> summaries;
+            std::unordered_set<std::string> scriptFunctions;
+            const DeadCodeOptions& options;
+            bool remove;
+            // Globals read anywhere, and locals read anywhere in the
+            // function being looked at.
+            std::unordered_set<std::string> globalReads;
+            std::unordered_set<std::string> localReads;
+            // What's live where the code being looked at returns.
+            Live exit;
+            // Name of the function being looked at, to tell its locals
+            // from other functions'.
+            std::string scope;
+            // Unused variables already reported, by scope and key, with the
+            // index of their report.
+            std::unordered_map<std::string, size_t> unused;
+
+            void function(FunctionDefinitionNode* def) {
+                if (def->lazyBody != nullptr)
+                    parseLazyBody(*def);
+
+                scope = def->name;
+                localReads.clear();
+                for (auto& child : def->body)
+                    readKeys(child.get(), localReads, true);
+
+                for (size_t i = 0; i < def->params.size(); i++) {
+                    if (localReads.count("#" + std::to_string(i)) == 0)
+                        report(DeadCodeKind::UnusedVariable, def->line, "parameter " + def->params[i].name + " is never used");
+                }
+
+                // Callers might read any global the script reads.
+                exit = Live();
+                exit.values = globalReads;
+                exit.globals = options.keepGlobals;
+                Live live = exit;
+                block(def->body, live, true);
+            }
+
+            void report(DeadCodeKind kind, int line, const std::string& message) {
+                found.push_back(DeadCode { kind, line, message });
+            }
+
+            void reportAssignment(VarAssignmentNode* assign, const std::string& key) {
+                bool read = isLocalKey(key) ? localReads.count(key) != 0 : globalReads.count(key) != 0;
+                if (read) {
+                    report(DeadCodeKind::UselessAssignment, assign->line, "value assigned to " + assign->varName + " is never read");
+                    return;
+                }
+
+                // Reported once, at the first assignment.
+                auto [it, inserted] = unused.emplace(scope + ":" + key, found.size());
+                if (inserted) {
+                    std::string what = isLocalKey(key) ? "variable " : "global ";
+                    report(DeadCodeKind::UnusedVariable, assign->line, what + assign->varName + " is never used");
+                } else if (assign->line < found[it->second].line) {
+                    found[it->second].line = assign->line;
+                }
+            }
+
+            // Whether evaluating expr can only produce a value. Reads of
+            // undefined variables and operations on the wrong types aren't
+            // considered; integer division only is by constants it can't
+            // trap on.
+            bool isHarmless(ProducesValueNode* expr) const {
+                if (expr == nullptr)
+                    return true;
+
+                switch (expr->type) {
+                case ASTNodeType::ConstVal:
+                case ASTNodeType::VariableReference:
+                case ASTNodeType::InductionVariable:
+                    return true;
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(expr);
+                    if (arith->operation == ArithmeticOperation::Divide) {
+                        if (arith->b->type != ASTNodeType::ConstVal)
+                            return false;
+                        const Value& divisor = static_cast<ConstValNode*>(arith->b.get())->val;
+                        if (divisor.type == DataType::Int32 && (divisor.intVal == 0 || divisor.intVal == -1))
+                            return false;
+                    }
+                    return isHarmless(arith->a.get()) && isHarmless(arith->b.get());
+                }
+                case ASTNodeType::UnaryOp:
+                    return isHarmless(static_cast<UnaryOpNode*>(expr)->valNode.get());
+                case ASTNodeType::Comparison:
+                    return isHarmless(static_cast<ComparisonNode*>(expr)->lhs.get())
+                        && isHarmless(static_cast<ComparisonNode*>(expr)->rhs.get());
+                case ASTNodeType::LoopInvariant:
+                    return isHarmless(static_cast<LoopInvariantNode*>(expr)->expr.get());
+                case ASTNodeType::CommonValue:
+                    return isHarmless(static_cast<CommonValueNode*>(expr)->expr.get());
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(expr);
+                    if (scriptFunctions.count(call->functionName))
+                        return false;
+                    auto it = functions.find(call->functionName);
+                    if (it == functions.end() || !it->second.isBuiltin || !it->second.isPure)
+                        return false;
+                    return std::all_of(call->args.begin(), call->args.end(), [&](auto& arg) { return isHarmless(arg.get()); });
+                }
+                default:
+                    return false;
+                }
+            }
+
+            // Adds the variables node reads, locals or globals, to keys.
+            // Function calls don't count what the function reads.
+            void readKeys(ASTNode* node, std::unordered_set<std::string>& keys, bool locals) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    if ((ref->localSlot >= 0) == locals)
+                        keys.insert(variableKey(ref->varName, ref->localSlot));
+                    break;
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    if ((init->localSlot >= 0) == locals)
+                        keys.insert(variableKey(init->varName, init->localSlot));
+                    break;
+                }
+                case ASTNodeType::VarAssignment:
+                    readKeys(static_cast<VarAssignmentNode*>(node)->valNode.get(), keys, locals);
+                    break;
+                case ASTNodeType::Arithmetic:
+                    readKeys(static_cast<ArithmeticNode*>(node)->a.get(), keys, locals);
+                    readKeys(static_cast<ArithmeticNode*>(node)->b.get(), keys, locals);
+                    break;
+                case ASTNodeType::UnaryOp:
+                    readKeys(static_cast<UnaryOpNode*>(node)->valNode.get(), keys, locals);
+                    break;
+                case ASTNodeType::Comparison:
+                    readKeys(static_cast<ComparisonNode*>(node)->lhs.get(), keys, locals);
+                    readKeys(static_cast<ComparisonNode*>(node)->rhs.get(), keys, locals);
+                    break;
+                case ASTNodeType::LoopInvariant:
+                    readKeys(static_cast<LoopInvariantNode*>(node)->expr.get(), keys, locals);
+                    break;
+                case ASTNodeType::CommonValue:
+                    readKeys(static_cast<CommonValueNode*>(node)->expr.get(), keys, locals);
+                    break;
+                case ASTNodeType::FunctionCall:
+                    for (auto& arg : static_cast<FunctionCallNode*>(node)->args)
+                        readKeys(arg.get(), keys, locals);
+                    break;
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    readKeys(ifNode->condition.get(), keys, locals);
+                    for (auto& child : ifNode->nodes)
+                        readKeys(child.get(), keys, locals);
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    readKeys(loop->condition.get(), keys, locals);
+                    for (auto& child : loop->nodes)
+                        readKeys(child.get(), keys, locals);
+
+                    if (node->type == ASTNodeType::For) {
+                        auto forNode = static_cast<ForNode*>(node);
+                        readKeys(forNode->init.get(), keys, locals);
+                        readKeys(forNode->step.get(), keys, locals);
+                        readKeys(forNode->counterLimit.get(), keys, locals);
+                    }
+                    break;
+                }
+                case ASTNodeType::Return:
+                    readKeys(static_cast<ReturnNode*>(node)->valNode.get(), keys, locals);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            // Makes live what evaluating expr reads, including the globals
+            // of the functions it calls.
+            void reads(ProducesValueNode* expr, Live& live) {
+                readKeys(expr, live.values, true);
+                readKeys(expr, live.values, false);
+
+                Effects effects;
+                collectEffects(expr, effects);
+                addCalledEffects(effects, summaries);
+                live.values.insert(effects.reads.begin(), effects.reads.end());
+                // Functions might assign globals without declaring them.
+                live.declared.insert(effects.writes.begin(), effects.writes.end());
+            }
+
+            // An assignment that has to stay, like a for loop's.
+            void assignment(VarAssignmentNode* assign, Live& live) {
+                std::string key = variableKey(assign->varName, assign->localSlot);
+                live.values.erase(key);
+                if (assign->createNew)
+                    live.declared.erase(key);
+                else
+                    live.declared.insert(key);
+                reads(assign->valNode.get(), live);
+            }
+
+            void clause(ASTNode* node, Live& live) {
+                if (node == nullptr)
+                    return;
+                if (node->type == ASTNodeType::VarAssignment)
+                    assignment(static_cast<VarAssignmentNode*>(node), live);
+                else
+                    reads(static_cast<ProducesValueNode*>(node), live);
+            }
+
+            // Turns live, what's needed after the statements, into what's
+            // needed before them. Only reports and removes code when mark
+            // is set, since loops look at their bodies more than once.
+            void block(std::vector<std::shared_ptr<ASTNode>>& nodes, Live& live, bool mark) {
+                size_t end = nodes.size();
+                for (size_t i = 0; i < nodes.size(); i++) {
+                    if (nodes[i]->type == ASTNodeType::Return) {
+                        end = i + 1;
+                        break;
+                    }
+                }
+
+                if (mark && end < nodes.size()) {
+                    report(DeadCodeKind::UnreachableCode, nodes[end]->line, "code after return never runs");
+                    if (remove) {
+                        removed += nodes.size() - end;
+                        nodes.resize(end);
+                    }
+                }
+
+                std::vector<bool> keep(end, true);
+                bool dropping = false;
+                for (size_t i = end; i-- > 0;) {
+                    keep[i] = statement(nodes[i], live, mark);
+                    dropping |= !keep[i];
+                }
+
+                if (dropping) {
+                    size_t kept = 0;
+                    for (size_t i = 0; i < nodes.size(); i++) {
+                        if (i >= end || keep[i])
+                            nodes[kept++] = std::move(nodes[i]);
+                    }
+                    nodes.resize(kept);
+                }
+            }
+
+            // What's live at the top of a loop, before its condition,
+            // given what's live after it.
+            Live loopEntry(LoopNode* loop, ForNode* forNode, const Live& after) {
+                Live top = after;
+                reads(loop->condition.get(), top);
+                if (forNode != nullptr)
+                    reads(forNode->counterLimit.get(), top);
+
+                while (true) {
+                    Live next = top;
+                    if (forNode != nullptr)
+                        clause(forNode->step.get(), next);
+                    block(loop->nodes, next, false);
+                    next.merge(after);
+                    reads(loop->condition.get(), next);
+                    if (forNode != nullptr)
+                        reads(forNode->counterLimit.get(), next);
+
+                    if (next == top)
+                        return top;
+                    top = std::move(next);
+                }
+            }
+
+            // Returns false if node should be removed.
+            bool statement(std::shared_ptr<ASTNode>& node, Live& live, bool mark) {
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node.get());
+                    std::string key = variableKey(assign->varName, assign->localSlot);
+                    bool dead = !live.valueLive(key) && !(assign->createNew && live.declared.count(key) != 0);
+                    if (!dead && !live.valueLive(key) && assign->valNode->type != ASTNodeType::ConstVal) {
+                        // Only the declaration is needed, by a later
+                        // assignment, so a harmless value can be any
+                        // constant.
+                        bool harmless = isHarmless(assign->valNode.get());
+                        live.declared.erase(key);
+                        if (!harmless)
+                            reads(assign->valNode.get(), live);
+                        if (!mark)
+                            return true;
+
+                        report(DeadCodeKind::UselessAssignment, assign->line, "value assigned to " + assign->varName + " is never read");
+                        if (remove && harmless && isNumberType(assign->type)) {
+                            assign->valNode = makeNode<ConstValNode>(Value(0).as(assign->type));
+                            removed++;
+                        }
+                        return true;
+                    }
+                    if (!dead) {
+                        assignment(assign, live);
+                        return true;
+                    }
+
+                    // The assignment goes, so it neither kills nor needs
+                    // anything.
+                    bool harmless = isHarmless(assign->valNode.get());
+                    if (!harmless)
+                        reads(assign->valNode.get(), live);
+                    if (!mark)
+                        return true;
+
+                    reportAssignment(assign, key);
+                    if (!remove)
+                        return true;
+                    removed++;
+                    if (harmless)
+                        return false;
+
+                    auto value = assign->valNode;
+                    value->line = assign->line;
+                    node = value;
+                    return true;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node.get());
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+
+                    bool taken;
+                    bool constant = constantCondition(ifNode->condition.get(), taken);
+                    if (constant && !taken) {
+                        if (mark && !ifNode->nodes.empty())
+                            report(DeadCodeKind::UnreachableCode, ifNode->line, "if body never runs");
+                        if (mark && remove) {
+                            removed++;
+                            return false;
+                        }
+                        return true;
+                    }
+
+                    Live inner = live;
+                    block(ifNode->nodes, inner, mark);
+                    if (constant)
+                        live = std::move(inner);
+                    else
+                        live.merge(inner);
+                    reads(ifNode->condition.get(), live);
+
+                    // Its body may have gone entirely.
+                    if (mark && remove && ifNode->nodes.empty() && isHarmless(ifNode->condition.get())) {
+                        removed++;
+                        return false;
+                    }
+                    return true;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<LoopNode*>(node.get());
+                    ForNode* forNode = node->type == ASTNodeType::For ? static_cast<ForNode*>(node.get()) : nullptr;
+
+                    bool taken;
+                    if (forNode == nullptr && constantCondition(loop->condition.get(), taken) && !taken) {
+                        if (mark && !loop->nodes.empty())
+                            report(DeadCodeKind::UnreachableCode, loop->line, "loop body never runs");
+                        if (mark && remove) {
+                            removed++;
+                            return false;
+                        }
+                        return true;
+                    }
+
+                    Live top = loopEntry(loop, forNode, live);
+                    if (mark) {
+                        Live body = top;
+                        if (forNode != nullptr)
+                            clause(forNode->step.get(), body);
+                        block(loop->nodes, body, true);
+                    }
+
+                    live = std::move(top);
+                    if (forNode != nullptr)
+                        clause(forNode->init.get(), live);
+                    return true;
+                }
+                case ASTNodeType::FunctionDefinition:
+                    return true;
+                case ASTNodeType::Return:
+                    live = exit;
+                    reads(static_cast<ReturnNode*>(node.get())->valNode.get(), live);
+                    return true;
+                default:
+                {
+                    auto expr = static_cast<ProducesValueNode*>(node.get());
+                    if (!isHarmless(expr)) {
+                        reads(expr, live);
+                        return true;
+                    }
+
+                    if (mark)
+                        report(DeadCodeKind::UselessExpression, node->line, "expression result is never used");
+                    if (mark && remove) {
+                        removed++;
+                        return false;
+                    }
+                    return true;
+                }
+                }
+            }
+        };
+    }
+
+    std::vector<DeadCode> findDeadCode(const std::vector<std::shared_ptr<ASTNode>>& statements, const DeadCodeOptions& options) {
+        // Nothing is removed, so the statements can be shared.
+        auto nodes = statements;
+        DeadCodeFinder finder(nodes, options, false);
+        finder.script(nodes);
+
+        std::stable_sort(finder.found.begin(), finder.found.end(), [](const DeadCode& a, const DeadCode& b) {
+            return a.line < b.line;
+        });
+        return std::move(finder.found);
+    }
+
+    size_t eliminateDeadCode(std::vector<std::shared_ptr<ASTNode>>& statements, const DeadCodeOptions& options) {
+        size_t total = 0;
+        while (true) {
+            DeadCodeFinder finder(statements, options, true);
+            finder.script(statements);
+            if (finder.removed == 0)
+                return total;
+            total += finder.removed;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "parser.hpp"
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    enum class DeadCodeKind {
+        // A variable or parameter nothing reads.
+        UnusedVariable,
+        // Statements that can never run.
+        UnreachableCode,
+        // An assignment whose value is overwritten or dropped before
+        // anything reads it.
+        UselessAssignment,
+        // An expression statement with nothing to show for it.
+        UselessExpression
+    };
+
+    struct DeadCode {
+        DeadCodeKind kind;
+        int line;
+        std::string message;
+    };
+
+    struct DeadCodeOptions {
+        // Count the value every global holds at the end of the script as
+        // read, for hosts that look at globals after a run.
+        bool keepGlobals = true;
+    };
+
+    // Finds code that never runs or whose results are never used: bodies
+    // of ifs and while loops with constant false conditions, statements
+    // after a return, assignments nothing reads before the variable is
+    // assigned again or goes away, and expression statements that only
+    // compute a value. Function bodies are parsed if they're lazy. Sorted
+    // by line.
+    std::vector<DeadCode> findDeadCode(const std::vector<std::shared_ptr<ASTNode>>& statements,
+        const DeadCodeOptions& options = {});
+
+    // Removes what findDeadCode finds, over and over until nothing more
+    // goes, and returns how many statements it removed or reduced. A
+    // useless assignment whose value calls something that isn't a pure
+    // builtin keeps the value as an expression statement. Anything else
+    // it drops is assumed not to fail, so a dropped read of an undefined
+    // variable, for instance, no longer throws. Run before
+    // eliminateCommonSubexpressions.
+    size_t eliminateDeadCode(std::vector<std::shared_ptr<ASTNode>>& statements, const DeadCodeOptions& options = {});
+}
@@ -0,0 +1,138 @@
+#include "Effects.hpp"
+
+namespace iodine {
+    void collectEffects(ASTNode* node, Effects& effects) {
+        if (node == nullptr)
+            return;
+
+        switch (node->type) {
+        case ASTNodeType::VarAssignment:
+        {
+            auto assign = static_cast<VarAssignmentNode*>(node);
+            if (assign->localSlot < 0)
+                effects.writes.insert(assign->varName);
+            collectEffects(assign->valNode.get(), effects);
+            break;
+        }
+        case ASTNodeType::VariableReference:
+        {
+            auto ref = static_cast<VariableReferenceNode*>(node);
+            if (ref->localSlot < 0)
+                effects.reads.insert(ref->varName);
+            break;
+        }
+        case ASTNodeType::InductionVariable:
+        {
+            auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+            if (init->localSlot < 0)
+                effects.reads.insert(init->varName);
+            break;
+        }
+        case ASTNodeType::Arithmetic:
+            collectEffects(static_cast<ArithmeticNode*>(node)->a.get(), effects);
+            collectEffects(static_cast<ArithmeticNode*>(node)->b.get(), effects);
+            break;
+        case ASTNodeType::UnaryOp:
+            collectEffects(static_cast<UnaryOpNode*>(node)->valNode.get(), effects);
+            break;
+        case ASTNodeType::Comparison:
+            collectEffects(static_cast<ComparisonNode*>(node)->lhs.get(), effects);
+            collectEffects(static_cast<ComparisonNode*>(node)->rhs.get(), effects);
+            break;
+        case ASTNodeType::LoopInvariant:
+            collectEffects(static_cast<LoopInvariantNode*>(node)->expr.get(), effects);
+            break;
+        case ASTNodeType::CommonValue:
+            collectEffects(static_cast<CommonValueNode*>(node)->expr.get(), effects);
+            break;
+        case ASTNodeType::FunctionCall:
+        {
+            auto call = static_cast<FunctionCallNode*>(node);
+            effects.calls.insert(call->functionName);
+            for (auto& arg : call->args)
+                collectEffects(arg.get(), effects);
+            break;
+        }
+        case ASTNodeType::If:
+        {
+            auto ifNode = static_cast<IfNode*>(node);
+            if (ifNode->lazyBody != nullptr)
+                parseLazyBody(*ifNode);
+            collectEffects(ifNode->condition.get(), effects);
+            for (auto& child : ifNode->nodes)
+                collectEffects(child.get(), effects);
+            break;
+        }
+        case ASTNodeType::While:
+        case ASTNodeType::For:
+        {
+            auto loop = static_cast<LoopNode*>(node);
+            collectEffects(loop->condition.get(), effects);
+            for (auto& child : loop->nodes)
+                collectEffects(child.get(), effects);
+
+            if (node->type == ASTNodeType::For) {
+                auto forNode = static_cast<ForNode*>(node);
+                collectEffects(forNode->init.get(), effects);
+                collectEffects(forNode->step.get(), effects);
+                collectEffects(forNode->counterLimit.get(), effects);
+            }
+            break;
+        }
+        case ASTNodeType::Return:
+            collectEffects(static_cast<ReturnNode*>(node)->valNode.get(), effects);
+            break;
+        default:
+            // Function definitions are summarized on their own.
+            break;
+        }
+    }
+
+    std::unordered_map<std::string, Effects> summarizeFunctions(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+        std::unordered_map<std::string, Effects> summaries;
+        for (auto& node : statements) {
+            if (node->type != ASTNodeType::FunctionDefinition)
+                continue;
+
+            auto def = static_cast<FunctionDefinitionNode*>(node.get());
+            if (def->lazyBody != nullptr)
+                parseLazyBody(*def);
+
+            Effects& effects = summaries[def->name];
+            for (auto& child : def->body)
+                collectEffects(child.get(), effects);
+        }
+
+        // A function does whatever the functions it calls do.
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            for (auto& [name, effects] : summaries) {
+                for (auto& callee : std::vector<std::string>(effects.calls.begin(), effects.calls.end())) {
+                    auto it = summaries.find(callee);
+                    if (it == summaries.end() || it->first == name)
+                        continue;
+
+                    for (auto& read : it->second.reads)
+                        grew |= effects.reads.insert(read).second;
+                    for (auto& write : it->second.writes)
+                        grew |= effects.writes.insert(write).second;
+                    for (auto& call : it->second.calls)
+                        grew |= effects.calls.insert(call).second;
+                }
+            }
+        }
+
+        return summaries;
+    }
+
+    void addCalledEffects(Effects& effects, const std::unordered_map<std::string, Effects>& summaries) {
+        for (auto& callee : effects.calls) {
+            auto it = summaries.find(callee);
+            if (it == summaries.end())
+                continue;
+            effects.reads.insert(it->second.reads.begin(), it->second.reads.end());
+            effects.writes.insert(it->second.writes.begin(), it->second.writes.end());
+        }
+    }
+}
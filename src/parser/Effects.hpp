@@ -0,0 +1,29 @@
+#pragma once
+#include "parser.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace iodine {
+    // Globals a piece of code reads and writes, and the functions it
+    // calls. Locals live in frames, so they never take part.
+    struct Effects {
+        std::unordered_set<std::string> reads;
+        std::unordered_set<std::string> writes;
+        std::unordered_set<std::string> calls;
+    };
+
+    // Adds what node does, not counting the functions it calls. Parses
+    // lazy if bodies on the way.
+    void collectEffects(ASTNode* node, Effects& effects);
+
+    // Effects of every script function defined among statements, including
+    // everything the functions they call do. Definitions of the same name
+    // are merged.
+    std::unordered_map<std::string, Effects> summarizeFunctions(const std::vector<std::shared_ptr<ASTNode>>& statements);
+
+    // Adds the effects of the script functions effects calls.
+    void addCalledEffects(Effects& effects, const std::unordered_map<std::string, Effects>& summaries);
+}
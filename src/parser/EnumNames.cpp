@@ -11,7 +11,14 @@ namespace iodine {
         "VariableReference",
         "FunctionCall",
         "If",
-        "Comparison"
+        "Comparison",
+        "FunctionDefinition",
+        "Return",
+        "While",
+        "For",
+        "LoopInvariant",
+        "InductionVariable",
+        "CommonValue"
     };
 
     EnumNames<TokenType> tokenNames {
@@ -31,7 +38,13 @@ namespace iodine {
         "NewLine",
         "True",
         "False",
-        "StringContents"
+        "StringContents",
+        "Fn",
+        "Return",
+        "While",
+        "For",
+        "LessThan",
+        "GreaterThan"
     };
 
     EnumNames<ArithmeticOperation> arithOperationNames {
@@ -51,8 +64,8 @@ namespace iodine {
         "F32",
         "F64",
         "Ref",
+        "Null",
         "Boolean",
-        "ConstStr",
-        "Null"
+        "String"
     };
 }
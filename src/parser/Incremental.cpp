@@ -0,0 +1,237 @@
+#include "Incremental.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace iodine {
+    namespace {
+        // Lines only count relative to the statement's first one, so a
+        // statement that just moved still matches.
+        uint64_t hashTokens(std::vector<Token>::const_iterator begin, std::vector<Token>::const_iterator end) {
+            uint64_t hash = 14695981039346656037ull;
+            auto mix = [&](unsigned char c) {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            };
+
+            for (auto it = begin; it < end; it++) {
+                mix((unsigned char)it->type);
+                mix((unsigned char)(it->line - begin->line));
+                for (char c : it->val)
+                    mix(c);
+                mix(0);
+            }
+            return hash;
+        }
+
+        bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b) {
+            return std::equal(a.begin(), a.end(), b.begin(), b.end(), [&](const Token& x, const Token& y) {
+                return x.type == y.type && x.val == y.val && x.line - a.front().line == y.line - b.front().line;
+            });
+        }
+
+        void shiftLines(ASTNode* node, int delta) {
+            if (node->line != 0)
+                node->line += delta;
+
+            const std::vector<std::shared_ptr<ASTNode>>* children = nullptr;
+            switch (node->type) {
+            case ASTNodeType::If:
+                children = &static_cast<IfNode*>(node)->nodes;
+                break;
+            case ASTNodeType::For:
+            {
+                auto loop = static_cast<ForNode*>(node);
+                if (loop->init != nullptr)
+                    shiftLines(loop->init.get(), delta);
+                if (loop->step != nullptr)
+                    shiftLines(loop->step.get(), delta);
+                children = &loop->nodes;
+                break;
+            }
+            case ASTNodeType::While:
+                children = &static_cast<LoopNode*>(node)->nodes;
+                break;
+            case ASTNodeType::FunctionDefinition:
+                children = &static_cast<FunctionDefinitionNode*>(node)->body;
+                break;
+            default:
+                break;
+            }
+
+            if (children != nullptr) {
+                for (auto& child : *children)
+                    shiftLines(child.get(), delta);
+            }
+        }
+    }
+
+    std::vector<IncrementalScript::Chunk> IncrementalScript::makeChunks(std::vector<Token>& tokens, size_t textSize) {
+        tokens.erase(std::remove_if(tokens.begin(), tokens.end(), [](const Token& t) {
+            return t.type == TokenType::NewLine;
+        }), tokens.end());
+
+        std::vector<Chunk> result;
+        size_t begin = 0;
+        for (size_t end : splitStatements(tokens)) {
+            Chunk chunk;
+            chunk.hash = hashTokens(tokens.begin() + begin, tokens.begin() + end);
+            chunk.line = tokens[begin].line;
+            chunk.endLine = tokens[end - 1].line;
+            chunk.begin = tokens[begin].offset;
+            chunk.end = end == tokens.size() ? textSize + 1 : tokens[end - 1].offset + 1;
+            chunk.tokens.assign(std::make_move_iterator(tokens.begin() + begin), std::make_move_iterator(tokens.begin() + end));
+            result.push_back(std::move(chunk));
+            begin = end;
+        }
+        return result;
+    }
+
+    bool IncrementalScript::relexEdit(const std::string& newText, size_t& first, size_t& last, std::vector<Chunk>& middle, int& lineDelta) const {
+        if (chunks.empty())
+            return false;
+
+        size_t shorter = std::min(text.size(), newText.size());
+        size_t prefix = std::mismatch(text.begin(), text.begin() + shorter, newText.begin()).first - text.begin();
+        size_t suffix = std::mismatch(text.rbegin(), text.rbegin() + (shorter - prefix), newText.rbegin()).first - text.rbegin();
+        size_t oldEditEnd = text.size() - suffix;
+
+        // Statements ending at or before the first changed byte, and those
+        // starting at or after the last one, are untouched. A statement
+        // ends right after its ; or }, where the lexer is between tokens,
+        // so everything in between can be lexed on its own.
+        first = std::partition_point(chunks.begin(), chunks.end(), [&](const Chunk& c) { return c.end <= prefix; }) - chunks.begin();
+        last = std::partition_point(chunks.begin() + first, chunks.end(), [&](const Chunk& c) { return c.begin < oldEditEnd; }) - chunks.begin();
+
+        size_t regionBegin = first > 0 ? chunks[first - 1].end : 0;
+        size_t oldRegionEnd = last < chunks.size() ? chunks[last].begin : text.size();
+        size_t regionEnd = oldRegionEnd + newText.size() - text.size();
+        int startLine = first > 0 ? chunks[first - 1].endLine : 1;
+        bool hasSuffix = last < chunks.size();
+
+        // With statements following, the region has to end between two
+        // of them: a sentinel } only comes out as a statement of its own
+        // if nothing before it is left open, comments and strings included.
+        std::string region = newText.substr(regionBegin, regionEnd - regionBegin);
+        if (hasSuffix)
+            region += '}';
+
+        std::vector<Token> tokens;
+        try {
+            tokens = parseTokens(region);
+        } catch (std::runtime_error&) {
+            return false;
+        }
+
+        for (auto& token : tokens) {
+            token.line += startLine - 1;
+            token.offset += regionBegin;
+        }
+
+        middle = makeChunks(tokens, newText.size());
+        if (hasSuffix) {
+            if (middle.empty() || middle.back().tokens.size() != 1 || middle.back().begin != regionEnd)
+                return false;
+            middle.pop_back();
+        }
+
+        lineDelta = std::count(newText.begin() + regionBegin, newText.begin() + regionEnd, '\n')
+            - std::count(text.begin() + regionBegin, text.begin() + oldRegionEnd, '\n');
+        return true;
+    }
+
+    ReparseStats IncrementalScript::update(const std::string& newText) {
+        size_t first, last;
+        int lineDelta = 0;
+        std::vector<Chunk> middle;
+
+        if (!relexEdit(newText, first, last, middle, lineDelta)) {
+            first = 0;
+            last = chunks.size();
+            std::vector<Token> tokens = parseTokens(newText);
+            middle = makeChunks(tokens, newText.size());
+        }
+
+        // Replaced chunks by hash. Identical statements can appear more
+        // than once, so each hash keeps a list and every old chunk is
+        // handed out at most once.
+        std::unordered_map<uint64_t, std::vector<size_t>> previous;
+        for (size_t i = last; i-- > first;)
+            previous[chunks[i].hash].push_back(i);
+
+        ReparseStats stats;
+        std::vector<bool> kept(chunks.size());
+        std::vector<int> lineShifts(middle.size());
+
+        for (size_t i = 0; i < middle.size(); i++) {
+            Chunk& chunk = middle[i];
+            auto it = previous.find(chunk.hash);
+            bool reused = false;
+
+            if (it != previous.end()) {
+                auto& candidates = it->second;
+                for (size_t c = candidates.size(); c-- > 0;) {
+                    const Chunk& old = chunks[candidates[c]];
+                    if (!sameTokens(old.tokens, chunk.tokens))
+                        continue;
+
+                    chunk.statements = old.statements;
+                    lineShifts[i] = chunk.line - old.line;
+                    kept[candidates[c]] = true;
+                    candidates.erase(candidates.begin() + c);
+                    reused = true;
+                    break;
+                }
+            }
+
+            if (reused) {
+                stats.reused += chunk.statements.size();
+            } else {
+                chunk.statements = parseScript(chunk.tokens);
+                stats.parsed += chunk.statements.size();
+            }
+        }
+
+        // Nothing is touched until every changed statement has parsed.
+        for (size_t i = 0; i < middle.size(); i++) {
+            if (lineShifts[i] == 0)
+                continue;
+            for (auto& statement : middle[i].statements)
+                shiftLines(statement.get(), lineShifts[i]);
+        }
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (i >= first && i < last) {
+                if (!kept[i])
+                    stats.removed += chunks[i].statements.size();
+            } else {
+                stats.reused += chunks[i].statements.size();
+            }
+        }
+
+        size_t byteDelta = newText.size() - text.size();
+        for (size_t i = last; i < chunks.size(); i++) {
+            Chunk& chunk = chunks[i];
+            chunk.begin += byteDelta;
+            chunk.end += byteDelta;
+            if (lineDelta == 0)
+                continue;
+
+            chunk.line += lineDelta;
+            chunk.endLine += lineDelta;
+            for (auto& statement : chunk.statements)
+                shiftLines(statement.get(), lineDelta);
+        }
+
+        chunks.erase(chunks.begin() + first, chunks.begin() + last);
+        chunks.insert(chunks.begin() + first, std::make_move_iterator(middle.begin()), std::make_move_iterator(middle.end()));
+        text = newText;
+        return stats;
+    }
+
+    std::vector<std::shared_ptr<ASTNode>> IncrementalScript::statements() const {
+        std::vector<std::shared_ptr<ASTNode>> result;
+        for (auto& chunk : chunks)
+            result.insert(result.end(), chunk.statements.begin(), chunk.statements.end());
+        return result;
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "parser.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    struct ReparseStats {
+        // Top-level statements kept from the previous version.
+        size_t reused = 0;
+        // Top-level statements that had to be parsed.
+        size_t parsed = 0;
+        // Top-level statements of the previous version that are gone.
+        size_t removed = 0;
+    };
+
+    // A script kept as its top-level statements alongside the tokens and
+    // source range each was parsed from, for reloading edited files.
+    // update() finds the edited bytes, lexes only the statements around
+    // them and parses only those whose tokens changed; everything else
+    // keeps its AST, loop optimizations included, and just has its line
+    // numbers moved. Edits that can't be contained that way (an opened
+    // comment or string, unbalanced braces) fall back to lexing the whole
+    // text. Statements are parsed eagerly.
+    class IncrementalScript {
+    public:
+        // Brings the script up to date with text. If a changed statement
+        // doesn't parse, throws std::runtime_error and keeps the previous
+        // version.
+        ReparseStats update(const std::string& text);
+
+        // Every top-level statement, in order.
+        std::vector<std::shared_ptr<ASTNode>> statements() const;
+
+    private:
+        struct Chunk {
+            uint64_t hash;
+            // Lines of the first and last token.
+            int line;
+            int endLine;
+            // Byte range in the text. The last statement of the file ends
+            // past the end of the text, so appending always touches it.
+            size_t begin;
+            size_t end;
+            // Compared by type, value and line relative to the first
+            // token, so absolute lines and offsets go stale once the chunk
+            // is behind an edit.
+            std::vector<Token> tokens;
+            std::vector<std::shared_ptr<ASTNode>> statements;
+        };
+
+        static std::vector<Chunk> makeChunks(std::vector<Token>& tokens, size_t textSize);
+
+        // Lexes the region of newText around its difference to text.
+        // Chunks [first, last) are the ones it replaces. Returns false if
+        // the region can't be lexed on its own.
+        bool relexEdit(const std::string& newText, size_t& first, size_t& last, std::vector<Chunk>& middle, int& lineDelta) const;
+
+        std::string text;
+        std::vector<Chunk> chunks;
+    };
+}
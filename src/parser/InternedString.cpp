@@ -0,0 +1,92 @@
+#include "InternedString.hpp"
+#include <stdlib.h>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+
+namespace iodine {
+    namespace {
+        // Function-local statics so strings created during static
+        // initialization of other translation units still find a table.
+        std::mutex& tableMutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        std::unordered_map<std::string_view, StringEntry*>& internTable() {
+            static std::unordered_map<std::string_view, StringEntry*> table;
+            return table;
+        }
+    }
+
+    InternedString::InternedString(const char* str, size_t length) {
+        if (length <= maxInlineLength) {
+            setInline(str, length);
+            return;
+        }
+
+        std::string_view view(str, length);
+        std::lock_guard<std::mutex> lock(tableMutex());
+        auto& table = internTable();
+
+        auto it = table.find(view);
+        if (it != table.end()) {
+            it->second->refCount.fetch_add(1, std::memory_order_relaxed);
+            bits.entry = it->second;
+            return;
+        }
+
+        void* mem = malloc(offsetof(StringEntry, chars) + length + 1);
+        if (mem == nullptr)
+            throw std::bad_alloc();
+
+        StringEntry* entry = new (mem) StringEntry;
+        entry->refCount.store(1, std::memory_order_relaxed);
+        entry->length = (uint32_t)length;
+        memcpy(entry->chars, str, length);
+        entry->chars[length] = '\0';
+
+        table.emplace(std::string_view(entry->chars, length), entry);
+        bits.entry = entry;
+    }
+
+    void InternedString::release() {
+        if (isInline())
+            return;
+
+        StringEntry* entry = bits.entry;
+
+        // Fast path: we aren't the last reference, so nobody can free the
+        // entry from under us.
+        uint32_t count = entry->refCount.load(std::memory_order_relaxed);
+        while (count > 1) {
+            if (entry->refCount.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel))
+                return;
+        }
+
+        // Possibly the last reference. Lookups only resurrect entries while
+        // holding the table lock, so the final decrement has to happen
+        // under it too.
+        std::lock_guard<std::mutex> lock(tableMutex());
+        if (entry->refCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        internTable().erase(std::string_view(entry->chars, entry->length));
+        entry->~StringEntry();
+        free(entry);
+    }
+
+    InternedString InternedString::operator+(const InternedString& other) const {
+        std::string concatenated;
+        concatenated.reserve(size() + other.size());
+        concatenated.append(c_str(), size());
+        concatenated.append(other.c_str(), other.size());
+        return InternedString(concatenated);
+    }
+
+    size_t InternedString::internedCount() {
+        std::lock_guard<std::mutex> lock(tableMutex());
+        return internTable().size();
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+
+namespace iodine {
+    // Heap-allocated body of a long string. Entries are shared through the
+    // intern table, so two strings with the same contents always point at
+    // the same entry.
+    struct StringEntry {
+        std::atomic<uint32_t> refCount;
+        uint32_t length;
+        char chars[1];
+    };
+
+    // Immutable, refcounted string used for Iodine string values.
+    //
+    // Strings short enough to fit in the handle itself (up to
+    // InternedString::maxInlineLength bytes) are stored inline and never touch the
+    // heap. Longer strings are interned, so equality is a pointer compare
+    // either way and freeing the last reference removes the entry from the
+    // table. This keeps memory flat when the same script is parsed over and
+    // over again.
+    class InternedString {
+    public:
+        static constexpr size_t maxInlineLength = sizeof(StringEntry*) - 2;
+
+        InternedString() { setInline("", 0); }
+        InternedString(const char* str) : InternedString(str, strlen(str)) {}
+        InternedString(const std::string& str) : InternedString(str.data(), str.size()) {}
+        InternedString(const char* str, size_t length);
+
+        InternedString(const InternedString& other) : bits(other.bits) { retain(); }
+        InternedString(InternedString&& other) noexcept : bits(other.bits) { other.setInline("", 0); }
+        ~InternedString() { release(); }
+
+        InternedString& operator=(const InternedString& other) {
+            if (this != &other) {
+                other.retain();
+                release();
+                bits = other.bits;
+            }
+            return *this;
+        }
+
+        InternedString& operator=(InternedString&& other) noexcept {
+            if (this != &other) {
+                release();
+                bits = other.bits;
+                other.setInline("", 0);
+            }
+            return *this;
+        }
+
+        bool isInline() const { return bits.inlineChars[0] & 1; }
+
+        size_t size() const {
+            return isInline() ? (size_t)(bits.inlineChars[0] >> 1) : bits.entry->length;
+        }
+
+        const char* c_str() const {
+            return isInline() ? bits.inlineChars + 1 : bits.entry->chars;
+        }
+
+        std::string str() const { return std::string(c_str(), size()); }
+
+        // Both representations are canonical, so comparing the raw handle is
+        // enough to compare contents.
+        bool operator==(const InternedString& other) const {
+            return memcmp(&bits, &other.bits, sizeof(bits)) == 0;
+        }
+
+        bool operator!=(const InternedString& other) const { return !(*this == other); }
+
+        InternedString operator+(const InternedString& other) const;
+
+        // Number of long strings currently held by the intern table.
+        static size_t internedCount();
+
+    private:
+        // The low bit of the first byte tags inline strings. Entries are at
+        // least 8-byte aligned, so on the little-endian targets we build for
+        // that bit is always clear for a real pointer.
+        union Bits {
+            StringEntry* entry;
+            char inlineChars[sizeof(StringEntry*)];
+        } bits;
+
+        void setInline(const char* str, size_t length) {
+            memset(&bits, 0, sizeof(bits));
+            bits.inlineChars[0] = (char)((length << 1) | 1);
+            memcpy(bits.inlineChars + 1, str, length);
+        }
+
+        void retain() const {
+            if (!isInline())
+                bits.entry->refCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void release();
+    };
+}
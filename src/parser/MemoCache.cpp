@@ -0,0 +1,200 @@
+#include "MemoCache.hpp"
+#include "Trace.hpp"
+#include <string.h>
+#include <functional>
+#include <string_view>
+
+namespace iodine {
+    namespace {
+        uint64_t mix(uint64_t hash, uint64_t bits) {
+            hash ^= bits + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+
+        uint64_t hashValue(uint64_t hash, const Value& val) {
+            hash = mix(hash, (uint64_t)val.type);
+            switch (val.type) {
+            case DataType::Int32:
+                return mix(hash, (uint32_t)val.intVal);
+            case DataType::F32:
+            {
+                uint32_t bits;
+                memcpy(&bits, &val.floatVal, sizeof(bits));
+                return mix(hash, bits);
+            }
+            case DataType::F64:
+            {
+                uint64_t bits;
+                memcpy(&bits, &val.doubleVal, sizeof(bits));
+                return mix(hash, bits);
+            }
+            case DataType::Boolean:
+                return mix(hash, val.boolVal);
+            case DataType::String:
+                return mix(hash, std::hash<std::string_view>()(std::string_view(val.strVal.c_str(), val.strVal.size())));
+            default:
+                return hash;
+            }
+        }
+
+        // Floats compare by their bits: a pure function may tell 0.0 from
+        // -0.0, and NaN arguments should still hit.
+        bool sameValue(const Value& a, const Value& b) {
+            if (a.type != b.type)
+                return false;
+
+            switch (a.type) {
+            case DataType::Int32:
+                return a.intVal == b.intVal;
+            case DataType::F32:
+                return memcmp(&a.floatVal, &b.floatVal, sizeof(a.floatVal)) == 0;
+            case DataType::F64:
+                return memcmp(&a.doubleVal, &b.doubleVal, sizeof(a.doubleVal)) == 0;
+            case DataType::Boolean:
+                return a.boolVal == b.boolVal;
+            case DataType::String:
+                return a.strVal == b.strVal;
+            case DataType::Null:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        Value callNative(const Function& func, const FuncArgs& args) {
+            if (activeProfiler != nullptr)
+                return profiledCall(func, args);
+
+            BuiltinMarker marker(&func);
+            TraceSpan span(func.name.c_str(), "native");
+            return func.nativeFunc(args);
+        }
+    }
+
+    MemoCache::MemoCache(size_t capacity) {
+        size_t perSegment = 1;
+        while (perSegment * segmentCount < capacity || perSegment < maxProbes)
+            perSegment *= 2;
+
+        slotMask = perSegment - 1;
+        segments.reset(new Segment[segmentCount]);
+        for (size_t i = 0; i < segmentCount; i++)
+            segments[i].slots.resize(perSegment);
+    }
+
+    Value MemoCache::call(const Function& func, const FuncArgs& args) {
+        if (args.size() > maxArgs)
+            return callNative(func, args);
+
+        Value values[maxArgs];
+        size_t count = args.size();
+        bool cacheable = true;
+        uint64_t hash = count;
+        for (size_t i = 0; i < count; i++) {
+            values[i] = args[i]->getValue();
+            cacheable = cacheable && values[i].type != DataType::Ref;
+            hash = hashValue(hash, values[i]);
+        }
+
+        if (cacheable) {
+            Segment& segment = segments[hash % segmentCount];
+            std::lock_guard<std::mutex> lock(segment.mutex);
+
+            long index = find(segment, hash, values, count);
+            if (index >= 0) {
+                hits.add(1);
+                return segment.slots[index].result;
+            }
+        }
+
+        // The arguments have been evaluated, so the builtin gets their
+        // values.
+        FuncArgs evaluated;
+        evaluated.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            evaluated.push_back(makeNode<ConstValNode>(values[i]));
+
+        Value result = callNative(func, evaluated);
+        if (cacheable) {
+            misses.add(1);
+            insert(hash, values, count, result);
+        }
+        return result;
+    }
+
+    long MemoCache::find(const Segment& segment, uint64_t hash, const Value* values, size_t count) const {
+        size_t home = (hash / segmentCount) & slotMask;
+        for (size_t probe = 0; probe < maxProbes; probe++) {
+            const Entry& entry = segment.slots[(home + probe) & slotMask];
+            if (!entry.used)
+                return -1;
+            if (entry.hash != hash || entry.argCount != count)
+                continue;
+
+            bool same = true;
+            for (size_t i = 0; i < count && same; i++)
+                same = sameValue(entry.args[i], values[i]);
+            if (same)
+                return (home + probe) & slotMask;
+        }
+        return -1;
+    }
+
+    void MemoCache::insert(uint64_t hash, const Value* values, size_t count, const Value& result) {
+        Segment& segment = segments[hash % segmentCount];
+        std::lock_guard<std::mutex> lock(segment.mutex);
+
+        // Another thread might have computed the same call meanwhile.
+        if (find(segment, hash, values, count) >= 0)
+            return;
+
+        // Entries are never removed one by one, so the first free slot
+        // ends every probe sequence.
+        size_t home = (hash / segmentCount) & slotMask;
+        size_t slot = home;
+        size_t probe = 0;
+        while (probe < maxProbes && segment.slots[slot].used)
+            slot = (home + ++probe) & slotMask;
+
+        if (probe == maxProbes) {
+            slot = (home + segment.victim++ % maxProbes) & slotMask;
+            evictions.add(1);
+        } else {
+            segment.used++;
+        }
+
+        Entry& entry = segment.slots[slot];
+        entry.used = true;
+        entry.argCount = count;
+        entry.hash = hash;
+        for (size_t i = 0; i < count; i++)
+            entry.args[i] = values[i];
+        for (size_t i = count; i < maxArgs; i++)
+            entry.args[i] = Value();
+        entry.result = result;
+    }
+
+    MemoCache::Stats MemoCache::stats() const {
+        Stats stats { hits.value(), misses.value(), evictions.value(), 0, 0 };
+        for (size_t i = 0; i < segmentCount; i++) {
+            std::lock_guard<std::mutex> lock(segments[i].mutex);
+            stats.entries += segments[i].used;
+            stats.capacity += segments[i].slots.size();
+        }
+        return stats;
+    }
+
+    void MemoCache::clear() {
+        for (size_t i = 0; i < segmentCount; i++) {
+            Segment& segment = segments[i];
+            std::lock_guard<std::mutex> lock(segment.mutex);
+            for (auto& entry : segment.slots)
+                entry = Entry();
+            segment.used = 0;
+        }
+    }
+
+    Value memoizedCall(const Function& func, const FuncArgs& args) {
+        return func.memo->call(func, args);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "parser.hpp"
+#include "Metrics.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace iodine {
+    // Results of one pure builtin, keyed by the values of its arguments.
+    // The table is open-addressed and bounded: an insert looks at a few
+    // slots from the key's home slot and evicts one of them, round robin,
+    // when all are taken. It's split into segments with a lock each, so
+    // contexts running on different threads can share one cache.
+    class MemoCache {
+    public:
+        // Calls with more arguments than this bypass the cache.
+        static constexpr size_t maxArgs = 4;
+
+        // Rounded up so every segment has a power of two slots.
+        explicit MemoCache(size_t capacity = 4096);
+
+        struct Stats {
+            int64_t hits;
+            int64_t misses;
+            int64_t evictions;
+            size_t entries;
+            size_t capacity;
+        };
+
+        // Evaluates each argument once, then returns the result remembered
+        // for those values or calls func with them and remembers what it
+        // returns. Reference arguments are never cached.
+        Value call(const Function& func, const FuncArgs& args);
+
+        Stats stats() const;
+        void clear();
+
+    private:
+        static constexpr size_t segmentCount = 16;
+        static constexpr size_t maxProbes = 8;
+
+        struct Entry {
+            bool used = false;
+            uint32_t argCount = 0;
+            uint64_t hash = 0;
+            Value args[maxArgs];
+            Value result;
+        };
+
+        struct alignas(64) Segment {
+            mutable std::mutex mutex;
+            std::vector<Entry> slots;
+            size_t used = 0;
+            size_t victim = 0;
+        };
+
+        size_t slotMask;
+        std::unique_ptr<Segment[]> segments;
+        ShardedValue hits;
+        ShardedValue misses;
+        ShardedValue evictions;
+
+        // Index of the entry for these arguments in segment, or -1.
+        long find(const Segment& segment, uint64_t hash, const Value* values, size_t count) const;
+        void insert(uint64_t hash, const Value* values, size_t count, const Value& result);
+    };
+}
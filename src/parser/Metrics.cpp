@@ -0,0 +1,149 @@
+#include "Metrics.hpp"
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace iodine {
+    namespace {
+        struct Registry {
+            std::mutex mutex;
+            std::vector<Metric*> metrics;
+        };
+
+        // Function-local so metrics defined in other translation units can
+        // register during static initialization.
+        Registry& registry() {
+            static Registry instance;
+            return instance;
+        }
+
+        const uint64_t bucketBoundsNs[Histogram::bucketCount] = {
+            1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 10000000000
+        };
+    }
+
+    std::atomic<int> nextMetricShard { 0 };
+
+    Metric::Metric(const char* name, const char* help, const char* type)
+        : name(name), help(help), type(type) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.metrics.push_back(this);
+    }
+
+    int64_t ShardedValue::value() const {
+        int64_t total = 0;
+        for (auto& shard : shards)
+            total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void Counter::writeSamples(std::ostream& out) const {
+        out << name << " " << value() << "\n";
+    }
+
+    void Gauge::writeSamples(std::ostream& out) const {
+        out << name << " " << value() << "\n";
+    }
+
+    Counter& CounterFamily::labeled(const std::string& labelValue) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& counter = counters[labelValue];
+        if (counter == nullptr) {
+            counter.reset(new Counter(Unregistered {}, name));
+            labelOrder.push_back(labelValue);
+        }
+        return *counter;
+    }
+
+    void CounterFamily::writeSamples(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& labelValue : labelOrder) {
+            out << name << "{" << labelName << "=\"";
+            for (char c : labelValue) {
+                if (c == '"' || c == '\\')
+                    out << '\\';
+                out << c;
+            }
+            out << "\"} " << counters.at(labelValue)->value() << "\n";
+        }
+    }
+
+    void Histogram::observeNs(uint64_t nanos) {
+        Shard& shard = shards[metricShard()];
+
+        int bucket = 0;
+        while (bucket < bucketCount && nanos > bucketBoundsNs[bucket])
+            bucket++;
+
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sumNs.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    void Histogram::writeSamples(std::ostream& out) const {
+        uint64_t buckets[bucketCount + 1] = {};
+        uint64_t sumNs = 0;
+        for (auto& shard : shards) {
+            for (int i = 0; i <= bucketCount; i++)
+                buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            sumNs += shard.sumNs.load(std::memory_order_relaxed);
+        }
+
+        // Prometheus buckets are cumulative.
+        uint64_t cumulative = 0;
+        for (int i = 0; i < bucketCount; i++) {
+            cumulative += buckets[i];
+            out << name << "_bucket{le=\"" << bucketBoundsNs[i] / 1e9 << "\"} " << cumulative << "\n";
+        }
+        cumulative += buckets[bucketCount];
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        out << name << "_sum " << sumNs / 1e9 << "\n";
+        out << name << "_count " << cumulative << "\n";
+    }
+
+    void writeMetrics(std::ostream& out) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+
+        for (auto metric : reg.metrics) {
+            out << "# HELP " << metric->name << " " << metric->help << "\n";
+            out << "# TYPE " << metric->name << " " << metric->type << "\n";
+            metric->writeSamples(out);
+        }
+    }
+
+    std::string metricsText() {
+        std::stringstream out;
+        writeMetrics(out);
+        return out.str();
+    }
+
+    void writeMetricsFile(const std::string& path) {
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream out(tempPath);
+            if (!out.good())
+                throw std::runtime_error("Couldn't write metrics to " + tempPath);
+            writeMetrics(out);
+        }
+
+        if (rename(tempPath.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("Couldn't replace " + path);
+    }
+
+    namespace metrics {
+        Counter statementsExecuted("iodine_statements_executed_total", "Statements executed, including those in loops and functions.");
+        Counter variableLookups("iodine_variable_lookups_total", "Reads of global and local variables.");
+        CounterFamily nativeCalls("iodine_native_calls_total", "Calls to builtin functions.", "function");
+        Counter typePromotions("iodine_type_promotions_total", "Arithmetic and comparisons that converted an operand to a wider type.");
+        CounterFamily errors("iodine_errors_total", "Exceptions thrown out of the lexer, parser and evaluator.", "phase");
+        Counter& lexErrors = errors.labeled("lex");
+        Counter& parseErrors = errors.labeled("parse");
+        Counter& evalErrors = errors.labeled("eval");
+        Gauge astBytesLive("iodine_ast_bytes_live", "Bytes held by AST nodes that haven't been freed.");
+        Histogram statementLatency("iodine_top_level_statement_seconds", "Time to run one top-level statement, including everything it calls.");
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    // Runtime metrics for long-running embedders. Every metric is split into
+    // cache-line sized shards and each thread updates its own shard with a
+    // relaxed add, so updates don't contend and are cheap enough to leave
+    // on. Reads sum the shards, so they can be a moment out of date.
+    constexpr int metricShardCount = 16;
+
+    extern std::atomic<int> nextMetricShard;
+
+    // Index of the calling thread's shard, assigned round-robin on first use.
+    inline int metricShard() {
+        thread_local int shard = nextMetricShard.fetch_add(1, std::memory_order_relaxed) % metricShardCount;
+        return shard;
+    }
+
+    class Metric {
+    public:
+        Metric(const char* name, const char* help, const char* type);
+        virtual ~Metric() {}
+
+        const char* name;
+        const char* help;
+        const char* type;
+
+        // Writes the metric's samples in Prometheus text format, without
+        // the HELP and TYPE lines.
+        virtual void writeSamples(std::ostream& out) const = 0;
+
+    protected:
+        // Metrics created on demand (e.g. per label) pass this so they
+        // aren't registered on their own.
+        struct Unregistered {};
+        Metric(Unregistered, const char* name, const char* help, const char* type)
+            : name(name), help(help), type(type) {}
+    };
+
+    class ShardedValue {
+    public:
+        void add(int64_t amount) {
+            shards[metricShard()].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        int64_t value() const;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<int64_t> value { 0 };
+        };
+
+        Shard shards[metricShardCount];
+    };
+
+    class Counter : public Metric {
+    public:
+        Counter(const char* name, const char* help) : Metric(name, help, "counter") {}
+
+        void increment() { count.add(1); }
+        void add(int64_t amount) { count.add(amount); }
+        int64_t value() const { return count.value(); }
+
+        void writeSamples(std::ostream& out) const override;
+
+    private:
+        ShardedValue count;
+
+        friend class CounterFamily;
+        Counter(Unregistered tag, const char* name) : Metric(tag, name, "", "counter") {}
+    };
+
+    class Gauge : public Metric {
+    public:
+        Gauge(const char* name, const char* help) : Metric(name, help, "gauge") {}
+
+        void add(int64_t amount) { current.add(amount); }
+        int64_t value() const { return current.value(); }
+
+        void writeSamples(std::ostream& out) const override;
+
+    private:
+        ShardedValue current;
+    };
+
+    // Counters sharing a name, told apart by the value of one label. Looking
+    // up a label takes a lock, so callers keep the returned reference.
+    class CounterFamily : public Metric {
+    public:
+        CounterFamily(const char* name, const char* help, const char* labelName)
+            : Metric(name, help, "counter"), labelName(labelName) {}
+
+        Counter& labeled(const std::string& labelValue);
+
+        void writeSamples(std::ostream& out) const override;
+
+    private:
+        const char* labelName;
+        mutable std::mutex mutex;
+        std::vector<std::string> labelOrder;
+        std::unordered_map<std::string, std::unique_ptr<Counter>> counters;
+    };
+
+    // Histogram over durations, with fixed exponential bucket bounds from
+    // one microsecond to ten seconds. Values are in seconds in the output.
+    class Histogram : public Metric {
+    public:
+        static constexpr int bucketCount = 8;
+
+        Histogram(const char* name, const char* help) : Metric(name, help, "histogram") {}
+
+        void observeNs(uint64_t nanos);
+
+        void writeSamples(std::ostream& out) const override;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> buckets[bucketCount + 1] {};
+            std::atomic<uint64_t> sumNs { 0 };
+        };
+
+        Shard shards[metricShardCount];
+    };
+
+    // Counts an error when an exception leaves the enclosing scope.
+    class CountErrors {
+    public:
+        CountErrors(Counter& counter) : counter(counter), uncaught(std::uncaught_exceptions()) {}
+
+        ~CountErrors() {
+            if (std::uncaught_exceptions() > uncaught)
+                counter.increment();
+        }
+
+    private:
+        Counter& counter;
+        int uncaught;
+    };
+
+    // Writes every registered metric in Prometheus text exposition format.
+    void writeMetrics(std::ostream& out);
+    std::string metricsText();
+
+    // Writes the metrics to a file for a textfile collector to scrape. The
+    // file is replaced atomically so scrapers never see a partial write.
+    void writeMetricsFile(const std::string& path);
+
+    namespace metrics {
+        extern Counter statementsExecuted;
+        extern Counter variableLookups;
+        extern CounterFamily nativeCalls;
+        extern Counter typePromotions;
+        extern CounterFamily errors;
+        extern Counter& lexErrors;
+        extern Counter& parseErrors;
+        extern Counter& evalErrors;
+        extern Gauge astBytesLive;
+        extern Histogram statementLatency;
+    }
+}
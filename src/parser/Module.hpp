@@ -0,0 +1,218 @@
+#pragma once
+#include "NativeScript.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    // Precompiled script (.iodc). The file is a header followed by flat
+    // arrays, each starting on an 8-byte boundary, in native byte order:
+    //
+    //   nodes      ModuleNode[nodeCount]; children always come before
+    //              their parents
+    //   lists      int32_t[listCount]; child lists of blocks and calls
+    //   lines      int32_t[nodeCount]; source line of each statement node
+    //   constants  ModuleConstant[constantCount]
+    //   symbols    ModuleSymbol[symbolCount]; variable and function names
+    //   functions  ModuleFunction[functionCount]
+    //   strings    stringBytes bytes of symbol and string constant text
+    //
+    // Loading maps the file and checks every index once; nothing is
+    // allocated per node. Bump moduleVersion whenever the layout or the
+    // meaning of a field changes.
+    constexpr char moduleMagic[4] = { 'I', 'O', 'D', 'C' };
+    constexpr uint32_t moduleVersion = 1;
+
+    struct ModuleHeader {
+        char magic[4];
+        uint32_t version;
+        // sizeof(ModuleHeader) when written, which catches files from
+        // builds with a different layout.
+        uint32_t headerSize;
+        uint32_t nodeCount;
+        uint32_t listCount;
+        uint32_t constantCount;
+        uint32_t symbolCount;
+        uint32_t functionCount;
+        // Top-level statements, as a range of lists.
+        uint32_t statementsOffset;
+        uint32_t statementCount;
+        // Symbol naming the source file.
+        uint32_t sourceSymbol;
+        uint32_t reserved;
+        uint64_t stringBytes;
+        uint64_t nodesOffset;
+        uint64_t listsOffset;
+        uint64_t linesOffset;
+        uint64_t constantsOffset;
+        uint64_t symbolsOffset;
+        uint64_t functionsOffset;
+        uint64_t stringsOffset;
+        uint64_t fileSize;
+    };
+
+    // One AST node. What a, b and c hold depends on type:
+    //
+    //   ConstVal           a: constant
+    //   Arithmetic         op: ArithmeticOperation, a, b: operands
+    //   UnaryOp            op: UnaryOperation, a: operand
+    //   VariableReference  a: symbol, b: local slot or -1
+    //   FunctionCall       a: symbol, b: first list entry, c: argument count
+    //   Comparison         op: ComparisonType, a, b: operands
+    //   VarAssignment      op: DataType, flags: 1 if declaring, a: symbol,
+    //                      b: value, c: local slot or -1
+    //   If, While          a: condition, b: first list entry, c: count
+    //   For                a: condition, b: first list entry, c: body count;
+    //                      the list holds init and step (-1 if absent),
+    //                      then the body
+    //   FunctionDefinition a: function
+    //   Return             a: value or -1, flags: 1 if a tail call
+    //
+    // Loop invariants and induction variables are written as the
+    // expressions they stand for.
+    struct ModuleNode {
+        uint8_t type;
+        uint8_t op;
+        uint16_t flags;
+        int32_t a;
+        int32_t b;
+        int32_t c;
+    };
+
+    struct ModuleConstant {
+        uint32_t type;
+        // Bytes of string data for strings.
+        uint32_t length;
+        union {
+            int32_t intVal;
+            float floatVal;
+            double doubleVal;
+            uint8_t boolVal;
+            uint64_t stringOffset;
+        };
+    };
+
+    struct ModuleSymbol {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    struct ModuleFunction {
+        uint32_t name;
+        // Parameters are (symbol, DataType) pairs in the list array.
+        uint32_t paramsOffset;
+        uint32_t paramCount;
+        uint32_t bodyOffset;
+        uint32_t bodyCount;
+        uint32_t frameSize;
+    };
+
+    // Writes a parsed script as a module. Lazy bodies are parsed first.
+    // Throws std::runtime_error if the file can't be written.
+    void writeModule(const std::string& path, const std::vector<std::shared_ptr<ASTNode>>& statements, const std::string& sourceName);
+    void writeModule(std::ostream& out, const std::vector<std::shared_ptr<ASTNode>>& statements, const std::string& sourceName);
+
+    // Whether the file starts with the module magic.
+    bool isModuleFile(const std::string& path);
+
+    // A module whose every index has been checked, either mapped from a
+    // file or copied into memory. Never changes after loading, so any
+    // number of ModuleScripts on any number of threads can share one.
+    class ModuleImage {
+    public:
+        // Both throw std::runtime_error if the module is missing, from
+        // another version, or inconsistent.
+        static std::shared_ptr<const ModuleImage> map(const std::string& path);
+        static std::shared_ptr<const ModuleImage> fromBytes(const std::string& bytes);
+
+        ~ModuleImage();
+
+        ModuleImage(const ModuleImage&) = delete;
+        ModuleImage& operator=(const ModuleImage&) = delete;
+
+        std::string symbolName(uint32_t symbol) const;
+        // -1 if no symbol has this name.
+        int32_t findSymbol(const std::string& name) const;
+
+        const ModuleHeader* header;
+        const ModuleNode* nodes;
+        const int32_t* lists;
+        const int32_t* lines;
+        const ModuleConstant* constants;
+        const ModuleSymbol* symbols;
+        const ModuleFunction* functions;
+        const char* strings;
+
+    private:
+        ModuleImage() = default;
+
+        const char* base = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        std::vector<uint64_t> storage;
+
+        void validate();
+    };
+
+    // Runs a module. Globals and script functions are private to the
+    // script rather than living in variables and functions; builtins are
+    // looked up in functions.
+    class ModuleScript : public ScriptExecutor {
+    public:
+        ModuleScript(std::shared_ptr<const ModuleImage> image);
+        // Maps the file with ModuleImage::map.
+        ModuleScript(const std::string& path);
+
+        void run() override;
+
+        // Defines a global before run(). Returns false if the script never
+        // mentions the name.
+        bool setGlobal(const std::string& name, const Value& value);
+        // Every global that currently has a value, by name.
+        std::vector<std::pair<std::string, Value>> definedGlobals() const;
+
+    private:
+        enum class ExecResult {
+            Normal,
+            Return,
+            // Call pendingTailCall with the arguments at the top of frames.
+            TailCall
+        };
+
+        std::shared_ptr<const ModuleImage> image;
+        const ModuleHeader* head;
+        const ModuleNode* nodes;
+        const int32_t* lists;
+        const int32_t* lines;
+        const ModuleConstant* constants;
+        const ModuleFunction* functionTable;
+        const char* strings;
+
+        // Indexed by symbol. A global is undefined while its type is Null.
+        std::vector<Value> globals;
+        std::vector<int32_t> definedFunctions;
+        std::vector<Function*> builtins;
+        // String constants, interned on first use.
+        std::vector<Value> stringConstants;
+        // Constant nodes each builtin call site passes its arguments in.
+        std::unordered_map<int32_t, FuncArgs> callArgs;
+
+        std::vector<Value> frames;
+        size_t frameBase = 0;
+        Value returnValue;
+        int32_t pendingTailCall = -1;
+        size_t pendingTailArgs = 0;
+
+        Value evaluate(int32_t index);
+        ExecResult execute(int32_t index);
+        ExecResult executeBlock(uint32_t offset, uint32_t count);
+        void assign(const ModuleNode& node);
+        Value call(int32_t index, const ModuleNode& node);
+        Value callFunction(int32_t function, const ModuleNode& node);
+        void bindArguments(const ModuleFunction& function, size_t argCount);
+    };
+}
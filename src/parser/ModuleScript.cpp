@@ -0,0 +1,644 @@
+#include "Module.hpp"
+#include "AllocStats.hpp"
+#include "Profiler.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <stdexcept>
+
+namespace iodine {
+    namespace {
+        void corrupt(const std::string& why) {
+            throw std::runtime_error("Corrupt module: " + why);
+        }
+
+        // Whether [offset, offset + count) lies inside a section of size
+        // entries, without overflowing.
+        bool inRange(uint64_t offset, uint64_t count, uint64_t size) {
+            return offset <= size && count <= size - offset;
+        }
+
+        // Scripts only declare numbers, but prepared ones also declare the
+        // bool and string globals they were bound to.
+        bool isDeclarableType(uint32_t type) {
+            return type == (uint32_t)DataType::Int32 || type == (uint32_t)DataType::F32 || type == (uint32_t)DataType::F64
+                || type == (uint32_t)DataType::Boolean || type == (uint32_t)DataType::String;
+        }
+    }
+
+    bool isModuleFile(const std::string& path) {
+        char magic[sizeof(moduleMagic)];
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        bool result = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic)
+            && memcmp(magic, moduleMagic, sizeof(magic)) == 0;
+        close(fd);
+        return result;
+    }
+
+    std::shared_ptr<const ModuleImage> ModuleImage::map(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Couldn't open " + path + ": " + strerror(errno));
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Couldn't stat " + path + ": " + strerror(errno));
+        }
+
+        if ((size_t)info.st_size < sizeof(ModuleHeader)) {
+            close(fd);
+            throw std::runtime_error(path + " is too short to be a module");
+        }
+
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Couldn't map " + path + ": " + strerror(errno));
+
+        std::shared_ptr<ModuleImage> image(new ModuleImage());
+        image->base = (const char*)mapping;
+        image->size = info.st_size;
+        image->mapped = true;
+        image->validate();
+        return image;
+    }
+
+    std::shared_ptr<const ModuleImage> ModuleImage::fromBytes(const std::string& bytes) {
+        if (bytes.size() < sizeof(ModuleHeader))
+            throw std::runtime_error("Too short to be a module");
+
+        // Copied into 8-byte words so the sections are aligned.
+        std::shared_ptr<ModuleImage> image(new ModuleImage());
+        image->storage.resize((bytes.size() + 7) / 8);
+        memcpy(image->storage.data(), bytes.data(), bytes.size());
+        image->base = (const char*)image->storage.data();
+        image->size = bytes.size();
+        image->validate();
+        return image;
+    }
+
+    ModuleImage::~ModuleImage() {
+        if (mapped)
+            munmap((void*)base, size);
+    }
+
+    void ModuleImage::validate() {
+        const ModuleHeader* head = (const ModuleHeader*)base;
+        header = head;
+
+        if (memcmp(head->magic, moduleMagic, sizeof(moduleMagic)) != 0)
+            throw std::runtime_error("Not a module");
+        if (head->version != moduleVersion || head->headerSize != sizeof(ModuleHeader)) {
+            throw std::runtime_error("Module version " + std::to_string(head->version)
+                + " isn't supported, recompile it with this version of Iodine");
+        }
+        if (head->fileSize != size)
+            corrupt("file is " + std::to_string(size) + " bytes, expected " + std::to_string(head->fileSize));
+
+        auto section = [&](uint64_t offset, uint64_t count, size_t entrySize, const char* name) {
+            if (offset % 8 != 0 || !inRange(offset, count * entrySize, size))
+                corrupt(std::string(name) + " section out of bounds");
+            return base + offset;
+        };
+
+        nodes = (const ModuleNode*)section(head->nodesOffset, head->nodeCount, sizeof(ModuleNode), "node");
+        lists = (const int32_t*)section(head->listsOffset, head->listCount, sizeof(int32_t), "list");
+        lines = (const int32_t*)section(head->linesOffset, head->nodeCount, sizeof(int32_t), "line");
+        constants = (const ModuleConstant*)section(head->constantsOffset, head->constantCount, sizeof(ModuleConstant), "constant");
+        symbols = (const ModuleSymbol*)section(head->symbolsOffset, head->symbolCount, sizeof(ModuleSymbol), "symbol");
+        functions = (const ModuleFunction*)section(head->functionsOffset, head->functionCount, sizeof(ModuleFunction), "function");
+        strings = section(head->stringsOffset, head->stringBytes, 1, "string");
+
+        for (uint32_t i = 0; i < head->symbolCount; i++) {
+            if (!inRange(symbols[i].offset, symbols[i].length + 1, head->stringBytes) || strings[symbols[i].offset + symbols[i].length] != '\0')
+                corrupt("symbol " + std::to_string(i) + " out of bounds");
+        }
+        if (head->sourceSymbol >= head->symbolCount)
+            corrupt("no source symbol");
+
+        for (uint32_t i = 0; i < head->constantCount; i++) {
+            const ModuleConstant& c = constants[i];
+            switch ((DataType)c.type) {
+            case DataType::Int32:
+            case DataType::F32:
+            case DataType::F64:
+            case DataType::Boolean:
+            case DataType::Null:
+                break;
+            case DataType::String:
+                if (!inRange(c.stringOffset, c.length, head->stringBytes))
+                    corrupt("constant " + std::to_string(i) + " out of bounds");
+                break;
+            default:
+                corrupt("constant " + std::to_string(i) + " has an invalid type");
+            }
+        }
+
+        // Children must come before their parents, which also rules out
+        // cycles.
+        auto child = [&](int32_t index, uint32_t parent, bool optional) {
+            if (optional && index == -1)
+                return;
+            if (index < 0 || (uint32_t)index >= parent)
+                corrupt("node " + std::to_string(parent) + " has an invalid child");
+        };
+        auto children = [&](uint64_t offset, uint64_t count, uint32_t parent) {
+            if (!inRange(offset, count, head->listCount))
+                corrupt("node " + std::to_string(parent) + " has an invalid list");
+            for (uint64_t i = 0; i < count; i++)
+                child(lists[offset + i], parent, false);
+        };
+        auto symbol = [&](int32_t index, uint32_t node) {
+            if (index < 0 || (uint32_t)index >= head->symbolCount)
+                corrupt("node " + std::to_string(node) + " has an invalid symbol");
+        };
+
+        for (uint32_t i = 0; i < head->nodeCount; i++) {
+            const ModuleNode& node = nodes[i];
+            bool validOp = true;
+
+            switch ((ASTNodeType)node.type) {
+            case ASTNodeType::ConstVal:
+                if (node.a < 0 || (uint32_t)node.a >= head->constantCount)
+                    corrupt("node " + std::to_string(i) + " has an invalid constant");
+                break;
+            case ASTNodeType::Arithmetic:
+                validOp = node.op < (uint8_t)ArithmeticOperation::Count;
+                child(node.a, i, false);
+                child(node.b, i, false);
+                break;
+            case ASTNodeType::UnaryOp:
+                validOp = node.op < (uint8_t)UnaryOperation::Count;
+                child(node.a, i, false);
+                break;
+            case ASTNodeType::VariableReference:
+                symbol(node.a, i);
+                break;
+            case ASTNodeType::FunctionCall:
+                symbol(node.a, i);
+                children(node.b, node.c, i);
+                break;
+            case ASTNodeType::Comparison:
+                validOp = node.op <= (uint8_t)ComparisonType::LessThanOrEqual;
+                child(node.a, i, false);
+                child(node.b, i, false);
+                break;
+            case ASTNodeType::VarAssignment:
+                validOp = isDeclarableType(node.op) || node.flags == 0;
+                symbol(node.a, i);
+                child(node.b, i, false);
+                break;
+            case ASTNodeType::If:
+            case ASTNodeType::While:
+                child(node.a, i, false);
+                children(node.b, node.c, i);
+                break;
+            case ASTNodeType::For:
+                child(node.a, i, false);
+                if (!inRange(node.b, 2, head->listCount))
+                    corrupt("node " + std::to_string(i) + " has an invalid list");
+                child(lists[node.b], i, true);
+                child(lists[node.b + 1], i, true);
+                children((uint64_t)node.b + 2, node.c, i);
+                break;
+            case ASTNodeType::FunctionDefinition:
+                if (node.a < 0 || (uint32_t)node.a >= head->functionCount)
+                    corrupt("node " + std::to_string(i) + " has an invalid function");
+                break;
+            case ASTNodeType::Return:
+                child(node.a, i, true);
+                break;
+            default:
+                corrupt("node " + std::to_string(i) + " has an invalid type");
+            }
+
+            if (!validOp)
+                corrupt("node " + std::to_string(i) + " has an invalid operation");
+        }
+
+        auto statements = [&](uint64_t offset, uint64_t count, const char* owner) {
+            if (!inRange(offset, count, head->listCount))
+                corrupt(std::string(owner) + " statements out of bounds");
+            for (uint64_t i = 0; i < count; i++) {
+                if (lists[offset + i] < 0 || (uint32_t)lists[offset + i] >= head->nodeCount)
+                    corrupt(std::string(owner) + " has an invalid statement");
+            }
+        };
+
+        statements(head->statementsOffset, head->statementCount, "script");
+
+        for (uint32_t i = 0; i < head->functionCount; i++) {
+            const ModuleFunction& function = functions[i];
+            if (function.name >= head->symbolCount || function.frameSize < function.paramCount
+                || !inRange(function.paramsOffset, (uint64_t)function.paramCount * 2, head->listCount))
+                corrupt("function " + std::to_string(i) + " is invalid");
+
+            for (uint32_t p = 0; p < function.paramCount; p++) {
+                if (!isDeclarableType(lists[function.paramsOffset + p * 2 + 1]))
+                    corrupt("function " + std::to_string(i) + " has an invalid parameter");
+            }
+
+            statements(function.bodyOffset, function.bodyCount, "function");
+        }
+    }
+
+    std::string ModuleImage::symbolName(uint32_t symbol) const {
+        return std::string(strings + symbols[symbol].offset, symbols[symbol].length);
+    }
+
+    int32_t ModuleImage::findSymbol(const std::string& name) const {
+        for (uint32_t i = 0; i < header->symbolCount; i++) {
+            if (symbols[i].length == name.size() && memcmp(strings + symbols[i].offset, name.data(), name.size()) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    ModuleScript::ModuleScript(std::shared_ptr<const ModuleImage> image)
+        : image(std::move(image)) {
+        head = this->image->header;
+        nodes = this->image->nodes;
+        lists = this->image->lists;
+        lines = this->image->lines;
+        constants = this->image->constants;
+        functionTable = this->image->functions;
+        strings = this->image->strings;
+
+        globals.resize(head->symbolCount);
+        definedFunctions.assign(head->symbolCount, -1);
+        builtins.assign(head->symbolCount, nullptr);
+        stringConstants.resize(head->constantCount);
+    }
+
+    ModuleScript::ModuleScript(const std::string& path)
+        : ModuleScript(ModuleImage::map(path)) {}
+
+    bool ModuleScript::setGlobal(const std::string& name, const Value& value) {
+        int32_t symbol = image->findSymbol(name);
+        if (symbol < 0)
+            return false;
+
+        globals[symbol] = value;
+        return true;
+    }
+
+    std::vector<std::pair<std::string, Value>> ModuleScript::definedGlobals() const {
+        std::vector<std::pair<std::string, Value>> result;
+        for (uint32_t i = 0; i < head->symbolCount; i++) {
+            if (globals[i].type != DataType::Null)
+                result.emplace_back(image->symbolName(i), globals[i]);
+        }
+        return result;
+    }
+
+    void ModuleScript::run() {
+        for (uint32_t i = 0; i < head->statementCount; i++) {
+            int32_t index = lists[head->statementsOffset + i];
+            const ModuleNode& node = nodes[index];
+
+            AllocPhaseScope allocPhase(AllocPhase::Eval);
+            TraceSpan span(nodeTypeNames[(ASTNodeType)node.type], "statement", lines[index]);
+            CountErrors countErrors(metrics::evalErrors);
+
+            if ((ASTNodeType)node.type == ASTNodeType::FunctionDefinition) {
+                definedFunctions[functionTable[node.a].name] = node.a;
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            if (execute(index) != ExecResult::Normal)
+                throw std::runtime_error("return outside of function");
+
+            metrics::statementLatency.observeNs(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    Value ModuleScript::evaluate(int32_t index) {
+        const ModuleNode& node = nodes[index];
+
+        switch ((ASTNodeType)node.type) {
+        case ASTNodeType::ConstVal:
+        {
+            const ModuleConstant& c = constants[node.a];
+            switch ((DataType)c.type) {
+            case DataType::Int32:
+                return Value(c.intVal);
+            case DataType::F32:
+                return Value(c.floatVal);
+            case DataType::F64:
+                return Value(c.doubleVal);
+            case DataType::Boolean:
+                return Value(c.boolVal != 0);
+            case DataType::String:
+            {
+                Value& cached = stringConstants[node.a];
+                if (cached.type == DataType::Null)
+                    cached = Value(InternedString(strings + c.stringOffset, c.length));
+                return cached;
+            }
+            default:
+                return Value();
+            }
+        }
+        case ASTNodeType::Arithmetic:
+        {
+            Value a = evaluate(node.a);
+            Value b = evaluate(node.b);
+
+            switch ((ArithmeticOperation)node.op) {
+            case ArithmeticOperation::Add:
+                return a + b;
+            case ArithmeticOperation::Subtract:
+                return a - b;
+            case ArithmeticOperation::Multiply:
+                return a * b;
+            case ArithmeticOperation::Divide:
+                return a / b;
+            default:
+                return 0;
+            }
+        }
+        case ASTNodeType::UnaryOp:
+        {
+            Value val = evaluate(node.a);
+            if ((UnaryOperation)node.op == UnaryOperation::Minus)
+                val.flipSign();
+            return val;
+        }
+        case ASTNodeType::VariableReference:
+        {
+            metrics::variableLookups.increment();
+
+            if (node.b >= 0) {
+                if (frameBase + node.b >= frames.size())
+                    corrupt("local " + image->symbolName(node.a) + " outside of its frame");
+                return frames[frameBase + node.b];
+            }
+
+            const Value& global = globals[node.a];
+            if (global.type == DataType::Null)
+                throw std::runtime_error("Nonexistent variable " + image->symbolName(node.a) + " referenced");
+            return global;
+        }
+        case ASTNodeType::FunctionCall:
+            return call(index, node);
+        case ASTNodeType::Comparison:
+        {
+            Value lhs = evaluate(node.a);
+            Value rhs = evaluate(node.b);
+
+            switch ((ComparisonType)node.op) {
+            case ComparisonType::Equal:
+                return lhs.isEqual(rhs);
+            case ComparisonType::LessThan:
+                return lhs.isLessThan(rhs);
+            case ComparisonType::GreaterThan:
+                return rhs.isLessThan(lhs);
+            case ComparisonType::LessThanOrEqual:
+                return Value(!rhs.isLessThan(lhs).boolVal);
+            case ComparisonType::GreaterThanOrEqual:
+                return Value(!lhs.isLessThan(rhs).boolVal);
+            default:
+                return false;
+            }
+        }
+        default:
+            corrupt("node " + std::to_string(index) + " isn't an expression");
+            return Value();
+        }
+    }
+
+    ModuleScript::ExecResult ModuleScript::execute(int32_t index) {
+        metrics::statementsExecuted.increment();
+        const ModuleNode& node = nodes[index];
+
+        switch ((ASTNodeType)node.type) {
+        case ASTNodeType::VarAssignment:
+            assign(node);
+            return ExecResult::Normal;
+        case ASTNodeType::If:
+        {
+            bool taken = evaluate(node.a).as<bool>();
+
+            if (activeProfiler != nullptr)
+                activeProfiler->recordBranch(taken);
+
+            if (taken)
+                return executeBlock(node.b, node.c);
+            return ExecResult::Normal;
+        }
+        case ASTNodeType::While:
+            while (evaluate(node.a).as<bool>()) {
+                ExecResult r = executeBlock(node.b, node.c);
+                if (r != ExecResult::Normal)
+                    return r;
+            }
+            return ExecResult::Normal;
+        case ASTNodeType::For:
+        {
+            int32_t init = lists[node.b];
+            int32_t step = lists[node.b + 1];
+
+            if (init >= 0)
+                execute(init);
+
+            while (evaluate(node.a).as<bool>()) {
+                ExecResult r = executeBlock(node.b + 2, node.c);
+                if (r != ExecResult::Normal)
+                    return r;
+
+                if (step >= 0)
+                    execute(step);
+            }
+            return ExecResult::Normal;
+        }
+        case ASTNodeType::FunctionDefinition:
+            throw std::runtime_error("Functions can only be defined at the top level");
+        case ASTNodeType::Return:
+        {
+            if (node.a < 0) {
+                returnValue = Value();
+                return ExecResult::Return;
+            }
+
+            const ModuleNode& value = nodes[node.a];
+            if (node.flags == 1 && (ASTNodeType)value.type == ASTNodeType::FunctionCall && definedFunctions[value.a] >= 0) {
+                // Arguments are evaluated in the current frame, then copied
+                // over it by callFunction.
+                pendingTailArgs = frames.size();
+                for (int32_t i = 0; i < value.c; i++) {
+                    Value arg = evaluate(lists[value.b + i]);
+                    frames.push_back(std::move(arg));
+                }
+                pendingTailCall = definedFunctions[value.a];
+                return ExecResult::TailCall;
+            }
+
+            returnValue = evaluate(node.a);
+            return ExecResult::Return;
+        }
+        default:
+            evaluate(index);
+            return ExecResult::Normal;
+        }
+    }
+
+    ModuleScript::ExecResult ModuleScript::executeBlock(uint32_t offset, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            ExecResult r = execute(lists[offset + i]);
+            if (r != ExecResult::Normal)
+                return r;
+        }
+        return ExecResult::Normal;
+    }
+
+    void ModuleScript::assign(const ModuleNode& node) {
+        Value val = evaluate(node.b);
+        DataType type = (DataType)node.op;
+        Value* slot;
+
+        if (node.c >= 0) {
+            if (frameBase + node.c >= frames.size())
+                corrupt("local " + image->symbolName(node.a) + " outside of its frame");
+            slot = &frames[frameBase + node.c];
+        } else {
+            slot = &globals[node.a];
+        }
+
+        if (node.flags == 1) {
+            *slot = val.as(type);
+            return;
+        }
+
+        if (slot->type == DataType::Null)
+            throw std::runtime_error("Reference to undefined variable " + image->symbolName(node.a));
+        if (val.type != slot->type) {
+            std::string msg = "Assignment to variable "
+                + image->symbolName(node.a) + " (" + dataTypeNames[slot->type] + ")"
+                + " with wrong type " + dataTypeNames[val.type];
+            throw std::runtime_error(msg);
+        }
+        *slot = val;
+    }
+
+    Value ModuleScript::call(int32_t index, const ModuleNode& node) {
+        int32_t function = definedFunctions[node.a];
+        if (function >= 0)
+            return callFunction(function, node);
+
+        Function*& builtin = builtins[node.a];
+        if (builtin == nullptr) {
+            auto iter = functions.find(image->symbolName(node.a));
+            if (iter == functions.end())
+                throw std::runtime_error("Tried to call nonexistent function");
+            builtin = &iter->second;
+        }
+
+        // Evaluate every argument before filling in the call site's nodes,
+        // in case an argument recursively comes back to this call site.
+        size_t argsBegin = frames.size();
+        for (int32_t i = 0; i < node.c; i++) {
+            Value arg = evaluate(lists[node.b + i]);
+            frames.push_back(std::move(arg));
+        }
+
+        FuncArgs& args = callArgs[index];
+        if (args.size() != (size_t)node.c) {
+            for (int32_t i = 0; i < node.c; i++)
+                args.push_back(makeNode<ConstValNode>());
+        }
+        for (int32_t i = 0; i < node.c; i++)
+            static_cast<ConstValNode*>(args[i].get())->val = std::move(frames[argsBegin + i]);
+        frames.resize(argsBegin);
+
+        if (builtin->isBuiltin) {
+            if (builtin->callCounter == nullptr)
+                builtin->callCounter = &metrics::nativeCalls.labeled(builtin->name);
+            builtin->callCounter->increment();
+
+            if (builtin->memo != nullptr)
+                return memoizedCall(*builtin, args);
+        }
+
+        if (activeProfiler != nullptr)
+            return profiledCall(*builtin, args);
+
+        if (builtin->isBuiltin) {
+            BuiltinMarker marker(builtin);
+            TraceSpan span(builtin->name.c_str(), "native");
+            return builtin->nativeFunc(args);
+        }
+
+        return callScriptFunction(*builtin, args);
+    }
+
+    void ModuleScript::bindArguments(const ModuleFunction& function, size_t argCount) {
+        if (argCount != function.paramCount)
+            throw std::runtime_error("Function " + image->symbolName(function.name) + " expects "
+                + std::to_string(function.paramCount) + " arguments, got " + std::to_string(argCount));
+
+        for (size_t i = 0; i < argCount; i++) {
+            Value& arg = frames[frameBase + i];
+            arg = arg.as((DataType)lists[function.paramsOffset + i * 2 + 1]);
+        }
+    }
+
+    Value ModuleScript::callFunction(int32_t function, const ModuleNode& node) {
+        size_t newBase = frames.size();
+        size_t savedBase = frameBase;
+
+        // Restores the caller's frame even if the callee throws.
+        struct FrameGuard {
+            ModuleScript& script;
+            size_t savedBase;
+            size_t savedSize;
+
+            ~FrameGuard() {
+                script.frames.resize(savedSize);
+                script.frameBase = savedBase;
+            }
+        } guard { *this, savedBase, newBase };
+
+        // Evaluate arguments while the caller's frame is still current.
+        for (int32_t i = 0; i < node.c; i++) {
+            Value arg = evaluate(lists[node.b + i]);
+            frames.push_back(std::move(arg));
+        }
+
+        frameBase = newBase;
+        const ModuleFunction* callee = &functionTable[function];
+        bindArguments(*callee, node.c);
+        frames.resize(newBase + callee->frameSize);
+
+        while (true) {
+            ExecResult r = executeBlock(callee->bodyOffset, callee->bodyCount);
+            if (r != ExecResult::TailCall)
+                break;
+
+            // Tail call: replace the current frame with the callee's.
+            callee = &functionTable[pendingTailCall];
+            size_t argCount = frames.size() - pendingTailArgs;
+
+            for (size_t i = 0; i < argCount; i++)
+                frames[frameBase + i] = std::move(frames[pendingTailArgs + i]);
+
+            frames.resize(frameBase + argCount);
+            bindArguments(*callee, argCount);
+            frames.resize(frameBase + callee->frameSize);
+        }
+
+        Value result = returnValue;
+        returnValue = Value();
+        return result;
+    }
+}
@@ -0,0 +1,312 @@
+#include "Module.hpp"
+#include <fstream>
+#include <stdexcept>
+
+namespace iodine {
+    namespace {
+        class ModuleWriter {
+        public:
+            std::vector<ModuleNode> nodes;
+            std::vector<int32_t> lists;
+            std::vector<int32_t> lines;
+            std::vector<ModuleConstant> constants;
+            std::vector<ModuleSymbol> symbols;
+            std::vector<ModuleFunction> functionTable;
+            std::string strings;
+
+            uint32_t symbol(const std::string& name) {
+                auto it = symbolIndices.find(name);
+                if (it != symbolIndices.end())
+                    return it->second;
+
+                ModuleSymbol entry;
+                entry.offset = addString(name);
+                entry.length = name.size();
+                symbols.push_back(entry);
+                symbolIndices[name] = symbols.size() - 1;
+                return symbols.size() - 1;
+            }
+
+            int32_t expression(ProducesValueNode* node) {
+                ModuleNode out = {};
+                out.type = (uint8_t)node->type;
+
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                    out.a = constant(static_cast<ConstValNode*>(node)->val);
+                    break;
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    out.op = (uint8_t)arith->operation;
+                    out.a = expression(arith->a.get());
+                    out.b = expression(arith->b.get());
+                    break;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    out.op = (uint8_t)unary->operation;
+                    out.a = expression(unary->valNode.get());
+                    break;
+                }
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    out.a = symbol(ref->varName);
+                    out.b = ref->localSlot;
+                    break;
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    // The loop runs its step statement, so the variable is
+                    // always current.
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    out.type = (uint8_t)ASTNodeType::VariableReference;
+                    out.a = symbol(init->varName);
+                    out.b = init->localSlot;
+                    break;
+                }
+                case ASTNodeType::LoopInvariant:
+                    return expression(static_cast<LoopInvariantNode*>(node)->expr.get());
+                case ASTNodeType::CommonValue:
+                    return expression(static_cast<CommonValueNode*>(node)->expr.get());
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(node);
+                    std::vector<int32_t> args;
+                    for (auto& arg : call->args)
+                        args.push_back(expression(arg.get()));
+
+                    out.a = symbol(call->functionName);
+                    out.b = list(args);
+                    out.c = args.size();
+                    break;
+                }
+                case ASTNodeType::Comparison:
+                {
+                    auto comparison = static_cast<ComparisonNode*>(node);
+                    out.op = (uint8_t)comparison->compType;
+                    out.a = expression(comparison->lhs.get());
+                    out.b = expression(comparison->rhs.get());
+                    break;
+                }
+                default:
+                    throw std::runtime_error(std::string("Can't write ") + nodeTypeNames[node->type] + " node to a module");
+                }
+
+                return add(out, 0);
+            }
+
+            int32_t statement(ASTNode* node) {
+                ModuleNode out = {};
+                out.type = (uint8_t)node->type;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node);
+                    // The type is only set on declarations.
+                    out.op = assign->createNew ? (uint8_t)assign->type : 0;
+                    out.flags = assign->createNew ? 1 : 0;
+                    out.a = symbol(assign->varName);
+                    out.b = expression(assign->valNode.get());
+                    out.c = assign->localSlot;
+                    break;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+
+                    out.a = expression(ifNode->condition.get());
+                    std::vector<int32_t> body = block(ifNode->nodes);
+                    out.b = list(body);
+                    out.c = body.size();
+                    break;
+                }
+                case ASTNodeType::While:
+                {
+                    auto loop = static_cast<WhileNode*>(node);
+                    out.a = expression(loop->condition.get());
+                    std::vector<int32_t> body = block(loop->nodes);
+                    out.b = list(body);
+                    out.c = body.size();
+                    break;
+                }
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<ForNode*>(node);
+                    std::vector<int32_t> entries;
+                    entries.push_back(loop->init != nullptr ? statement(loop->init.get()) : -1);
+                    entries.push_back(loop->step != nullptr ? statement(loop->step.get()) : -1);
+                    out.a = expression(loop->condition.get());
+
+                    std::vector<int32_t> body = block(loop->nodes);
+                    entries.insert(entries.end(), body.begin(), body.end());
+                    out.b = list(entries);
+                    out.c = body.size();
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                {
+                    auto def = static_cast<FunctionDefinitionNode*>(node);
+                    if (def->lazyBody != nullptr)
+                        parseLazyBody(*def);
+
+                    std::vector<int32_t> params;
+                    for (auto& param : def->params) {
+                        params.push_back(symbol(param.name));
+                        params.push_back((int32_t)param.type);
+                    }
+                    std::vector<int32_t> body = block(def->body);
+
+                    ModuleFunction function;
+                    function.name = symbol(def->name);
+                    function.paramsOffset = list(params);
+                    function.paramCount = def->params.size();
+                    function.bodyOffset = list(body);
+                    function.bodyCount = body.size();
+                    function.frameSize = def->frameSize;
+                    functionTable.push_back(function);
+
+                    out.a = functionTable.size() - 1;
+                    break;
+                }
+                case ASTNodeType::Return:
+                {
+                    auto ret = static_cast<ReturnNode*>(node);
+                    out.flags = ret->isTailCall ? 1 : 0;
+                    out.a = ret->valNode != nullptr ? expression(ret->valNode.get()) : -1;
+                    break;
+                }
+                default:
+                    return expression(static_cast<ProducesValueNode*>(node));
+                }
+
+                return add(out, node->line);
+            }
+
+            std::vector<int32_t> block(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+                std::vector<int32_t> result;
+                for (auto& s : statements)
+                    result.push_back(statement(s.get()));
+                return result;
+            }
+
+            uint32_t list(const std::vector<int32_t>& entries) {
+                uint32_t offset = lists.size();
+                lists.insert(lists.end(), entries.begin(), entries.end());
+                return offset;
+            }
+
+        private:
+            std::unordered_map<std::string, uint32_t> symbolIndices;
+
+            int32_t add(const ModuleNode& node, int line) {
+                nodes.push_back(node);
+                lines.push_back(line);
+                return nodes.size() - 1;
+            }
+
+            uint64_t addString(const std::string& str) {
+                uint64_t offset = strings.size();
+                strings += str;
+                strings += '\0';
+                return offset;
+            }
+
+            int32_t constant(const Value& val) {
+                ModuleConstant out = {};
+                out.type = (uint32_t)val.type;
+
+                switch (val.type) {
+                case DataType::Int32:
+                    out.intVal = val.intVal;
+                    break;
+                case DataType::F32:
+                    out.floatVal = val.floatVal;
+                    break;
+                case DataType::F64:
+                    out.doubleVal = val.doubleVal;
+                    break;
+                case DataType::Boolean:
+                    out.boolVal = val.boolVal;
+                    break;
+                case DataType::String:
+                {
+                    std::string str = val.strVal.str();
+                    out.length = str.size();
+                    out.stringOffset = addString(str);
+                    break;
+                }
+                case DataType::Null:
+                    break;
+                default:
+                    throw std::runtime_error(std::string("Can't write ") + dataTypeNames[val.type] + " constant to a module");
+                }
+
+                constants.push_back(out);
+                return constants.size() - 1;
+            }
+        };
+
+        uint64_t align(uint64_t offset) {
+            return (offset + 7) & ~(uint64_t)7;
+        }
+
+        void writeSection(std::ostream& out, uint64_t offset, const void* data, size_t bytes) {
+            static const char zeroes[8] = {};
+            uint64_t position = out.tellp();
+            out.write(zeroes, offset - position);
+            out.write((const char*)data, bytes);
+        }
+    }
+
+    void writeModule(std::ostream& out, const std::vector<std::shared_ptr<ASTNode>>& statements, const std::string& sourceName) {
+        ModuleWriter writer;
+        uint32_t sourceSymbol = writer.symbol(sourceName);
+        std::vector<int32_t> topLevel = writer.block(statements);
+
+        ModuleHeader header = {};
+        memcpy(header.magic, moduleMagic, sizeof(moduleMagic));
+        header.version = moduleVersion;
+        header.headerSize = sizeof(ModuleHeader);
+        header.nodeCount = writer.nodes.size();
+        header.statementsOffset = writer.list(topLevel);
+        header.statementCount = topLevel.size();
+        header.listCount = writer.lists.size();
+        header.constantCount = writer.constants.size();
+        header.symbolCount = writer.symbols.size();
+        header.functionCount = writer.functionTable.size();
+        header.sourceSymbol = sourceSymbol;
+        header.stringBytes = writer.strings.size();
+
+        header.nodesOffset = align(sizeof(ModuleHeader));
+        header.listsOffset = align(header.nodesOffset + writer.nodes.size() * sizeof(ModuleNode));
+        header.linesOffset = align(header.listsOffset + writer.lists.size() * sizeof(int32_t));
+        header.constantsOffset = align(header.linesOffset + writer.lines.size() * sizeof(int32_t));
+        header.symbolsOffset = align(header.constantsOffset + writer.constants.size() * sizeof(ModuleConstant));
+        header.functionsOffset = align(header.symbolsOffset + writer.symbols.size() * sizeof(ModuleSymbol));
+        header.stringsOffset = align(header.functionsOffset + writer.functionTable.size() * sizeof(ModuleFunction));
+        header.fileSize = header.stringsOffset + writer.strings.size();
+
+        out.write((const char*)&header, sizeof(header));
+        writeSection(out, header.nodesOffset, writer.nodes.data(), writer.nodes.size() * sizeof(ModuleNode));
+        writeSection(out, header.listsOffset, writer.lists.data(), writer.lists.size() * sizeof(int32_t));
+        writeSection(out, header.linesOffset, writer.lines.data(), writer.lines.size() * sizeof(int32_t));
+        writeSection(out, header.constantsOffset, writer.constants.data(), writer.constants.size() * sizeof(ModuleConstant));
+        writeSection(out, header.symbolsOffset, writer.symbols.data(), writer.symbols.size() * sizeof(ModuleSymbol));
+        writeSection(out, header.functionsOffset, writer.functionTable.data(), writer.functionTable.size() * sizeof(ModuleFunction));
+        writeSection(out, header.stringsOffset, writer.strings.data(), writer.strings.size());
+    }
+
+    void writeModule(const std::string& path, const std::vector<std::shared_ptr<ASTNode>>& statements, const std::string& sourceName) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        writeModule(out, statements, sourceName);
+
+        if (!out.good())
+            throw std::runtime_error("Couldn't write " + path);
+    }
+}
@@ -0,0 +1,193 @@
+#include "NativeScript.hpp"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+extern char** environ;
+
+namespace iodine {
+    namespace {
+        uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+            for (size_t i = 0; i < size; i++) {
+                hash ^= (unsigned char)data[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Generated code is compiled against this build's headers, so a
+        // rebuilt Iodine mustn't load objects cached by an older one. Hashes
+        // the running executable, which changes with any rebuild that
+        // matters and stays the same for identical builds.
+        const std::string& buildId() {
+            static const std::string id = [] {
+                std::ifstream in("/proc/self/exe", std::ios::binary);
+                if (!in)
+                    throw std::runtime_error("Couldn't read /proc/self/exe");
+
+                uint64_t hash = fnv1a(nullptr, 0);
+                char buffer[1 << 16];
+                while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+                    hash = fnv1a(buffer, in.gcount(), hash);
+
+                char id[17];
+                snprintf(id, sizeof(id), "%016llx", (unsigned long long)hash);
+                return std::string(id);
+            }();
+            return id;
+        }
+
+        std::string defaultCacheDir() {
+            if (const char* dir = getenv("IODINE_AOT_CACHE"))
+                return dir;
+            if (const char* dir = getenv("XDG_CACHE_HOME"))
+                return std::string(dir) + "/iodine/aot";
+            if (const char* home = getenv("HOME"))
+                return std::string(home) + "/.cache/iodine/aot";
+            return "/tmp/iodine-aot";
+        }
+
+        void makeDirectories(const std::string& path) {
+            for (size_t i = 1; i <= path.size(); i++) {
+                if (i == path.size() || path[i] == '/')
+                    mkdir(path.substr(0, i).c_str(), 0755);
+            }
+
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+                throw std::runtime_error("Couldn't create " + path);
+        }
+
+        std::vector<std::string> splitFlags(const std::string& flags) {
+            std::vector<std::string> result;
+            std::stringstream stream(flags);
+            std::string flag;
+            while (stream >> flag)
+                result.push_back(flag);
+            return result;
+        }
+
+        // Runs the compiler with its diagnostics going to logPath and
+        // returns its exit status.
+        int runCompiler(const std::vector<std::string>& args, const std::string& logPath) {
+            std::vector<char*> argv;
+            for (auto& arg : args)
+                argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+            pid_t pid;
+            int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+            posix_spawn_file_actions_destroy(&actions);
+            if (error != 0)
+                throw std::runtime_error("Couldn't run " + args[0] + ": " + strerror(error));
+
+            int status;
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR)
+                    throw std::runtime_error(std::string("Lost track of the compiler: ") + strerror(errno));
+            }
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+    }
+
+    NativeScript::NativeScript(const std::vector<std::shared_ptr<ASTNode>>& statements, const NativeScriptOptions& options) {
+        std::string source = transpileToCpp(statements);
+
+        std::string compiler = options.compiler;
+        if (compiler.empty()) {
+            const char* fromEnvironment = getenv("IODINE_CXX");
+            compiler = fromEnvironment != nullptr ? fromEnvironment : "c++";
+        }
+
+        // -fwrapv so signed overflow wraps like it does in the interpreter
+        // instead of being something the optimizer may assume away.
+        std::vector<std::string> command = {
+            compiler, "-std=c++17", "-shared", "-fPIC", "-fwrapv", "-I" IODINE_INCLUDE_DIR
+        };
+        for (auto& flag : splitFlags(options.flags))
+            command.push_back(flag);
+
+        std::string key = buildId();
+        for (auto& arg : command)
+            key += "\n" + arg;
+        key += "\n" + source;
+
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)fnv1a(key.data(), key.size()));
+
+        std::string dir = options.cacheDir.empty() ? defaultCacheDir() : options.cacheDir;
+        std::string base = dir + "/" + hash;
+        path = base + ".so";
+
+        if (access(path.c_str(), R_OK) == 0) {
+            cached = true;
+        } else {
+            makeDirectories(dir);
+
+            // Other processes may be building the same script; each builds
+            // under its own name and the rename makes the result appear
+            // whole.
+            std::string pid = std::to_string(getpid());
+            std::string sourcePath = base + "." + pid + ".cpp";
+            std::string tempPath = base + "." + pid + ".so";
+            std::string logPath = base + ".log";
+
+            {
+                std::ofstream out(sourcePath);
+                out << source;
+                if (!out.good())
+                    throw std::runtime_error("Couldn't write " + sourcePath);
+            }
+
+            command.push_back("-o");
+            command.push_back(tempPath);
+            command.push_back(sourcePath);
+
+            int status = runCompiler(command, logPath);
+            rename(sourcePath.c_str(), (base + ".cpp").c_str());
+
+            if (status != 0) {
+                unlink(tempPath.c_str());
+                throw std::runtime_error("Compiling " + base + ".cpp failed, see " + logPath);
+            }
+
+            if (rename(tempPath.c_str(), path.c_str()) != 0)
+                throw std::runtime_error("Couldn't move the compiled script to " + path);
+        }
+
+        handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr)
+            throw std::runtime_error("Couldn't load " + path + ": " + dlerror());
+
+        entry = (void (*)())dlsym(handle, "iodine_aot_run");
+        if (entry == nullptr) {
+            dlclose(handle);
+            handle = nullptr;
+            throw std::runtime_error(path + " has no iodine_aot_run");
+        }
+    }
+
+    NativeScript::~NativeScript() {
+        if (handle != nullptr)
+            dlclose(handle);
+    }
+
+    void NativeScript::run() {
+        entry();
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "parser.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    // Runs a parsed script from start to finish.
+    class ScriptExecutor {
+    public:
+        virtual ~ScriptExecutor() {}
+
+        virtual void run() = 0;
+    };
+
+    // Walks the AST with evalAST one top-level statement at a time.
+    class InterpretedScript : public ScriptExecutor {
+    public:
+        InterpretedScript(std::vector<std::shared_ptr<ASTNode>> statements)
+            : statements(std::move(statements)) {}
+
+        void run() override {
+            for (auto& statement : statements)
+                evalAST(statement);
+        }
+
+    private:
+        std::vector<std::shared_ptr<ASTNode>> statements;
+    };
+
+    // Generates a C++ translation unit that does what the statements do.
+    // Variables become C++ variables of their declared type, script
+    // functions become C++ functions, and expressions whose type is known
+    // statically use plain C++ arithmetic; only builtin results and mixed
+    // types go through Value. The unit exports
+    // extern "C" void iodine_aot_run().
+    //
+    // Throws std::runtime_error for scripts it can't translate faithfully,
+    // such as a variable declared with two different types.
+    std::string transpileToCpp(const std::vector<std::shared_ptr<ASTNode>>& statements);
+
+    struct NativeScriptOptions {
+        // Where built shared objects are kept. Empty means $IODINE_AOT_CACHE,
+        // then $XDG_CACHE_HOME/iodine/aot, then ~/.cache/iodine/aot.
+        std::string cacheDir;
+        // Empty means $IODINE_CXX, then c++.
+        std::string compiler;
+        std::string flags = "-O2";
+    };
+
+    // A script transpiled to C++, built with the system compiler into a
+    // shared object and loaded with dlopen. Shared objects are cached under
+    // a hash of the generated code, the compile command and this build of
+    // Iodine, so an unchanged script loads without running the compiler.
+    //
+    // The generated code calls into Iodine for strings, builtins and
+    // dynamically typed values, so programs using this must export their
+    // symbols (export_dynamic in meson). Builtins must be registered before
+    // run() is first called. Statement-level metrics, profiling and
+    // tracing only cover builtin calls.
+    class NativeScript : public ScriptExecutor {
+    public:
+        NativeScript(const std::vector<std::shared_ptr<ASTNode>>& statements, const NativeScriptOptions& options = {});
+        ~NativeScript();
+
+        NativeScript(const NativeScript&) = delete;
+        NativeScript& operator=(const NativeScript&) = delete;
+
+        void run() override;
+
+        const std::string& libraryPath() const { return path; }
+        // Whether the shared object came from the cache.
+        bool wasCached() const { return cached; }
+
+    private:
+        std::string path;
+        bool cached = false;
+        void* handle = nullptr;
+        void (*entry)() = nullptr;
+    };
+}
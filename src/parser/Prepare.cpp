@@ -0,0 +1,442 @@
+#include "Prepare.hpp"
+#include "Effects.hpp"
+#include <limits.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        struct Known {
+            DataType type;
+            Value val;
+        };
+
+        // Globals whose current value is known, by name.
+        typedef std::unordered_map<std::string, Known> Environment;
+
+        const Value* constantValue(const std::shared_ptr<ProducesValueNode>& node) {
+            if (node == nullptr || node->type != ASTNodeType::ConstVal)
+                return nullptr;
+            return &static_cast<ConstValNode*>(node.get())->val;
+        }
+
+        // Value's operators assert on anything but numbers (and strings for
+        // +), and integer division by zero traps, so only what's certain to
+        // work is evaluated ahead of time.
+        bool canFold(ArithmeticOperation operation, const Value& a, const Value& b) {
+            if (a.type == DataType::String && b.type == DataType::String)
+                return operation == ArithmeticOperation::Add;
+            if (!isNumberType(a.type) || !isNumberType(b.type))
+                return false;
+            if (operation == ArithmeticOperation::Divide && a.type == DataType::Int32 && b.type == DataType::Int32)
+                return b.intVal != 0 && !(a.intVal == INT_MIN && b.intVal == -1);
+            return true;
+        }
+
+        // Whether storing val in a variable of type can't fail.
+        bool convertsCleanly(const Value& val, DataType type, bool createNew) {
+            if (val.type == type)
+                return true;
+            return createNew && isNumberType(val.type) && isNumberType(type);
+        }
+
+        void forget(Environment& env, const std::unordered_set<std::string>& names) {
+            for (auto& name : names)
+                env.erase(name);
+        }
+
+        class Specializer {
+        public:
+            Specializer(const std::vector<std::shared_ptr<ASTNode>>& statements, const std::unordered_map<std::string, Value>& bindings)
+                : functionEffects(summarizeFunctions(statements)) {
+                Effects written;
+                for (auto& node : statements)
+                    collectEffects(node.get(), written);
+                for (auto& [name, effects] : functionEffects)
+                    written.writes.insert(effects.writes.begin(), effects.writes.end());
+
+                for (auto& [name, val] : bindings) {
+                    top[name] = Known { val.type, val };
+                    if (written.writes.count(name) == 0)
+                        constants[name] = Known { val.type, val };
+                }
+            }
+
+            std::vector<std::shared_ptr<ASTNode>> specialize(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+                std::vector<std::shared_ptr<ASTNode>> out;
+                for (auto& node : statements)
+                    statement(node, out, top, true);
+                return out;
+            }
+
+            // Top-level assignments of constants that can't fail.
+            std::unordered_set<const ASTNode*> droppable;
+
+        private:
+            std::unordered_map<std::string, Effects> functionEffects;
+            // Bindings the script never assigns, which hold everywhere.
+            Environment constants;
+            Environment top;
+
+            std::shared_ptr<ProducesValueNode> expression(ProducesValueNode* node, const Environment& env) {
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                    return makeNode<ConstValNode>(static_cast<ConstValNode*>(node)->val);
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    if (ref->localSlot < 0) {
+                        auto it = env.find(ref->varName);
+                        if (it != env.end())
+                            return makeNode<ConstValNode>(it->second.val);
+                    }
+
+                    auto copy = makeNode<VariableReferenceNode>();
+                    copy->varName = ref->varName;
+                    copy->localSlot = ref->localSlot;
+                    return copy;
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    // The loop is rebuilt without its counted fast path, so
+                    // the counter is read from its variable again.
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    auto copy = makeNode<VariableReferenceNode>();
+                    copy->varName = init->varName;
+                    copy->localSlot = init->localSlot;
+                    return copy;
+                }
+                case ASTNodeType::LoopInvariant:
+                    return expression(static_cast<LoopInvariantNode*>(node)->expr.get(), env);
+                case ASTNodeType::CommonValue:
+                    return expression(static_cast<CommonValueNode*>(node)->expr.get(), env);
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    auto copy = makeNode<ArithmeticNode>();
+                    copy->operation = arith->operation;
+                    copy->a = expression(arith->a.get(), env);
+                    copy->b = expression(arith->b.get(), env);
+
+                    const Value* a = constantValue(copy->a);
+                    const Value* b = constantValue(copy->b);
+                    if (a != nullptr && b != nullptr && canFold(copy->operation, *a, *b))
+                        return fold(copy);
+                    return copy;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    auto copy = makeNode<UnaryOpNode>();
+                    copy->operation = unary->operation;
+                    copy->valNode = expression(unary->valNode.get(), env);
+
+                    const Value* val = constantValue(copy->valNode);
+                    if (val != nullptr && isNumberType(val->type))
+                        return fold(copy);
+                    return copy;
+                }
+                case ASTNodeType::Comparison:
+                {
+                    auto comparison = static_cast<ComparisonNode*>(node);
+                    auto copy = makeNode<ComparisonNode>();
+                    copy->compType = comparison->compType;
+                    copy->lhs = expression(comparison->lhs.get(), env);
+                    copy->rhs = expression(comparison->rhs.get(), env);
+
+                    const Value* lhs = constantValue(copy->lhs);
+                    const Value* rhs = constantValue(copy->rhs);
+                    if (lhs != nullptr && rhs != nullptr
+                        && ((isNumberType(lhs->type) && isNumberType(rhs->type)) || lhs->type == rhs->type))
+                        return fold(copy);
+                    return copy;
+                }
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(node);
+                    auto copy = makeNode<FunctionCallNode>();
+                    copy->functionName = call->functionName;
+                    for (auto& arg : call->args)
+                        copy->args.push_back(expression(arg.get(), env));
+                    return copy;
+                }
+                default:
+                    throw std::runtime_error(std::string("Can't prepare ") + nodeTypeNames[node->type] + " node");
+                }
+            }
+
+            // Evaluates a node whose operands are all constants. Anything
+            // that still throws, like ordering two strings, is left to fail
+            // at run time.
+            std::shared_ptr<ProducesValueNode> fold(std::shared_ptr<ProducesValueNode> node) {
+                try {
+                    return makeNode<ConstValNode>(node->getValue());
+                } catch (const std::runtime_error&) {
+                    return node;
+                }
+            }
+
+            std::shared_ptr<VarAssignmentNode> assignment(VarAssignmentNode* assign, const Environment& env) {
+                auto copy = makeNode<VarAssignmentNode>();
+                copy->line = assign->line;
+                copy->createNew = assign->createNew;
+                copy->varName = assign->varName;
+                copy->localSlot = assign->localSlot;
+                if (assign->createNew)
+                    copy->type = assign->type;
+                copy->valNode = expression(assign->valNode.get(), env);
+                return copy;
+            }
+
+            // A for loop's init or step.
+            std::shared_ptr<ASTNode> clause(const std::shared_ptr<ASTNode>& node, const Environment& env) {
+                if (node == nullptr)
+                    return nullptr;
+                if (node->type == ASTNodeType::VarAssignment)
+                    return assignment(static_cast<VarAssignmentNode*>(node.get()), env);
+                return expression(static_cast<ProducesValueNode*>(node.get()), env);
+            }
+
+            // True if condition is a constant, setting taken to what the if
+            // or loop would do with it.
+            static bool constantCondition(const std::shared_ptr<ProducesValueNode>& condition, bool& taken) {
+                const Value* val = constantValue(condition);
+                if (val == nullptr)
+                    return false;
+
+                try {
+                    taken = val->as<bool>();
+                    return true;
+                } catch (const std::runtime_error&) {
+                    return false;
+                }
+            }
+
+            // Appends what's left of node to out. At the top level, env
+            // follows the globals as the statements assign them; in function
+            // bodies it's only the constants.
+            void statement(const std::shared_ptr<ASTNode>& node, std::vector<std::shared_ptr<ASTNode>>& out, Environment& env, bool tracking) {
+                Effects effects;
+                if (tracking) {
+                    collectEffects(node.get(), effects);
+
+                    // The functions it calls may change globals before any
+                    // part of the statement runs.
+                    Effects called;
+                    called.calls = effects.calls;
+                    addCalledEffects(called, functionEffects);
+                    forget(env, called.writes);
+                }
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node.get());
+                    auto copy = assignment(assign, env);
+                    out.push_back(copy);
+                    if (assign->localSlot >= 0 || !tracking)
+                        break;
+
+                    const Value* val = constantValue(copy->valNode);
+                    auto it = env.find(assign->varName);
+                    if (val != nullptr && (assign->createNew || it != env.end())) {
+                        DataType type = assign->createNew ? assign->type : it->second.type;
+                        if (convertsCleanly(*val, type, assign->createNew)) {
+                            env[assign->varName] = Known { type, val->as(type) };
+                            droppable.insert(copy.get());
+                            break;
+                        }
+                    }
+                    env.erase(assign->varName);
+                    break;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node.get());
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+
+                    auto condition = expression(ifNode->condition.get(), env);
+                    bool taken;
+                    if (constantCondition(condition, taken)) {
+                        if (!taken)
+                            break;
+
+                        // Bodies share the enclosing scope, so a taken if is
+                        // just its statements. A function definition in it
+                        // has to keep failing, though.
+                        bool defines = std::any_of(ifNode->nodes.begin(), ifNode->nodes.end(), [](auto& child) {
+                            return child->type == ASTNodeType::FunctionDefinition;
+                        });
+                        if (!defines) {
+                            for (auto& child : ifNode->nodes)
+                                statement(child, out, env, tracking);
+                            break;
+                        }
+                    }
+
+                    auto copy = makeNode<IfNode>();
+                    copy->line = ifNode->line;
+                    copy->condition = condition;
+                    Environment inner = env;
+                    for (auto& child : ifNode->nodes)
+                        statement(child, copy->nodes, inner, tracking);
+                    forget(env, effects.writes);
+                    out.push_back(copy);
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    // Nothing the loop assigns is known in the condition or
+                    // body, or after it.
+                    forget(env, effects.writes);
+                    auto loop = static_cast<LoopNode*>(node.get());
+
+                    std::shared_ptr<LoopNode> copy;
+                    if (node->type == ASTNodeType::For) {
+                        auto forNode = static_cast<ForNode*>(node.get());
+                        auto forCopy = makeNode<ForNode>();
+                        forCopy->init = clause(forNode->init, env);
+                        forCopy->step = clause(forNode->step, env);
+                        copy = forCopy;
+                    } else {
+                        copy = makeNode<WhileNode>();
+                    }
+
+                    copy->line = loop->line;
+                    if (loop->condition != nullptr)
+                        copy->condition = expression(loop->condition.get(), env);
+
+                    bool taken;
+                    if (node->type == ASTNodeType::While && constantCondition(copy->condition, taken) && !taken)
+                        break;
+
+                    Environment inner = env;
+                    for (auto& child : loop->nodes)
+                        statement(child, copy->nodes, inner, tracking);
+                    out.push_back(copy);
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                {
+                    auto def = static_cast<FunctionDefinitionNode*>(node.get());
+                    if (def->lazyBody != nullptr)
+                        parseLazyBody(*def);
+
+                    auto copy = makeNode<FunctionDefinitionNode>();
+                    copy->line = def->line;
+                    copy->name = def->name;
+                    copy->params = def->params;
+                    copy->frameSize = def->frameSize;
+                    Environment inner = constants;
+                    for (auto& child : def->body)
+                        statement(child, copy->body, inner, false);
+                    out.push_back(copy);
+                    break;
+                }
+                case ASTNodeType::Return:
+                {
+                    auto ret = static_cast<ReturnNode*>(node.get());
+                    auto copy = makeNode<ReturnNode>();
+                    copy->line = ret->line;
+                    if (ret->valNode != nullptr)
+                        copy->valNode = expression(ret->valNode.get(), env);
+                    copy->isTailCall = ret->isTailCall && copy->valNode != nullptr && copy->valNode->type == ASTNodeType::FunctionCall;
+                    out.push_back(copy);
+                    break;
+                }
+                default:
+                {
+                    // A statement that's just a constant does nothing.
+                    auto copy = expression(static_cast<ProducesValueNode*>(node.get()), env);
+                    if (copy->type == ASTNodeType::ConstVal)
+                        break;
+                    copy->line = node->line;
+                    out.push_back(copy);
+                    break;
+                }
+                }
+            }
+        };
+    }
+
+    std::vector<std::shared_ptr<ASTNode>> prepareScript(const std::vector<std::shared_ptr<ASTNode>>& statements,
+        const std::unordered_map<std::string, Value>& bindings, const PrepareOptions& options) {
+        Specializer specializer(statements, bindings);
+
+        std::vector<std::string> names;
+        for (auto& [name, val] : bindings)
+            names.push_back(name);
+        std::sort(names.begin(), names.end());
+
+        std::vector<std::shared_ptr<ASTNode>> residual;
+        for (auto& name : names) {
+            auto declaration = makeNode<VarAssignmentNode>();
+            declaration->createNew = true;
+            declaration->varName = name;
+            declaration->type = bindings.at(name).type;
+            declaration->valNode = makeNode<ConstValNode>(bindings.at(name));
+            specializer.droppable.insert(declaration.get());
+            residual.push_back(declaration);
+        }
+
+        auto body = specializer.specialize(statements);
+        residual.insert(residual.end(), body.begin(), body.end());
+
+        // Globals something in the residual program reads, or assigns in a
+        // way that needs them to exist already. Reads are counted wherever
+        // they are, which only ever keeps more.
+        Effects used;
+        Effects inFunctions;
+        for (auto& node : residual) {
+            if (node->type == ASTNodeType::FunctionDefinition) {
+                for (auto& child : static_cast<FunctionDefinitionNode*>(node.get())->body)
+                    collectEffects(child.get(), inFunctions);
+            } else {
+                collectEffects(node.get(), used);
+            }
+        }
+        used.reads.insert(inFunctions.reads.begin(), inFunctions.reads.end());
+        used.reads.insert(inFunctions.writes.begin(), inFunctions.writes.end());
+
+        // Walking backwards, an assignment of a constant nothing needs can go
+        // if a later declaration replaces the value, or if final values
+        // don't matter.
+        std::unordered_set<std::string> declaredLater;
+        std::vector<bool> keep(residual.size(), true);
+        for (size_t i = residual.size(); i-- > 0;) {
+            auto& node = residual[i];
+            if (node->type != ASTNodeType::VarAssignment) {
+                if (node->type != ASTNodeType::FunctionDefinition) {
+                    Effects effects;
+                    collectEffects(node.get(), effects);
+                    used.reads.insert(effects.writes.begin(), effects.writes.end());
+                }
+                continue;
+            }
+
+            auto assign = static_cast<VarAssignmentNode*>(node.get());
+            if (specializer.droppable.count(assign) != 0 && used.reads.count(assign->varName) == 0
+                && (!options.keepGlobals || declaredLater.count(assign->varName) != 0)) {
+                keep[i] = false;
+                continue;
+            }
+
+            if (assign->createNew)
+                declaredLater.insert(assign->varName);
+            else
+                used.reads.insert(assign->varName);
+        }
+
+        std::vector<std::shared_ptr<ASTNode>> result;
+        for (size_t i = 0; i < residual.size(); i++) {
+            if (keep[i]) {
+                optimizeLoops(residual[i]);
+                result.push_back(residual[i]);
+            }
+        }
+        return result;
+    }
+}
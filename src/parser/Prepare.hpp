@@ -0,0 +1,35 @@
+#pragma once
+#include "parser.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    struct PrepareOptions {
+        // Keep assignments nothing in the residual program reads when they
+        // leave a global's final value, so a run ends with the same globals
+        // as the original script would.
+        bool keepGlobals = true;
+    };
+
+    // Partially evaluates a script for globals whose values are known
+    // before it runs, such as configuration the host would otherwise set
+    // on every run. Returns a residual program that declares the bound
+    // globals itself and can be run, compiled to a module or transpiled
+    // any number of times with the remaining inputs. statements are left
+    // untouched.
+    //
+    // Reads of a global are replaced by its value wherever it's known:
+    // at the top level, from the bindings and constant assignments, until
+    // something might change it; in function bodies, only for bindings
+    // the script never assigns. Constant subexpressions are folded, if
+    // statements with constant conditions are replaced by their body or
+    // dropped, and assignments of constants that nothing reads are
+    // dropped when a later declaration supersedes them (or whenever
+    // keepGlobals is off). Builtin calls are never evaluated, and folding
+    // leaves alone anything that would fail, so errors still happen at
+    // run time if that code runs.
+    std::vector<std::shared_ptr<ASTNode>> prepareScript(const std::vector<std::shared_ptr<ASTNode>>& statements,
+        const std::unordered_map<std::string, Value>& bindings, const PrepareOptions& options = {});
+}
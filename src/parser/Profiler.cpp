@@ -0,0 +1,181 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <iomanip>
+
+namespace iodine {
+    Profiler* activeProfiler = nullptr;
+
+    Value profiledCall(const Function& func, const FuncArgs& args) {
+        Profiler::Scope scope(*activeProfiler, func.name);
+
+        if (func.isBuiltin) {
+            BuiltinMarker marker(&func);
+            TraceSpan span(func.name.c_str(), "native");
+            return func.nativeFunc(args);
+        }
+
+        return callScriptFunction(func, args);
+    }
+
+    std::string describeStatement(const ASTNode* statement) {
+        std::string description = std::to_string(statement->line) + ": ";
+
+        switch (statement->type) {
+        case ASTNodeType::VarAssignment:
+            return description + "assign " + static_cast<const VarAssignmentNode*>(statement)->varName;
+        case ASTNodeType::FunctionCall:
+            return description + "call " + static_cast<const FunctionCallNode*>(statement)->functionName;
+        case ASTNodeType::FunctionDefinition:
+            return description + "fn " + static_cast<const FunctionDefinitionNode*>(statement)->name;
+        case ASTNodeType::If:
+            return description + "if";
+        case ASTNodeType::While:
+            return description + "while";
+        case ASTNodeType::For:
+            return description + "for";
+        case ASTNodeType::Return:
+            return description + "return";
+        default:
+            return description + nodeTypeNames[statement->type];
+        }
+    }
+
+    Profiler::Profiler() {
+        root.entry = -1;
+        root.parent = nullptr;
+    }
+
+    int Profiler::labelEntry(const std::string& label) {
+        auto it = labelEntries.find(label);
+        if (it != labelEntries.end())
+            return it->second;
+
+        Entry entry;
+        entry.label = label;
+        entries.push_back(entry);
+        labelEntries[label] = (int)entries.size() - 1;
+        return (int)entries.size() - 1;
+    }
+
+    int Profiler::statementEntry(const ASTNode* statement) {
+        auto it = statementEntries.find(statement);
+        if (it != statementEntries.end())
+            return it->second;
+
+        int entry = labelEntry(describeStatement(statement));
+        entries[entry].isIf = statement->type == ASTNodeType::If;
+        entries[entry].line = statement->line;
+        statementEntries[statement] = entry;
+        return entry;
+    }
+
+    int Profiler::functionEntry(const std::string& functionName) {
+        return labelEntry(functionName);
+    }
+
+    void Profiler::enter(int entry) {
+        TreeNode* parent = stack.empty() ? &root : stack.back().node;
+
+        auto& child = parent->children[entry];
+        if (child == nullptr) {
+            child = std::make_unique<TreeNode>();
+            child->entry = entry;
+            child->parent = parent;
+        }
+
+        entries[entry].calls++;
+        entries[entry].activeDepth++;
+        stack.push_back(ActiveFrame { child.get(), Clock::now(), 0 });
+    }
+
+    void Profiler::exit() {
+        ActiveFrame frame = stack.back();
+        stack.pop_back();
+
+        uint64_t inclusive = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start).count();
+        uint64_t exclusive = inclusive > frame.childNs ? inclusive - frame.childNs : 0;
+
+        Entry& entry = entries[frame.node->entry];
+        entry.activeDepth--;
+        if (entry.activeDepth == 0)
+            entry.inclusiveNs += inclusive;
+        entry.exclusiveNs += exclusive;
+        frame.node->exclusiveNs += exclusive;
+
+        if (!stack.empty())
+            stack.back().childNs += inclusive;
+    }
+
+    void Profiler::recordBranch(bool taken) {
+        Entry& entry = entries[stack.back().node->entry];
+        if (taken)
+            entry.taken++;
+        else
+            entry.notTaken++;
+    }
+
+    void Profiler::releaseStatements() {
+        statementEntries.clear();
+    }
+
+    void Profiler::writeFolded(std::ostream& out, const TreeNode& node, const std::string& path) const {
+        uint64_t micros = node.exclusiveNs / 1000;
+        if (node.entry >= 0 && micros > 0)
+            out << path << " " << micros << "\n";
+
+        for (auto& child : node.children) {
+            // ';' separates frames in the folded format.
+            std::string label = entries[child.first].label;
+            std::replace(label.begin(), label.end(), ';', ',');
+            writeFolded(out, *child.second, path + ";" + label);
+        }
+    }
+
+    void Profiler::writeFoldedStacks(std::ostream& out) const {
+        writeFolded(out, root, "script");
+    }
+
+    void Profiler::writeReport(std::ostream& out) const {
+        std::vector<const Entry*> sorted;
+        uint64_t totalNs = 0;
+        for (auto& entry : entries) {
+            sorted.push_back(&entry);
+            totalNs += entry.exclusiveNs;
+        }
+
+        std::sort(sorted.begin(), sorted.end(), [](const Entry* a, const Entry* b) {
+            return a->exclusiveNs > b->exclusiveNs;
+        });
+
+        out << std::fixed << std::setprecision(3);
+        out << std::setw(12) << "calls" << std::setw(14) << "incl ms" << std::setw(14) << "excl ms"
+            << std::setw(9) << "excl %" << "  name\n";
+
+        for (auto entry : sorted) {
+            double percent = totalNs > 0 ? 100.0 * entry->exclusiveNs / totalNs : 0.0;
+            out << std::setw(12) << entry->calls
+                << std::setw(14) << entry->inclusiveNs / 1e6
+                << std::setw(14) << entry->exclusiveNs / 1e6
+                << std::setw(8) << std::setprecision(1) << percent << "%"
+                << std::setprecision(3) << "  " << entry->label << "\n";
+        }
+
+        std::vector<const Entry*> branches;
+        for (auto& entry : entries) {
+            if (entry.isIf)
+                branches.push_back(&entry);
+        }
+
+        if (branches.empty())
+            return;
+
+        std::sort(branches.begin(), branches.end(), [](const Entry* a, const Entry* b) {
+            return a->line < b->line;
+        });
+
+        out << "\n" << std::setw(12) << "taken" << std::setw(14) << "not taken" << "  branch\n";
+        for (auto entry : branches) {
+            out << std::setw(12) << entry->taken << std::setw(14) << entry->notTaken << "  " << entry->label << "\n";
+        }
+    }
+}
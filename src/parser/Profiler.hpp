@@ -0,0 +1,101 @@
+#pragma once
+#include "parser.hpp"
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    // Instrumenting profiler. While it's installed as activeProfiler, the
+    // evaluator opens a Scope for every statement it executes and every
+    // function it calls, building a call tree with inclusive and exclusive
+    // times. If statements also count how often their branch was taken.
+    //
+    // Time spent in a chain of tail calls is attributed to the function
+    // that started the chain, since they share a frame.
+    class Profiler {
+    public:
+        Profiler();
+
+        class Scope {
+        public:
+            Scope(Profiler& profiler, const ASTNode* statement) : profiler(profiler) {
+                profiler.enter(profiler.statementEntry(statement));
+            }
+
+            Scope(Profiler& profiler, const std::string& functionName) : profiler(profiler) {
+                profiler.enter(profiler.functionEntry(functionName));
+            }
+
+            ~Scope() { profiler.exit(); }
+
+        private:
+            Profiler& profiler;
+        };
+
+        // Records the outcome of the if statement whose Scope is innermost.
+        void recordBranch(bool taken);
+
+        // Statements are looked up by address. Call this before freeing ASTs
+        // that have been profiled so a new node reusing the address doesn't
+        // inherit the old one's label.
+        void releaseStatements();
+
+        // Writes one line per call stack in the format flamegraph.pl and
+        // speedscope expect, weighted by exclusive time in microseconds.
+        void writeFoldedStacks(std::ostream& out) const;
+
+        // Writes a table of every statement and function sorted by
+        // exclusive time, followed by branch counts of if statements.
+        void writeReport(std::ostream& out) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Entry {
+            std::string label;
+            bool isIf = false;
+            int line = 0;
+            uint64_t calls = 0;
+            uint64_t inclusiveNs = 0;
+            uint64_t exclusiveNs = 0;
+            uint64_t taken = 0;
+            uint64_t notTaken = 0;
+            // Activations currently on the stack, so recursive calls don't
+            // count their inclusive time twice.
+            int activeDepth = 0;
+        };
+
+        struct TreeNode {
+            int entry;
+            TreeNode* parent;
+            uint64_t exclusiveNs = 0;
+            std::unordered_map<int, std::unique_ptr<TreeNode>> children;
+        };
+
+        struct ActiveFrame {
+            TreeNode* node;
+            Clock::time_point start;
+            uint64_t childNs;
+        };
+
+        std::vector<Entry> entries;
+        std::unordered_map<const ASTNode*, int> statementEntries;
+        std::unordered_map<std::string, int> labelEntries;
+        TreeNode root;
+        std::vector<ActiveFrame> stack;
+
+        int statementEntry(const ASTNode* statement);
+        int functionEntry(const std::string& functionName);
+        int labelEntry(const std::string& label);
+        void enter(int entry);
+        void exit();
+        void writeFolded(std::ostream& out, const TreeNode& node, const std::string& path) const;
+    };
+
+    // Describes a statement for profiles, e.g. "12: assign x".
+    std::string describeStatement(const ASTNode* statement);
+}
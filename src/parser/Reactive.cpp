@@ -0,0 +1,233 @@
+#include "Reactive.hpp"
+#include "Effects.hpp"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+
+namespace iodine {
+    namespace {
+        bool sameValue(const Value& a, const Value& b) {
+            if (a.type != b.type)
+                return false;
+
+            switch (a.type) {
+            case DataType::Int32:
+                return a.intVal == b.intVal;
+            case DataType::F32:
+                return a.floatVal == b.floatVal;
+            case DataType::F64:
+                return a.doubleVal == b.doubleVal;
+            case DataType::Boolean:
+                return a.boolVal == b.boolVal;
+            case DataType::String:
+                return a.strVal == b.strVal;
+            case DataType::Null:
+                return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    ReactiveScript::ReactiveScript(std::vector<std::shared_ptr<ASTNode>> nodes) {
+        std::unordered_set<std::string> defined;
+        for (auto& node : nodes) {
+            if (node->type != ASTNodeType::FunctionDefinition)
+                continue;
+
+            auto& name = static_cast<FunctionDefinitionNode*>(node.get())->name;
+            if (!defined.insert(name).second)
+                throw std::runtime_error("Function " + name + " is defined more than once");
+        }
+        auto functionEffects = summarizeFunctions(nodes);
+
+        for (auto& node : nodes) {
+            int index = statements.size();
+            Statement statement;
+            statement.node = node;
+
+            Effects effects;
+            collectEffects(node.get(), effects);
+            addCalledEffects(effects, functionEffects);
+
+            // A write that might not happen leaves the previous value in
+            // place, and assigning to an existing global checks its type,
+            // so writes count as reads. Only a top-level declaration
+            // determines its variable by itself.
+            std::string declared;
+            if (node->type == ASTNodeType::VarAssignment) {
+                auto assign = static_cast<VarAssignmentNode*>(node.get());
+                if (assign->createNew)
+                    declared = assign->varName;
+            }
+            for (auto& write : effects.writes) {
+                if (write != declared)
+                    effects.reads.insert(write);
+            }
+
+            for (auto& read : effects.reads) {
+                int var = variableId(read);
+                statement.reads.push_back(lastWriter[var]);
+                readers[var].push_back(index);
+            }
+            for (auto& write : effects.writes) {
+                int var = variableId(write);
+                lastWriter[var] = Read { var, index, (int)statement.writes.size() };
+                statement.writes.push_back(var);
+            }
+
+            statement.after.resize(statement.writes.size());
+            statement.changed.resize(statement.writes.size());
+            statements.push_back(std::move(statement));
+        }
+    }
+
+    int ReactiveScript::variableId(const std::string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end())
+            return it->second;
+
+        int var = names.size();
+        ids[name] = var;
+        names.push_back(name);
+        readers.emplace_back();
+        lastWriter.push_back(Read { var, -1, 0 });
+        initial.emplace_back();
+        inputChanged.push_back(false);
+        return var;
+    }
+
+    ReactiveScript::Binding ReactiveScript::current(int var) const {
+        Binding binding;
+        auto it = variables.find(names[var]);
+        if (it != variables.end()) {
+            binding.defined = true;
+            binding.type = it->second.type;
+            binding.val = it->second.val;
+        }
+        return binding;
+    }
+
+    void ReactiveScript::assign(int var, const Binding& binding) {
+        if (!binding.defined) {
+            variables.erase(names[var]);
+            return;
+        }
+
+        Variable& variable = variables[names[var]];
+        variable.name = names[var];
+        variable.type = binding.type;
+        variable.val = binding.val;
+    }
+
+    void ReactiveScript::run() {
+        hasRun = false;
+        for (size_t var = 0; var < names.size(); var++)
+            initial[var] = current(var);
+
+        for (auto& statement : statements) {
+            evalAST(statement.node);
+            for (size_t slot = 0; slot < statement.writes.size(); slot++)
+                statement.after[slot] = current(statement.writes[slot]);
+        }
+
+        std::fill(inputChanged.begin(), inputChanged.end(), false);
+        hasRun = true;
+    }
+
+    bool ReactiveScript::setInput(const std::string& name, const Value& value) {
+        auto it = ids.find(name);
+        if (it == ids.end())
+            return false;
+
+        int var = it->second;
+        initial[var].defined = true;
+        initial[var].type = value.type;
+        initial[var].val = value;
+
+        // Once the script has run, a global it assigns keeps the value the
+        // script gave it until update() recomputes it.
+        if (!hasRun || lastWriter[var].writer < 0)
+            assign(var, initial[var]);
+        inputChanged[var] = true;
+        return true;
+    }
+
+    size_t ReactiveScript::update() {
+        if (!hasRun)
+            throw std::runtime_error("update() needs a completed run()");
+        hasRun = false;
+
+        std::priority_queue<int, std::vector<int>, std::greater<int>> queue;
+        std::vector<bool> queued(statements.size());
+        auto enqueueReaders = [&](int var, int after) {
+            auto& list = readers[var];
+            for (auto it = std::upper_bound(list.begin(), list.end(), after); it != list.end(); it++) {
+                if (!queued[*it]) {
+                    queued[*it] = true;
+                    queue.push(*it);
+                }
+            }
+        };
+        auto changed = [&](const Read& read) {
+            return read.writer < 0 ? inputChanged[read.var] : statements[read.writer].changed[read.slot];
+        };
+        auto valueAt = [&](const Read& read) -> const Binding& {
+            return read.writer < 0 ? initial[read.var] : statements[read.writer].after[read.slot];
+        };
+
+        for (size_t var = 0; var < names.size(); var++) {
+            if (inputChanged[var])
+                enqueueReaders(var, -1);
+        }
+
+        // Globals now holding something other than their final value.
+        std::vector<int> touched;
+        std::vector<int> reran;
+
+        while (!queue.empty()) {
+            int index = queue.top();
+            queue.pop();
+
+            Statement& statement = statements[index];
+            if (std::none_of(statement.reads.begin(), statement.reads.end(), changed))
+                continue;
+
+            // Globals hold their final values, so everything the statement
+            // reads goes back to what it was at this point.
+            for (auto& read : statement.reads) {
+                assign(read.var, valueAt(read));
+                touched.push_back(read.var);
+            }
+
+            evalAST(statement.node);
+            reran.push_back(index);
+
+            for (size_t slot = 0; slot < statement.writes.size(); slot++) {
+                int var = statement.writes[slot];
+                Binding now = current(var);
+                Binding& before = statement.after[slot];
+
+                bool differs = now.defined != before.defined
+                    || (now.defined && (now.type != before.type || !sameValue(now.val, before.val)));
+                statement.changed[slot] = differs;
+                before = std::move(now);
+                touched.push_back(var);
+
+                if (differs)
+                    enqueueReaders(var, index);
+            }
+        }
+
+        for (int var : touched)
+            assign(var, valueAt(lastWriter[var]));
+
+        for (int index : reran)
+            std::fill(statements[index].changed.begin(), statements[index].changed.end(), false);
+        std::fill(inputChanged.begin(), inputChanged.end(), false);
+
+        hasRun = true;
+        return reran.size();
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "NativeScript.hpp"
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    // Runs a script once, then keeps its globals up to date as the host
+    // changes inputs, re-evaluating only the top-level statements that
+    // depend on what changed.
+    //
+    // Every top-level statement is analyzed up front for the globals it
+    // reads and writes, including through the script functions it calls.
+    // update() visits the statements reading a changed variable in program
+    // order, which is a topological order of the dependencies, and reruns
+    // each with the values its reads had at that point in the original
+    // run. A rerun whose writes come out unchanged stops the propagation
+    // there. When it's done, every global holds the value a full run from
+    // the same inputs would have left.
+    //
+    // Any statement can be rerun, not just assignments, so a println of a
+    // value that changed prints again. Builtins are assumed to depend on
+    // nothing but their arguments.
+    class ReactiveScript : public ScriptExecutor {
+    public:
+        // Throws std::runtime_error if a function is defined more than once,
+        // since reruns would only ever see the last definition.
+        ReactiveScript(std::vector<std::shared_ptr<ASTNode>> statements);
+
+        // Runs every statement, recording the values it leaves behind.
+        void run() override;
+
+        // Sets the value a global has before the script starts, which is
+        // how the host feeds inputs in. Before run() this just defines the
+        // global; after it, the change is applied by the next update().
+        // Returns false if the script never mentions the name.
+        bool setInput(const std::string& name, const Value& value);
+
+        // Reruns what depends on the inputs set since the last run() or
+        // update(), returning how many statements ran. Throws
+        // std::runtime_error if run() hasn't completed; if a statement
+        // throws, call run() again before the next update().
+        size_t update();
+
+    private:
+        // The value a global had at some point of the run. Globals that
+        // don't exist yet are recorded as undefined.
+        struct Binding {
+            bool defined = false;
+            DataType type = DataType::Null;
+            Value val;
+        };
+
+        struct Read {
+            int var;
+            // The last statement before this one that writes var, and
+            // which of its writes it is. -1 means the initial value.
+            int writer;
+            int slot;
+        };
+
+        struct Statement {
+            std::shared_ptr<ASTNode> node;
+            std::vector<Read> reads;
+            std::vector<int> writes;
+            // What each write left behind the last time the statement ran.
+            std::vector<Binding> after;
+            // Which writes changed during the current update().
+            std::vector<bool> changed;
+        };
+
+        std::vector<Statement> statements;
+        std::vector<std::string> names;
+        std::unordered_map<std::string, int> ids;
+        // Per variable: the statements reading it, in order, and the last
+        // writer in the whole script (-1 if none).
+        std::vector<std::vector<int>> readers;
+        std::vector<Read> lastWriter;
+        std::vector<Binding> initial;
+        std::vector<bool> inputChanged;
+        bool hasRun = false;
+
+        int variableId(const std::string& name);
+        Binding current(int var) const;
+        void assign(int var, const Binding& binding);
+    };
+}
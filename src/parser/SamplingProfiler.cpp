@@ -0,0 +1,206 @@
+#include "SamplingProfiler.hpp"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+namespace iodine {
+    thread_local std::atomic<const ASTNode*> currentStatement { nullptr };
+    thread_local std::atomic<const Function*> currentBuiltin { nullptr };
+
+    static_assert(std::atomic<const ASTNode*>::is_always_lock_free, "statement marker must be usable from a signal handler");
+
+    namespace {
+        // Fixed-size open addressing tables, so the signal handler never
+        // has to allocate. Samples that don't fit are counted as dropped.
+        constexpr size_t lineTableSize = 8192;
+        constexpr size_t builtinTableSize = 256;
+
+        struct LineSlot {
+            int line;
+            uint64_t samples;
+        };
+
+        struct BuiltinSlot {
+            const Function* func;
+            uint64_t samples;
+        };
+
+        LineSlot lineTable[lineTableSize];
+        BuiltinSlot builtinTable[builtinTableSize];
+        volatile uint64_t totalSamples = 0;
+        volatile uint64_t idleSamples = 0;
+        volatile uint64_t droppedSamples = 0;
+
+        bool samplerRunning = false;
+        struct sigaction previousAction;
+#ifdef __linux__
+        timer_t timer;
+#endif
+
+        void recordLine(int line) {
+            size_t index = (size_t)line * 2654435761u % lineTableSize;
+            for (size_t probe = 0; probe < lineTableSize; probe++) {
+                LineSlot& slot = lineTable[(index + probe) % lineTableSize];
+                if (slot.samples == 0 || slot.line == line) {
+                    slot.line = line;
+                    slot.samples++;
+                    return;
+                }
+            }
+            droppedSamples++;
+        }
+
+        void recordBuiltin(const Function* func) {
+            size_t index = ((uintptr_t)func >> 4) % builtinTableSize;
+            for (size_t probe = 0; probe < builtinTableSize; probe++) {
+                BuiltinSlot& slot = builtinTable[(index + probe) % builtinTableSize];
+                if (slot.samples == 0 || slot.func == func) {
+                    slot.func = func;
+                    slot.samples++;
+                    return;
+                }
+            }
+            droppedSamples++;
+        }
+
+        void handleSample(int) {
+            totalSamples++;
+
+            const ASTNode* statement = currentStatement.load(std::memory_order_relaxed);
+            if (statement == nullptr)
+                idleSamples++;
+            else
+                recordLine(statement->line);
+
+            const Function* builtin = currentBuiltin.load(std::memory_order_relaxed);
+            if (builtin != nullptr)
+                recordBuiltin(builtin);
+        }
+    }
+
+    SamplingProfiler::SamplingProfiler(int intervalMicros)
+        : intervalMicros(intervalMicros) {
+    }
+
+    SamplingProfiler::~SamplingProfiler() {
+        stop();
+    }
+
+    void SamplingProfiler::start() {
+        if (samplerRunning)
+            throw std::runtime_error("A sampling profiler is already running");
+
+        memset(lineTable, 0, sizeof(lineTable));
+        memset(builtinTable, 0, sizeof(builtinTable));
+        totalSamples = 0;
+        idleSamples = 0;
+        droppedSamples = 0;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handleSample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &previousAction);
+
+        struct timespec interval;
+        interval.tv_sec = intervalMicros / 1000000;
+        interval.tv_nsec = (intervalMicros % 1000000) * 1000;
+
+#ifdef __linux__
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_SIGNAL;
+        event.sigev_signo = SIGPROF;
+        if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &timer) != 0)
+            throw std::runtime_error(std::string("timer_create failed: ") + strerror(errno));
+
+        struct itimerspec spec;
+        spec.it_interval = interval;
+        spec.it_value = interval;
+        timer_settime(timer, 0, &spec, nullptr);
+#else
+        struct itimerval spec;
+        spec.it_interval.tv_sec = interval.tv_sec;
+        spec.it_interval.tv_usec = interval.tv_nsec / 1000;
+        spec.it_value = spec.it_interval;
+        setitimer(ITIMER_PROF, &spec, nullptr);
+#endif
+
+        samplerRunning = true;
+        running = true;
+    }
+
+    void SamplingProfiler::stop() {
+        if (!running)
+            return;
+
+#ifdef __linux__
+        timer_delete(timer);
+#else
+        struct itimerval spec;
+        memset(&spec, 0, sizeof(spec));
+        setitimer(ITIMER_PROF, &spec, nullptr);
+#endif
+        sigaction(SIGPROF, &previousAction, nullptr);
+
+        samplerRunning = false;
+        running = false;
+    }
+
+    uint64_t SamplingProfiler::sampleCount() const {
+        return totalSamples;
+    }
+
+    void SamplingProfiler::writeReport(std::ostream& out, const std::vector<std::string>& sourceLines) const {
+        uint64_t total = totalSamples;
+        auto percent = [total](uint64_t samples) {
+            return total > 0 ? 100.0 * samples / total : 0.0;
+        };
+
+        std::vector<LineSlot> lines;
+        for (auto& slot : lineTable) {
+            if (slot.samples > 0)
+                lines.push_back(slot);
+        }
+        std::sort(lines.begin(), lines.end(), [](const LineSlot& a, const LineSlot& b) {
+            return a.samples > b.samples;
+        });
+
+        out << std::fixed << std::setprecision(1);
+        out << total << " samples every " << intervalMicros << " us of CPU time";
+        if (droppedSamples > 0)
+            out << " (" << droppedSamples << " dropped)";
+        out << "\n\n";
+
+        out << std::setw(10) << "samples" << std::setw(8) << "%" << "  line\n";
+        for (auto& slot : lines) {
+            out << std::setw(10) << slot.samples << std::setw(7) << percent(slot.samples) << "%  " << slot.line;
+            if (slot.line > 0 && (size_t)slot.line <= sourceLines.size())
+                out << ": " << sourceLines[slot.line - 1];
+            out << "\n";
+        }
+        out << std::setw(10) << (uint64_t)idleSamples << std::setw(7) << percent(idleSamples) << "%  (not evaluating)\n";
+
+        std::vector<BuiltinSlot> builtins;
+        for (auto& slot : builtinTable) {
+            if (slot.samples > 0)
+                builtins.push_back(slot);
+        }
+        if (builtins.empty())
+            return;
+
+        std::sort(builtins.begin(), builtins.end(), [](const BuiltinSlot& a, const BuiltinSlot& b) {
+            return a.samples > b.samples;
+        });
+
+        out << "\n" << std::setw(10) << "samples" << std::setw(8) << "%" << "  builtin\n";
+        for (auto& slot : builtins)
+            out << std::setw(10) << slot.samples << std::setw(7) << percent(slot.samples) << "%  " << slot.func->name << "\n";
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "parser.hpp"
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace iodine {
+    // Statistical profiler driven by a CPU-time timer. Every interval a
+    // SIGPROF handler reads the interrupted thread's currentStatement and
+    // currentBuiltin and bumps a counter for the statement's source line
+    // and the running builtin.
+    // The handler doesn't allocate or lock, and the evaluator only pays for
+    // the marker stores, so it's cheap enough to leave on in production.
+    //
+    // Only one sampler can run at a time, and samples are attributed to
+    // whichever thread the signal lands on, so it's meant for
+    // single-threaded runners like scriptrunner.
+    class SamplingProfiler {
+    public:
+        explicit SamplingProfiler(int intervalMicros = 1000);
+        ~SamplingProfiler();
+
+        void start();
+        void stop();
+
+        uint64_t sampleCount() const;
+
+        // Writes per-line and per-builtin sample counts, hottest first. If
+        // the script's source lines are given they're printed alongside.
+        void writeReport(std::ostream& out, const std::vector<std::string>& sourceLines = {}) const;
+
+    private:
+        int intervalMicros;
+        bool running = false;
+    };
+}
@@ -0,0 +1,152 @@
+#include "Trace.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace iodine {
+    std::atomic<bool> tracingEnabled { false };
+
+    namespace {
+        struct TraceEvent {
+            const char* name;
+            const char* category;
+            uint64_t startNs;
+            uint64_t durationNs;
+            int line;
+        };
+
+        // Buffers are linked lists of fixed-size chunks so the writer never
+        // moves events the flusher might be reading. Each count is published
+        // with release ordering after the event it covers is written.
+        struct TraceChunk {
+            static constexpr size_t capacity = 4096;
+
+            TraceEvent events[capacity];
+            std::atomic<size_t> count { 0 };
+            std::atomic<TraceChunk*> next { nullptr };
+        };
+
+        struct ThreadBuffer {
+            int threadId;
+            TraceChunk head;
+            TraceChunk* tail = &head;
+            std::vector<std::unique_ptr<TraceChunk>> owned;
+
+            void append(const TraceEvent& event) {
+                size_t count = tail->count.load(std::memory_order_relaxed);
+                if (count == TraceChunk::capacity) {
+                    owned.push_back(std::make_unique<TraceChunk>());
+                    TraceChunk* chunk = owned.back().get();
+                    tail->next.store(chunk, std::memory_order_release);
+                    tail = chunk;
+                    count = 0;
+                }
+
+                tail->events[count] = event;
+                tail->count.store(count + 1, std::memory_order_release);
+            }
+        };
+
+        // Only touched when a thread records its first span and when the
+        // trace is written.
+        std::mutex registryMutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> registry;
+        std::string tracePath;
+        bool exitHandlerInstalled = false;
+
+        thread_local ThreadBuffer* threadBuffer = nullptr;
+
+        ThreadBuffer* currentBuffer() {
+            if (threadBuffer == nullptr) {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                registry.push_back(std::make_unique<ThreadBuffer>());
+                registry.back()->threadId = (int)registry.size();
+                threadBuffer = registry.back().get();
+            }
+            return threadBuffer;
+        }
+
+        void writeString(std::ostream& out, const char* str) {
+            out << '"';
+            for (; *str != '\0'; str++) {
+                if (*str == '"' || *str == '\\')
+                    out << '\\';
+                out << *str;
+            }
+            out << '"';
+        }
+
+        void writeTrace() {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            if (tracePath.empty())
+                return;
+
+            std::ofstream out(tracePath);
+            int pid = getpid();
+
+            out << "{\"traceEvents\": [\n";
+            out << std::fixed << std::setprecision(3);
+
+            bool first = true;
+            for (auto& buffer : registry) {
+                out << (first ? "" : ",\n")
+                    << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << buffer->threadId
+                    << ", \"args\": {\"name\": \"iodine " << buffer->threadId << "\"}}";
+                first = false;
+
+                for (TraceChunk* chunk = &buffer->head; chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire)) {
+                    size_t count = chunk->count.load(std::memory_order_acquire);
+                    for (size_t i = 0; i < count; i++) {
+                        const TraceEvent& event = chunk->events[i];
+                        out << ",\n{\"name\": ";
+                        writeString(out, event.name);
+                        out << ", \"cat\": ";
+                        writeString(out, event.category);
+                        out << ", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << buffer->threadId
+                            << ", \"ts\": " << event.startNs / 1000.0 << ", \"dur\": " << event.durationNs / 1000.0;
+                        if (event.line > 0)
+                            out << ", \"args\": {\"line\": " << event.line << "}";
+                        out << "}";
+                    }
+                }
+            }
+
+            out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+            tracePath.clear();
+        }
+    }
+
+    void startTracing(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            tracePath = path;
+
+            if (!exitHandlerInstalled) {
+                atexit(stopTracing);
+                exitHandlerInstalled = true;
+            }
+        }
+
+        tracingEnabled.store(true, std::memory_order_relaxed);
+    }
+
+    void stopTracing() {
+        tracingEnabled.store(false, std::memory_order_relaxed);
+        writeTrace();
+    }
+
+    uint64_t traceNowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void recordTraceSpan(const char* name, const char* category, uint64_t startNs, int line) {
+        uint64_t endNs = traceNowNs();
+        currentBuffer()->append(TraceEvent { name, category, startNs, endNs - startNs, line });
+    }
+}
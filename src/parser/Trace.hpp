@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace iodine {
+    // Chrome trace-event recorder, viewable in chrome://tracing or Perfetto.
+    // Each thread appends completed spans to its own buffer without locking;
+    // the buffers are written out as one JSON file by stopTracing, or at
+    // exit if tracing is still running.
+    extern std::atomic<bool> tracingEnabled;
+
+    // Starts recording and arranges for the trace to be written to path
+    // when the process exits.
+    void startTracing(const std::string& path);
+
+    // Stops recording and writes everything recorded so far. Threads still
+    // recording may lose their last few spans.
+    void stopTracing();
+
+    uint64_t traceNowNs();
+    void recordTraceSpan(const char* name, const char* category, uint64_t startNs, int line);
+
+    // Records the time between construction and destruction as one span.
+    // Name and category must outlive the trace, so they're usually string
+    // literals, enum names or function names. Costs one relaxed load when
+    // tracing is off.
+    class TraceSpan {
+    public:
+        TraceSpan(const char* name, const char* category, int line = 0)
+            : name(name), category(category), line(line) {
+            if (tracingEnabled.load(std::memory_order_relaxed))
+                startNs = traceNowNs();
+        }
+
+        ~TraceSpan() {
+            if (startNs != 0)
+                recordTraceSpan(name, category, startNs, line);
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+        const char* name;
+        const char* category;
+        int line;
+        uint64_t startNs = 0;
+    };
+}
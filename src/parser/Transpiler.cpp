@@ -0,0 +1,846 @@
+#include "NativeScript.hpp"
+#include <math.h>
+#include <stdio.h>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace iodine {
+    namespace {
+        // What an expression compiles to. Value is used when the type is
+        // only known at runtime; Unknown only while inferring the return
+        // types of recursive functions.
+        enum class CppType {
+            Int,
+            Float,
+            Double,
+            Bool,
+            String,
+            Null,
+            Value,
+            Unknown
+        };
+
+        const char* cppTypeName(CppType type) {
+            switch (type) {
+            case CppType::Int: return "int";
+            case CppType::Float: return "float";
+            case CppType::Double: return "double";
+            case CppType::Bool: return "bool";
+            case CppType::String: return "InternedString";
+            case CppType::Null: return "void";
+            default: return "Value";
+            }
+        }
+
+        CppType cppType(DataType type) {
+            switch (type) {
+            case DataType::Int32: return CppType::Int;
+            case DataType::F32: return CppType::Float;
+            case DataType::F64: return CppType::Double;
+            case DataType::Boolean: return CppType::Bool;
+            case DataType::String: return CppType::String;
+            default: return CppType::Value;
+            }
+        }
+
+        bool isNumeric(CppType type) {
+            return type == CppType::Int || type == CppType::Float || type == CppType::Double;
+        }
+
+        // Same rule as getHighestPrecisionType.
+        CppType promote(CppType a, CppType b) {
+            if (a == CppType::Double || b == CppType::Double)
+                return CppType::Double;
+            if (a == CppType::Float || b == CppType::Float)
+                return CppType::Float;
+            return CppType::Int;
+        }
+
+        CppType join(CppType a, CppType b) {
+            if (a == CppType::Unknown)
+                return b;
+            if (b == CppType::Unknown || a == b)
+                return a;
+            return CppType::Value;
+        }
+
+        struct Expr {
+            std::string code;
+            CppType type;
+            bool calls = false;
+        };
+
+        struct LocalVariable {
+            std::string name;
+            DataType type;
+        };
+
+        struct FunctionInfo {
+            FunctionDefinitionNode* def;
+            std::map<int, LocalVariable> locals;
+            CppType returnType = CppType::Unknown;
+        };
+
+        const char* prelude = R"(// Generated by Iodine from a script. Don't edit.
+#include <parser.hpp>
+#include <initializer_list>
+#include <stdexcept>
+
+using namespace iodine;
+
+namespace {
+    template <typename T = Value>
+    T fail(const char* message) {
+        throw std::runtime_error(message);
+    }
+
+    Value negated(Value val) {
+        val.flipSign();
+        return val;
+    }
+
+    template <typename T>
+    T assigned(const Value& val, DataType type, const char* name) {
+        if (val.type != type) {
+            throw std::runtime_error(std::string("Assignment to variable ") + name + " ("
+                + dataTypeNames[type] + ") with wrong type " + dataTypeNames[val.type]);
+        }
+        return val.as<T>();
+    }
+
+    Function* findBuiltin(const char* name) {
+        auto it = functions.find(name);
+        return it != functions.end() && it->second.isBuiltin ? &it->second : nullptr;
+    }
+
+    // Builtins take AST nodes, so each call site keeps constant nodes to
+    // pass its argument values in.
+    FuncArgs makeArgs(size_t count) {
+        FuncArgs args;
+        for (size_t i = 0; i < count; i++)
+            args.push_back(std::make_shared<ConstValNode>());
+        return args;
+    }
+
+    Value callBuiltin(Function* func, FuncArgs& args, std::initializer_list<Value> values) {
+        if (func == nullptr)
+            throw std::runtime_error("Tried to call nonexistent function");
+
+        size_t i = 0;
+        for (auto& val : values)
+            static_cast<ConstValNode*>(args[i++].get())->val = val;
+
+        if (func->callCounter == nullptr)
+            func->callCounter = &metrics::nativeCalls.labeled(func->name);
+        func->callCounter->increment();
+
+        BuiltinMarker marker(func);
+        TraceSpan span(func->name.c_str(), "native");
+        return func->nativeFunc(args);
+    }
+)";
+
+        class Transpiler {
+        public:
+            std::string transpile(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+                for (auto& statement : statements)
+                    parseLazyBodies(statement.get());
+
+                for (auto& statement : statements) {
+                    if (statement->type == ASTNodeType::FunctionDefinition) {
+                        auto def = static_cast<FunctionDefinitionNode*>(statement.get());
+                        if (functionInfo.count(def->name))
+                            unsupported("function " + def->name + " is defined more than once");
+                        // Calls are bound to f_<name> up front, but until the
+                        // definition runs the interpreter calls the builtin.
+                        auto builtin = functions.find(def->name);
+                        if (builtin != functions.end() && builtin->second.isBuiltin)
+                            unsupported("function " + def->name + " shadows a builtin");
+                        functionInfo[def->name].def = def;
+                        functionOrder.push_back(def->name);
+                    } else {
+                        collectGlobals(statement.get());
+                    }
+                }
+
+                for (auto& name : functionOrder)
+                    collectLocals(functionInfo[name]);
+                inferReturnTypes();
+
+                std::stringstream functionsOut;
+                for (auto& name : functionOrder)
+                    emitFunction(functionsOut, functionInfo[name]);
+
+                std::stringstream runOut;
+                for (auto& statement : statements) {
+                    if (statement->type != ASTNodeType::FunctionDefinition)
+                        emitStatement(runOut, statement.get(), nullptr, 1);
+                }
+
+                std::stringstream out;
+                out << prelude;
+
+                if (!strings.empty())
+                    out << "\n";
+                for (size_t i = 0; i < strings.size(); i++)
+                    out << "    const InternedString s" << i << "(" << stringLiteral(strings[i]) << ", " << strings[i].size() << ");\n";
+
+                if (!globalOrder.empty())
+                    out << "\n";
+                for (auto& name : globalOrder)
+                    out << "    " << cppTypeName(cppType(globals[name])) << " g_" << name << " = 0;\n";
+
+                if (!builtinNames.empty())
+                    out << "\n";
+                for (size_t i = 0; i < builtinNames.size(); i++)
+                    out << "    Function* b" << i << " = nullptr;\n";
+                for (size_t i = 0; i < callSiteArgCounts.size(); i++)
+                    out << "    FuncArgs a" << i << " = makeArgs(" << callSiteArgCounts[i] << ");\n";
+
+                if (!functionOrder.empty())
+                    out << "\n";
+                for (auto& name : functionOrder)
+                    out << "    " << signature(functionInfo[name]) << ";\n";
+
+                out << functionsOut.str();
+                out << "}\n\n";
+
+                out << "extern \"C\" void iodine_aot_run() {\n";
+                for (size_t i = 0; i < builtinNames.size(); i++)
+                    out << "    b" << i << " = findBuiltin(" << stringLiteral(builtinNames[i]) << ");\n";
+                out << runOut.str();
+                out << "}\n";
+
+                return out.str();
+            }
+
+        private:
+            std::unordered_map<std::string, FunctionInfo> functionInfo;
+            std::vector<std::string> functionOrder;
+            std::unordered_map<std::string, DataType> globals;
+            std::vector<std::string> globalOrder;
+            std::vector<std::string> strings;
+            std::unordered_map<std::string, size_t> builtinIndices;
+            std::vector<std::string> builtinNames;
+            std::vector<size_t> callSiteArgCounts;
+            size_t operandCount = 0;
+
+            [[noreturn]] void unsupported(const std::string& message) {
+                throw std::runtime_error("Can't transpile: " + message);
+            }
+
+            static std::string indentation(int indent) {
+                return std::string(indent * 4, ' ');
+            }
+
+            static std::string stringLiteral(const std::string& str) {
+                std::string literal = "\"";
+                for (unsigned char c : str) {
+                    if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || c == '?') {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\%03o", c);
+                        literal += escaped;
+                    } else {
+                        literal += (char)c;
+                    }
+                }
+                return literal + "\"";
+            }
+
+            void parseLazyBodies(ASTNode* node) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    for (auto& child : ifNode->nodes)
+                        parseLazyBodies(child.get());
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                {
+                    auto def = static_cast<FunctionDefinitionNode*>(node);
+                    if (def->lazyBody != nullptr)
+                        parseLazyBody(*def);
+                    for (auto& child : def->body)
+                        parseLazyBodies(child.get());
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                    for (auto& child : static_cast<LoopNode*>(node)->nodes)
+                        parseLazyBodies(child.get());
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            // Calls visit on every statement under node, including loop
+            // initializers and steps, without entering function bodies.
+            template <typename Visit>
+            void forEachStatement(ASTNode* node, Visit visit) {
+                if (node == nullptr)
+                    return;
+                visit(node);
+
+                switch (node->type) {
+                case ASTNodeType::If:
+                    for (auto& child : static_cast<IfNode*>(node)->nodes)
+                        forEachStatement(child.get(), visit);
+                    break;
+                case ASTNodeType::For:
+                    forEachStatement(static_cast<ForNode*>(node)->init.get(), visit);
+                    forEachStatement(static_cast<ForNode*>(node)->step.get(), visit);
+                    // Fall through
+                case ASTNodeType::While:
+                    for (auto& child : static_cast<LoopNode*>(node)->nodes)
+                        forEachStatement(child.get(), visit);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            void collectGlobals(ASTNode* statement) {
+                forEachStatement(statement, [this](ASTNode* node) {
+                    if (node->type != ASTNodeType::VarAssignment)
+                        return;
+                    auto assign = static_cast<VarAssignmentNode*>(node);
+                    if (!assign->createNew || assign->localSlot >= 0)
+                        return;
+
+                    auto it = globals.find(assign->varName);
+                    if (it == globals.end()) {
+                        globals[assign->varName] = assign->type;
+                        globalOrder.push_back(assign->varName);
+                    } else if (it->second != assign->type) {
+                        unsupported("variable " + assign->varName + " is declared as both "
+                            + dataTypeNames[it->second] + " and " + dataTypeNames[assign->type]);
+                    }
+                });
+            }
+
+            void collectLocals(FunctionInfo& info) {
+                auto declare = [&](int slot, const std::string& name, DataType type) {
+                    auto it = info.locals.find(slot);
+                    if (it == info.locals.end())
+                        info.locals[slot] = LocalVariable { name, type };
+                    else if (it->second.type != type)
+                        unsupported("variable " + name + " in " + info.def->name + " is declared as both "
+                            + dataTypeNames[it->second.type] + " and " + dataTypeNames[type]);
+                };
+
+                for (size_t i = 0; i < info.def->params.size(); i++)
+                    declare((int)i, info.def->params[i].name, info.def->params[i].type);
+
+                for (auto& statement : info.def->body) {
+                    forEachStatement(statement.get(), [&](ASTNode* node) {
+                        if (node->type == ASTNodeType::FunctionDefinition)
+                            unsupported("functions can only be defined at the top level");
+                        if (node->type != ASTNodeType::VarAssignment)
+                            return;
+                        auto assign = static_cast<VarAssignmentNode*>(node);
+                        if (assign->createNew && assign->localSlot >= 0)
+                            declare(assign->localSlot, assign->varName, assign->type);
+                    });
+                }
+            }
+
+            CppType variableType(const std::string& name, int localSlot, FunctionInfo* function) {
+                if (localSlot >= 0 && function != nullptr) {
+                    auto it = function->locals.find(localSlot);
+                    if (it != function->locals.end())
+                        return cppType(it->second.type);
+                }
+
+                auto it = globals.find(name);
+                return it != globals.end() ? cppType(it->second) : CppType::Value;
+            }
+
+            // Static type of an expression given what's known about return
+            // types so far. Mirrors the types emitExpression produces.
+            CppType typeOf(ProducesValueNode* node, FunctionInfo* function) {
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                {
+                    DataType type = static_cast<ConstValNode*>(node)->val.type;
+                    return type == DataType::Null ? CppType::Value : cppType(type);
+                }
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    return variableType(ref->varName, ref->localSlot, function);
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    return variableType(init->varName, init->localSlot, function);
+                }
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    CppType a = typeOf(arith->a.get(), function);
+                    CppType b = typeOf(arith->b.get(), function);
+                    if (a == CppType::Unknown || b == CppType::Unknown)
+                        return CppType::Unknown;
+                    if (isNumeric(a) && isNumeric(b))
+                        return promote(a, b);
+                    if (a == CppType::String && b == CppType::String && arith->operation == ArithmeticOperation::Add)
+                        return CppType::String;
+                    return CppType::Value;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    CppType type = typeOf(unary->valNode.get(), function);
+                    if (type == CppType::Unknown || isNumeric(type) || unary->operation == UnaryOperation::Plus)
+                        return type;
+                    return CppType::Value;
+                }
+                case ASTNodeType::Comparison:
+                    return CppType::Bool;
+                case ASTNodeType::FunctionCall:
+                {
+                    auto it = functionInfo.find(static_cast<FunctionCallNode*>(node)->functionName);
+                    return it != functionInfo.end() ? it->second.returnType : CppType::Value;
+                }
+                case ASTNodeType::LoopInvariant:
+                    return typeOf(static_cast<LoopInvariantNode*>(node)->expr.get(), function);
+                case ASTNodeType::CommonValue:
+                    return typeOf(static_cast<CommonValueNode*>(node)->expr.get(), function);
+                default:
+                    unsupported(std::string("expression of type ") + nodeTypeNames[node->type]);
+                }
+            }
+
+            // A function's return type is the join of what its return
+            // statements return, with Null if it can fall off the end.
+            // Iterates because recursive calls depend on the result.
+            void inferReturnTypes() {
+                auto iterate = [this]() {
+                    bool changed = true;
+                    while (changed) {
+                        changed = false;
+                        for (auto& name : functionOrder) {
+                            FunctionInfo& info = functionInfo[name];
+                            CppType type = CppType::Unknown;
+
+                            for (auto& statement : info.def->body) {
+                                forEachStatement(statement.get(), [&](ASTNode* node) {
+                                    if (node->type != ASTNodeType::Return)
+                                        return;
+                                    auto ret = static_cast<ReturnNode*>(node);
+                                    type = join(type, ret->valNode != nullptr ? typeOf(ret->valNode.get(), &info) : CppType::Null);
+                                });
+                            }
+
+                            if (info.def->body.empty() || info.def->body.back()->type != ASTNodeType::Return)
+                                type = join(type, CppType::Null);
+
+                            if (type != info.returnType) {
+                                info.returnType = type;
+                                changed = true;
+                            }
+                        }
+                    }
+                };
+
+                iterate();
+
+                // Functions that only ever return their own result.
+                for (auto& name : functionOrder) {
+                    if (functionInfo[name].returnType == CppType::Unknown)
+                        functionInfo[name].returnType = CppType::Value;
+                }
+                iterate();
+            }
+
+            std::string signature(FunctionInfo& info) {
+                std::string result = std::string(cppTypeName(info.returnType)) + " f_" + info.def->name + "(";
+                for (size_t i = 0; i < info.def->params.size(); i++) {
+                    if (i > 0)
+                        result += ", ";
+                    result += std::string(cppTypeName(cppType(info.def->params[i].type))) + " l_" + info.def->params[i].name;
+                }
+                return result + ")";
+            }
+
+            static std::string boxed(const Expr& expr) {
+                switch (expr.type) {
+                case CppType::Value:
+                    return expr.code;
+                case CppType::Null:
+                    return "(" + expr.code + ", Value())";
+                default:
+                    return "Value(" + expr.code + ")";
+                }
+            }
+
+            static std::string cast(const Expr& expr, CppType type) {
+                if (expr.type == type)
+                    return expr.code;
+                return "(" + std::string(cppTypeName(type)) + ")" + expr.code;
+            }
+
+            // C++ leaves the order of operands and arguments open, so when
+            // any of them calls something, binds them all to locals in order
+            // and returns the declarations for sequenced to wrap around the
+            // code that uses them. Empty when the order can't matter.
+            std::string bindOperands(std::vector<Expr*> operands) {
+                bool calls = false;
+                for (Expr* operand : operands)
+                    calls = calls || operand->calls;
+                if (!calls)
+                    return "";
+
+                std::string bindings;
+                for (Expr* operand : operands) {
+                    std::string name = "o" + std::to_string(operandCount++);
+                    if (operand->type == CppType::Null)
+                        *operand = Expr { boxed(*operand), CppType::Value };
+                    bindings += "auto " + name + " = " + operand->code + "; ";
+                    operand->code = name;
+                }
+                return bindings;
+            }
+
+            static Expr sequenced(const std::string& bindings, Expr expr) {
+                if (!bindings.empty())
+                    expr.code = "[&] { " + bindings + "return " + expr.code + "; }()";
+                expr.calls = true;
+                return expr;
+            }
+
+            // What Value::as(type) gives, for declarations and arguments.
+            static std::string converted(const Expr& expr, DataType type) {
+                CppType target = cppType(type);
+                if (expr.type == target)
+                    return expr.code;
+                if (isNumeric(expr.type) || expr.type == CppType::Bool)
+                    return cast(expr, target);
+                return boxed(expr) + ".as<" + cppTypeName(target) + ">()";
+            }
+
+            static std::string condition(const Expr& expr) {
+                if (isNumeric(expr.type) || expr.type == CppType::Bool)
+                    return expr.code;
+                return boxed(expr) + ".as<bool>()";
+            }
+
+            Expr variable(const std::string& name, int localSlot, FunctionInfo* function) {
+                if (localSlot >= 0 && function != nullptr && function->locals.count(localSlot))
+                    return Expr { "l_" + name, cppType(function->locals[localSlot].type) };
+
+                auto it = globals.find(name);
+                if (it == globals.end())
+                    return Expr { "fail(" + stringLiteral("Nonexistent variable " + name + " referenced") + ")", CppType::Value };
+                return Expr { "g_" + name, cppType(it->second) };
+            }
+
+            Expr constant(const Value& val) {
+                switch (val.type) {
+                case DataType::Int32:
+                    return Expr { val.intVal < 0 ? "(" + std::to_string(val.intVal) + ")" : std::to_string(val.intVal), CppType::Int };
+                case DataType::F32:
+                case DataType::F64:
+                {
+                    double number = val.type == DataType::F32 ? val.floatVal : val.doubleVal;
+                    if (!isfinite(number))
+                        unsupported("non-finite constant");
+
+                    // Hex floats are exact.
+                    char text[64];
+                    snprintf(text, sizeof(text), "%a", number);
+                    if (val.type == DataType::F32)
+                        return Expr { "(float)(" + std::string(text) + ")", CppType::Float };
+                    return Expr { "(" + std::string(text) + ")", CppType::Double };
+                }
+                case DataType::Boolean:
+                    return Expr { val.boolVal ? "true" : "false", CppType::Bool };
+                case DataType::String:
+                    strings.push_back(val.strVal.str());
+                    return Expr { "s" + std::to_string(strings.size() - 1), CppType::String };
+                case DataType::Null:
+                    return Expr { "Value()", CppType::Value };
+                default:
+                    unsupported(std::string("constant of type ") + dataTypeNames[val.type]);
+                }
+            }
+
+            Expr call(FunctionCallNode* call, FunctionInfo* function) {
+                std::vector<Expr> args;
+                for (auto& arg : call->args)
+                    args.push_back(emitExpression(arg.get(), function));
+
+                auto it = functionInfo.find(call->functionName);
+                if (it != functionInfo.end()) {
+                    auto& params = it->second.def->params;
+                    if (params.size() != args.size())
+                        unsupported("call to " + call->functionName + " with "
+                            + std::to_string(args.size()) + " arguments instead of " + std::to_string(params.size()));
+
+                    std::vector<Expr*> operands;
+                    for (auto& arg : args)
+                        operands.push_back(&arg);
+                    std::string bindings = bindOperands(operands);
+
+                    std::string code = "f_" + call->functionName + "(";
+                    for (size_t i = 0; i < args.size(); i++) {
+                        if (i > 0)
+                            code += ", ";
+                        code += converted(args[i], params[i].type);
+                    }
+                    return sequenced(bindings, Expr { code + ")", it->second.returnType });
+                }
+
+                auto builtin = builtinIndices.find(call->functionName);
+                if (builtin == builtinIndices.end()) {
+                    builtin = builtinIndices.emplace(call->functionName, builtinNames.size()).first;
+                    builtinNames.push_back(call->functionName);
+                }
+
+                size_t site = callSiteArgCounts.size();
+                callSiteArgCounts.push_back(args.size());
+
+                std::string code = "callBuiltin(b" + std::to_string(builtin->second) + ", a" + std::to_string(site) + ", {";
+                for (size_t i = 0; i < args.size(); i++) {
+                    if (i > 0)
+                        code += ", ";
+                    code += boxed(args[i]);
+                }
+                // Braced lists are evaluated in order already.
+                return Expr { code + "})", CppType::Value, true };
+            }
+
+            Expr emitExpression(ProducesValueNode* node, FunctionInfo* function) {
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                    return constant(static_cast<ConstValNode*>(node)->val);
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    return variable(ref->varName, ref->localSlot, function);
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    return variable(init->varName, init->localSlot, function);
+                }
+                case ASTNodeType::LoopInvariant:
+                    // Left to the C++ compiler to hoist.
+                    return emitExpression(static_cast<LoopInvariantNode*>(node)->expr.get(), function);
+                case ASTNodeType::CommonValue:
+                    return emitExpression(static_cast<CommonValueNode*>(node)->expr.get(), function);
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    Expr a = emitExpression(arith->a.get(), function);
+                    Expr b = emitExpression(arith->b.get(), function);
+                    bool calls = a.calls || b.calls;
+                    std::string bindings = bindOperands({ &a, &b });
+
+                    const char* op = " + ";
+                    switch (arith->operation) {
+                    case ArithmeticOperation::Subtract: op = " - "; break;
+                    case ArithmeticOperation::Multiply: op = " * "; break;
+                    case ArithmeticOperation::Divide: op = " / "; break;
+                    default: break;
+                    }
+
+                    Expr result { "", CppType::Value };
+                    if (isNumeric(a.type) && isNumeric(b.type)) {
+                        CppType type = promote(a.type, b.type);
+                        result = Expr { "(" + cast(a, type) + op + cast(b, type) + ")", type };
+                    } else if (a.type == CppType::String && b.type == CppType::String && arith->operation == ArithmeticOperation::Add) {
+                        result = Expr { "(" + a.code + " + " + b.code + ")", CppType::String };
+                    } else {
+                        result.code = "(" + boxed(a) + op + boxed(b) + ")";
+                    }
+                    return calls ? sequenced(bindings, result) : result;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    Expr val = emitExpression(unary->valNode.get(), function);
+                    if (unary->operation == UnaryOperation::Plus)
+                        return val;
+                    if (isNumeric(val.type))
+                        return Expr { "(-" + val.code + ")", val.type, val.calls };
+                    return Expr { "negated(" + boxed(val) + ")", CppType::Value, val.calls };
+                }
+                case ASTNodeType::Comparison:
+                {
+                    auto comp = static_cast<ComparisonNode*>(node);
+                    Expr lhs = emitExpression(comp->lhs.get(), function);
+                    Expr rhs = emitExpression(comp->rhs.get(), function);
+                    bool calls = lhs.calls || rhs.calls;
+                    std::string bindings = bindOperands({ &lhs, &rhs });
+
+                    Expr result { "", CppType::Bool };
+                    if (comp->compType == ComparisonType::Equal) {
+                        if (lhs.type == rhs.type && lhs.type != CppType::Value && lhs.type != CppType::Null)
+                            result.code = "(" + lhs.code + " == " + rhs.code + ")";
+                        else
+                            result.code = boxed(lhs) + ".isEqual(" + boxed(rhs) + ").boolVal";
+                        return calls ? sequenced(bindings, result) : result;
+                    }
+
+                    // Same operand order as ComparisonNode::getValue, so NaN
+                    // compares the same way.
+                    std::string less, greater;
+                    if (isNumeric(lhs.type) && isNumeric(rhs.type)) {
+                        CppType type = promote(lhs.type, rhs.type);
+                        less = "(" + cast(lhs, type) + " < " + cast(rhs, type) + ")";
+                        greater = "(" + cast(rhs, type) + " < " + cast(lhs, type) + ")";
+                    } else {
+                        less = boxed(lhs) + ".isLessThan(" + boxed(rhs) + ").boolVal";
+                        greater = boxed(rhs) + ".isLessThan(" + boxed(lhs) + ").boolVal";
+                    }
+
+                    switch (comp->compType) {
+                    case ComparisonType::LessThan: result.code = less; break;
+                    case ComparisonType::GreaterThan: result.code = greater; break;
+                    case ComparisonType::LessThanOrEqual: result.code = "!" + greater; break;
+                    default: result.code = "!" + less; break;
+                    }
+                    return calls ? sequenced(bindings, result) : result;
+                }
+                case ASTNodeType::FunctionCall:
+                    return call(static_cast<FunctionCallNode*>(node), function);
+                default:
+                    unsupported(std::string("expression of type ") + nodeTypeNames[node->type]);
+                }
+            }
+
+            void emitBlock(std::ostream& out, const std::vector<std::shared_ptr<ASTNode>>& nodes, FunctionInfo* function, int indent) {
+                for (auto& node : nodes)
+                    emitStatement(out, node.get(), function, indent);
+            }
+
+            void emitAssignment(std::ostream& out, VarAssignmentNode* assign, FunctionInfo* function, int indent) {
+                Expr val = emitExpression(assign->valNode.get(), function);
+                Expr target = variable(assign->varName, assign->localSlot, function);
+
+                if (target.type == CppType::Value) {
+                    out << indentation(indent) << "(void)" << val.code << ";\n";
+                    out << indentation(indent) << "fail(" << stringLiteral("Reference to undefined variable " + assign->varName) << ");\n";
+                    return;
+                }
+
+                out << indentation(indent) << target.code << " = ";
+                if (assign->createNew) {
+                    out << converted(val, assign->type);
+                } else if (val.type == target.type) {
+                    out << val.code;
+                } else {
+                    // Variables are always numeric.
+                    const char* type = target.type == CppType::Int ? "DataType::Int32" : target.type == CppType::Float ? "DataType::F32" : "DataType::F64";
+                    out << "assigned<" << cppTypeName(target.type) << ">(" << boxed(val) << ", " << type
+                        << ", " << stringLiteral(assign->varName) << ")";
+                }
+                out << ";\n";
+            }
+
+            void emitReturn(std::ostream& out, ReturnNode* ret, FunctionInfo* function, int indent) {
+                if (function == nullptr)
+                    unsupported("return outside of function");
+
+                std::string pad = indentation(indent);
+                CppType type = function->returnType;
+
+                if (ret->valNode == nullptr) {
+                    out << pad << (type == CppType::Null ? "return;\n" : "return Value();\n");
+                    return;
+                }
+
+                Expr val = emitExpression(ret->valNode.get(), function);
+                if (type == CppType::Null) {
+                    out << pad << val.code << ";\n" << pad << "return;\n";
+                } else if (type == CppType::Value) {
+                    out << pad << "return " << boxed(val) << ";\n";
+                } else if (val.type == type) {
+                    out << pad << "return " << val.code << ";\n";
+                } else {
+                    unsupported("return type of " + function->def->name + " doesn't match its return statements");
+                }
+            }
+
+            void emitStatement(std::ostream& out, ASTNode* node, FunctionInfo* function, int indent) {
+                std::string pad = indentation(indent);
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                    emitAssignment(out, static_cast<VarAssignmentNode*>(node), function, indent);
+                    break;
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    out << pad << "if (" << condition(emitExpression(ifNode->condition.get(), function)) << ") {\n";
+                    emitBlock(out, ifNode->nodes, function, indent + 1);
+                    out << pad << "}\n";
+                    break;
+                }
+                case ASTNodeType::While:
+                {
+                    auto loop = static_cast<WhileNode*>(node);
+                    out << pad << "while (" << condition(emitExpression(loop->condition.get(), function)) << ") {\n";
+                    emitBlock(out, loop->nodes, function, indent + 1);
+                    out << pad << "}\n";
+                    break;
+                }
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<ForNode*>(node);
+                    out << pad << "{\n";
+                    if (loop->init != nullptr)
+                        emitStatement(out, loop->init.get(), function, indent + 1);
+                    out << indentation(indent + 1) << "while (" << condition(emitExpression(loop->condition.get(), function)) << ") {\n";
+                    emitBlock(out, loop->nodes, function, indent + 2);
+                    if (loop->step != nullptr)
+                        emitStatement(out, loop->step.get(), function, indent + 2);
+                    out << indentation(indent + 1) << "}\n";
+                    out << pad << "}\n";
+                    break;
+                }
+                case ASTNodeType::Return:
+                    emitReturn(out, static_cast<ReturnNode*>(node), function, indent);
+                    break;
+                case ASTNodeType::FunctionDefinition:
+                    unsupported("functions can only be defined at the top level");
+                default:
+                {
+                    Expr val = emitExpression(static_cast<ProducesValueNode*>(node), function);
+                    out << pad << (val.type == CppType::Null ? "" : "(void)") << val.code << ";\n";
+                    break;
+                }
+                }
+            }
+
+            void emitFunction(std::ostream& out, FunctionInfo& info) {
+                out << "\n    " << signature(info) << " {\n";
+
+                for (auto& local : info.locals) {
+                    if (local.first >= (int)info.def->params.size())
+                        out << "        " << cppTypeName(cppType(local.second.type)) << " l_" << local.second.name << " = 0;\n";
+                }
+
+                emitBlock(out, info.def->body, &info, 2);
+
+                if (info.returnType == CppType::Value && (info.def->body.empty() || info.def->body.back()->type != ASTNodeType::Return))
+                    out << "        return Value();\n";
+                out << "    }\n";
+            }
+        };
+    }
+
+    std::string transpileToCpp(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+        return Transpiler().transpile(statements);
+    }
+}
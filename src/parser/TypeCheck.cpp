@@ -0,0 +1,619 @@
+#include "TypeCheck.hpp"
+#include "Effects.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        // A type as far as the checker can tell: known, unknown, or none
+        // yet, for calls to functions whose return types are still being
+        // worked out.
+        struct StaticType {
+            enum Kind { None, Known, Unknown };
+
+            Kind kind = Unknown;
+            DataType data = DataType::Count;
+
+            static StaticType none() { return { None, DataType::Count }; }
+            static StaticType known(DataType type) { return { Known, type }; }
+            static StaticType unknown() { return { Unknown, DataType::Count }; }
+
+            bool is(DataType type) const {
+                return kind == Known && data == type;
+            }
+
+            bool operator==(const StaticType& other) const {
+                return kind == other.kind && data == other.data;
+            }
+
+            bool operator!=(const StaticType& other) const {
+                return !(*this == other);
+            }
+        };
+
+        StaticType join(StaticType a, StaticType b) {
+            if (a.kind == StaticType::None)
+                return b;
+            if (b.kind == StaticType::None || a == b)
+                return a;
+            return StaticType::unknown();
+        }
+
+        // What a variable of the given declared type holds. Declarations
+        // and parameters convert numbers, but store 0 for anything else.
+        StaticType declaredType(DataType type) {
+            return isNumberType(type) ? StaticType::known(type) : StaticType::unknown();
+        }
+
+        // Value::as<T> throws for anything but numbers and booleans.
+        bool castsToNumber(DataType type) {
+            return isNumberType(type) || type == DataType::Boolean;
+        }
+
+        std::string typeName(const StaticType& type) {
+            return dataTypeNames[type.data];
+        }
+
+        bool isValueNode(ASTNode* node) {
+            switch (node->type) {
+            case ASTNodeType::ConstVal:
+            case ASTNodeType::Arithmetic:
+            case ASTNodeType::UnaryOp:
+            case ASTNodeType::VariableReference:
+            case ASTNodeType::FunctionCall:
+            case ASTNodeType::Comparison:
+            case ASTNodeType::LoopInvariant:
+            case ASTNodeType::InductionVariable:
+            case ASTNodeType::CommonValue:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        struct FunctionInfo {
+            FunctionDefinitionNode* def = nullptr;
+            // Scripts can define a function more than once; calls to those
+            // aren't checked.
+            int definitions = 0;
+            // Join of the declarations of each frame slot, Unknown once a
+            // slot is used where it might not be declared yet.
+            std::vector<StaticType> locals;
+            StaticType result = StaticType::none();
+            // Join of the returns seen by the current pass over the body.
+            StaticType returns = StaticType::none();
+        };
+
+        class TypeChecker {
+        public:
+            TypeChecker(std::vector<std::shared_ptr<ASTNode>>& statements, const std::unordered_map<std::string, DataType>& hostGlobals)
+                : statements(statements) {
+                for (auto& node : statements) {
+                    if (node->type != ASTNodeType::FunctionDefinition)
+                        continue;
+
+                    auto def = static_cast<FunctionDefinitionNode*>(node.get());
+                    if (def->lazyBody != nullptr)
+                        parseLazyBody(*def);
+
+                    FunctionInfo& info = scriptFunctions[def->name];
+                    info.def = def;
+                    info.definitions++;
+                }
+                summaries = summarizeFunctions(statements);
+
+                std::unordered_set<std::string> declared;
+                for (auto& [name, type] : hostGlobals) {
+                    globals[name] = declaredType(type);
+                    declared.insert(name);
+                }
+
+                current = nullptr;
+                for (auto& node : statements) {
+                    if (node->type != ASTNodeType::FunctionDefinition)
+                        scanStatement(node.get(), declared);
+                }
+                for (auto& name : unsafe) {
+                    auto it = globals.find(name);
+                    if (it != globals.end())
+                        it->second = StaticType::unknown();
+                }
+
+                for (auto& [name, info] : scriptFunctions) {
+                    current = &info;
+                    info.locals.assign(info.def->frameSize, StaticType::none());
+                    declared.clear();
+                    for (size_t i = 0; i < info.def->params.size(); i++) {
+                        info.locals[i] = declaredType(info.def->params[i].type);
+                        declared.insert(localKey((int)i));
+                    }
+
+                    unsafe.clear();
+                    scanBlock(info.def->body, declared);
+                    for (auto& key : unsafe)
+                        info.locals[std::stoi(key.substr(1))] = StaticType::unknown();
+                }
+            }
+
+            std::vector<TypeError> errors;
+
+            void check() {
+                // Return types only go up from none to known to unknown,
+                // so this settles after a few passes.
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (auto& [name, info] : scriptFunctions) {
+                        StaticType result = functionBody(info);
+                        if (result != info.result) {
+                            info.result = result;
+                            changed = true;
+                        }
+                    }
+                }
+
+                for (auto& [name, info] : scriptFunctions) {
+                    if (info.result.kind == StaticType::None)
+                        info.result = StaticType::unknown();
+                }
+
+                final = true;
+                for (auto& [name, info] : scriptFunctions)
+                    functionBody(info);
+
+                current = nullptr;
+                for (auto& node : statements) {
+                    if (node->type != ASTNodeType::FunctionDefinition)
+                        statement(node.get());
+                }
+            }
+
+        private:
+            std::vector<std::shared_ptr<ASTNode>>& statements;
+            std::unordered_map<std::string, Effects> summaries;
+            std::unordered_map<std::string, FunctionInfo> scriptFunctions;
+            // Globals something declares, by the join of their declarations.
+            std::unordered_map<std::string, StaticType> globals;
+            // Variables used where they might not be declared yet, by name
+            // or localKey, while scanning.
+            std::unordered_set<std::string> unsafe;
+            // The function being looked at, null for the top level.
+            FunctionInfo* current = nullptr;
+            // Set for the last pass, which reports errors and marks nodes.
+            bool final = false;
+            int line = 0;
+
+            static std::string localKey(int slot) {
+                return "#" + std::to_string(slot);
+            }
+
+            // Globals are only followed at the top level, where calls bring
+            // in everything the called functions use.
+            void use(const std::string& name, int localSlot, const std::unordered_set<std::string>& declared) {
+                if (localSlot >= 0) {
+                    if (!declared.count(localKey(localSlot)))
+                        unsafe.insert(localKey(localSlot));
+                } else if (current == nullptr && !declared.count(name)) {
+                    unsafe.insert(name);
+                }
+            }
+
+            // Walks code in the order it runs, recording declarations and
+            // which variables might be used before them. Blocks that might
+            // not run declare nothing for the code after them.
+            void scanBlock(const std::vector<std::shared_ptr<ASTNode>>& nodes, std::unordered_set<std::string> declared) {
+                for (auto& node : nodes)
+                    scanStatement(node.get(), declared);
+            }
+
+            void scanStatement(ASTNode* node, std::unordered_set<std::string>& declared) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node);
+                    scanExpression(assign->valNode.get(), declared);
+                    if (!assign->createNew) {
+                        use(assign->varName, assign->localSlot, declared);
+                    } else if (assign->localSlot >= 0) {
+                        StaticType& slot = current->locals[assign->localSlot];
+                        slot = join(slot, declaredType(assign->type));
+                        declared.insert(localKey(assign->localSlot));
+                    } else {
+                        auto inserted = globals.emplace(assign->varName, declaredType(assign->type));
+                        if (!inserted.second)
+                            inserted.first->second = join(inserted.first->second, declaredType(assign->type));
+                        declared.insert(assign->varName);
+                    }
+                    break;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    scanExpression(ifNode->condition.get(), declared);
+                    scanBlock(ifNode->nodes, declared);
+                    break;
+                }
+                case ASTNodeType::While:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    scanExpression(loop->condition.get(), declared);
+                    scanBlock(loop->nodes, declared);
+                    break;
+                }
+                case ASTNodeType::For:
+                {
+                    auto forNode = static_cast<ForNode*>(node);
+                    scanStatement(forNode->init.get(), declared);
+                    scanExpression(forNode->condition.get(), declared);
+                    scanExpression(forNode->counterLimit.get(), declared);
+
+                    std::unordered_set<std::string> body = declared;
+                    for (auto& child : forNode->nodes)
+                        scanStatement(child.get(), body);
+                    scanStatement(forNode->step.get(), body);
+                    break;
+                }
+                case ASTNodeType::Return:
+                    scanExpression(static_cast<ReturnNode*>(node)->valNode.get(), declared);
+                    break;
+                default:
+                    if (isValueNode(node))
+                        scanExpression(static_cast<ProducesValueNode*>(node), declared);
+                    break;
+                }
+            }
+
+            void scanExpression(ProducesValueNode* node, const std::unordered_set<std::string>& declared) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    use(ref->varName, ref->localSlot, declared);
+                    break;
+                }
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    scanExpression(arith->a.get(), declared);
+                    scanExpression(arith->b.get(), declared);
+                    break;
+                }
+                case ASTNodeType::UnaryOp:
+                    scanExpression(static_cast<UnaryOpNode*>(node)->valNode.get(), declared);
+                    break;
+                case ASTNodeType::Comparison:
+                {
+                    auto comparison = static_cast<ComparisonNode*>(node);
+                    scanExpression(comparison->lhs.get(), declared);
+                    scanExpression(comparison->rhs.get(), declared);
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(node);
+                    for (auto& arg : call->args)
+                        scanExpression(arg.get(), declared);
+
+                    auto summary = summaries.find(call->functionName);
+                    if (current == nullptr && summary != summaries.end()) {
+                        for (auto& name : summary->second.reads)
+                            use(name, -1, declared);
+                        for (auto& name : summary->second.writes)
+                            use(name, -1, declared);
+                    }
+                    break;
+                }
+                case ASTNodeType::LoopInvariant:
+                    scanExpression(static_cast<LoopInvariantNode*>(node)->expr.get(), declared);
+                    break;
+                case ASTNodeType::CommonValue:
+                    scanExpression(static_cast<CommonValueNode*>(node)->expr.get(), declared);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            void error(const std::string& message) {
+                if (final)
+                    errors.push_back({ line, message });
+            }
+
+            // Returns what the body returns.
+            StaticType functionBody(FunctionInfo& info) {
+                current = &info;
+                info.returns = StaticType::none();
+                block(info.def->body);
+
+                // Falling off the end returns Null.
+                bool returns = std::any_of(info.def->body.begin(), info.def->body.end(),
+                    [](const std::shared_ptr<ASTNode>& node) { return node->type == ASTNodeType::Return; });
+                if (!returns)
+                    info.returns = join(info.returns, StaticType::known(DataType::Null));
+                return info.returns;
+            }
+
+            void block(const std::vector<std::shared_ptr<ASTNode>>& nodes) {
+                for (auto& node : nodes)
+                    statement(node.get());
+            }
+
+            void statement(ASTNode* node) {
+                if (node == nullptr)
+                    return;
+                if (node->line != 0)
+                    line = node->line;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                    assignment(static_cast<VarAssignmentNode*>(node));
+                    break;
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    condition(ifNode->condition.get());
+                    block(ifNode->nodes);
+                    break;
+                }
+                case ASTNodeType::While:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    condition(loop->condition.get());
+                    block(loop->nodes);
+                    break;
+                }
+                case ASTNodeType::For:
+                {
+                    auto forNode = static_cast<ForNode*>(node);
+                    statement(forNode->init.get());
+                    if (forNode->counterLimit != nullptr)
+                        expression(forNode->counterLimit.get());
+                    condition(forNode->condition.get());
+                    block(forNode->nodes);
+                    statement(forNode->step.get());
+                    break;
+                }
+                case ASTNodeType::Return:
+                {
+                    auto ret = static_cast<ReturnNode*>(node);
+                    StaticType type = ret->valNode != nullptr ? expression(ret->valNode.get()) : StaticType::known(DataType::Null);
+                    if (current != nullptr)
+                        current->returns = join(current->returns, type);
+                    break;
+                }
+                default:
+                    if (isValueNode(node))
+                        expression(static_cast<ProducesValueNode*>(node));
+                    break;
+                }
+            }
+
+            void condition(ProducesValueNode* node) {
+                if (node == nullptr)
+                    return;
+
+                StaticType type = expression(node);
+                if (type.kind == StaticType::Known && !castsToNumber(type.data))
+                    error("Condition of type " + typeName(type) + " is neither a number nor a boolean");
+            }
+
+            StaticType variable(const std::string& name, int localSlot) {
+                if (localSlot >= 0) {
+                    StaticType type = current->locals[localSlot];
+                    return type.kind == StaticType::None ? StaticType::unknown() : type;
+                }
+
+                auto it = globals.find(name);
+                return it != globals.end() ? it->second : StaticType::unknown();
+            }
+
+            bool isDeclared(const std::string& name, int localSlot) {
+                return localSlot >= 0 || globals.count(name) != 0;
+            }
+
+            void assignment(VarAssignmentNode* node) {
+                StaticType value = expression(node->valNode.get());
+
+                if (node->createNew) {
+                    if (value.kind != StaticType::Known)
+                        return;
+                    if (isNumberType(node->type) && !castsToNumber(value.data))
+                        error("Invalid cast of " + typeName(value) + " to " + dataTypeNames[node->type] + " in the declaration of " + node->varName);
+                    else if (final && value.data == node->type)
+                        node->typeChecked = true;
+                    return;
+                }
+
+                if (!isDeclared(node->varName, node->localSlot)) {
+                    error("Reference to undefined variable " + node->varName);
+                    return;
+                }
+
+                StaticType target = variable(node->varName, node->localSlot);
+                if (target.kind != StaticType::Known || value.kind != StaticType::Known)
+                    return;
+                if (value.data != target.data)
+                    error("Assignment to variable " + node->varName + " (" + typeName(target) + ") with wrong type " + typeName(value));
+                else if (final)
+                    node->typeChecked = true;
+            }
+
+            StaticType expression(ProducesValueNode* node) {
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                    return StaticType::known(static_cast<ConstValNode*>(node)->val.type);
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    if (!isDeclared(ref->varName, ref->localSlot)) {
+                        error("Nonexistent variable " + ref->varName + " referenced");
+                        return StaticType::unknown();
+                    }
+                    return variable(ref->varName, ref->localSlot);
+                }
+                case ASTNodeType::InductionVariable:
+                    return StaticType::known(DataType::Int32);
+                case ASTNodeType::Arithmetic:
+                    return arithmetic(static_cast<ArithmeticNode*>(node));
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    StaticType type = expression(unary->valNode.get());
+                    if (unary->operation == UnaryOperation::Minus && type.kind == StaticType::Known && !isNumberType(type.data)) {
+                        error("Can't negate " + typeName(type));
+                        return StaticType::unknown();
+                    }
+                    return type;
+                }
+                case ASTNodeType::Comparison:
+                    return comparison(static_cast<ComparisonNode*>(node));
+                case ASTNodeType::FunctionCall:
+                    return call(static_cast<FunctionCallNode*>(node));
+                case ASTNodeType::LoopInvariant:
+                    return expression(static_cast<LoopInvariantNode*>(node)->expr.get());
+                case ASTNodeType::CommonValue:
+                    return expression(static_cast<CommonValueNode*>(node)->expr.get());
+                default:
+                    return StaticType::unknown();
+                }
+            }
+
+            StaticType arithmetic(ArithmeticNode* node) {
+                StaticType a = expression(node->a.get());
+                StaticType b = expression(node->b.get());
+
+                static const char* verbs[] = { "add", "subtract", "divide", "multiply" };
+                bool isAdd = node->operation == ArithmeticOperation::Add;
+
+                // Strings can only be added to strings.
+                auto invalid = [&](const StaticType& type) {
+                    return type.kind == StaticType::Known && !isNumberType(type.data) && !(isAdd && type.data == DataType::String);
+                };
+                bool mixedStrings = a.kind == StaticType::Known && b.kind == StaticType::Known
+                    && (a.data == DataType::String) != (b.data == DataType::String);
+
+                if (invalid(a) || invalid(b) || (isAdd && mixedStrings)) {
+                    std::string operands = a.kind != StaticType::Known ? typeName(b)
+                        : b.kind != StaticType::Known ? typeName(a)
+                        : typeName(a) + " and " + typeName(b);
+                    error(std::string("Can't ") + verbs[(int)node->operation] + " " + operands);
+                    return StaticType::unknown();
+                }
+
+                if (a.kind == StaticType::None || b.kind == StaticType::None)
+                    return StaticType::none();
+                if (a.is(DataType::String) || b.is(DataType::String))
+                    return StaticType::known(DataType::String);
+                if (a.kind != StaticType::Known || b.kind != StaticType::Known)
+                    return StaticType::unknown();
+
+                DataType result = getHighestPrecisionType(a.data, b.data);
+                if (final)
+                    node->checkedType = result;
+                return StaticType::known(result);
+            }
+
+            StaticType comparison(ComparisonNode* node) {
+                StaticType lhs = expression(node->lhs.get());
+                StaticType rhs = expression(node->rhs.get());
+                bool bothKnown = lhs.kind == StaticType::Known && rhs.kind == StaticType::Known;
+
+                if (node->compType == ComparisonType::Equal) {
+                    if (!bothKnown)
+                        return StaticType::known(DataType::Boolean);
+
+                    if (lhs.data != rhs.data)
+                        error("Trying to compare values of different types (" + typeName(lhs) + " and " + typeName(rhs) + ")");
+                    else if (!castsToNumber(lhs.data) && lhs.data != DataType::String)
+                        error("No comparison for " + typeName(lhs));
+                    else if (final && isNumberType(lhs.data))
+                        node->checkedType = lhs.data;
+                    return StaticType::known(DataType::Boolean);
+                }
+
+                auto unordered = [](const StaticType& type) {
+                    return type.kind == StaticType::Known && !isNumberType(type.data);
+                };
+                if (unordered(lhs) || unordered(rhs)) {
+                    std::string operands = !bothKnown ? typeName(lhs.kind == StaticType::Known ? lhs : rhs)
+                        : typeName(lhs) + " and " + typeName(rhs);
+                    error("Can't order " + operands);
+                } else if (final && bothKnown) {
+                    node->checkedType = getHighestPrecisionType(lhs.data, rhs.data);
+                }
+                return StaticType::known(DataType::Boolean);
+            }
+
+            StaticType call(FunctionCallNode* node) {
+                std::vector<StaticType> args;
+                for (auto& arg : node->args)
+                    args.push_back(expression(arg.get()));
+
+                auto script = scriptFunctions.find(node->functionName);
+                if (script != scriptFunctions.end()) {
+                    FunctionInfo& callee = script->second;
+                    if (callee.definitions > 1)
+                        return StaticType::unknown();
+
+                    auto& params = callee.def->params;
+                    if (args.size() != params.size()) {
+                        error("Function " + node->functionName + " expects " + std::to_string(params.size())
+                            + " arguments, got " + std::to_string(args.size()));
+                        return StaticType::unknown();
+                    }
+
+                    for (size_t i = 0; i < args.size(); i++) {
+                        if (args[i].kind == StaticType::Known && isNumberType(params[i].type) && !castsToNumber(args[i].data))
+                            error("Invalid cast of " + typeName(args[i]) + " to " + dataTypeNames[params[i].type]
+                                + " for parameter " + params[i].name + " of " + node->functionName);
+                    }
+                    return callee.result;
+                }
+
+                auto builtin = functions.find(node->functionName);
+                if (builtin == functions.end() || !builtin->second.isBuiltin) {
+                    error("Tried to call nonexistent function " + node->functionName);
+                    return StaticType::unknown();
+                }
+
+                if (!builtin->second.resultType)
+                    return StaticType::unknown();
+
+                std::vector<DataType> argTypes;
+                for (auto& arg : args) {
+                    if (arg.kind == StaticType::None)
+                        return StaticType::none();
+                    argTypes.push_back(arg.kind == StaticType::Known ? arg.data : DataType::Count);
+                }
+
+                try {
+                    DataType result = builtin->second.resultType(argTypes);
+                    return result == DataType::Count ? StaticType::unknown() : StaticType::known(result);
+                } catch (const std::runtime_error& e) {
+                    error(node->functionName + ": " + e.what());
+                    return StaticType::unknown();
+                }
+            }
+        };
+    }
+
+    std::vector<TypeError> checkTypes(std::vector<std::shared_ptr<ASTNode>>& statements,
+        const std::unordered_map<std::string, DataType>& globals) {
+        TypeChecker checker(statements, globals);
+        checker.check();
+
+        std::stable_sort(checker.errors.begin(), checker.errors.end(),
+            [](const TypeError& a, const TypeError& b) { return a.line < b.line; });
+        return std::move(checker.errors);
+    }
+}
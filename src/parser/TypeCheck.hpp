@@ -0,0 +1,30 @@
+#pragma once
+#include "parser.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iodine {
+    struct TypeError {
+        int line;
+        std::string message;
+    };
+
+    // Works out the types of a script's variables, expressions and calls
+    // before it runs, and returns the type errors it's certain the code
+    // would run into if it ran, sorted by line. globals are the ones the
+    // host declares before running the script; reading or assigning any
+    // other global nothing declares is an error.
+    //
+    // A variable has a known type when every declaration of it agrees on
+    // a number type and nothing uses it before it's certainly declared.
+    // Builtins are typed through Function::resultType. Where the types are
+    // proven, the nodes are marked so the evaluator skips the runtime type
+    // checks there: arithmetic and comparisons on numbers, and assignments
+    // of values of the variable's type. The marks hold whether or not
+    // errors were found. Lazy bodies are parsed. Run after
+    // eliminateDeadCode and before eliminateCommonSubexpressions.
+    std::vector<TypeError> checkTypes(std::vector<std::shared_ptr<ASTNode>>& statements,
+        const std::unordered_map<std::string, DataType>& globals = {});
+}
@@ -0,0 +1,701 @@
+#include "parser.hpp"
+#include "AllocStats.hpp"
+#include "Effects.hpp"
+#include <string.h>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        // Same as the loop optimizer's: locals are keyed by slot.
+        std::string variableKey(const std::string& name, int localSlot) {
+            if (localSlot >= 0)
+                return "#" + std::to_string(localSlot);
+            return name;
+        }
+
+        std::string constantKey(const Value& val) {
+            switch (val.type) {
+            case DataType::Int32:
+                return "i" + std::to_string(val.intVal);
+            case DataType::F32:
+            {
+                uint32_t bits;
+                memcpy(&bits, &val.floatVal, sizeof(bits));
+                return "f" + std::to_string(bits);
+            }
+            case DataType::F64:
+            {
+                uint64_t bits;
+                memcpy(&bits, &val.doubleVal, sizeof(bits));
+                return "d" + std::to_string(bits);
+            }
+            case DataType::Boolean:
+                return val.boolVal ? "true" : "false";
+            case DataType::String:
+                return "s" + val.strVal.str();
+            default:
+                return "null";
+            }
+        }
+
+        // An expression whose value is known to be computed by the time
+        // the rest of the block runs. Its CommonValueNode is only made
+        // once something reuses it.
+        struct Available {
+            std::shared_ptr<ProducesValueNode>* slot;
+            std::shared_ptr<CommonValueNode> node;
+        };
+
+        // Value numbers available at some point of a block. Nested blocks
+        // get a copy, so what they compute isn't seen after them, but they
+        // share the entries.
+        typedef std::unordered_map<int, Available*> AvailableValues;
+
+        enum class KeyKind {
+            Int,
+            F32,
+            F64,
+            Boolean,
+            String,
+            Null,
+            Variable,
+            Counter,
+            Arithmetic,
+            UnaryOp,
+            Comparison,
+            Call,
+            Argument
+        };
+
+        // What a value number stands for: an operation and its operands,
+        // which are value numbers themselves, or for leaves a constant or a
+        // version of a variable.
+        struct Key {
+            int kind;
+            int64_t a;
+            int64_t b;
+
+            bool operator==(const Key& other) const {
+                return kind == other.kind && a == other.a && b == other.b;
+            }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                return std::hash<int64_t>()(key.a * 1000003 + key.b) ^ ((size_t)key.kind * 0x9e3779b97f4a7c15ull);
+            }
+        };
+
+        Key makeKey(KeyKind kind, int64_t a = 0, int64_t b = 0, int op = 0) {
+            return Key { (int)kind * 16 + op, a, b };
+        }
+
+        // Variables a statement might assign, by ValueNumbering::variable().
+        struct Writes {
+            std::unordered_set<int> vars;
+            bool callsScript = false;
+        };
+
+        class ValueNumbering {
+        public:
+            ValueNumbering(const std::vector<std::shared_ptr<ASTNode>>& statements)
+                : summaries(summarizeFunctions(statements)) {
+                for (auto& node : statements) {
+                    if (node->type == ASTNodeType::FunctionDefinition)
+                        scriptFunctions.insert(static_cast<FunctionDefinitionNode*>(node.get())->name);
+                }
+            }
+
+            void block(std::vector<std::shared_ptr<ASTNode>>& nodes, AvailableValues& available) {
+                for (auto& node : nodes)
+                    statement(node, available, true);
+            }
+
+        private:
+            std::unordered_map<std::string, Effects> summaries;
+            std::unordered_set<std::string> scriptFunctions;
+            // Ids of global names, function names and string constants.
+            std::unordered_map<std::string, int> names;
+            // Current version of each variable; bumped on every assignment.
+            std::unordered_map<int, int> versions;
+            int lastVersion = 0;
+            std::unordered_map<Key, int, KeyHash> numbers;
+            std::deque<Available> entries;
+            // Value numbers of nodes already numbered, valid while their
+            // generation is the current one, that is until an assignment.
+            std::unordered_map<ProducesValueNode*, std::pair<int, int>> memo;
+            int generation = 0;
+            // Subtrees replaced by reuses, kept alive until the end so no
+            // new node gets the address of one that's memoized.
+            std::vector<std::shared_ptr<ProducesValueNode>> replaced;
+            // What the expression being visited computes for sure.
+            std::vector<std::pair<int, Available*>> computed;
+            bool inFunction = false;
+
+            Key constantKey(const Value& val) {
+                switch (val.type) {
+                case DataType::Int32:
+                    return makeKey(KeyKind::Int, val.intVal);
+                case DataType::F32:
+                {
+                    uint32_t bits;
+                    memcpy(&bits, &val.floatVal, sizeof(bits));
+                    return makeKey(KeyKind::F32, bits);
+                }
+                case DataType::F64:
+                {
+                    int64_t bits;
+                    memcpy(&bits, &val.doubleVal, sizeof(bits));
+                    return makeKey(KeyKind::F64, bits);
+                }
+                case DataType::Boolean:
+                    return makeKey(KeyKind::Boolean, val.boolVal);
+                case DataType::String:
+                    return makeKey(KeyKind::String, nameId(val.strVal.str()));
+                default:
+                    return makeKey(KeyKind::Null);
+                }
+            }
+
+            bool isPureBuiltin(const std::string& name) const {
+                if (scriptFunctions.count(name))
+                    return false;
+                auto it = functions.find(name);
+                return it != functions.end() && it->second.isBuiltin && it->second.isPure;
+            }
+
+            static bool isComputation(ProducesValueNode* node) {
+                switch (node->type) {
+                case ASTNodeType::Arithmetic:
+                case ASTNodeType::UnaryOp:
+                case ASTNodeType::Comparison:
+                case ASTNodeType::FunctionCall:
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+            int nameId(const std::string& name) {
+                return names.emplace(name, (int)names.size()).first->second;
+            }
+
+            // Globals by name, locals by slot, since function locals shadow
+            // globals.
+            int variable(const std::string& name, int localSlot) {
+                return localSlot >= 0 ? -1 - localSlot : nameId(name);
+            }
+
+            void assigned(int var) {
+                versions[var] = ++lastVersion;
+                generation++;
+            }
+
+            void collectWrites(ASTNode* node, Writes& writes) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = static_cast<VarAssignmentNode*>(node);
+                    writes.vars.insert(variable(assign->varName, assign->localSlot));
+                    collectWrites(assign->valNode.get(), writes);
+                    break;
+                }
+                case ASTNodeType::Arithmetic:
+                    collectWrites(static_cast<ArithmeticNode*>(node)->a.get(), writes);
+                    collectWrites(static_cast<ArithmeticNode*>(node)->b.get(), writes);
+                    break;
+                case ASTNodeType::UnaryOp:
+                    collectWrites(static_cast<UnaryOpNode*>(node)->valNode.get(), writes);
+                    break;
+                case ASTNodeType::Comparison:
+                    collectWrites(static_cast<ComparisonNode*>(node)->lhs.get(), writes);
+                    collectWrites(static_cast<ComparisonNode*>(node)->rhs.get(), writes);
+                    break;
+                case ASTNodeType::LoopInvariant:
+                    collectWrites(static_cast<LoopInvariantNode*>(node)->expr.get(), writes);
+                    break;
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(node);
+                    if (scriptFunctions.count(call->functionName)) {
+                        writes.callsScript = true;
+                        auto it = summaries.find(call->functionName);
+                        if (it != summaries.end()) {
+                            for (auto& write : it->second.writes)
+                                writes.vars.insert(nameId(write));
+                        }
+                    }
+                    for (auto& arg : call->args)
+                        collectWrites(arg.get(), writes);
+                    break;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    collectWrites(ifNode->condition.get(), writes);
+                    for (auto& child : ifNode->nodes)
+                        collectWrites(child.get(), writes);
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    collectWrites(loop->condition.get(), writes);
+                    for (auto& child : loop->nodes)
+                        collectWrites(child.get(), writes);
+
+                    if (node->type == ASTNodeType::For) {
+                        collectWrites(static_cast<ForNode*>(node)->init.get(), writes);
+                        collectWrites(static_cast<ForNode*>(node)->step.get(), writes);
+                    }
+                    break;
+                }
+                case ASTNodeType::Return:
+                    collectWrites(static_cast<ReturnNode*>(node)->valNode.get(), writes);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            // Forgets what a nested block might have changed, in the block
+            // around it.
+            void afterWrites(const Writes& writes, AvailableValues& available) {
+                for (int var : writes.vars)
+                    assigned(var);
+                if (inFunction && writes.callsScript)
+                    available.clear();
+            }
+
+            // -1 for expressions that aren't pure.
+            int number(ProducesValueNode* node) {
+                auto memoized = memo.find(node);
+                if (memoized != memo.end() && memoized->second.first == generation)
+                    return memoized->second.second;
+
+                Key key;
+                bool pure = true;
+                switch (node->type) {
+                case ASTNodeType::ConstVal:
+                    key = constantKey(static_cast<ConstValNode*>(node)->val);
+                    break;
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(node);
+                    int var = variable(ref->varName, ref->localSlot);
+                    key = makeKey(KeyKind::Variable, var, versions[var]);
+                    break;
+                }
+                case ASTNodeType::InductionVariable:
+                {
+                    auto init = static_cast<VarAssignmentNode*>(static_cast<InductionVariableNode*>(node)->loop->init.get());
+                    int var = variable(init->varName, init->localSlot);
+                    key = makeKey(KeyKind::Counter, var, versions[var]);
+                    break;
+                }
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(node);
+                    int a = number(arith->a.get());
+                    int b = number(arith->b.get());
+                    pure = a >= 0 && b >= 0;
+                    key = makeKey(KeyKind::Arithmetic, a, b, (int)arith->operation);
+                    break;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(node);
+                    int val = number(unary->valNode.get());
+                    pure = val >= 0;
+                    key = makeKey(KeyKind::UnaryOp, val, 0, (int)unary->operation);
+                    break;
+                }
+                case ASTNodeType::Comparison:
+                {
+                    auto comparison = static_cast<ComparisonNode*>(node);
+                    int lhs = number(comparison->lhs.get());
+                    int rhs = number(comparison->rhs.get());
+                    pure = lhs >= 0 && rhs >= 0;
+                    key = makeKey(KeyKind::Comparison, lhs, rhs, (int)comparison->compType);
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(node);
+                    pure = isPureBuiltin(call->functionName);
+                    if (!pure)
+                        break;
+
+                    // The call with its arguments so far, one at a time.
+                    key = makeKey(KeyKind::Call, nameId(call->functionName));
+                    for (auto& arg : call->args) {
+                        int val = number(arg.get());
+                        if (val < 0) {
+                            pure = false;
+                            break;
+                        }
+                        int partial = numbers.emplace(key, (int)numbers.size()).first->second;
+                        key = makeKey(KeyKind::Argument, partial, val);
+                    }
+                    break;
+                }
+                default:
+                    // Loop invariants are only computed on the first
+                    // iteration, and common values are already numbered.
+                    pure = false;
+                    break;
+                }
+
+                int vn = pure ? numbers.emplace(key, (int)numbers.size()).first->second : -1;
+                memo[node] = { generation, vn };
+                return vn;
+            }
+
+            // Reuses an earlier result for expr if one is available, and
+            // numbers what's inside it otherwise. certain means expr is
+            // always evaluated before whatever follows it in the block.
+            void visit(std::shared_ptr<ProducesValueNode>& expr, AvailableValues& available, bool certain) {
+                if (expr == nullptr)
+                    return;
+
+                int vn = -1;
+                if (isComputation(expr.get())) {
+                    vn = number(expr.get());
+                    auto it = vn >= 0 ? available.find(vn) : available.end();
+                    if (it != available.end()) {
+                        Available& source = *it->second;
+                        if (source.node == nullptr) {
+                            source.node = makeNode<CommonValueNode>();
+                            source.node->expr = *source.slot;
+                            *source.slot = source.node;
+                        }
+
+                        auto reuse = makeNode<CommonValueNode>();
+                        reuse->expr = source.node->expr;
+                        reuse->source = source.node;
+                        replaced.push_back(expr);
+                        expr = reuse;
+                        return;
+                    }
+                }
+
+                // Operands in the order they're evaluated.
+                switch (expr->type) {
+                case ASTNodeType::Arithmetic:
+                    visit(std::static_pointer_cast<ArithmeticNode>(expr)->a, available, certain);
+                    visit(std::static_pointer_cast<ArithmeticNode>(expr)->b, available, certain);
+                    break;
+                case ASTNodeType::UnaryOp:
+                    visit(std::static_pointer_cast<UnaryOpNode>(expr)->valNode, available, certain);
+                    break;
+                case ASTNodeType::Comparison:
+                    visit(std::static_pointer_cast<ComparisonNode>(expr)->lhs, available, certain);
+                    visit(std::static_pointer_cast<ComparisonNode>(expr)->rhs, available, certain);
+                    break;
+                case ASTNodeType::FunctionCall:
+                    arguments(std::static_pointer_cast<FunctionCallNode>(expr).get(), available, certain);
+                    break;
+                case ASTNodeType::LoopInvariant:
+                    visit(std::static_pointer_cast<LoopInvariantNode>(expr)->expr, available, false);
+                    break;
+                default:
+                    break;
+                }
+
+                if (vn >= 0 && certain) {
+                    entries.push_back(Available { &expr, nullptr });
+                    computed.push_back({ vn, &entries.back() });
+                }
+            }
+
+            void arguments(FunctionCallNode* call, AvailableValues& available, bool certain) {
+                // Builtins get their arguments unevaluated, and might not
+                // evaluate them at all.
+                bool evaluated = certain && scriptFunctions.count(call->functionName);
+                for (auto& arg : call->args)
+                    visit(arg, available, evaluated);
+            }
+
+            // Numbers an expression that's evaluated as a whole: a value
+            // assigned, a condition, a return value or an expression
+            // statement. Operands aren't evaluated in a fixed order, so what
+            // it computes is only reused after it, and globals the functions
+            // it calls assign count as changed throughout.
+            template <typename Visit>
+            void expression(ASTNode* root, AvailableValues& available, Visit&& visitRoot) {
+                Writes writes;
+                collectWrites(root, writes);
+                afterWrites(writes, available);
+
+                computed.clear();
+                visitRoot();
+                afterWrites(writes, available);
+
+                // A call might have recursed into this function and
+                // overwritten what was computed here.
+                if (inFunction && writes.callsScript)
+                    return;
+                for (auto& [vn, entry] : computed)
+                    available.emplace(vn, entry);
+            }
+
+            void statement(std::shared_ptr<ASTNode>& node, AvailableValues& available, bool certain) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                {
+                    auto assign = std::static_pointer_cast<VarAssignmentNode>(node);
+                    expression(assign->valNode.get(), available, [&] { visit(assign->valNode, available, certain); });
+                    assigned(variable(assign->varName, assign->localSlot));
+                    break;
+                }
+                case ASTNodeType::If:
+                {
+                    auto ifNode = std::static_pointer_cast<IfNode>(node);
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    expression(ifNode->condition.get(), available, [&] { visit(ifNode->condition, available, certain); });
+
+                    Writes writes;
+                    for (auto& child : ifNode->nodes)
+                        collectWrites(child.get(), writes);
+
+                    AvailableValues inner = available;
+                    block(ifNode->nodes, inner);
+                    afterWrites(writes, available);
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    auto loop = std::static_pointer_cast<LoopNode>(node);
+                    ForNode* forNode = node->type == ASTNodeType::For ? static_cast<ForNode*>(node.get()) : nullptr;
+                    if (forNode != nullptr)
+                        statement(forNode->init, available, certain);
+
+                    // Whatever the loop assigns may differ from one
+                    // iteration to the next, and after it.
+                    Writes writes;
+                    collectWrites(node.get(), writes);
+                    afterWrites(writes, available);
+
+                    // Counted loops never evaluate their condition.
+                    bool conditionRuns = forNode == nullptr || !forNode->isCounted;
+                    expression(loop->condition.get(), available, [&] { visit(loop->condition, available, certain && conditionRuns); });
+
+                    AvailableValues inner = available;
+                    block(loop->nodes, inner);
+                    if (forNode != nullptr)
+                        statement(forNode->step, inner, false);
+                    afterWrites(writes, available);
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                {
+                    auto def = std::static_pointer_cast<FunctionDefinitionNode>(node);
+                    if (def->lazyBody != nullptr)
+                        parseLazyBody(*def);
+
+                    AvailableValues body;
+                    inFunction = true;
+                    block(def->body, body);
+                    inFunction = false;
+                    break;
+                }
+                case ASTNodeType::Return:
+                {
+                    auto ret = std::static_pointer_cast<ReturnNode>(node);
+                    // A tail call has to stay a call.
+                    expression(ret->valNode.get(), available, [&] {
+                        if (ret->isTailCall)
+                            arguments(static_cast<FunctionCallNode*>(ret->valNode.get()), available, certain);
+                        else
+                            visit(ret->valNode, available, certain);
+                    });
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                    expression(node.get(), available, [&] { arguments(static_cast<FunctionCallNode*>(node.get()), available, certain); });
+                    break;
+                default:
+                {
+                    // Any other expression statement is evaluated for
+                    // nothing, so nothing after it relies on it.
+                    auto expr = std::static_pointer_cast<ProducesValueNode>(node);
+                    expression(node.get(), available, [&] { visit(expr, available, false); });
+                    node = expr;
+                    break;
+                }
+                }
+            }
+        };
+
+        // Merges structurally equal subtrees. Everything but loop invariants
+        // and common values evaluates the same wherever it is, so one node
+        // can stand in for all of its copies.
+        class HashConsing {
+        public:
+            void statement(ASTNode* node) {
+                if (node == nullptr)
+                    return;
+
+                switch (node->type) {
+                case ASTNodeType::VarAssignment:
+                    expression(static_cast<VarAssignmentNode*>(node)->valNode);
+                    break;
+                case ASTNodeType::If:
+                {
+                    auto ifNode = static_cast<IfNode*>(node);
+                    expression(ifNode->condition);
+                    for (auto& child : ifNode->nodes)
+                        statement(child.get());
+                    break;
+                }
+                case ASTNodeType::While:
+                case ASTNodeType::For:
+                {
+                    auto loop = static_cast<LoopNode*>(node);
+                    expression(loop->condition);
+                    for (auto& child : loop->nodes)
+                        statement(child.get());
+
+                    if (node->type == ASTNodeType::For) {
+                        auto forNode = static_cast<ForNode*>(node);
+                        statement(forNode->init.get());
+                        statement(forNode->step.get());
+                        if (forNode->counterLimit != nullptr)
+                            expression(forNode->counterLimit);
+                    }
+                    break;
+                }
+                case ASTNodeType::FunctionDefinition:
+                    for (auto& child : static_cast<FunctionDefinitionNode*>(node)->body)
+                        statement(child.get());
+                    break;
+                case ASTNodeType::Return:
+                {
+                    auto ret = static_cast<ReturnNode*>(node);
+                    if (ret->isTailCall)
+                        arguments(static_cast<FunctionCallNode*>(ret->valNode.get()));
+                    else
+                        expression(ret->valNode);
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                    arguments(static_cast<FunctionCallNode*>(node));
+                    break;
+                default:
+                    break;
+                }
+            }
+
+        private:
+            std::unordered_map<std::string, std::shared_ptr<ProducesValueNode>> nodes;
+
+            static std::string id(const std::shared_ptr<ProducesValueNode>& node) {
+                return std::to_string((uintptr_t)node.get());
+            }
+
+            void arguments(FunctionCallNode* call) {
+                for (auto& arg : call->args)
+                    expression(arg);
+            }
+
+            void expression(std::shared_ptr<ProducesValueNode>& expr) {
+                if (expr == nullptr)
+                    return;
+
+                std::string key;
+                switch (expr->type) {
+                case ASTNodeType::ConstVal:
+                    key = "k" + constantKey(static_cast<ConstValNode*>(expr.get())->val);
+                    break;
+                case ASTNodeType::VariableReference:
+                {
+                    auto ref = static_cast<VariableReferenceNode*>(expr.get());
+                    key = "v" + variableKey(ref->varName, ref->localSlot);
+                    break;
+                }
+                case ASTNodeType::InductionVariable:
+                    key = "i" + std::to_string((uintptr_t)static_cast<InductionVariableNode*>(expr.get())->loop);
+                    break;
+                case ASTNodeType::Arithmetic:
+                {
+                    auto arith = static_cast<ArithmeticNode*>(expr.get());
+                    expression(arith->a);
+                    expression(arith->b);
+                    // Locals of different functions share keys, and with
+                    // them maybe not the types checkTypes proved.
+                    key = "a" + std::to_string((int)arith->operation) + ":" + std::to_string((int)arith->checkedType)
+                        + ":" + id(arith->a) + ":" + id(arith->b);
+                    break;
+                }
+                case ASTNodeType::UnaryOp:
+                {
+                    auto unary = static_cast<UnaryOpNode*>(expr.get());
+                    expression(unary->valNode);
+                    key = "u" + std::to_string((int)unary->operation) + ":" + id(unary->valNode);
+                    break;
+                }
+                case ASTNodeType::Comparison:
+                {
+                    auto comparison = static_cast<ComparisonNode*>(expr.get());
+                    expression(comparison->lhs);
+                    expression(comparison->rhs);
+                    key = "c" + std::to_string((int)comparison->compType) + ":" + std::to_string((int)comparison->checkedType)
+                        + ":" + id(comparison->lhs) + ":" + id(comparison->rhs);
+                    break;
+                }
+                case ASTNodeType::FunctionCall:
+                {
+                    auto call = static_cast<FunctionCallNode*>(expr.get());
+                    arguments(call);
+                    key = "f" + call->functionName;
+                    for (auto& arg : call->args)
+                        key += ":" + id(arg);
+                    break;
+                }
+                case ASTNodeType::LoopInvariant:
+                    expression(static_cast<LoopInvariantNode*>(expr.get())->expr);
+                    return;
+                case ASTNodeType::CommonValue:
+                {
+                    // Every occurrence already shares expr.
+                    auto common = static_cast<CommonValueNode*>(expr.get());
+                    if (common->source == nullptr)
+                        expression(common->expr);
+                    return;
+                }
+                default:
+                    return;
+                }
+
+                auto inserted = nodes.emplace(key, expr);
+                if (!inserted.second)
+                    expr = inserted.first->second;
+            }
+        };
+    }
+
+    void eliminateCommonSubexpressions(std::vector<std::shared_ptr<ASTNode>>& statements) {
+        AllocPhaseScope allocPhase(AllocPhase::Optimize);
+
+        ValueNumbering numbering(statements);
+        AvailableValues available;
+        numbering.block(statements, available);
+
+        HashConsing consing;
+        for (auto& node : statements)
+            consing.statement(node.get());
+    }
+}
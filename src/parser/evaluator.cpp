@@ -0,0 +1,394 @@
+#include "parser.hpp"
+#include "AllocStats.hpp"
+#include "Profiler.hpp"
+#include <chrono>
+#include <stdexcept>
+
+namespace iodine {
+    std::vector<Value> frameStack;
+    size_t frameBase = 0;
+
+    namespace {
+        enum class ExecResult {
+            Normal,
+            Return,
+            // A return statement wants to call pendingTailCallee with the
+            // arguments sitting at the top of the frame stack.
+            TailCall
+        };
+
+        Value returnValue;
+        const Function* pendingTailCallee = nullptr;
+        size_t pendingTailArgsBegin = 0;
+
+        // Restores the caller's frame even if the callee throws, so the REPL
+        // can keep going after a runtime error.
+        struct FrameGuard {
+            size_t savedBase;
+            size_t savedSize;
+
+            FrameGuard(size_t savedSize) : savedBase(frameBase), savedSize(savedSize) {}
+
+            ~FrameGuard() {
+                frameStack.resize(savedSize);
+                frameBase = savedBase;
+            }
+        };
+
+        void assignVariable(VarAssignmentNode* assignNode) {
+            auto val = assignNode->valNode->getValue();
+
+            if (assignNode->localSlot >= 0) {
+                Value& slot = frameStack[frameBase + assignNode->localSlot];
+
+                if (assignNode->typeChecked) {
+                    slot = std::move(val);
+                } else if (assignNode->createNew) {
+                    slot = val.as(assignNode->type);
+                } else {
+                    if (slot.type == DataType::Null)
+                        throw std::runtime_error("Reference to undefined variable " + assignNode->varName);
+                    if (val.type != slot.type) {
+                        std::string msg = "Assignment to variable "
+                            + assignNode->varName + " (" + dataTypeNames[slot.type] + ")"
+                            + " with wrong type " + dataTypeNames[val.type];
+                        throw std::runtime_error(msg);
+                    }
+                    slot = val;
+                }
+                return;
+            }
+
+            if (assignNode->createNew) {
+                Variable var;
+                var.name = assignNode->varName;
+                var.type = assignNode->type;
+                var.val = assignNode->typeChecked ? std::move(val) : val.as(var.type);
+                variables[assignNode->varName] = var;
+            } else {
+                auto varIt = variables.find(assignNode->varName);
+                if (varIt == variables.end())
+                    throw std::runtime_error("Reference to undefined variable " + assignNode->varName);
+                if (!assignNode->typeChecked && val.type != varIt->second.type) {
+                    std::string msg = "Assignment to variable "
+                        + assignNode->varName + " (" + dataTypeNames[varIt->second.type] + ")"
+                        + " with wrong type " + dataTypeNames[val.type];
+                    throw std::runtime_error(msg);
+                }
+                varIt->second.val = val;
+            }
+        }
+
+        ExecResult execStatement(ASTNode* node, Value& result);
+
+        ExecResult execBlock(const std::vector<std::shared_ptr<ASTNode>>& nodes) {
+            Value discarded;
+            for (auto& n : nodes) {
+                ExecResult r = execStatement(n.get(), discarded);
+                if (r != ExecResult::Normal)
+                    return r;
+            }
+            return ExecResult::Normal;
+        }
+
+        // Resets a loop's invariant caches for a new run of the loop. If the
+        // loop is already running further up the stack (the body recursed
+        // back into it), the outer activation's state is saved and restored
+        // on exit.
+        struct LoopActivation {
+            LoopNode* loop;
+            std::vector<Value> savedValues;
+            std::vector<bool> savedCached;
+            int savedCounter = 0;
+
+            LoopActivation(LoopNode* loop) : loop(loop) {
+                if (loop->activeDepth > 0) {
+                    for (auto& invariant : loop->invariants) {
+                        savedValues.push_back(invariant->cached);
+                        savedCached.push_back(invariant->isCached);
+                    }
+
+                    if (loop->type == ASTNodeType::For)
+                        savedCounter = static_cast<ForNode*>(loop)->counterValue;
+                }
+
+                for (auto& invariant : loop->invariants)
+                    invariant->isCached = false;
+
+                loop->activeDepth++;
+            }
+
+            ~LoopActivation() {
+                loop->activeDepth--;
+
+                if (loop->activeDepth > 0) {
+                    for (size_t i = 0; i < loop->invariants.size(); i++) {
+                        loop->invariants[i]->cached = savedValues[i];
+                        loop->invariants[i]->isCached = savedCached[i];
+                    }
+
+                    if (loop->type == ASTNodeType::For)
+                        static_cast<ForNode*>(loop)->counterValue = savedCounter;
+                }
+            }
+        };
+
+        ExecResult execWhile(WhileNode* loop) {
+            LoopActivation activation(loop);
+
+            while (loop->condition->getValue().as<bool>()) {
+                ExecResult r = execBlock(loop->nodes);
+                if (r != ExecResult::Normal)
+                    return r;
+            }
+
+            return ExecResult::Normal;
+        }
+
+        Value& counterStorage(VarAssignmentNode* init) {
+            if (init->localSlot >= 0)
+                return frameStack[frameBase + init->localSlot];
+            return variables.at(init->varName).val;
+        }
+
+        bool counterInRange(int counter, int limit, ComparisonType comparison) {
+            switch (comparison) {
+            case ComparisonType::LessThan:
+                return counter < limit;
+            case ComparisonType::LessThanOrEqual:
+                return counter <= limit;
+            case ComparisonType::GreaterThan:
+                return counter > limit;
+            case ComparisonType::GreaterThanOrEqual:
+                return counter >= limit;
+            default:
+                return false;
+            }
+        }
+
+        // A limit that isn't an i32 is compared the way the condition
+        // would, in the type both sides promote to.
+        bool counterInRange(int counter, const Value& limit, ComparisonType comparison) {
+            Value counterVal(counter);
+            switch (comparison) {
+            case ComparisonType::LessThan:
+                return counterVal.isLessThan(limit).boolVal;
+            case ComparisonType::LessThanOrEqual:
+                return !limit.isLessThan(counterVal).boolVal;
+            case ComparisonType::GreaterThan:
+                return limit.isLessThan(counterVal).boolVal;
+            case ComparisonType::GreaterThanOrEqual:
+                return !counterVal.isLessThan(limit).boolVal;
+            default:
+                return false;
+            }
+        }
+
+        // Fast path for counted loops: the counter lives in a plain int
+        // and the condition and step never go through the AST.
+        ExecResult execCountedFor(ForNode* loop) {
+            auto init = static_cast<VarAssignmentNode*>(loop->init.get());
+            Value limit = loop->counterLimit->getValue();
+            loop->counterValue = counterStorage(init).intVal;
+
+            ExecResult r = ExecResult::Normal;
+            while (limit.type == DataType::Int32
+                    ? counterInRange(loop->counterValue, limit.intVal, loop->counterComparison)
+                    : counterInRange(loop->counterValue, limit, loop->counterComparison)) {
+                if (loop->syncCounter)
+                    counterStorage(init).intVal = loop->counterValue;
+
+                r = execBlock(loop->nodes);
+                if (r != ExecResult::Normal)
+                    break;
+
+                if (loop->syncCounter)
+                    loop->counterValue = counterStorage(init).intVal;
+                loop->counterValue += loop->counterStep;
+            }
+
+            counterStorage(init).intVal = loop->counterValue;
+            return r;
+        }
+
+        ExecResult execFor(ForNode* loop) {
+            LoopActivation activation(loop);
+            Value discarded;
+
+            if (loop->init != nullptr)
+                execStatement(loop->init.get(), discarded);
+
+            if (loop->isCounted)
+                return execCountedFor(loop);
+
+            while (loop->condition->getValue().as<bool>()) {
+                ExecResult r = execBlock(loop->nodes);
+                if (r != ExecResult::Normal)
+                    return r;
+
+                if (loop->step != nullptr)
+                    execStatement(loop->step.get(), discarded);
+            }
+
+            return ExecResult::Normal;
+        }
+
+        ExecResult execReturn(ReturnNode* returnNode) {
+            if (returnNode->valNode == nullptr) {
+                returnValue = Value();
+                return ExecResult::Return;
+            }
+
+            if (returnNode->isTailCall) {
+                auto call = static_cast<FunctionCallNode*>(returnNode->valNode.get());
+                auto iter = functions.find(call->functionName);
+
+                if (iter != functions.end() && !iter->second.isBuiltin) {
+                    // Arguments are evaluated in the current frame, then
+                    // copied over it by the caller's call loop.
+                    pendingTailArgsBegin = frameStack.size();
+                    for (auto& arg : call->args)
+                        frameStack.push_back(arg->getValue());
+                    pendingTailCallee = &iter->second;
+                    return ExecResult::TailCall;
+                }
+            }
+
+            returnValue = returnNode->valNode->getValue();
+            return ExecResult::Return;
+        }
+
+        ExecResult dispatchStatement(ASTNode* node, Value& result) {
+            switch (node->type) {
+            case ASTNodeType::VarAssignment:
+                assignVariable(static_cast<VarAssignmentNode*>(node));
+                return ExecResult::Normal;
+            case ASTNodeType::If:
+            {
+                auto ifNode = static_cast<IfNode*>(node);
+                bool taken = ifNode->condition->getValue().as<bool>();
+
+                if (activeProfiler != nullptr)
+                    activeProfiler->recordBranch(taken);
+
+                if (taken) {
+                    if (ifNode->lazyBody != nullptr)
+                        parseLazyBody(*ifNode);
+                    return execBlock(ifNode->nodes);
+                }
+                return ExecResult::Normal;
+            }
+            case ASTNodeType::While:
+                return execWhile(static_cast<WhileNode*>(node));
+            case ASTNodeType::For:
+                return execFor(static_cast<ForNode*>(node));
+            case ASTNodeType::FunctionDefinition:
+                throw std::runtime_error("Functions can only be defined at the top level");
+            case ASTNodeType::Return:
+                return execReturn(static_cast<ReturnNode*>(node));
+            default:
+                result = static_cast<ProducesValueNode*>(node)->getValue();
+                return ExecResult::Normal;
+            }
+        }
+
+        struct StatementMarker {
+            const ASTNode* saved;
+
+            StatementMarker(const ASTNode* node)
+                : saved(currentStatement.load(std::memory_order_relaxed)) {
+                currentStatement.store(node, std::memory_order_relaxed);
+            }
+
+            ~StatementMarker() {
+                currentStatement.store(saved, std::memory_order_relaxed);
+            }
+        };
+
+        ExecResult execStatement(ASTNode* node, Value& result) {
+            StatementMarker marker(node);
+            metrics::statementsExecuted.increment();
+
+            if (activeProfiler == nullptr)
+                return dispatchStatement(node, result);
+
+            Profiler::Scope scope(*activeProfiler, node);
+            return dispatchStatement(node, result);
+        }
+
+        void bindArguments(const FunctionDefinitionNode* def, size_t argCount) {
+            if (argCount != def->params.size())
+                throw std::runtime_error("Function " + def->name + " expects "
+                    + std::to_string(def->params.size()) + " arguments, got " + std::to_string(argCount));
+
+            for (size_t i = 0; i < argCount; i++) {
+                Value& arg = frameStack[frameBase + i];
+                arg = arg.as(def->params[i].type);
+            }
+        }
+    }
+
+    Value callScriptFunction(const Function& func, const FuncArgs& args) {
+        FunctionDefinitionNode* def = func.definition.get();
+        if (def->lazyBody != nullptr)
+            parseLazyBody(*def);
+
+        size_t newBase = frameStack.size();
+        FrameGuard guard(newBase);
+
+        // Evaluate arguments while the caller's frame is still current.
+        for (auto& arg : args)
+            frameStack.push_back(arg->getValue());
+
+        frameBase = newBase;
+        bindArguments(def, args.size());
+        frameStack.resize(newBase + def->frameSize);
+
+        while (true) {
+            ExecResult r = execBlock(def->body);
+
+            if (r != ExecResult::TailCall)
+                break;
+
+            // Tail call: replace the current frame with the callee's instead
+            // of growing the stack.
+            def = pendingTailCallee->definition.get();
+            if (def->lazyBody != nullptr)
+                parseLazyBody(*def);
+            size_t argCount = frameStack.size() - pendingTailArgsBegin;
+
+            for (size_t i = 0; i < argCount; i++)
+                frameStack[frameBase + i] = std::move(frameStack[pendingTailArgsBegin + i]);
+
+            frameStack.resize(frameBase + argCount);
+            bindArguments(def, argCount);
+            frameStack.resize(frameBase + def->frameSize);
+        }
+
+        Value result = returnValue;
+        returnValue = Value();
+        return result;
+    }
+
+    Value evalAST(std::shared_ptr<ASTNode> exprRoot) {
+        AllocPhaseScope allocPhase(AllocPhase::Eval);
+        TraceSpan span(nodeTypeNames[exprRoot->type], "statement", exprRoot->line);
+        CountErrors countErrors(metrics::evalErrors);
+
+        if (exprRoot->type == ASTNodeType::FunctionDefinition) {
+            auto def = std::static_pointer_cast<FunctionDefinitionNode>(exprRoot);
+            functions[def->name] = Function { false, def->name, nullptr, def };
+            return Value{};
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        Value result;
+        if (execStatement(exprRoot.get(), result) != ExecResult::Normal)
+            throw std::runtime_error("return outside of function");
+
+        metrics::statementLatency.observeNs(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        return result;
+    }
+}
@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include "AllocStats.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <unordered_map>
@@ -15,6 +16,8 @@ namespace iodine {
         { '*', TokenType::Operator },
         { '/', TokenType::Operator },
         { '=', TokenType::Equals },
+        { '<', TokenType::LessThan },
+        { '>', TokenType::GreaterThan },
         { '{', TokenType::OpenBrace },
         { '}', TokenType::CloseBrace },
         { '\n', TokenType::NewLine }
@@ -23,7 +26,11 @@ namespace iodine {
     std::unordered_map<std::string, TokenType> keywords = {
         { "if", TokenType::If },
         { "true", TokenType::True },
-        { "false", TokenType::False }
+        { "false", TokenType::False },
+        { "fn", TokenType::Fn },
+        { "return", TokenType::Return },
+        { "while", TokenType::While },
+        { "for", TokenType::For }
     };
 
     bool isStrNumber(const std::string& str) {
@@ -51,8 +58,24 @@ namespace iodine {
     }
 
     std::vector<Token> parseTokens(std::string str) {
+        AllocPhaseScope allocPhase(AllocPhase::Lex);
+        TraceSpan span("parseTokens", "lex");
+        CountErrors countErrors(metrics::lexErrors);
         std::vector<Token> tokens;
         std::string currentText;
+        size_t currentTextOffset = 0;
+
+        // Counts newlines up to the given position. Positions only ever move
+        // forward, so this stays linear in the length of the script.
+        int line = 1;
+        auto lineCursor = str.begin();
+        auto lineAt = [&](std::string::iterator pos) {
+            for (; lineCursor < pos; lineCursor++) {
+                if (*lineCursor == '\n')
+                    line++;
+            }
+            return line;
+        };
 
         for (auto charIt = str.begin(); charIt < str.end(); charIt++) {
             if (charIt < str.end() - 1) {
@@ -78,11 +101,10 @@ namespace iodine {
                 }
 
                 if (*charIt == '/' && *(charIt + 1) == '/') {
+                    // Stop on the newline itself; the loop increment skips it.
                     while (charIt < str.end() - 1) {
-                        if (*charIt == '\n') {
-                            charIt++;
+                        if (*charIt == '\n')
                             break;
-                        }
 
                         charIt++;
                     }
@@ -95,7 +117,8 @@ namespace iodine {
 
             if (pair != singleCharTokens.end()) {
                 if (pair->second == TokenType::DoubleQuote) {
-                    std::cout << "parsing str1: charit " << *charIt << "\n";
+                    int startLine = lineAt(charIt);
+                    size_t startOffset = charIt - str.begin();
                     bool reachedEnd = false;
                     std::string parsedStr = "";
                     charIt++;
@@ -114,6 +137,8 @@ namespace iodine {
                     Token t;
                     t.type = TokenType::StringContents;
                     t.val = parsedStr;
+                    t.line = startLine;
+                    t.offset = startOffset;
                     tokens.push_back(t);
                     continue;
                 }
@@ -135,6 +160,8 @@ namespace iodine {
                         newToken.type = TokenType::DecimalNumber;
                     }
                     newToken.val = currentText;
+                    newToken.line = lineAt(charIt);
+                    newToken.offset = currentTextOffset;
                     currentText.clear();
                     tokens.push_back(newToken);
                 }
@@ -142,6 +169,8 @@ namespace iodine {
                 Token newToken;
                 newToken.val = *charIt;
                 newToken.type = pair->second;
+                newToken.line = lineAt(charIt);
+                newToken.offset = charIt - str.begin();
                 tokens.push_back(newToken);
                 continue;
             }
@@ -164,12 +193,16 @@ namespace iodine {
                         newToken.type = TokenType::DecimalNumber;
                     }
                     newToken.val = currentText;
+                    newToken.line = lineAt(charIt);
+                    newToken.offset = currentTextOffset;
                     currentText.clear();
                     tokens.push_back(newToken);
                 }
                 continue;
             }
 
+            if (currentText.empty())
+                currentTextOffset = charIt - str.begin();
             currentText += *charIt;
         }
 
@@ -185,6 +218,8 @@ namespace iodine {
                 newToken.type = TokenType::DecimalNumber;
             }
 
+            newToken.line = lineAt(str.end());
+            newToken.offset = currentTextOffset;
             currentText.clear();
             tokens.push_back(newToken);
         }
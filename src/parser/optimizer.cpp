@@ -0,0 +1,417 @@
+#include "parser.hpp"
+#include "AllocStats.hpp"
+#include <unordered_set>
+
+namespace iodine {
+    namespace {
+        // Identifies a variable for the purposes of the optimizer. Locals
+        // are keyed by slot, since function locals shadow globals.
+        std::string variableKey(const std::string& name, int localSlot) {
+            if (localSlot >= 0)
+                return "#" + std::to_string(localSlot);
+            return name;
+        }
+
+        struct LoopInfo {
+            LoopNode* loop;
+            std::unordered_set<std::string> assigned;
+            // A call can modify any global, so globals are only invariant
+            // in loops that don't call anything.
+            bool hasCalls = false;
+        };
+
+        void collectEffects(ASTNode* node, LoopInfo& info) {
+            if (node == nullptr)
+                return;
+
+            switch (node->type) {
+            case ASTNodeType::VarAssignment:
+            {
+                auto assign = static_cast<VarAssignmentNode*>(node);
+                info.assigned.insert(variableKey(assign->varName, assign->localSlot));
+                collectEffects(assign->valNode.get(), info);
+                break;
+            }
+            case ASTNodeType::Arithmetic:
+                collectEffects(static_cast<ArithmeticNode*>(node)->a.get(), info);
+                collectEffects(static_cast<ArithmeticNode*>(node)->b.get(), info);
+                break;
+            case ASTNodeType::UnaryOp:
+                collectEffects(static_cast<UnaryOpNode*>(node)->valNode.get(), info);
+                break;
+            case ASTNodeType::Comparison:
+                collectEffects(static_cast<ComparisonNode*>(node)->lhs.get(), info);
+                collectEffects(static_cast<ComparisonNode*>(node)->rhs.get(), info);
+                break;
+            case ASTNodeType::FunctionCall:
+                info.hasCalls = true;
+                for (auto& arg : static_cast<FunctionCallNode*>(node)->args)
+                    collectEffects(arg.get(), info);
+                break;
+            case ASTNodeType::LoopInvariant:
+                collectEffects(static_cast<LoopInvariantNode*>(node)->expr.get(), info);
+                break;
+            case ASTNodeType::InductionVariable:
+            {
+                auto inductionVar = static_cast<InductionVariableNode*>(node);
+                auto init = static_cast<VarAssignmentNode*>(inductionVar->loop->init.get());
+                info.assigned.insert(variableKey(init->varName, init->localSlot));
+                break;
+            }
+            case ASTNodeType::If:
+            {
+                auto ifNode = static_cast<IfNode*>(node);
+                collectEffects(ifNode->condition.get(), info);
+                for (auto& child : ifNode->nodes)
+                    collectEffects(child.get(), info);
+                break;
+            }
+            case ASTNodeType::While:
+            case ASTNodeType::For:
+            {
+                auto loop = static_cast<LoopNode*>(node);
+                collectEffects(loop->condition.get(), info);
+                for (auto& child : loop->nodes)
+                    collectEffects(child.get(), info);
+
+                if (node->type == ASTNodeType::For) {
+                    collectEffects(static_cast<ForNode*>(node)->init.get(), info);
+                    collectEffects(static_cast<ForNode*>(node)->step.get(), info);
+                }
+                break;
+            }
+            case ASTNodeType::Return:
+                collectEffects(static_cast<ReturnNode*>(node)->valNode.get(), info);
+                break;
+            default:
+                break;
+            }
+        }
+
+        bool isInvariant(ProducesValueNode* node, const LoopInfo& info) {
+            switch (node->type) {
+            case ASTNodeType::ConstVal:
+                return true;
+            case ASTNodeType::VariableReference:
+            {
+                auto ref = static_cast<VariableReferenceNode*>(node);
+                if (info.assigned.count(variableKey(ref->varName, ref->localSlot)))
+                    return false;
+                return ref->localSlot >= 0 || !info.hasCalls;
+            }
+            case ASTNodeType::Arithmetic:
+                return isInvariant(static_cast<ArithmeticNode*>(node)->a.get(), info)
+                    && isInvariant(static_cast<ArithmeticNode*>(node)->b.get(), info);
+            case ASTNodeType::UnaryOp:
+                return isInvariant(static_cast<UnaryOpNode*>(node)->valNode.get(), info);
+            case ASTNodeType::Comparison:
+                return isInvariant(static_cast<ComparisonNode*>(node)->lhs.get(), info)
+                    && isInvariant(static_cast<ComparisonNode*>(node)->rhs.get(), info);
+            case ASTNodeType::LoopInvariant:
+                return isInvariant(static_cast<LoopInvariantNode*>(node)->expr.get(), info);
+            default:
+                // Calls might have side effects, and induction variables
+                // change every iteration by definition.
+                return false;
+            }
+        }
+
+        void wrapInvariant(std::shared_ptr<ProducesValueNode>& expr, LoopInfo& info) {
+            if (expr->type == ASTNodeType::ConstVal || expr->type == ASTNodeType::VariableReference)
+                return;
+
+            auto invariant = makeNode<LoopInvariantNode>();
+            invariant->expr = expr;
+            info.loop->invariants.push_back(invariant);
+            expr = invariant;
+        }
+
+        // Wraps the largest invariant subexpressions of expr.
+        void hoistExpression(std::shared_ptr<ProducesValueNode>& expr, LoopInfo& info) {
+            if (expr == nullptr)
+                return;
+
+            if (isInvariant(expr.get(), info)) {
+                wrapInvariant(expr, info);
+                return;
+            }
+
+            switch (expr->type) {
+            case ASTNodeType::Arithmetic:
+                hoistExpression(std::static_pointer_cast<ArithmeticNode>(expr)->a, info);
+                hoistExpression(std::static_pointer_cast<ArithmeticNode>(expr)->b, info);
+                break;
+            case ASTNodeType::UnaryOp:
+                hoistExpression(std::static_pointer_cast<UnaryOpNode>(expr)->valNode, info);
+                break;
+            case ASTNodeType::Comparison:
+                hoistExpression(std::static_pointer_cast<ComparisonNode>(expr)->lhs, info);
+                hoistExpression(std::static_pointer_cast<ComparisonNode>(expr)->rhs, info);
+                break;
+            case ASTNodeType::FunctionCall:
+                for (auto& arg : std::static_pointer_cast<FunctionCallNode>(expr)->args)
+                    hoistExpression(arg, info);
+                break;
+            default:
+                break;
+            }
+        }
+
+        void hoistStatement(const std::shared_ptr<ASTNode>& node, LoopInfo& info) {
+            if (node == nullptr)
+                return;
+
+            switch (node->type) {
+            case ASTNodeType::VarAssignment:
+                hoistExpression(std::static_pointer_cast<VarAssignmentNode>(node)->valNode, info);
+                break;
+            case ASTNodeType::Return:
+                hoistExpression(std::static_pointer_cast<ReturnNode>(node)->valNode, info);
+                break;
+            case ASTNodeType::If:
+            {
+                auto ifNode = std::static_pointer_cast<IfNode>(node);
+                hoistExpression(ifNode->condition, info);
+                for (auto& child : ifNode->nodes)
+                    hoistStatement(child, info);
+                break;
+            }
+            case ASTNodeType::While:
+            case ASTNodeType::For:
+            {
+                auto loop = std::static_pointer_cast<LoopNode>(node);
+                hoistExpression(loop->condition, info);
+                for (auto& child : loop->nodes)
+                    hoistStatement(child, info);
+
+                if (node->type == ASTNodeType::For) {
+                    hoistStatement(std::static_pointer_cast<ForNode>(node)->init, info);
+                    hoistStatement(std::static_pointer_cast<ForNode>(node)->step, info);
+                }
+                break;
+            }
+            case ASTNodeType::FunctionCall:
+                // Expression statement. Only the arguments can be hoisted,
+                // the call itself has to happen every iteration.
+                for (auto& arg : std::static_pointer_cast<FunctionCallNode>(node)->args)
+                    hoistExpression(arg, info);
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Points every read of the counter in the body at the unboxed value.
+        void replaceInductionReads(std::shared_ptr<ProducesValueNode>& expr, ForNode* loop, const std::string& key);
+
+        void replaceInductionReads(const std::shared_ptr<ASTNode>& node, ForNode* loop, const std::string& key) {
+            if (node == nullptr)
+                return;
+
+            switch (node->type) {
+            case ASTNodeType::VarAssignment:
+                replaceInductionReads(std::static_pointer_cast<VarAssignmentNode>(node)->valNode, loop, key);
+                break;
+            case ASTNodeType::Return:
+                replaceInductionReads(std::static_pointer_cast<ReturnNode>(node)->valNode, loop, key);
+                break;
+            case ASTNodeType::If:
+            {
+                auto ifNode = std::static_pointer_cast<IfNode>(node);
+                replaceInductionReads(ifNode->condition, loop, key);
+                for (auto& child : ifNode->nodes)
+                    replaceInductionReads(child, loop, key);
+                break;
+            }
+            case ASTNodeType::While:
+            case ASTNodeType::For:
+            {
+                auto inner = std::static_pointer_cast<LoopNode>(node);
+                replaceInductionReads(inner->condition, loop, key);
+                for (auto& child : inner->nodes)
+                    replaceInductionReads(child, loop, key);
+
+                if (node->type == ASTNodeType::For) {
+                    auto innerFor = std::static_pointer_cast<ForNode>(node);
+                    replaceInductionReads(innerFor->init, loop, key);
+                    replaceInductionReads(innerFor->step, loop, key);
+                    if (innerFor->counterLimit != nullptr)
+                        replaceInductionReads(innerFor->counterLimit, loop, key);
+                }
+                break;
+            }
+            case ASTNodeType::FunctionCall:
+                for (auto& arg : std::static_pointer_cast<FunctionCallNode>(node)->args)
+                    replaceInductionReads(arg, loop, key);
+                break;
+            default:
+                break;
+            }
+        }
+
+        void replaceInductionReads(std::shared_ptr<ProducesValueNode>& expr, ForNode* loop, const std::string& key) {
+            if (expr == nullptr)
+                return;
+
+            switch (expr->type) {
+            case ASTNodeType::VariableReference:
+            {
+                auto ref = std::static_pointer_cast<VariableReferenceNode>(expr);
+                if (variableKey(ref->varName, ref->localSlot) == key) {
+                    auto inductionVar = makeNode<InductionVariableNode>();
+                    inductionVar->varName = ref->varName;
+                    inductionVar->loop = loop;
+                    expr = inductionVar;
+                }
+                break;
+            }
+            case ASTNodeType::Arithmetic:
+                replaceInductionReads(std::static_pointer_cast<ArithmeticNode>(expr)->a, loop, key);
+                replaceInductionReads(std::static_pointer_cast<ArithmeticNode>(expr)->b, loop, key);
+                break;
+            case ASTNodeType::UnaryOp:
+                replaceInductionReads(std::static_pointer_cast<UnaryOpNode>(expr)->valNode, loop, key);
+                break;
+            case ASTNodeType::Comparison:
+                replaceInductionReads(std::static_pointer_cast<ComparisonNode>(expr)->lhs, loop, key);
+                replaceInductionReads(std::static_pointer_cast<ComparisonNode>(expr)->rhs, loop, key);
+                break;
+            case ASTNodeType::FunctionCall:
+                for (auto& arg : std::static_pointer_cast<FunctionCallNode>(expr)->args)
+                    replaceInductionReads(arg, loop, key);
+                break;
+            case ASTNodeType::LoopInvariant:
+                replaceInductionReads(std::static_pointer_cast<LoopInvariantNode>(expr)->expr, loop, key);
+                break;
+            default:
+                break;
+            }
+        }
+
+        bool isVariable(ProducesValueNode* node, const std::string& key) {
+            if (node->type != ASTNodeType::VariableReference)
+                return false;
+            auto ref = static_cast<VariableReferenceNode*>(node);
+            return variableKey(ref->varName, ref->localSlot) == key;
+        }
+
+        bool isIntConstant(ProducesValueNode* node) {
+            return node->type == ASTNodeType::ConstVal
+                && static_cast<ConstValNode*>(node)->val.type == DataType::Int32;
+        }
+
+        // Recognizes "for (i32 i = a; i < b; i = i + c)" with an invariant
+        // limit and constant step.
+        void setupCountedLoop(ForNode* loop, const LoopInfo& info) {
+            if (loop->init == nullptr || loop->step == nullptr)
+                return;
+            if (loop->init->type != ASTNodeType::VarAssignment || loop->step->type != ASTNodeType::VarAssignment)
+                return;
+
+            auto init = static_cast<VarAssignmentNode*>(loop->init.get());
+            auto step = static_cast<VarAssignmentNode*>(loop->step.get());
+            if (!init->createNew || init->type != DataType::Int32)
+                return;
+
+            std::string key = variableKey(init->varName, init->localSlot);
+            if (step->createNew || variableKey(step->varName, step->localSlot) != key)
+                return;
+
+            // The body must leave the counter alone.
+            LoopInfo bodyInfo { loop };
+            for (auto& child : loop->nodes)
+                collectEffects(child.get(), bodyInfo);
+            if (bodyInfo.assigned.count(key))
+                return;
+
+            if (loop->condition->type != ASTNodeType::Comparison)
+                return;
+            auto comp = static_cast<ComparisonNode*>(loop->condition.get());
+            if (comp->compType == ComparisonType::Equal || !isVariable(comp->lhs.get(), key))
+                return;
+            if (!isInvariant(comp->rhs.get(), info))
+                return;
+
+            if (step->valNode->type != ASTNodeType::Arithmetic)
+                return;
+            auto stepExpr = static_cast<ArithmeticNode*>(step->valNode.get());
+            int stepAmount;
+            if (stepExpr->operation == ArithmeticOperation::Add && isVariable(stepExpr->a.get(), key) && isIntConstant(stepExpr->b.get())) {
+                stepAmount = static_cast<ConstValNode*>(stepExpr->b.get())->val.intVal;
+            } else if (stepExpr->operation == ArithmeticOperation::Add && isIntConstant(stepExpr->a.get()) && isVariable(stepExpr->b.get(), key)) {
+                stepAmount = static_cast<ConstValNode*>(stepExpr->a.get())->val.intVal;
+            } else if (stepExpr->operation == ArithmeticOperation::Subtract && isVariable(stepExpr->a.get(), key) && isIntConstant(stepExpr->b.get())) {
+                stepAmount = -static_cast<ConstValNode*>(stepExpr->b.get())->val.intVal;
+            } else {
+                return;
+            }
+
+            loop->isCounted = true;
+            loop->counterComparison = comp->compType;
+            loop->counterLimit = comp->rhs;
+            loop->counterStep = stepAmount;
+            loop->syncCounter = init->localSlot < 0 && bodyInfo.hasCalls;
+
+            // A function called from the body can assign a global counter,
+            // so the body reads the variable, which holds the latest value.
+            if (loop->syncCounter)
+                return;
+            for (auto& child : loop->nodes)
+                replaceInductionReads(child, loop, key);
+        }
+
+        void optimizeLoop(LoopNode* loop) {
+            LoopInfo info { loop };
+            collectEffects(loop->condition.get(), info);
+            for (auto& child : loop->nodes)
+                collectEffects(child.get(), info);
+
+            if (loop->type == ASTNodeType::For) {
+                auto forNode = static_cast<ForNode*>(loop);
+                collectEffects(forNode->init.get(), info);
+                collectEffects(forNode->step.get(), info);
+            }
+
+            hoistExpression(loop->condition, info);
+            for (auto& child : loop->nodes)
+                hoistStatement(child, info);
+
+            if (loop->type == ASTNodeType::For) {
+                auto forNode = static_cast<ForNode*>(loop);
+                hoistStatement(forNode->step, info);
+                setupCountedLoop(forNode, info);
+            }
+        }
+    }
+
+    void optimizeLoops(std::shared_ptr<ASTNode> node) {
+        if (node == nullptr)
+            return;
+
+        AllocPhaseScope allocPhase(AllocPhase::Optimize);
+
+        switch (node->type) {
+        case ASTNodeType::If:
+            for (auto& child : std::static_pointer_cast<IfNode>(node)->nodes)
+                optimizeLoops(child);
+            break;
+        case ASTNodeType::FunctionDefinition:
+            for (auto& child : std::static_pointer_cast<FunctionDefinitionNode>(node)->body)
+                optimizeLoops(child);
+            break;
+        case ASTNodeType::While:
+        case ASTNodeType::For:
+        {
+            // Inner loops first, so outer loops can hoist what the inner
+            // ones already found.
+            auto loop = std::static_pointer_cast<LoopNode>(node);
+            for (auto& child : loop->nodes)
+                optimizeLoops(child);
+            optimizeLoop(loop.get());
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
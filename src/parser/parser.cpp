@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include "AllocStats.hpp"
 #include <cassert>
 #include <iostream>
 #include <memory>
@@ -14,10 +15,37 @@ namespace iodine {
 
     class Parser {
     private:
+        using TokenIter = std::vector<Token>::iterator;
+
+        // Only set when parsing a whole script; lazy blocks keep the token
+        // stream alive through it.
+        std::shared_ptr<std::vector<Token>> source;
+        bool lazy;
+
+        friend void iodine::parseLazyBody(IfNode& node);
+        friend void iodine::parseLazyBody(FunctionDefinitionNode& node);
+        friend std::vector<size_t> iodine::splitStatements(std::vector<Token>& tokens);
+
+        std::shared_ptr<LazyBlock> makeLazyBlock(TokenIter begin, TokenIter end) {
+            auto block = std::make_shared<LazyBlock>();
+            block->tokens = source;
+            block->begin = begin - source->begin();
+            block->end = end - source->begin();
+            return block;
+        }
+
+        std::vector<std::shared_ptr<ASTNode>> parseEagerBlock(TokenIter begin, TokenIter end) {
+            bool wasLazy = lazy;
+            lazy = false;
+            auto nodes = parseBlock(begin, end);
+            lazy = wasLazy;
+            return nodes;
+        }
+
         std::shared_ptr<ArithmeticNode> makeArithmeticNode(Token& opToken, std::shared_ptr<ProducesValueNode> a, std::shared_ptr<ProducesValueNode> b) {
             assert(opToken.type == TokenType::Operator);
 
-            auto node = std::make_shared<ArithmeticNode>();
+            auto node = makeNode<ArithmeticNode>();
 
             if (opToken.val == "-")
                 node->operation = ArithmeticOperation::Subtract;
@@ -35,13 +63,13 @@ namespace iodine {
 
         std::shared_ptr<ConstValNode> tokenToVal(const Token& token) {
             if (token.type == TokenType::DecimalNumber) {
-                return std::make_shared<ConstValNode>((float)std::atof(token.val.c_str()));
+                return makeNode<ConstValNode>((float)std::atof(token.val.c_str()));
             } else if (token.type == TokenType::Number) {
-                return std::make_shared<ConstValNode>(token.numberVal);
+                return makeNode<ConstValNode>(token.numberVal);
             } else if (token.type == TokenType::True) {
-                return std::make_shared<ConstValNode>(true);
+                return makeNode<ConstValNode>(true);
             } else if (token.type == TokenType::False) {
-                return std::make_shared<ConstValNode>(false);
+                return makeNode<ConstValNode>(false);
             } else {
                 std::cerr << "Warning: Can't deduce value type of token " << tokenNames[token.type] << "\n";
                 return nullptr;
@@ -62,7 +90,7 @@ namespace iodine {
                 safeAdvance(tokenIt, end);
                 expect(tokenIt, TokenType::Equals);
 
-                auto comp = std::make_shared<ComparisonNode>();
+                auto comp = makeNode<ComparisonNode>();
                 comp->compType = ComparisonType::Equal;
                 comp->lhs = val;
                 safeAdvance(tokenIt, end);
@@ -70,6 +98,25 @@ namespace iodine {
                 return comp;
             }
 
+            if (tokenIt->type == TokenType::LessThan || tokenIt->type == TokenType::GreaterThan) {
+                bool isLess = tokenIt->type == TokenType::LessThan;
+                safeAdvance(tokenIt, end);
+
+                auto comp = makeNode<ComparisonNode>();
+                if (tokenIt->type == TokenType::Equals) {
+                    comp->compType = isLess ? ComparisonType::LessThanOrEqual : ComparisonType::GreaterThanOrEqual;
+                    safeAdvance(tokenIt, end);
+                } else {
+                    comp->compType = isLess ? ComparisonType::LessThan : ComparisonType::GreaterThan;
+                }
+
+                comp->lhs = val;
+                comp->rhs = std::static_pointer_cast<ProducesValueNode>(parseExpression(tokenIt, end));
+                if (comp->rhs == nullptr)
+                    throw std::runtime_error("Expected expression");
+                return comp;
+            }
+
             if (tokenIt->type != TokenType::Operator)
                 throw std::runtime_error(std::string("Expected operator, found ") + tokenNames[tokenIt->type]);
 
@@ -85,8 +132,6 @@ namespace iodine {
             return makeArithmeticNode(*tokenIt, a, b);
         }
 
-        using TokenIter = std::vector<Token>::iterator;
-
         void expect(TokenIter it, TokenType type) {
             if (it->type != type) {
                 throw std::runtime_error(std::string("Expected ") + tokenNames[type] + ", got " + tokenNames[it->type]);
@@ -119,8 +164,270 @@ namespace iodine {
 
             return end;
         }
+
+        // Finds the token closing the bracket at open, skipping over nested pairs.
+        TokenIter findMatching(TokenIter open, TokenIter end) {
+            TokenType openType = open->type;
+            TokenType closeType = openType == TokenType::OpenBrace ? TokenType::CloseBrace : TokenType::CloseParenthesis;
+            int depth = 0;
+
+            for (auto i = open; i < end; i++) {
+                if (i->type == openType) {
+                    depth++;
+                } else if (i->type == closeType) {
+                    depth--;
+                    if (depth == 0)
+                        return i;
+                }
+            }
+
+            throw std::runtime_error(std::string("Could not find matching ") + tokenNames[closeType]);
+        }
+
+        // Returns the token ending the statement starting at begin: either
+        // its semicolon, or the token after the brace closing its block.
+        TokenIter findStatementEnd(TokenIter begin, TokenIter end) {
+            // Parentheses only matter outside of blocks (semicolons in for
+            // headers), so a block's contents can't throw off the scan.
+            int braceDepth = 0;
+            int parenDepth = 0;
+
+            for (auto i = begin; i < end; i++) {
+                if (i->type == TokenType::OpenBrace) {
+                    braceDepth++;
+                } else if (i->type == TokenType::CloseBrace) {
+                    braceDepth--;
+                    if (braceDepth == 0)
+                        return i + 1;
+                } else if (braceDepth > 0) {
+                    continue;
+                } else if (i->type == TokenType::OpenParenthesis) {
+                    parenDepth++;
+                } else if (i->type == TokenType::CloseParenthesis) {
+                    parenDepth--;
+                } else if (i->type == TokenType::Semicolon && parenDepth == 0) {
+                    return i;
+                }
+            }
+
+            return end;
+        }
+
+        std::vector<std::shared_ptr<ASTNode>> parseBlock(TokenIter begin, TokenIter end) {
+            std::vector<std::shared_ptr<ASTNode>> nodes;
+            auto cIt = begin;
+
+            while (cIt < end) {
+                auto next = findStatementEnd(cIt, end);
+                auto expr = parseExpression(cIt, next);
+
+                if (expr != nullptr) {
+                    expr->line = cIt->line;
+                    nodes.push_back(expr);
+                }
+
+                cIt = next;
+                if (cIt < end && cIt->type == TokenType::Semicolon)
+                    cIt++;
+            }
+
+            return nodes;
+        }
+
+        std::shared_ptr<FunctionCallNode> parseFunctionCall(TokenIter nameToken, TokenIter closeParenToken) {
+            auto fCall = makeNode<FunctionCallNode>();
+            fCall->functionName = nameToken->val;
+
+            auto openParenToken = nameToken + 1;
+            auto currentArgStart = openParenToken + 1;
+            for (auto it = openParenToken + 1; it < closeParenToken; it++) {
+                if (it->type == TokenType::OpenParenthesis) {
+                    it = findMatching(it, closeParenToken);
+                } else if (it->type == TokenType::Comma) {
+                    fCall->args.emplace_back(std::static_pointer_cast<ProducesValueNode>(parseExpression(currentArgStart, it)));
+                    currentArgStart = it + 1;
+                }
+            }
+
+            if (std::distance(openParenToken, closeParenToken) > 1) {
+                fCall->args.emplace_back(std::static_pointer_cast<ProducesValueNode>(parseExpression(currentArgStart, closeParenToken)));
+            }
+
+            return fCall;
+        }
+
+        std::shared_ptr<FunctionDefinitionNode> parseFunctionDefinition(TokenIter begin, TokenIter end) {
+            auto tokenIt = begin;
+            auto def = makeNode<FunctionDefinitionNode>();
+
+            safeAdvance(tokenIt, end);
+            expect(tokenIt, TokenType::Name);
+            def->name = tokenIt->val;
+
+            safeAdvance(tokenIt, end);
+            expect(tokenIt, TokenType::OpenParenthesis);
+            auto closeParen = findMatching(tokenIt, end);
+
+            for (auto it = tokenIt + 1; it < closeParen; it++) {
+                if (it->type == TokenType::Comma)
+                    continue;
+
+                expect(it, TokenType::Name);
+                auto typeIt = builtinTypes.find(it->val);
+                if (typeIt == builtinTypes.end())
+                    throw std::runtime_error("Unknown parameter type " + it->val);
+
+                it++;
+                if (it >= closeParen)
+                    throw std::runtime_error("Expected parameter name");
+                expect(it, TokenType::Name);
+
+                def->params.push_back(FunctionParameter { it->val, typeIt->second });
+            }
+
+            tokenIt = closeParen;
+            safeAdvance(tokenIt, end);
+            expect(tokenIt, TokenType::OpenBrace);
+            auto closeBrace = findMatching(tokenIt, end);
+
+            if (lazy) {
+                def->lazyBody = makeLazyBlock(tokenIt + 1, closeBrace);
+                return def;
+            }
+
+            def->body = parseEagerBlock(tokenIt + 1, closeBrace);
+            resolveFunction(*def);
+            return def;
+        }
+
+        void resolveFunction(FunctionDefinitionNode& def) {
+            std::unordered_map<std::string, int> slots;
+            for (auto& param : def.params) {
+                if (slots.count(param.name))
+                    throw std::runtime_error("Duplicate parameter " + param.name);
+                slots[param.name] = (int)slots.size();
+            }
+
+            for (auto& node : def.body)
+                collectLocals(node.get(), slots);
+
+            for (auto& node : def.body)
+                resolveLocals(node.get(), slots);
+
+            def.frameSize = (int)slots.size();
+        }
+
+        // Gives every variable declared anywhere in a function body its own
+        // frame slot.
+        void collectLocals(ASTNode* node, std::unordered_map<std::string, int>& slots) {
+            switch (node->type) {
+            case ASTNodeType::VarAssignment:
+            {
+                auto assign = static_cast<VarAssignmentNode*>(node);
+                if (assign->createNew && !slots.count(assign->varName))
+                    slots[assign->varName] = (int)slots.size();
+                break;
+            }
+            case ASTNodeType::If:
+                for (auto& child : static_cast<IfNode*>(node)->nodes)
+                    collectLocals(child.get(), slots);
+                break;
+            case ASTNodeType::For:
+            {
+                auto forNode = static_cast<ForNode*>(node);
+                if (forNode->init != nullptr)
+                    collectLocals(forNode->init.get(), slots);
+                for (auto& child : forNode->nodes)
+                    collectLocals(child.get(), slots);
+                break;
+            }
+            case ASTNodeType::While:
+                for (auto& child : static_cast<WhileNode*>(node)->nodes)
+                    collectLocals(child.get(), slots);
+                break;
+            case ASTNodeType::FunctionDefinition:
+                throw std::runtime_error("Functions can only be defined at the top level");
+            default:
+                break;
+            }
+        }
+
+        void resolveLocals(ASTNode* node, const std::unordered_map<std::string, int>& slots) {
+            if (node == nullptr)
+                return;
+
+            switch (node->type) {
+            case ASTNodeType::VariableReference:
+            {
+                auto ref = static_cast<VariableReferenceNode*>(node);
+                auto it = slots.find(ref->varName);
+                if (it != slots.end())
+                    ref->localSlot = it->second;
+                break;
+            }
+            case ASTNodeType::VarAssignment:
+            {
+                auto assign = static_cast<VarAssignmentNode*>(node);
+                auto it = slots.find(assign->varName);
+                if (it != slots.end())
+                    assign->localSlot = it->second;
+                resolveLocals(assign->valNode.get(), slots);
+                break;
+            }
+            case ASTNodeType::Arithmetic:
+            {
+                auto arith = static_cast<ArithmeticNode*>(node);
+                resolveLocals(arith->a.get(), slots);
+                resolveLocals(arith->b.get(), slots);
+                break;
+            }
+            case ASTNodeType::UnaryOp:
+                resolveLocals(static_cast<UnaryOpNode*>(node)->valNode.get(), slots);
+                break;
+            case ASTNodeType::Comparison:
+            {
+                auto comp = static_cast<ComparisonNode*>(node);
+                resolveLocals(comp->lhs.get(), slots);
+                resolveLocals(comp->rhs.get(), slots);
+                break;
+            }
+            case ASTNodeType::FunctionCall:
+                for (auto& arg : static_cast<FunctionCallNode*>(node)->args)
+                    resolveLocals(arg.get(), slots);
+                break;
+            case ASTNodeType::If:
+            {
+                auto ifNode = static_cast<IfNode*>(node);
+                resolveLocals(ifNode->condition.get(), slots);
+                for (auto& child : ifNode->nodes)
+                    resolveLocals(child.get(), slots);
+                break;
+            }
+            case ASTNodeType::Return:
+                resolveLocals(static_cast<ReturnNode*>(node)->valNode.get(), slots);
+                break;
+            case ASTNodeType::While:
+            case ASTNodeType::For:
+            {
+                auto loop = static_cast<LoopNode*>(node);
+                resolveLocals(loop->condition.get(), slots);
+                for (auto& child : loop->nodes)
+                    resolveLocals(child.get(), slots);
+
+                if (node->type == ASTNodeType::For) {
+                    resolveLocals(static_cast<ForNode*>(node)->init.get(), slots);
+                    resolveLocals(static_cast<ForNode*>(node)->step.get(), slots);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
     public:
-        Parser() {
+        Parser(std::shared_ptr<std::vector<Token>> source = nullptr, bool lazy = false)
+            : source(source)
+            , lazy(lazy && source != nullptr) {
         }
 
         std::shared_ptr<ASTNode> parseExpression(std::vector<Token>::iterator begin, std::vector<Token>::iterator end) {
@@ -128,7 +435,12 @@ namespace iodine {
             for (auto tokenIt = begin; tokenIt < end; tokenIt++) {
                 if (tokenIt->type == TokenType::Semicolon || tokenIt->type == TokenType::NewLine) continue;
                 if (tokenIt->type == TokenType::StringContents) {
-                    return std::make_shared<ConstValNode>(Value{strdup(tokenIt->val.c_str())}); 
+                    auto val = makeNode<ConstValNode>(Value{InternedString(tokenIt->val)});
+                    if (tokenIt == end - 1)
+                        return val;
+
+                    tokenIt++;
+                    return parsePartialExpression(val, tokenIt, end);
                 } else if (tokenIt->type == TokenType::Number || tokenIt->type == TokenType::DecimalNumber || tokenIt->type == TokenType::True || tokenIt->type == TokenType::False) {
                     // Tokens that can follow this:
                     // Operator
@@ -142,17 +454,7 @@ namespace iodine {
                     tokenIt++;
                     return parsePartialExpression(val, tokenIt, end);
                 } else if (tokenIt->type == TokenType::OpenParenthesis) {
-                    // search forward for close parenthesis
-
-                    std::vector<Token>::iterator closeParenthesisPos = end;
-                    for (auto it2 = tokenIt; it2 < end; it2++) {
-                        if (it2->type == TokenType::CloseParenthesis) {
-                            closeParenthesisPos = it2;
-                        }
-                    }
-
-                    if (closeParenthesisPos == end)
-                        throw std::runtime_error("Couldn't find close parenthesis");
+                    auto closeParenthesisPos = findMatching(tokenIt, end);
 
                     auto parenthesisNode = parseExpression(tokenIt + 1, closeParenthesisPos);
                     if (parenthesisNode == nullptr)
@@ -162,23 +464,14 @@ namespace iodine {
                         return parenthesisNode;
 
                     // look for an operator
-                    tokenIt = closeParenthesisPos + 1;
-
-                    assert(tokenIt->type == TokenType::Operator);
-
-                    auto b = parseExpression(tokenIt + 1, end);
-
-                    if (b == nullptr)
-                        throw std::runtime_error("Expected expression");
-
-                    return makeArithmeticNode(*tokenIt, std::static_pointer_cast<ProducesValueNode>(parenthesisNode), std::static_pointer_cast<ProducesValueNode>(b));
+                    return parsePartialExpression(std::static_pointer_cast<ProducesValueNode>(parenthesisNode), closeParenthesisPos + 1, end);
                 } else if (tokenIt->type == TokenType::Operator) {
                     // Bit of a problem with unary ops
                     // If we do something like -5 + 2, we're expecting it to parse as (-5) + (2) = -3
                     // However, Iodine currently parses it as -(5 + 2) = -7 which is just wrong!
                     // I'm not entirely sure how to fix this...
                     // Order of operations seems to be a significant problem with how the parser is designed right now.
-                    auto unaryOpNode = std::make_shared<UnaryOpNode>();
+                    auto unaryOpNode = makeNode<UnaryOpNode>();
                     if (tokenIt->val == "+") {
                         // Unary plus
                         unaryOpNode->operation = UnaryOperation::Plus;
@@ -206,7 +499,7 @@ namespace iodine {
                     if (typeIt == builtinTypes.end()) {
                         // is this the end?
                         if (tokenIt == (end - 1)) {
-                            auto varRef = std::make_shared<VariableReferenceNode>();
+                            auto varRef = makeNode<VariableReferenceNode>();
                             varRef->varName = tokenIt->val;
                             return varRef;
                         }
@@ -216,50 +509,30 @@ namespace iodine {
                         // if it's an open parenthesis we know this is a function call
 
                         if ((tokenIt + 1)->type == TokenType::OpenParenthesis) {
-                            auto openParenToken = tokenIt + 1;
-
-                            // find close parenthesis
-                            auto closeParenToken = end;
-                            for (auto it = openParenToken; it < end; it++) {
-                                if (it->type == TokenType::CloseParenthesis)
-                                    closeParenToken = it;
-                            }
+                            // function call!
+                            auto closeParenToken = findMatching(tokenIt + 1, end);
+                            auto fCall = parseFunctionCall(tokenIt, closeParenToken);
 
-                            if (closeParenToken == end)
-                                throw std::runtime_error("Could not find close parenthesis for function call");
+                            if (closeParenToken == end - 1)
+                                return fCall;
 
-                            // function call!
-                            auto fCall = std::make_shared<FunctionCallNode>();
-
-                            fCall->functionName = tokenIt->val; 
-                            auto currentArgStart = openParenToken + 1;
-                            for (auto it = openParenToken +1; it < closeParenToken; it++) {
-                                if (it->type == TokenType::Comma) {
-                                    fCall->args.emplace_back(std::static_pointer_cast<ProducesValueNode>(parseExpression(currentArgStart, it))); 
-                                    currentArgStart = it + 1;
-                                }
-                            }
-
-                            if (std::distance(openParenToken, closeParenToken) > 1) {
-                                fCall->args.emplace_back(std::static_pointer_cast<ProducesValueNode>(parseExpression(openParenToken + 1, closeParenToken)));
-                            }
-                            
-                            return fCall;
+                            return parsePartialExpression(fCall, closeParenToken + 1, end);
                         }
 
                         // Cross our fingers and hope it's a variable reference
                         std::string name = tokenIt->val;
 
                         tokenIt++;
-                        if (tokenIt->type == TokenType::Equals) {
-                            auto varAssign = std::make_shared<VarAssignmentNode>();
+                        bool isComparison = tokenIt + 1 < end && (tokenIt + 1)->type == TokenType::Equals;
+                        if (tokenIt->type == TokenType::Equals && !isComparison) {
+                            auto varAssign = makeNode<VarAssignmentNode>();
                             varAssign->varName = name;
                             varAssign->createNew = false;
                             varAssign->valNode = std::static_pointer_cast<ProducesValueNode>(parseExpression(tokenIt + 1, end));
                             return varAssign;
                         }
 
-                        auto varRef = std::make_shared<VariableReferenceNode>();
+                        auto varRef = makeNode<VariableReferenceNode>();
                         varRef->varName = name;
 
                         return parsePartialExpression(varRef, tokenIt, end);
@@ -286,7 +559,7 @@ namespace iodine {
                     if (expr == nullptr)
                         throw std::runtime_error("Expected expression after equals");
 
-                    auto varAssignment = std::make_shared<VarAssignmentNode>();
+                    auto varAssignment = makeNode<VarAssignmentNode>();
                     varAssignment->varName = name;
                     varAssignment->createNew = true;
                     varAssignment->type = typeIt->second;
@@ -298,38 +571,83 @@ namespace iodine {
                     // Get expression in parenthesis
                     safeAdvance(tokenIt, end);
                     expect(tokenIt, TokenType::OpenParenthesis);
-                    safeAdvance(tokenIt, end);
 
-                    auto closeParen = findAssured(tokenIt, end, TokenType::CloseParenthesis);
+                    auto closeParen = findMatching(tokenIt, end);
 
-                    auto expr = parseExpression(tokenIt, closeParen);
+                    auto expr = parseExpression(tokenIt + 1, closeParen);
 
                     if (expr == nullptr)
                         throw std::runtime_error("Expected expression");
 
-                    auto ifNode = std::make_shared<IfNode>();
+                    auto ifNode = makeNode<IfNode>();
                     ifNode->condition = std::static_pointer_cast<ProducesValueNode>(expr);
 
                     tokenIt = closeParen;
                     safeAdvance(tokenIt, end);
                     expect(tokenIt, TokenType::OpenBrace);
+
+                    auto closeBrace = findMatching(tokenIt, end);
+                    if (lazy)
+                        ifNode->lazyBody = makeLazyBlock(tokenIt + 1, closeBrace);
+                    else
+                        ifNode->nodes = parseBlock(tokenIt + 1, closeBrace);
+
+                    return ifNode;
+                } else if (tokenIt->type == TokenType::Fn) {
+                    return parseFunctionDefinition(tokenIt, end);
+                } else if (tokenIt->type == TokenType::Return) {
+                    auto returnNode = makeNode<ReturnNode>();
+                    auto value = parseExpression(tokenIt + 1, end);
+
+                    if (value != nullptr) {
+                        returnNode->valNode = std::static_pointer_cast<ProducesValueNode>(value);
+                        returnNode->isTailCall = value->type == ASTNodeType::FunctionCall;
+                    }
+
+                    return returnNode;
+                } else if (tokenIt->type == TokenType::While) {
+                    safeAdvance(tokenIt, end);
+                    expect(tokenIt, TokenType::OpenParenthesis);
+                    auto closeParen = findMatching(tokenIt, end);
+
+                    auto whileNode = makeNode<WhileNode>();
+                    whileNode->condition = std::static_pointer_cast<ProducesValueNode>(parseExpression(tokenIt + 1, closeParen));
+                    if (whileNode->condition == nullptr)
+                        throw std::runtime_error("Expected loop condition");
+
+                    tokenIt = closeParen;
+                    safeAdvance(tokenIt, end);
+                    expect(tokenIt, TokenType::OpenBrace);
+                    whileNode->nodes = parseEagerBlock(tokenIt + 1, findMatching(tokenIt, end));
+
+                    return whileNode;
+                } else if (tokenIt->type == TokenType::For) {
+                    // for (init; condition; step) { ... }
                     safeAdvance(tokenIt, end);
+                    expect(tokenIt, TokenType::OpenParenthesis);
+                    auto closeParen = findMatching(tokenIt, end);
 
-                    auto cIt = tokenIt;
+                    auto firstSemicolon = findAssured(tokenIt + 1, closeParen, TokenType::Semicolon);
+                    auto secondSemicolon = findAssured(firstSemicolon + 1, closeParen, TokenType::Semicolon);
 
-                    while (true) {
-                        // get the next statement to the semicolon
-                        auto nextSemicolon = find(cIt, end, TokenType::Semicolon);
-                        auto expr = parseExpression(cIt, nextSemicolon);
+                    auto forNode = makeNode<ForNode>();
+                    forNode->init = parseExpression(tokenIt + 1, firstSemicolon);
+                    forNode->condition = std::static_pointer_cast<ProducesValueNode>(parseExpression(firstSemicolon + 1, secondSemicolon));
+                    forNode->step = parseExpression(secondSemicolon + 1, closeParen);
+                    if (forNode->condition == nullptr)
+                        throw std::runtime_error("Expected loop condition");
 
-                        if (expr == nullptr)
-                            break;
+                    if (forNode->init != nullptr)
+                        forNode->init->line = (tokenIt + 1)->line;
+                    if (forNode->step != nullptr)
+                        forNode->step->line = (secondSemicolon + 1)->line;
 
-                        ifNode->nodes.push_back(parseExpression(cIt, nextSemicolon));
-                        cIt = nextSemicolon;
-                    }
+                    tokenIt = closeParen;
+                    safeAdvance(tokenIt, end);
+                    expect(tokenIt, TokenType::OpenBrace);
+                    forNode->nodes = parseEagerBlock(tokenIt + 1, findMatching(tokenIt, end));
 
-                    return ifNode;
+                    return forNode;
                 } else {
                     throw std::runtime_error("Unexpected token " + tokenIt->val + " (" + tokenNames[tokenIt->type] + ")");
                 }
@@ -338,28 +656,109 @@ namespace iodine {
             return nullptr;
         }
 
-        std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token> tokens) {
-            std::vector<std::shared_ptr<ASTNode>> nodes;
-            auto cIt = tokens.begin();
-            while (cIt < tokens.end()) {
-                auto next = find(cIt, tokens.end(), TokenType::Semicolon);
-                auto expr = parseExpression(cIt, next);
-                if (expr == nullptr)
-                    break;
+        std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token>& tokens) {
+            // Line breaks carry no meaning inside a script.
+            tokens.erase(std::remove_if(tokens.begin(), tokens.end(), [](const Token& t) {
+                return t.type == TokenType::NewLine;
+            }), tokens.end());
 
-                nodes.push_back(expr);
-                cIt = next + 1;
+            return parseTopLevelBlock(tokens.begin(), tokens.end());
+        }
+
+        std::vector<std::shared_ptr<ASTNode>> parseTopLevelBlock(TokenIter begin, TokenIter end) {
+            auto nodes = parseBlock(begin, end);
+
+            for (auto& node : nodes) {
+                if (containsReturn(node.get()))
+                    throw std::runtime_error("return outside of function");
+                optimizeLoops(node);
             }
-            
+
             return nodes;
         }
+
+        bool containsReturn(ASTNode* node) {
+            if (node->type == ASTNodeType::Return)
+                return true;
+
+            const std::vector<std::shared_ptr<ASTNode>>* children = nullptr;
+            if (node->type == ASTNodeType::If)
+                children = &static_cast<IfNode*>(node)->nodes;
+            else if (node->type == ASTNodeType::While || node->type == ASTNodeType::For)
+                children = &static_cast<LoopNode*>(node)->nodes;
+
+            if (children != nullptr) {
+                for (auto& child : *children) {
+                    if (containsReturn(child.get()))
+                        return true;
+                }
+            }
+
+            return false;
+        }
     };
 
     std::shared_ptr<ASTNode> parseExpression(std::vector<Token> tokens) {
-        return Parser().parseExpression(tokens.begin(), tokens.end());
+        AllocPhaseScope allocPhase(AllocPhase::Parse);
+        CountErrors countErrors(metrics::parseErrors);
+        auto node = Parser().parseExpression(tokens.begin(), tokens.end());
+
+        if (node != nullptr) {
+            node->line = tokens.front().line;
+            optimizeLoops(node);
+        }
+
+        return node;
     }
 
-    std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token> tokens) {
-        return Parser().parseScript(tokens);
+    std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token> tokens, bool lazy) {
+        AllocPhaseScope allocPhase(AllocPhase::Parse);
+        TraceSpan span("parseScript", "parse");
+        CountErrors countErrors(metrics::parseErrors);
+        if (!lazy)
+            return Parser().parseScript(tokens);
+
+        auto source = std::make_shared<std::vector<Token>>(std::move(tokens));
+        return Parser(source, true).parseScript(*source);
+    }
+
+    std::vector<size_t> splitStatements(std::vector<Token>& tokens) {
+        Parser parser;
+        std::vector<size_t> ends;
+        auto it = tokens.begin();
+
+        while (it < tokens.end()) {
+            it = parser.findStatementEnd(it, tokens.end());
+            if (it < tokens.end() && it->type == TokenType::Semicolon)
+                it++;
+            ends.push_back(it - tokens.begin());
+        }
+
+        return ends;
+    }
+
+    void parseLazyBody(IfNode& node) {
+        AllocPhaseScope allocPhase(AllocPhase::Parse);
+        auto block = node.lazyBody;
+        auto begin = block->tokens->begin();
+
+        // Nested if-blocks stay lazy.
+        node.nodes = Parser(block->tokens, true).parseTopLevelBlock(begin + block->begin, begin + block->end);
+        node.lazyBody = nullptr;
+    }
+
+    void parseLazyBody(FunctionDefinitionNode& node) {
+        AllocPhaseScope allocPhase(AllocPhase::Parse);
+        auto block = node.lazyBody;
+        auto begin = block->tokens->begin();
+        Parser parser(block->tokens, false);
+
+        node.body = parser.parseBlock(begin + block->begin, begin + block->end);
+        parser.resolveFunction(node);
+
+        for (auto& child : node.body)
+            optimizeLoops(child);
+
+        node.lazyBody = nullptr;
     }
 }
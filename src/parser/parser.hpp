@@ -1,14 +1,19 @@
 #pragma once
 #include <string.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <initializer_list>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <functional>
+#include "InternedString.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 
 namespace iodine {
     enum class DataType {
@@ -18,7 +23,7 @@ namespace iodine {
         Ref,
         Null,
         Boolean,
-        ConstStr,
+        String,
         Count
     };
 
@@ -40,6 +45,12 @@ namespace iodine {
         True,
         False,
         StringContents,
+        Fn,
+        Return,
+        While,
+        For,
+        LessThan,
+        GreaterThan,
         Count
     };
 
@@ -54,6 +65,13 @@ namespace iodine {
         FunctionCall,
         If,
         Comparison,
+        FunctionDefinition,
+        Return,
+        While,
+        For,
+        LoopInvariant,
+        InductionVariable,
+        CommonValue,
         Count
     };
 
@@ -128,11 +146,11 @@ namespace iodine {
 
     struct Ref {
         std::shared_ptr<TypeInfo> typeInfo;
-        void* data;
+        void* data = nullptr;
     };
 
     struct Value {
-        Value() : type(DataType::Null) { }
+        Value() : type(DataType::Null), doubleVal(0) { }
         Value(int i)
             : type(DataType::Int32)
             , intVal(i) { }
@@ -145,9 +163,43 @@ namespace iodine {
         Value(bool b)
             : type(DataType::Boolean)
             , boolVal(b) { }
-        Value(const char* constStr)
-            : type(DataType::ConstStr)
-            , constStrVal(constStr) {}
+        Value(const InternedString& str)
+            : type(DataType::String)
+            , strVal(str) {}
+
+        Value(const Value& other)
+            : type(other.type)
+            , ref(other.ref) {
+            copyUnion(other);
+        }
+
+        Value(Value&& other) noexcept
+            : type(other.type)
+            , ref(std::move(other.ref)) {
+            moveUnion(other);
+        }
+
+        Value& operator=(Value&& other) noexcept {
+            if (this != &other) {
+                destroyUnion();
+                type = other.type;
+                ref = std::move(other.ref);
+                moveUnion(other);
+            }
+            return *this;
+        }
+
+        Value& operator=(const Value& other) {
+            if (this != &other) {
+                destroyUnion();
+                type = other.type;
+                ref = other.ref;
+                copyUnion(other);
+            }
+            return *this;
+        }
+
+        ~Value() { destroyUnion(); }
 
         DataType type;
         union {
@@ -155,13 +207,32 @@ namespace iodine {
             float floatVal;
             double doubleVal;
             bool boolVal;
-            const char* constStrVal;
+            InternedString strVal;
         };
 
         // Declaring outside the union since it has a non-trivial
         // destructor. Wastes some memory, but oh well!
         Ref ref;
 
+        void copyUnion(const Value& other) {
+            if (other.type == DataType::String)
+                new (&strVal) InternedString(other.strVal);
+            else
+                doubleVal = other.doubleVal;
+        }
+
+        void moveUnion(Value& other) {
+            if (other.type == DataType::String)
+                new (&strVal) InternedString(std::move(other.strVal));
+            else
+                doubleVal = other.doubleVal;
+        }
+
+        void destroyUnion() {
+            if (type == DataType::String)
+                strVal.~InternedString();
+        }
+
         template <typename T>
         T as() const {
             switch (type) {
@@ -197,6 +268,9 @@ namespace iodine {
         }
 
         Value as(DataType type) const {
+            if (type == this->type)
+                return *this;
+
             switch (type) {
             case DataType::Int32:
                 return Value(as<int>());
@@ -211,6 +285,7 @@ namespace iodine {
 
         Value operator*(const Value& other) {
             if (other.type != type) {
+                metrics::typePromotions.increment();
                 DataType newType = getHighestPrecisionType(other.type, type);
                 return other.as(newType) * as(newType);
             }
@@ -228,7 +303,14 @@ namespace iodine {
         }
 
         Value operator+(const Value& other) {
+            if (type == DataType::String || other.type == DataType::String) {
+                if (type != other.type)
+                    throw std::runtime_error(std::string("Can't add ") + dataTypeNames[type] + " and " + dataTypeNames[other.type]);
+                return strVal + other.strVal;
+            }
+
             if (other.type != type) {
+                metrics::typePromotions.increment();
                 DataType newType = getHighestPrecisionType(other.type, type);
                 return other.as(newType) + as(newType);
             }
@@ -247,8 +329,9 @@ namespace iodine {
 
         Value operator-(const Value& other) {
             if (other.type != type) {
+                metrics::typePromotions.increment();
                 DataType newType = getHighestPrecisionType(other.type, type);
-                return other.as(newType) - as(newType);
+                return as(newType) - other.as(newType);
             }
 
             switch (type) {
@@ -265,8 +348,9 @@ namespace iodine {
 
         Value operator/(const Value& other) {
             if (other.type != type) {
+                metrics::typePromotions.increment();
                 DataType newType = getHighestPrecisionType(other.type, type);
-                return other.as(newType) / as(newType);
+                return as(newType) / other.as(newType);
             }
 
             switch (type) {
@@ -281,6 +365,26 @@ namespace iodine {
             }
         }
 
+        Value isLessThan(const Value& other) const {
+            if (!isNumberType(type) || !isNumberType(other.type))
+                throw std::runtime_error(std::string("Can't order ") + dataTypeNames[type] + " and " + dataTypeNames[other.type]);
+
+            if (other.type != type) {
+                metrics::typePromotions.increment();
+                DataType newType = getHighestPrecisionType(other.type, type);
+                return as(newType).isLessThan(other.as(newType));
+            }
+
+            switch (type) {
+            case DataType::Int32:
+                return Value(intVal < other.intVal);
+            case DataType::F32:
+                return Value(floatVal < other.floatVal);
+            default:
+                return Value(doubleVal < other.doubleVal);
+            }
+        }
+
         Value isEqual(const Value& other) {
             if (type != other.type)
                 throw std::runtime_error("Trying to compare values of different types");
@@ -294,8 +398,8 @@ namespace iodine {
                     return Value(floatVal == other.floatVal);
                 case DataType::F64:
                     return Value(doubleVal == other.doubleVal);
-                case DataType::ConstStr:
-                    return Value(strcmp(constStrVal, other.constStrVal));
+                case DataType::String:
+                    return Value(strVal == other.strVal);
                 default:
                     throw std::runtime_error(std::string("No comparison for ") + dataTypeNames[type]);
             }
@@ -313,6 +417,11 @@ namespace iodine {
         TokenType type;
         std::string val;
         int numberVal;
+        // 1-based source line the token starts on.
+        int line = 0;
+        // Byte offset of its first character (the opening quote of a
+        // string) in the lexed text.
+        size_t offset = 0;
     };
 
     class ASTNode {
@@ -323,8 +432,43 @@ namespace iodine {
         virtual ~ASTNode() {}
     public:
         ASTNodeType type;
+        // Source line of the statement. Only set on statement nodes.
+        int line = 0;
+    };
+
+    // Counts the bytes of every node allocated through it, shared_ptr
+    // control block included, in metrics::astBytesLive.
+    template <typename T>
+    struct ASTAllocator {
+        using value_type = T;
+
+        ASTAllocator() = default;
+        template <typename U>
+        ASTAllocator(const ASTAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            metrics::astBytesLive.add((int64_t)(n * sizeof(T)));
+            return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* ptr, size_t n) {
+            metrics::astBytesLive.add(-(int64_t)(n * sizeof(T)));
+            std::allocator<T>().deallocate(ptr, n);
+        }
+
+        template <typename U>
+        bool operator==(const ASTAllocator<U>&) const { return true; }
+        template <typename U>
+        bool operator!=(const ASTAllocator<U>&) const { return false; }
     };
 
+    // The parser and optimizer create nodes through this rather than
+    // make_shared so they show up in the live AST bytes metric.
+    template <typename T, typename... Args>
+    std::shared_ptr<T> makeNode(Args&&... args) {
+        return std::allocate_shared<T>(ASTAllocator<T>(), std::forward<Args>(args)...);
+    }
+
     class ScriptNode : public ASTNode {
     public:
         ScriptNode()
@@ -374,24 +518,61 @@ namespace iodine {
         std::shared_ptr<ProducesValueNode> a;
         std::shared_ptr<ProducesValueNode> b;
         ArithmeticOperation operation;
+        // Set by checkTypes when both operands are proven to be numbers: the
+        // type they're promoted to, or Count.
+        DataType checkedType = DataType::Count;
 
+        // Evaluates a before b, here, in the checked path and in modules,
+        // so calls with side effects run in the same order everywhere.
         Value calculateValue() {
+            Value aVal = a->getValue();
             switch (operation) {
             case ArithmeticOperation::Add:
-                return a->getValue() + b->getValue();
+                return aVal + b->getValue();
             case ArithmeticOperation::Subtract:
-                return a->getValue() - b->getValue();
+                return aVal - b->getValue();
             case ArithmeticOperation::Multiply:
-                return a->getValue() * b->getValue();
+                return aVal * b->getValue();
             case ArithmeticOperation::Divide:
-                return a->getValue() / b->getValue();
+                return aVal / b->getValue();
             default:
                 return 0;
             }
         }
 
         Value getValue() override {
-            return calculateValue();
+            switch (checkedType) {
+            case DataType::Int32:
+                return calculateChecked<int>();
+            case DataType::F32:
+                return calculateChecked<float>();
+            case DataType::F64:
+                return calculateChecked<double>();
+            default:
+                return calculateValue();
+            }
+        }
+
+    private:
+        // Skips the type checks of the Value operators, and counts no
+        // type promotions.
+        template <typename T>
+        Value calculateChecked() {
+            T x = a->getValue().as<T>();
+            T y = b->getValue().as<T>();
+
+            switch (operation) {
+            case ArithmeticOperation::Add:
+                return Value(x + y);
+            case ArithmeticOperation::Subtract:
+                return Value(x - y);
+            case ArithmeticOperation::Multiply:
+                return Value(x * y);
+            case ArithmeticOperation::Divide:
+                return Value(x / y);
+            default:
+                return 0;
+            }
         }
     };
 
@@ -431,18 +612,36 @@ namespace iodine {
         bool createNew;
         std::string varName;
         DataType type;
+        int localSlot = -1;
+        // Set by checkTypes when the value is proven to have the variable's
+        // type and the variable to exist, so assigning needs no checks.
+        bool typeChecked = false;
     };
 
     extern std::unordered_map<std::string, Variable> variables;
 
+    // Locals of script-defined functions. Every call pushes a frame of
+    // FunctionDefinitionNode::frameSize values onto the stack; frameBase is
+    // the index of the first slot of the frame that's currently executing.
+    extern std::vector<Value> frameStack;
+    extern size_t frameBase;
+
     class VariableReferenceNode : public ProducesValueNode {
     public:
         VariableReferenceNode()
             : ProducesValueNode(ASTNodeType::VariableReference) { }
         virtual ~VariableReferenceNode() {}
         std::string varName;
+        // Index into the current call frame if this refers to a function
+        // local, -1 for globals.
+        int localSlot = -1;
 
         Value getValue() override {
+            metrics::variableLookups.increment();
+
+            if (localSlot >= 0)
+                return frameStack[frameBase + localSlot];
+
             auto varIt = variables.find(varName);
             if (varIt == variables.end())
                 throw std::runtime_error("Nonexistent variable " + varName + " referenced");
@@ -455,14 +654,64 @@ namespace iodine {
 
     typedef std::function<Value(FuncArgs)> NativeFunction;
 
+    class FunctionDefinitionNode;
+
+    class MemoCache;
+
     struct Function {
         bool isBuiltin;
         std::string name;
         NativeFunction nativeFunc;
+        std::shared_ptr<FunctionDefinitionNode> definition;
+        // This builtin's call counter, looked up on the first call.
+        Counter* callCounter = nullptr;
+        // Set on builtins whose result depends only on their arguments and
+        // that do nothing else, so repeated calls can share one result.
+        bool isPure = false;
+        // Optional cache of this builtin's results, for pure builtins that
+        // evaluate each argument exactly once and are costly enough that
+        // looking them up pays off.
+        std::shared_ptr<MemoCache> memo;
+        // Optional, for checkTypes: the type a builtin returns for
+        // arguments of the given types, Count for those not known. Returns
+        // Count if that isn't known either, and throws std::runtime_error
+        // for arguments the builtin would reject.
+        std::function<DataType(const std::vector<DataType>&)> resultType;
     };
 
     extern std::unordered_map<std::string, Function> functions;
 
+    Value callScriptFunction(const Function& func, const FuncArgs& args);
+
+    class Profiler;
+    // Non-null while profiling. Instrumented code checks this and nothing
+    // else, so profiling costs a single branch when it's off.
+    extern Profiler* activeProfiler;
+    Value profiledCall(const Function& func, const FuncArgs& args);
+
+    // Calls a builtin through its memo cache.
+    Value memoizedCall(const Function& func, const FuncArgs& args);
+
+    // What the evaluator on this thread is doing right now, for the
+    // sampling profiler's signal handler. Maintained whether or not a
+    // sampler is running; the relaxed stores compile to plain moves, and
+    // being per thread, server workers don't contend on them.
+    extern thread_local std::atomic<const ASTNode*> currentStatement;
+    extern thread_local std::atomic<const Function*> currentBuiltin;
+
+    struct BuiltinMarker {
+        const Function* saved;
+
+        BuiltinMarker(const Function* func)
+            : saved(currentBuiltin.load(std::memory_order_relaxed)) {
+            currentBuiltin.store(func, std::memory_order_relaxed);
+        }
+
+        ~BuiltinMarker() {
+            currentBuiltin.store(saved, std::memory_order_relaxed);
+        }
+    };
+
     class FunctionCallNode : public ProducesValueNode {
     public:
         FunctionCallNode() : ProducesValueNode(ASTNodeType::FunctionCall) {}
@@ -478,9 +727,25 @@ namespace iodine {
             if (iter == functions.end())
                throw std::runtime_error("Tried to call nonexistent function"); 
 
-            assert(iter->second.isBuiltin);
+            if (iter->second.isBuiltin) {
+                if (iter->second.callCounter == nullptr)
+                    iter->second.callCounter = &metrics::nativeCalls.labeled(iter->second.name);
+                iter->second.callCounter->increment();
+
+                if (iter->second.memo != nullptr)
+                    return memoizedCall(iter->second, args);
+            }
+
+            if (activeProfiler != nullptr)
+                return profiledCall(iter->second, args);
 
-            return iter->second.nativeFunc(args);
+            if (iter->second.isBuiltin) {
+                BuiltinMarker marker(&iter->second);
+                TraceSpan span(iter->second.name.c_str(), "native");
+                return iter->second.nativeFunc(args);
+            }
+
+            return callScriptFunction(iter->second, args);
         }
     };
 
@@ -493,19 +758,72 @@ namespace iodine {
         std::shared_ptr<ProducesValueNode> lhs;
         std::shared_ptr<ProducesValueNode> rhs;
         ComparisonType compType;
+        // Set by checkTypes when both sides are proven to be numbers that
+        // can be compared: the type they're promoted to, or Count.
+        DataType checkedType = DataType::Count;
 
         Value getValue() override {
+            switch (checkedType) {
+            case DataType::Int32:
+                return compareChecked<int>();
+            case DataType::F32:
+                return compareChecked<float>();
+            case DataType::F64:
+                return compareChecked<double>();
+            default:
+                break;
+            }
+
+            // lhs first, like modules do.
+            Value lhsVal = lhs->getValue();
+            Value rhsVal = rhs->getValue();
+            switch (compType) {
+                case ComparisonType::Equal:
+                    return lhsVal.isEqual(rhsVal);
+                case ComparisonType::LessThan:
+                    return lhsVal.isLessThan(rhsVal);
+                case ComparisonType::GreaterThan:
+                    return rhsVal.isLessThan(lhsVal);
+                case ComparisonType::LessThanOrEqual:
+                    return Value(!rhsVal.isLessThan(lhsVal).boolVal);
+                case ComparisonType::GreaterThanOrEqual:
+                    return Value(!lhsVal.isLessThan(rhsVal).boolVal);
+                default:
+                    return false;
+            }
+        }
+
+    private:
+        template <typename T>
+        Value compareChecked() {
+            T x = lhs->getValue().as<T>();
+            T y = rhs->getValue().as<T>();
+
             switch (compType) {
                 case ComparisonType::Equal:
-                    if (lhs->getValue().type != rhs->getValue().type)
-                        throw std::runtime_error("Trying to compare values of different types");
-                    return lhs->getValue().isEqual(rhs->getValue());
+                    return Value(x == y);
+                case ComparisonType::LessThan:
+                    return Value(x < y);
+                case ComparisonType::GreaterThan:
+                    return Value(y < x);
+                case ComparisonType::LessThanOrEqual:
+                    return Value(!(y < x));
+                case ComparisonType::GreaterThanOrEqual:
+                    return Value(!(x < y));
                 default:
                     return false;
             }
         }
     };
 
+    // Token range of a block that was only skimmed for its braces by the
+    // lazy parser. The statements are parsed the first time the block runs.
+    struct LazyBlock {
+        std::shared_ptr<std::vector<Token>> tokens;
+        size_t begin;
+        size_t end;
+    };
+
     class IfNode : public ASTNode {
     public:
         IfNode() : ASTNode(ASTNodeType::If) {}
@@ -514,9 +832,181 @@ namespace iodine {
 
         std::vector<std::shared_ptr<ASTNode>> nodes;
         std::shared_ptr<ProducesValueNode> condition;
+        // Non-null until the body has been parsed.
+        std::shared_ptr<LazyBlock> lazyBody;
+    };
+
+    // Base for while and for loops. The loop optimizer wraps expressions
+    // in the body that can't change between iterations in
+    // LoopInvariantNodes, whose caches are reset each time the loop starts.
+    class LoopInvariantNode;
+
+    class LoopNode : public ASTNode {
+    protected:
+        LoopNode(ASTNodeType type) : ASTNode(type) {}
+
+    public:
+        virtual ~LoopNode() {}
+
+        std::shared_ptr<ProducesValueNode> condition;
+        std::vector<std::shared_ptr<ASTNode>> nodes;
+        std::vector<std::shared_ptr<LoopInvariantNode>> invariants;
+        // Number of activations of this loop currently executing. Only goes
+        // above 1 when the body recursively calls back into the loop.
+        int activeDepth = 0;
+    };
+
+    class WhileNode : public LoopNode {
+    public:
+        WhileNode() : LoopNode(ASTNodeType::While) {}
+
+        virtual ~WhileNode() {}
+    };
+
+    class ForNode : public LoopNode {
+    public:
+        ForNode() : LoopNode(ASTNodeType::For) {}
+
+        virtual ~ForNode() {}
+
+        // Either may be null.
+        std::shared_ptr<ASTNode> init;
+        std::shared_ptr<ASTNode> step;
+
+        // Counted loop fast path, filled in by the loop optimizer for
+        // "for (i32 i = a; i < b; i = i + c)" when the body never assigns
+        // i. The counter is kept unboxed in counterValue and the body reads
+        // it through InductionVariableNodes.
+        bool isCounted = false;
+        ComparisonType counterComparison;
+        std::shared_ptr<ProducesValueNode> counterLimit;
+        int counterStep = 0;
+        int counterValue = 0;
+        // The counter is a global and the body calls functions, which might
+        // read or assign it. It's written back to the variable before every
+        // iteration and read back after, and the body reads the variable.
+        bool syncCounter = false;
+    };
+
+    class LoopInvariantNode : public ProducesValueNode {
+    public:
+        LoopInvariantNode() : ProducesValueNode(ASTNodeType::LoopInvariant) {}
+
+        virtual ~LoopInvariantNode() {}
+
+        std::shared_ptr<ProducesValueNode> expr;
+        Value cached;
+        bool isCached = false;
+
+        Value getValue() override {
+            if (!isCached) {
+                cached = expr->getValue();
+                isCached = true;
+            }
+            return cached;
+        }
+    };
+
+    class InductionVariableNode : public ProducesValueNode {
+    public:
+        InductionVariableNode() : ProducesValueNode(ASTNodeType::InductionVariable) {}
+
+        virtual ~InductionVariableNode() {}
+
+        std::string varName;
+        ForNode* loop = nullptr;
+
+        Value getValue() override {
+            return Value(loop->counterValue);
+        }
+    };
+
+    // An occurrence of a pure expression that value numbering found
+    // computed more than once with the same inputs. The first occurrence
+    // to run stores its value, and later ones, which are only placed where
+    // it's certain to have run already, return that instead of evaluating
+    // expr. All of them share expr.
+    class CommonValueNode : public ProducesValueNode {
+    public:
+        CommonValueNode() : ProducesValueNode(ASTNodeType::CommonValue) {}
+
+        virtual ~CommonValueNode() {}
+
+        std::shared_ptr<ProducesValueNode> expr;
+        // The occurrence that computes the value, or null for that one.
+        std::shared_ptr<CommonValueNode> source;
+        Value cached;
+
+        Value getValue() override {
+            if (source != nullptr)
+                return source->cached;
+            cached = expr->getValue();
+            return cached;
+        }
+    };
+
+    struct FunctionParameter {
+        std::string name;
+        DataType type;
+    };
+
+    class FunctionDefinitionNode : public ASTNode {
+    public:
+        FunctionDefinitionNode() : ASTNode(ASTNodeType::FunctionDefinition) {}
+
+        virtual ~FunctionDefinitionNode() {}
+
+        std::string name;
+        // Parameters occupy the first slots of the frame, followed by
+        // every local declared in the body.
+        std::vector<FunctionParameter> params;
+        std::vector<std::shared_ptr<ASTNode>> body;
+        int frameSize = 0;
+        // Non-null until the body has been parsed. frameSize is only valid
+        // once it has.
+        std::shared_ptr<LazyBlock> lazyBody;
+    };
+
+    class ReturnNode : public ASTNode {
+    public:
+        ReturnNode() : ASTNode(ASTNodeType::Return) {}
+
+        virtual ~ReturnNode() {}
+
+        // May be null for a bare "return".
+        std::shared_ptr<ProducesValueNode> valNode;
+        // Set when valNode is a call whose result is returned directly, so
+        // script callees can reuse the current frame.
+        bool isTailCall = false;
     };
 
     std::vector<Token> parseTokens(std::string str);
     std::shared_ptr<ASTNode> parseExpression(std::vector<Token> tokens);
-    std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token> tokens);
+    // In lazy mode, if-blocks outside of loops and function bodies are only
+    // scanned for matching braces; errors inside them are reported when
+    // they first run.
+    std::vector<std::shared_ptr<ASTNode>> parseScript(std::vector<Token> tokens, bool lazy = false);
+
+    // Splits tokens (without line breaks) into top-level statements the way
+    // parseScript does, returning the index one past the end of each, its
+    // semicolon included.
+    std::vector<size_t> splitStatements(std::vector<Token>& tokens);
+
+    void parseLazyBody(IfNode& node);
+    void parseLazyBody(FunctionDefinitionNode& node);
+
+    // Hoists loop-invariant expressions and sets up the counted loop fast
+    // path for every loop under node. Run once after parsing.
+    void optimizeLoops(std::shared_ptr<ASTNode> node);
+
+    // Global value numbering over a whole script, after optimizeLoops. A
+    // pure expression computed again with the same inputs reads the first
+    // result through a CommonValueNode, and structurally equal expressions
+    // left over are merged into one shared subtree. Only for trees that are
+    // interpreted and never parsed further; lazy bodies are parsed here.
+    void eliminateCommonSubexpressions(std::vector<std::shared_ptr<ASTNode>>& statements);
+
+    // Executes a top-level statement, returning the value of expression
+    // statements and Null for everything else.
+    Value evalAST(std::shared_ptr<ASTNode> exprRoot);
 }
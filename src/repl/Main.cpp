@@ -2,8 +2,10 @@
 #include <math.h>
 #include <string.h>
 #include <parser.hpp>
+#include <Profiler.hpp>
 #include <iostream>
 #include <unordered_map>
+#include <fstream>
 
 using namespace iodine;
 
@@ -29,8 +31,8 @@ std::string valueToStr(const Value& val) {
         case DataType::Boolean:
             return std::to_string(val.boolVal);
             break;
-        case DataType::ConstStr:
-            return std::string(val.constStrVal);
+        case DataType::String:
+            return val.strVal.str();
             break;
         default:
             return "";
@@ -121,55 +123,76 @@ void printASTNode(std::shared_ptr<ASTNode> node, int indentDepth = 0) {
             printASTNode(in->condition, indentDepth + 1);
 
             printIndents(indentDepth);
-            std::cout << "children:\n";
+            std::cout << "children:" << (in->lazyBody != nullptr ? " (not parsed yet)" : "") << "\n";
             for (auto& n : in->nodes) {
                 printIndents(indentDepth);
                 printASTNode(n, indentDepth + 1);
             }
             break;
         }
-        default:
-            break;
-    }
-}
+        case ASTNodeType::FunctionDefinition:
+        {
+            auto def = std::static_pointer_cast<FunctionDefinitionNode>(node);
+            printIndents(indentDepth);
+            std::cout << "name: " << def->name << " (" << def->params.size() << " params, frame size " << def->frameSize << ")\n";
 
-Value evalAST(std::shared_ptr<ASTNode> exprRoot) {
-    if (exprRoot->type == ASTNodeType::VarAssignment) {
-        auto assignNode = std::static_pointer_cast<VarAssignmentNode>(exprRoot);
-
-        auto val = assignNode->valNode->getValue();
-        if (assignNode->createNew) {
-            Variable var;
-            var.name = assignNode->varName;
-            var.type = assignNode->type;
-            var.val = val.as(var.type);
-            variables[assignNode->varName] = var;
-        } else {
-            auto varIt = variables.find(assignNode->varName);
-            if (varIt == variables.end()) 
-                throw std::runtime_error("Reference to undefined variable " + assignNode->varName);
-            if (val.type != varIt->second.type) {
-                std::string msg = "Assignment to variable "
-                    + assignNode->varName + " (" + dataTypeNames[varIt->second.type] + ")"
-                    + " with wrong type " + dataTypeNames[val.type];
-                throw std::runtime_error(msg);
+            printIndents(indentDepth);
+            std::cout << "body:" << (def->lazyBody != nullptr ? " (not parsed yet)" : "") << "\n";
+            for (auto& n : def->body) {
+                printASTNode(n, indentDepth + 1);
             }
-            variables.at(assignNode->varName).val = val;
+            break;
         }
-        return Value{};
-    }
+        case ASTNodeType::While:
+        case ASTNodeType::For:
+        {
+            auto loop = std::static_pointer_cast<LoopNode>(node);
+            printIndents(indentDepth);
+            std::cout << "condition:\n";
+            printASTNode(loop->condition, indentDepth + 1);
+
+            if (node->type == ASTNodeType::For) {
+                auto forNode = std::static_pointer_cast<ForNode>(node);
+                printIndents(indentDepth);
+                std::cout << "counted: " << forNode->isCounted << "\n";
+            }
 
-    if (exprRoot->type == ASTNodeType::If) {
-        auto ifNode = std::static_pointer_cast<IfNode>(exprRoot);
+            printIndents(indentDepth);
+            std::cout << "invariants: " << loop->invariants.size() << "\n";
 
-        if (ifNode->condition->getValue().as<bool>()) {
-            for (auto& n : ifNode->nodes) {
-                evalAST(n);
+            printIndents(indentDepth);
+            std::cout << "children:\n";
+            for (auto& n : loop->nodes) {
+                printASTNode(n, indentDepth + 1);
             }
+            break;
+        }
+        case ASTNodeType::LoopInvariant:
+            printASTNode(std::static_pointer_cast<LoopInvariantNode>(node)->expr, indentDepth + 1);
+            break;
+        case ASTNodeType::Return:
+        {
+            auto ret = std::static_pointer_cast<ReturnNode>(node);
+            printIndents(indentDepth);
+            std::cout << "tail call: " << ret->isTailCall << "\n";
+
+            if (ret->valNode != nullptr)
+                printASTNode(ret->valNode, indentDepth + 1);
+            break;
         }
-        return Value{};
+        default:
+            break;
     }
-    return std::static_pointer_cast<ProducesValueNode>(exprRoot)->getValue();
+}
+
+void writeProfile(const Profiler& profiler, const std::string& baseName) {
+    std::ofstream folded(baseName + ".folded");
+    profiler.writeFoldedStacks(folded);
+
+    std::ofstream report(baseName + ".txt");
+    profiler.writeReport(report);
+
+    std::cerr << "Profile written to " << baseName << ".folded and " << baseName << ".txt\n";
 }
 
 void printTokens(std::vector<Token>& tokens) {
@@ -183,6 +206,7 @@ void printTokens(std::vector<Token>& tokens) {
 int main(int argc, char** argv) {
     bool doPrintTokens = false;
     bool printAST = false;
+    std::string profileName;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--print-tokens") == 0) {
@@ -192,8 +216,18 @@ int main(int argc, char** argv) {
         if (strcmp(argv[i], "--print-ast") == 0) {
             printAST = true;
         }
+
+        if (strcmp(argv[i], "--profile") == 0) {
+            profileName = "iodine-profile";
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profileName = argv[i] + 10;
+        }
     }
 
+    Profiler profiler;
+    if (!profileName.empty())
+        activeProfiler = &profiler;
+
     Function sqrt {true, "sqrt", [](std::vector<std::shared_ptr<ProducesValueNode>> args) {
         if (args.size() != 1) {
             throw std::runtime_error("incorrect num args");
@@ -219,6 +253,7 @@ int main(int argc, char** argv) {
         return Value();
     }};
 
+    sqrt.isPure = true;
     functions.insert({ "sqrt", sqrt });
     functions.insert({ "println", println });
 
@@ -259,6 +294,14 @@ int main(int argc, char** argv) {
         } catch (std::exception& e) {
             std::cout << "Error: " << e.what() << "\n";
         }
+
+        // The line's AST is about to be freed.
+        profiler.releaseStatements();
     } 
+
+    if (!profileName.empty()) {
+        activeProfiler = nullptr;
+        writeProfile(profiler, profileName);
+    }
     return 0;
 }
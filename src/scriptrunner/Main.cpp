@@ -2,6 +2,17 @@
 #include <math.h>
 #include <string.h>
 #include <parser.hpp>
+#include <AllocStats.hpp>
+#include <DeadCode.hpp>
+#include <MemoCache.hpp>
+#include <Module.hpp>
+#include <NativeScript.hpp>
+#include <Prepare.hpp>
+#include <Profiler.hpp>
+#include <SamplingProfiler.hpp>
+#include <TypeCheck.hpp>
+#include "Server.hpp"
+#include "Watch.hpp"
 #include <iostream>
 #include <unordered_map>
 #include <fstream>
@@ -26,6 +37,8 @@ std::string valueToStr(const Value& val) {
             break;
         case DataType::Null:
             return "(null)";
+        case DataType::String:
+            return val.strVal.str();
         default:
             return "";
     }
@@ -115,55 +128,84 @@ void printASTNode(std::shared_ptr<ASTNode> node, int indentDepth = 0) {
             printASTNode(in->condition, indentDepth + 1);
 
             printIndents(indentDepth);
-            std::cout << "children:\n";
+            std::cout << "children:" << (in->lazyBody != nullptr ? " (not parsed yet)" : "") << "\n";
             for (auto& n : in->nodes) {
                 printIndents(indentDepth);
                 printASTNode(n, indentDepth + 1);
             }
             break;
         }
-        default:
-            break;
-    }
-}
+        case ASTNodeType::FunctionDefinition:
+        {
+            auto def = std::static_pointer_cast<FunctionDefinitionNode>(node);
+            printIndents(indentDepth);
+            std::cout << "name: " << def->name << " (" << def->params.size() << " params, frame size " << def->frameSize << ")\n";
 
-Value evalAST(std::shared_ptr<ASTNode> exprRoot) {
-    if (exprRoot->type == ASTNodeType::VarAssignment) {
-        auto assignNode = std::static_pointer_cast<VarAssignmentNode>(exprRoot);
-
-        auto val = assignNode->valNode->getValue();
-        if (assignNode->createNew) {
-            Variable var;
-            var.name = assignNode->varName;
-            var.type = val.type;
-            var.val = val;
-            variables[assignNode->varName] = var;
-        } else {
-            auto varIt = variables.find(assignNode->varName);
-            if (varIt == variables.end()) 
-                throw std::runtime_error("Reference to undefined variable " + assignNode->varName);
-            if (val.type != varIt->second.type) {
-                std::string msg = "Assignment to variable "
-                    + assignNode->varName + " (" + dataTypeNames[varIt->second.type] + ")"
-                    + " with wrong type " + dataTypeNames[val.type];
-                throw std::runtime_error(msg);
+            printIndents(indentDepth);
+            std::cout << "body:" << (def->lazyBody != nullptr ? " (not parsed yet)" : "") << "\n";
+            for (auto& n : def->body) {
+                printASTNode(n, indentDepth + 1);
             }
-            variables.at(assignNode->varName).val = val;
+            break;
         }
-        return Value{};
-    }
+        case ASTNodeType::While:
+        case ASTNodeType::For:
+        {
+            auto loop = std::static_pointer_cast<LoopNode>(node);
+            printIndents(indentDepth);
+            std::cout << "condition:\n";
+            printASTNode(loop->condition, indentDepth + 1);
 
-    if (exprRoot->type == ASTNodeType::If) {
-        auto ifNode = std::static_pointer_cast<IfNode>(exprRoot);
+            if (node->type == ASTNodeType::For) {
+                auto forNode = std::static_pointer_cast<ForNode>(node);
+                printIndents(indentDepth);
+                std::cout << "counted: " << forNode->isCounted << "\n";
+            }
 
-        if (ifNode->condition->getValue().as<bool>()) {
-            for (auto& n : ifNode->nodes) {
-                evalAST(n);
+            printIndents(indentDepth);
+            std::cout << "invariants: " << loop->invariants.size() << "\n";
+
+            printIndents(indentDepth);
+            std::cout << "children:\n";
+            for (auto& n : loop->nodes) {
+                printASTNode(n, indentDepth + 1);
             }
+            break;
+        }
+        case ASTNodeType::LoopInvariant:
+            printASTNode(std::static_pointer_cast<LoopInvariantNode>(node)->expr, indentDepth + 1);
+            break;
+        case ASTNodeType::CommonValue:
+        {
+            auto common = std::static_pointer_cast<CommonValueNode>(node);
+            printIndents(indentDepth);
+            std::cout << (common->source == nullptr ? "computed here\n" : "reused\n");
+            printASTNode(common->expr, indentDepth + 1);
+            break;
+        }
+        case ASTNodeType::Return:
+        {
+            auto ret = std::static_pointer_cast<ReturnNode>(node);
+            printIndents(indentDepth);
+            std::cout << "tail call: " << ret->isTailCall << "\n";
+
+            if (ret->valNode != nullptr)
+                printASTNode(ret->valNode, indentDepth + 1);
+            break;
         }
-        return Value{};
+        default:
+            break;
     }
-    return std::static_pointer_cast<ProducesValueNode>(exprRoot)->getValue();
+}
+
+void writeProfile(const Profiler& profiler, const std::string& baseName) {
+    std::ofstream folded(baseName + ".folded");
+    profiler.writeFoldedStacks(folded);
+
+    std::ofstream report(baseName + ".txt");
+    profiler.writeReport(report);
+
+    std::cerr << "Profile written to " << baseName << ".folded and " << baseName << ".txt\n";
 }
 
 void printTokens(std::vector<Token>& tokens) {
@@ -175,6 +217,87 @@ void printTokens(std::vector<Token>& tokens) {
 }
 
 int main(int argc, char** argv) {
+    bool doPrintTokens = false;
+    bool printAST = false;
+    bool lazy = false;
+    bool typeCheck = false;
+    bool deadCode = false;
+    bool allocStatsEnabled = false;
+    bool aot = false;
+    bool watch = false;
+    NativeScriptOptions aotOptions;
+    const char* scriptPath = "script.iod";
+    std::string profileName;
+    std::string sampleName;
+    std::string metricsPath;
+    std::string compilePath;
+    std::vector<std::string> bindArgs;
+    ServerOptions serverOptions;
+    int sampleInterval = 1000;
+    // Slots in each pure builtin's memo cache, or 0 for none.
+    size_t memoCapacity = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--print-tokens") == 0) {
+            doPrintTokens = true;
+        } else if (strcmp(argv[i], "--print-ast") == 0) {
+            printAST = true;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = true;
+        } else if (strcmp(argv[i], "--check-types") == 0) {
+            typeCheck = true;
+        } else if (strcmp(argv[i], "--eliminate-dead-code") == 0) {
+            deadCode = true;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            startTracing(argv[i] + 8);
+        } else if (strncmp(argv[i], "--metrics=", 10) == 0) {
+            metricsPath = argv[i] + 10;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--aot") == 0) {
+            aot = true;
+        } else if (strncmp(argv[i], "--aot-cache=", 12) == 0) {
+            aot = true;
+            aotOptions.cacheDir = argv[i] + 12;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serverOptions.socketPath = argv[++i];
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serverOptions.socketPath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            serverOptions.workers = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--compile=", 10) == 0) {
+            compilePath = argv[i] + 10;
+        } else if (strncmp(argv[i], "--bind=", 7) == 0) {
+            bindArgs.push_back(argv[i] + 7);
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            allocStatsEnabled = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profileName = "iodine-profile";
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profileName = argv[i] + 10;
+        } else if (strcmp(argv[i], "--memoize") == 0) {
+            memoCapacity = 4096;
+        } else if (strncmp(argv[i], "--memoize=", 10) == 0) {
+            memoCapacity = strtoul(argv[i] + 10, nullptr, 10);
+            if (memoCapacity == 0) {
+                std::cerr << "Invalid memo capacity: " << argv[i] + 10 << "\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sample") == 0) {
+            sampleName = "iodine-samples";
+        } else if (strncmp(argv[i], "--sample=", 9) == 0) {
+            sampleName = argv[i] + 9;
+        } else if (strncmp(argv[i], "--sample-interval=", 18) == 0) {
+            sampleInterval = atoi(argv[i] + 18);
+            if (sampleInterval <= 0) {
+                std::cerr << "Invalid sample interval: " << argv[i] + 18 << "\n";
+                return 1;
+            }
+        } else {
+            scriptPath = argv[i];
+        }
+    }
+
     Function sqrt {true, "sqrt", [](std::vector<std::shared_ptr<ProducesValueNode>> args) {
         if (args.size() != 1) {
             throw std::runtime_error("incorrect num args");
@@ -196,32 +319,206 @@ int main(int argc, char** argv) {
         return Value();
     }};
 
+    sqrt.isPure = true;
+    sqrt.resultType = [](const std::vector<DataType>& args) {
+        if (args.size() != 1)
+            throw std::runtime_error("incorrect num args");
+        if (args[0] == DataType::F32 || args[0] == DataType::Count)
+            return args[0];
+        if (!isNumberType(args[0]) && args[0] != DataType::Boolean)
+            throw std::runtime_error("Invalid cast");
+        return DataType::F64;
+    };
+    println.resultType = [](const std::vector<DataType>& args) {
+        if (args.size() != 1)
+            throw std::runtime_error("Incorrect number of arguments");
+        return DataType::Null;
+    };
     functions.insert({ "sqrt", sqrt });
     functions.insert({ "println", println });
 
-    std::ifstream scriptStream("script.iod");
+    if (memoCapacity > 0) {
+        for (auto& [name, func] : functions) {
+            if (func.isBuiltin && func.isPure)
+                func.memo = std::make_shared<MemoCache>(memoCapacity);
+        }
+    }
+
+    if (!serverOptions.socketPath.empty()) {
+        try {
+            runServer(serverOptions);
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+
+        if (!metricsPath.empty()) {
+            try {
+                writeMetricsFile(metricsPath);
+            } catch (std::exception& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+            }
+        }
+        return 0;
+    }
+
+    if (watch) {
+        try {
+            watchScript(scriptPath);
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Precompiled modules skip the lexer and parser entirely.
+    bool isModule = isModuleFile(scriptPath);
+
+    std::ifstream scriptStream;
+    if (!isModule)
+        scriptStream.open(scriptPath);
 
     std::string txt;
+    std::vector<std::string> sourceLines;
 
     while (scriptStream.good()) {
         std::string line;
 
         std::getline(scriptStream, line);
 
-        if (line.empty()) continue;
-        txt += line;
+        // Keep empty lines so line numbers in profiles match the file.
+        txt += line + "\n";
+        sourceLines.push_back(line);
     }
 
+    Profiler profiler;
+    if (!profileName.empty())
+        activeProfiler = &profiler;
+
+    SamplingProfiler sampler(sampleInterval);
+    if (!sampleName.empty())
+        sampler.start();
+
+    size_t tokenCount = 0;
+    size_t statementCount = 0;
+    if (allocStatsEnabled)
+        enableAllocTracking();
+
     try {
-        std::vector<Token> tokens = parseTokens(txt);
-        printTokens(tokens);
+        std::unique_ptr<ScriptExecutor> executor;
+
+        // --bind=type:name:value fixes a global before the script runs,
+        // and the script is specialized for it.
+        std::unordered_map<std::string, Value> bindings;
+        for (auto& arg : bindArgs) {
+            size_t typeEnd = arg.find(':');
+            size_t nameEnd = typeEnd == std::string::npos ? typeEnd : arg.find(':', typeEnd + 1);
+            if (nameEnd == std::string::npos)
+                throw std::runtime_error("Expected --bind=type:name:value, got " + arg);
+            bindings[arg.substr(typeEnd + 1, nameEnd - typeEnd - 1)] = parseBinding(arg.substr(0, typeEnd), arg.substr(nameEnd + 1));
+        }
 
-        auto asts = parseScript(tokens);
+        if (isModule) {
+            if (!compilePath.empty() || aot || !bindings.empty())
+                throw std::runtime_error(std::string(scriptPath) + " is already compiled");
 
-        for (auto& a : asts) {
-            evalAST(a);
+            executor.reset(new ModuleScript(scriptPath));
+        } else {
+            std::vector<Token> tokens = parseTokens(txt);
+            tokenCount = tokens.size();
+
+            if (doPrintTokens)
+                printTokens(tokens);
+
+            auto asts = parseScript(tokens, lazy);
+            statementCount = asts.size();
+            if (!bindings.empty())
+                asts = prepareScript(asts, bindings);
+
+            // Generated scripts carry a lot of code that does nothing. Only
+            // on request, since dropped code no longer fails the way it
+            // would have at run time. Parses every lazy body.
+            if (deadCode)
+                eliminateDeadCode(asts);
+
+            // Also lets the evaluator skip the type checks it proves
+            // unneeded.
+            if (typeCheck) {
+                auto typeErrors = checkTypes(asts);
+                for (auto& error : typeErrors)
+                    std::cerr << scriptPath << ":" << error.line << ": error: " << error.message << "\n";
+                if (!typeErrors.empty())
+                    throw std::runtime_error(std::to_string(typeErrors.size()) + " type errors in " + scriptPath);
+            }
+
+            if (printAST) {
+                for (auto& a : asts)
+                    printASTNode(a);
+            }
+
+            if (!compilePath.empty()) {
+                writeModule(compilePath, asts, scriptPath);
+                std::cerr << "Compiled " << scriptPath << " to " << compilePath << "\n";
+            } else if (aot) {
+                try {
+                    executor.reset(new NativeScript(asts, aotOptions));
+                } catch (std::exception& e) {
+                    std::cerr << e.what() << "; interpreting instead\n";
+                }
+            }
+
+            if (executor == nullptr && compilePath.empty()) {
+                // Lazy mode is about not parsing what doesn't run, which
+                // value numbering would undo.
+                if (!lazy)
+                    eliminateCommonSubexpressions(asts);
+                executor.reset(new InterpretedScript(asts));
+            }
         }
+
+        if (executor != nullptr)
+            executor->run();
     } catch (std::exception& e) {
         std::cout << "Error: " << e.what() << "\n";
     }
+
+    if (!metricsPath.empty()) {
+        try {
+            writeMetricsFile(metricsPath);
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+        }
+    }
+
+    if (allocStatsEnabled) {
+        disableAllocTracking();
+        writeAllocStats(std::cerr);
+
+        if (tokenCount > 0)
+            std::cerr << "\nlex: " << (double)allocStats(AllocPhase::Lex).allocations / tokenCount << " allocs per token\n";
+        if (statementCount > 0)
+            std::cerr << "parse: " << (double)allocStats(AllocPhase::Parse).allocations / statementCount << " allocs per top-level statement\n";
+    }
+
+    for (auto& [name, func] : functions) {
+        if (func.memo == nullptr)
+            continue;
+
+        auto stats = func.memo->stats();
+        std::cerr << "memo " << name << ": " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << stats.entries << "/" << stats.capacity << " entries\n";
+    }
+
+    if (!sampleName.empty()) {
+        sampler.stop();
+
+        std::ofstream out(sampleName + ".txt");
+        sampler.writeReport(out, sourceLines);
+        std::cerr << "Samples written to " << sampleName << ".txt\n";
+    }
+
+    if (!profileName.empty()) {
+        activeProfiler = nullptr;
+        writeProfile(profiler, profileName);
+    }
 }
@@ -0,0 +1,640 @@
+#include "Server.hpp"
+#include <Incremental.hpp>
+#include <Module.hpp>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using namespace iodine;
+
+namespace {
+    // Requests bigger than this close the connection.
+    constexpr size_t maxRequestBytes = 1 << 20;
+
+    thread_local std::string* requestOutput = nullptr;
+
+    uint64_t fnv1a(const std::string& data) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string escape(const std::string& str) {
+        std::string result;
+        for (char c : str) {
+            if (c == '\n')
+                result += "\\n";
+            else if (c == '\\')
+                result += "\\\\";
+            else
+                result += c;
+        }
+        return result;
+    }
+
+    std::string unescape(const std::string& str) {
+        std::string result;
+        for (size_t i = 0; i < str.size(); i++) {
+            if (str[i] == '\\' && i + 1 < str.size()) {
+                i++;
+                result += str[i] == 'n' ? '\n' : str[i];
+            } else {
+                result += str[i];
+            }
+        }
+        return result;
+    }
+
+    std::string formatResult(const std::string& name, const Value& val) {
+        switch (val.type) {
+        case DataType::Int32:
+            return "i32 " + name + " " + valueToStr(val);
+        case DataType::F32:
+            return "f32 " + name + " " + valueToStr(val);
+        case DataType::F64:
+            return "f64 " + name + " " + valueToStr(val);
+        case DataType::Boolean:
+            return "bool " + name + " " + (val.boolVal ? "true" : "false");
+        case DataType::String:
+            return "string " + name + " " + escape(val.strVal.str());
+        default:
+            return std::string(dataTypeNames[val.type]) + " " + name;
+        }
+    }
+
+    struct Binding {
+        std::string name;
+        Value value;
+    };
+
+    struct Request {
+        std::string script;
+        std::vector<Binding> bindings;
+    };
+
+    // Takes one complete request off the front of buffer. Returns false
+    // if it hasn't all arrived yet; throws for malformed requests.
+    bool takeRequest(std::string& buffer, Request& request) {
+        size_t lineEnd = buffer.find('\n');
+        if (lineEnd == std::string::npos)
+            return false;
+
+        std::string header = buffer.substr(0, lineEnd);
+        size_t firstSpace = header.find(' ');
+        size_t lastSpace = header.rfind(' ');
+        if (header.compare(0, firstSpace, "EVAL") != 0 || lastSpace == firstSpace)
+            throw std::runtime_error("Expected EVAL <script> <binding count>");
+
+        char* end;
+        long count = strtol(header.c_str() + lastSpace + 1, &end, 10);
+        if (*end != '\0' || count < 0)
+            throw std::runtime_error("Invalid binding count");
+
+        size_t position = lineEnd + 1;
+        std::vector<std::string> lines;
+        for (long i = 0; i < count; i++) {
+            lineEnd = buffer.find('\n', position);
+            if (lineEnd == std::string::npos)
+                return false;
+            lines.push_back(buffer.substr(position, lineEnd - position));
+            position = lineEnd + 1;
+        }
+        buffer.erase(0, position);
+
+        request.script = header.substr(firstSpace + 1, lastSpace - firstSpace - 1);
+        request.bindings.clear();
+        for (auto& line : lines) {
+            size_t typeEnd = line.find(' ');
+            size_t nameEnd = typeEnd == std::string::npos ? std::string::npos : line.find(' ', typeEnd + 1);
+            if (nameEnd == std::string::npos)
+                throw std::runtime_error("Expected <type> <name> <value>");
+
+            std::string type = line.substr(0, typeEnd);
+            std::string name = line.substr(typeEnd + 1, nameEnd - typeEnd - 1);
+            request.bindings.push_back({ name, parseBinding(type, line.substr(nameEnd + 1)) });
+        }
+        return true;
+    }
+
+    // Parsed scripts by path. An entry is reused while the file's mtime
+    // and size are unchanged; when they change, the contents are hashed
+    // and only reparsed if the hash differs too, and then only the
+    // statements that changed.
+    class ScriptCache {
+    public:
+        std::shared_ptr<const ModuleImage> get(const std::string& path) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+                throw std::runtime_error("Couldn't open " + path + ": " + strerror(errno));
+
+            int64_t mtime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = entries.find(path);
+                if (it != entries.end() && it->second.image != nullptr && it->second.mtime == mtime && it->second.size == info.st_size)
+                    return it->second.image;
+            }
+
+            std::ifstream in(path, std::ios::binary);
+            std::stringstream contents;
+            contents << in.rdbuf();
+            std::string source = contents.str();
+            uint64_t hash = fnv1a(source);
+
+            std::shared_ptr<Source> parsed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Entry& entry = entries[path];
+                if (entry.image != nullptr && entry.hash == hash) {
+                    entry.mtime = mtime;
+                    entry.size = info.st_size;
+                    return entry.image;
+                }
+
+                if (entry.source == nullptr)
+                    entry.source = std::make_shared<Source>();
+                parsed = entry.source;
+            }
+
+            // Several workers may miss on the same script at once; each
+            // compiles it and the last one's image stays.
+            std::shared_ptr<const ModuleImage> image;
+            if (source.compare(0, sizeof(moduleMagic), moduleMagic, sizeof(moduleMagic)) == 0) {
+                image = ModuleImage::fromBytes(source);
+            } else {
+                std::lock_guard<std::mutex> lock(parsed->mutex);
+                ReparseStats stats = parsed->script.update(source);
+                if (stats.reused > 0) {
+                    std::cerr << "Reloaded " << path << ": " << stats.parsed << " statements parsed, "
+                              << stats.reused << " reused, " << stats.removed << " removed\n";
+                }
+
+                std::ostringstream module;
+                writeModule(module, parsed->script.statements(), path);
+                image = ModuleImage::fromBytes(module.str());
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[path] = Entry { image, mtime, info.st_size, hash, parsed };
+            return image;
+        }
+
+    private:
+        // The parsed statements of a source script, kept for reloads.
+        struct Source {
+            std::mutex mutex;
+            IncrementalScript script;
+        };
+
+        struct Entry {
+            std::shared_ptr<const ModuleImage> image;
+            int64_t mtime = 0;
+            off_t size = 0;
+            uint64_t hash = 0;
+            std::shared_ptr<Source> source;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    std::string evaluate(ScriptCache& cache, const Request& request) {
+        std::string output;
+        requestOutput = &output;
+
+        try {
+            ModuleScript script(cache.get(request.script));
+            for (auto& binding : request.bindings)
+                script.setGlobal(binding.name, binding.value);
+            script.run();
+            requestOutput = nullptr;
+
+            auto results = script.definedGlobals();
+            std::string response = "OK " + std::to_string(output.size()) + " " + std::to_string(results.size()) + "\n" + output;
+            for (auto& result : results)
+                response += formatResult(result.first, result.second) + "\n";
+            return response;
+        } catch (std::exception& e) {
+            requestOutput = nullptr;
+            std::string message = e.what();
+            for (char& c : message) {
+                if (c == '\n')
+                    c = ' ';
+            }
+            return "ERR " + message + "\n";
+        }
+    }
+
+    class Server {
+    public:
+        Server(const ServerOptions& options) : options(options) {}
+
+        ~Server() {
+            for (auto& entry : connections)
+                close(entry.second.fd);
+            if (listener >= 0) {
+                close(listener);
+                unlink(options.socketPath.c_str());
+            }
+            if (wakeup >= 0)
+                close(wakeup);
+            if (signals >= 0)
+                close(signals);
+            if (epoll >= 0)
+                close(epoll);
+        }
+
+        void run() {
+            setUp();
+
+            int workerCount = options.workers > 0 ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+            for (int i = 0; i < workerCount; i++)
+                workers.emplace_back([this] { work(); });
+
+            std::cerr << "Serving on " << options.socketPath << " with " << workerCount << " workers\n";
+
+            try {
+                loop();
+            } catch (...) {
+                stopWorkers();
+                throw;
+            }
+            stopWorkers();
+        }
+
+    private:
+        struct Connection {
+            int fd;
+            std::string in;
+            std::string out;
+            // A request from this connection is with the workers.
+            bool busy = false;
+            // The peer stopped sending; close once everything is answered.
+            bool draining = false;
+            uint32_t watched = EPOLLIN;
+        };
+
+        struct Job {
+            uint64_t connection;
+            Request request;
+        };
+
+        struct Completion {
+            uint64_t connection;
+            std::string response;
+        };
+
+        // Epoll data of the two non-connection descriptors. Connections
+        // get ids counting up from firstConnectionId.
+        static constexpr uint64_t listenerId = 0;
+        static constexpr uint64_t wakeupId = 1;
+        static constexpr uint64_t signalsId = 2;
+        static constexpr uint64_t firstConnectionId = 3;
+
+        ServerOptions options;
+        int epoll = -1;
+        int listener = -1;
+        int wakeup = -1;
+        int signals = -1;
+        uint64_t nextConnectionId = firstConnectionId;
+        std::unordered_map<uint64_t, Connection> connections;
+        ScriptCache cache;
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable jobReady;
+        std::deque<Job> jobs;
+        std::vector<Completion> completions;
+        bool stopping = false;
+
+        void check(int result, const char* what) {
+            if (result < 0)
+                throw std::runtime_error(std::string(what) + " failed: " + strerror(errno));
+        }
+
+        void watch(int fd, uint64_t id, uint32_t events, int op = EPOLL_CTL_ADD) {
+            epoll_event event = {};
+            event.events = events;
+            event.data.u64 = id;
+            check(epoll_ctl(epoll, op, fd, &event), "epoll_ctl");
+        }
+
+        void setUp() {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (options.socketPath.size() >= sizeof(address.sun_path))
+                throw std::runtime_error("Socket path too long: " + options.socketPath);
+            strcpy(address.sun_path, options.socketPath.c_str());
+
+            // SIGINT and SIGTERM arrive through the epoll loop instead, and
+            // writes to closed connections report EPIPE instead of killing
+            // the server.
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGINT);
+            sigaddset(&mask, SIGTERM);
+            pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+            signal(SIGPIPE, SIG_IGN);
+
+            epoll = epoll_create1(EPOLL_CLOEXEC);
+            check(epoll, "epoll_create1");
+
+            signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+            check(signals, "signalfd");
+            watch(signals, signalsId, EPOLLIN);
+
+            wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            check(wakeup, "eventfd");
+            watch(wakeup, wakeupId, EPOLLIN);
+
+            unlink(options.socketPath.c_str());
+            listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            check(listener, "socket");
+            if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0) {
+                close(listener);
+                listener = -1;
+                throw std::runtime_error("Couldn't bind " + options.socketPath + ": " + strerror(errno));
+            }
+            check(listen(listener, SOMAXCONN), "listen");
+            watch(listener, listenerId, EPOLLIN);
+        }
+
+        void loop() {
+            epoll_event events[64];
+
+            while (true) {
+                int count = epoll_wait(epoll, events, 64, -1);
+                if (count < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    check(count, "epoll_wait");
+                }
+
+                for (int i = 0; i < count; i++) {
+                    uint64_t id = events[i].data.u64;
+
+                    if (id == signalsId)
+                        return;
+                    if (id == listenerId)
+                        acceptConnections();
+                    else if (id == wakeupId)
+                        finishJobs();
+                    else
+                        handleConnection(id, events[i].events);
+                }
+            }
+        }
+
+        void acceptConnections() {
+            while (true) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+                        return;
+                    check(fd, "accept4");
+                }
+
+                uint64_t id = nextConnectionId++;
+                connections[id].fd = fd;
+                watch(fd, id, EPOLLIN);
+            }
+        }
+
+        void closeConnection(uint64_t id) {
+            close(connections.at(id).fd);
+            connections.erase(id);
+        }
+
+        void handleConnection(uint64_t id, uint32_t events) {
+            auto it = connections.find(id);
+            if (it == connections.end())
+                return;
+            Connection& connection = it->second;
+
+            // Hangups are only reported once the peer has closed both
+            // ways, so nobody is left to read an answer.
+            if (events & (EPOLLHUP | EPOLLERR)) {
+                closeConnection(id);
+                return;
+            }
+
+            if (events & EPOLLIN) {
+                char buffer[16384];
+                while (true) {
+                    ssize_t bytes = read(connection.fd, buffer, sizeof(buffer));
+                    if (bytes > 0) {
+                        connection.in.append(buffer, bytes);
+                        continue;
+                    }
+                    if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                        connection.draining = true;
+                    if (bytes < 0 && errno == EINTR)
+                        continue;
+                    break;
+                }
+
+                if (connection.in.size() > maxRequestBytes) {
+                    closeConnection(id);
+                    return;
+                }
+            }
+
+            if (!flush(id))
+                return;
+            dispatch(id);
+        }
+
+        // Hands the connection's next request to the workers if it has one
+        // and nothing is in flight, or closes it once a draining connection
+        // has nothing left to do.
+        void dispatch(uint64_t id) {
+            Connection& connection = connections.at(id);
+
+            while (!connection.busy) {
+                Request request;
+                bool complete;
+                try {
+                    complete = takeRequest(connection.in, request);
+                } catch (std::exception& e) {
+                    // The rest of the stream can't be framed any more.
+                    connection.in.clear();
+                    connection.out += std::string("ERR ") + e.what() + "\n";
+                    connection.draining = true;
+                    break;
+                }
+
+                if (!complete)
+                    break;
+
+                connection.busy = true;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    jobs.push_back(Job { id, std::move(request) });
+                }
+                jobReady.notify_one();
+            }
+
+            if (!flush(id))
+                return;
+
+            if (connection.draining && !connection.busy && connection.out.empty())
+                closeConnection(id);
+        }
+
+        // Writes as much pending output as the socket takes. Returns false
+        // if the connection had to be closed.
+        bool flush(uint64_t id) {
+            Connection& connection = connections.at(id);
+
+            while (!connection.out.empty()) {
+                ssize_t bytes = send(connection.fd, connection.out.data(), connection.out.size(), MSG_NOSIGNAL);
+                if (bytes < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+                    closeConnection(id);
+                    return false;
+                }
+                connection.out.erase(0, bytes);
+            }
+
+            // A draining connection stays readable at end of file, so it
+            // stops being watched for input.
+            uint32_t wanted = (connection.draining ? 0 : EPOLLIN) | (connection.out.empty() ? 0 : EPOLLOUT);
+            if (wanted != connection.watched) {
+                watch(connection.fd, id, wanted, EPOLL_CTL_MOD);
+                connection.watched = wanted;
+            }
+            return true;
+        }
+
+        void finishJobs() {
+            uint64_t counter;
+            while (read(wakeup, &counter, sizeof(counter)) < 0 && errno == EINTR) {}
+
+            std::vector<Completion> finished;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.swap(completions);
+            }
+
+            for (auto& completion : finished) {
+                auto it = connections.find(completion.connection);
+                if (it == connections.end())
+                    continue;
+
+                it->second.out += completion.response;
+                it->second.busy = false;
+                dispatch(completion.connection);
+            }
+        }
+
+        void work() {
+            while (true) {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (stopping)
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+
+                std::string response = evaluate(cache, job.request);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    completions.push_back(Completion { job.connection, std::move(response) });
+                }
+
+                uint64_t one = 1;
+                while (write(wakeup, &one, sizeof(one)) < 0 && errno == EINTR) {}
+            }
+        }
+
+        void stopWorkers() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            jobReady.notify_all();
+
+            for (auto& worker : workers)
+                worker.join();
+            workers.clear();
+        }
+    };
+}
+
+Value parseBinding(const std::string& type, const std::string& text) {
+    const char* begin = text.c_str();
+    char* end;
+    errno = 0;
+
+    if (type == "i32") {
+        long val = strtol(begin, &end, 10);
+        if (*end == '\0' && end != begin && errno == 0 && val >= INT32_MIN && val <= INT32_MAX)
+            return Value((int)val);
+    } else if (type == "f32") {
+        float val = strtof(begin, &end);
+        if (*end == '\0' && end != begin)
+            return Value(val);
+    } else if (type == "f64") {
+        double val = strtod(begin, &end);
+        if (*end == '\0' && end != begin)
+            return Value(val);
+    } else if (type == "bool") {
+        if (text == "true" || text == "false")
+            return Value(text == "true");
+    } else if (type == "string") {
+        return Value(InternedString(unescape(text)));
+    } else {
+        throw std::runtime_error("Unknown binding type " + type);
+    }
+
+    throw std::runtime_error("Invalid " + type + " value " + text);
+}
+
+void runServer(const ServerOptions& options) {
+    // Scripts print into the output of the request that's running them.
+    functions["println"] = Function { true, "println", [](FuncArgs args) {
+        if (args.size() != 1) throw std::runtime_error("Incorrect number of arguments");
+
+        if (requestOutput != nullptr)
+            *requestOutput += valueToStr(args[0]->getValue()) + "\n";
+        return Value();
+    }};
+
+    // Builtins are shared by every worker, so look up their counters now
+    // rather than on first call.
+    for (auto& entry : functions) {
+        if (entry.second.isBuiltin && entry.second.callCounter == nullptr)
+            entry.second.callCounter = &metrics::nativeCalls.labeled(entry.second.name);
+    }
+
+    Server server(options);
+    server.run();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <parser.hpp>
+#include <string>
+
+// Formats a value the way println prints it. Defined in Main.cpp.
+std::string valueToStr(const iodine::Value& val);
+
+// Parses a value of type i32, f32, f64, bool or string, unescaping
+// strings like the protocol does. Throws std::runtime_error if it doesn't
+// parse.
+iodine::Value parseBinding(const std::string& type, const std::string& text);
+
+// Long-running evaluation server on a Unix domain socket.
+//
+// Each request names a script and binds some of its globals:
+//
+//   EVAL <script path> <binding count>\n
+//   <type> <name> <value>\n          (binding count times)
+//
+// where type is i32, f32, f64, bool or string. The answer is either
+//
+//   OK <output bytes> <result count>\n
+//   <everything the script printed>
+//   <type> <name> <value>\n          (result count times)
+//
+// listing every global with a value when the script finished, or
+//
+//   ERR <message>\n
+//
+// Newlines and backslashes in string values are escaped as \n and \\.
+// A connection may send any number of requests; they're answered in
+// order.
+//
+// Scripts are parsed once and kept as module images, keyed by path and
+// revalidated against the file's mtime, size and content hash on every
+// request. Relative paths are resolved against the server's working
+// directory. .iodc modules are loaded as they are.
+//
+// One thread runs an epoll loop that does all socket I/O; evaluation
+// happens on a pool of worker threads, each run on a fresh ModuleScript,
+// so requests never see each other's globals. println writes to the
+// request's output.
+struct ServerOptions {
+    std::string socketPath;
+    // 0 means one per hardware thread.
+    int workers = 0;
+};
+
+// Serves until SIGINT or SIGTERM, then removes the socket. Throws
+// std::runtime_error if the socket can't be set up.
+void runServer(const ServerOptions& options);
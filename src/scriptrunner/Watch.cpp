@@ -0,0 +1,119 @@
+#include "Watch.hpp"
+#include <Incremental.hpp>
+#include <NativeScript.hpp>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace iodine;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    std::string readFile(const std::string& path) {
+        std::ifstream in(path);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    void runFresh(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+        variables.clear();
+        for (auto it = functions.begin(); it != functions.end();) {
+            if (it->second.isBuiltin)
+                ++it;
+            else
+                it = functions.erase(it);
+        }
+
+        try {
+            InterpretedScript(statements).run();
+        } catch (std::exception& e) {
+            std::cout << "Error: " << e.what() << "\n";
+        }
+        std::cout.flush();
+    }
+
+    // Blocks until the watched directory reports that name was written or
+    // replaced. Editors often save by writing a new file and renaming it
+    // over the old one, which is why the directory is watched rather than
+    // the file.
+    void waitForChange(int fd, const std::string& name) {
+        alignas(inotify_event) char buffer[sizeof(inotify_event) + NAME_MAX + 1];
+
+        while (true) {
+            ssize_t bytes = read(fd, buffer, sizeof(buffer));
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("Reading inotify events failed: ") + strerror(errno));
+            }
+
+            for (char* p = buffer; p < buffer + bytes;) {
+                auto event = (inotify_event*)p;
+                if (event->len > 0 && name == event->name)
+                    return;
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+}
+
+void watchScript(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error(std::string("inotify_init1 failed: ") + strerror(errno));
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::string message = "Couldn't watch " + dir + ": " + strerror(errno);
+        close(fd);
+        throw std::runtime_error(message);
+    }
+
+    IncrementalScript script;
+    std::string text = readFile(path);
+    bool loaded = false;
+
+    try {
+        script.update(text);
+        loaded = true;
+    } catch (std::exception& e) {
+        std::cout << "Error: " << e.what() << "\n";
+    }
+    if (loaded)
+        runFresh(script.statements());
+
+    while (true) {
+        std::cerr << "Watching " << path << " for changes\n";
+        waitForChange(fd, name);
+
+        std::string updated = readFile(path);
+        if (updated == text)
+            continue;
+        text = updated;
+
+        auto start = Clock::now();
+        ReparseStats stats;
+        try {
+            stats = script.update(text);
+        } catch (std::exception& e) {
+            std::cout << "Error: " << e.what() << "\n";
+            continue;
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::cerr << "Reloaded " << path << " in " << ms << " ms: " << stats.parsed << " statements parsed, "
+                  << stats.reused << " reused, " << stats.removed << " removed\n";
+        runFresh(script.statements());
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+
+// Runs the script, then waits for it to change and runs it again, until
+// interrupted. Reloads go through IncrementalScript, so only statements
+// that changed are parsed again. Each run starts without the previous
+// run's globals and script functions. Throws std::runtime_error if the
+// file can't be watched.
+void watchScript(const std::string& path);
@@ -0,0 +1,42 @@
+#pragma once
+#include <iostream>
+#include <vector>
+
+// Tiny assertion helpers for the test programs. A failed check prints
+// where it is and what it saw, and the test exits with 1 at the end.
+namespace iodine::test {
+    inline int failures = 0;
+
+    inline void fail(const char* file, int line, const char* expression) {
+        std::cerr << file << ":" << line << ": check failed: " << expression << "\n";
+        failures++;
+    }
+
+    template <typename T>
+    std::ostream& operator<<(std::ostream& out, const std::vector<T>& values) {
+        out << "{";
+        for (size_t i = 0; i < values.size(); i++)
+            out << (i > 0 ? ", " : " ") << values[i];
+        return out << " }";
+    }
+
+    template <typename A, typename B>
+    void checkEqual(const A& actual, const B& expected, const char* file, int line, const char* expression) {
+        if (actual == expected)
+            return;
+        fail(file, line, expression);
+        std::cerr << "    got: " << actual << "\n    expected: " << expected << "\n";
+    }
+
+    inline int result() {
+        if (failures > 0)
+            std::cerr << failures << " checks failed\n";
+        return failures > 0 ? 1 : 0;
+    }
+}
+
+#define CHECK(expression) \
+    ((expression) ? (void)0 : iodine::test::fail(__FILE__, __LINE__, #expression))
+
+#define CHECK_EQ(actual, expected) \
+    iodine::test::checkEqual((actual), (expected), __FILE__, __LINE__, #actual " == " #expected)
@@ -0,0 +1,142 @@
+#include "Check.hpp"
+#include <Incremental.hpp>
+#include <parser.hpp>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+std::string printed;
+
+// What running the statements prints, one value per line.
+std::string run(const std::vector<std::shared_ptr<ASTNode>>& statements) {
+    printed.clear();
+    variables.clear();
+    for (auto& statement : statements)
+        evalAST(statement);
+    return printed;
+}
+
+std::string runFresh(const std::string& text) {
+    return run(parseScript(parseTokens(text)));
+}
+
+void testEdits() {
+    IncrementalScript script;
+    ReparseStats stats = script.update("i32 a = 1;\ni32 b = 2;\nprintln(a + b);\n");
+    CHECK_EQ(stats.parsed, 3u);
+    CHECK_EQ(stats.reused, 0u);
+    auto before = script.statements();
+    CHECK_EQ(run(before), "3\n");
+
+    // Only the edited statement is parsed again.
+    stats = script.update("i32 a = 1;\ni32 b = 40;\nprintln(a + b);\n");
+    CHECK_EQ(stats.parsed, 1u);
+    CHECK_EQ(stats.reused, 2u);
+    CHECK_EQ(stats.removed, 1u);
+    auto edited = script.statements();
+    CHECK_EQ(edited.size(), 3u);
+    CHECK(edited[0] == before[0]);
+    CHECK(edited[1] != before[1]);
+    CHECK(edited[2] == before[2]);
+    CHECK_EQ(run(edited), "41\n");
+
+    // Statements after an inserted line keep their ASTs and move down.
+    stats = script.update("i32 c = 5;\n\ni32 a = 1;\ni32 b = 40;\nprintln(a + b);\n");
+    CHECK_EQ(stats.parsed, 1u);
+    CHECK_EQ(stats.reused, 3u);
+    auto inserted = script.statements();
+    CHECK_EQ(inserted.size(), 4u);
+    CHECK(inserted[1] == edited[0]);
+    CHECK(inserted[3] == edited[2]);
+    CHECK_EQ(inserted[0]->line, 1);
+    CHECK_EQ(inserted[1]->line, 3);
+    CHECK_EQ(inserted[3]->line, 5);
+
+    // And move back up when lines go.
+    stats = script.update("i32 a = 1;\ni32 b = 40;\nprintln(a + b);\n");
+    CHECK_EQ(stats.removed, 1u);
+    auto removed = script.statements();
+    CHECK_EQ(removed.size(), 3u);
+    CHECK(removed[2] == edited[2]);
+    CHECK_EQ(removed[2]->line, 3);
+}
+
+void testBlocks() {
+    std::string text =
+        "fn twice(i32 v) {\n"
+        "    return v * 2;\n"
+        "}\n"
+        "i32 total = 0;\n"
+        "for (i32 i = 0; i < 4; i = i + 1) {\n"
+        "    total = total + twice(i);\n"
+        "}\n"
+        "println(total);\n";
+
+    IncrementalScript script;
+    script.update(text);
+    CHECK_EQ(run(script.statements()), "12\n");
+
+    // An edit inside a function body reparses the function only.
+    std::string edited = text;
+    edited.replace(edited.find("v * 2"), 5, "v * 3");
+    ReparseStats stats = script.update(edited);
+    CHECK_EQ(stats.parsed, 1u);
+    CHECK_EQ(stats.reused, 3u);
+    CHECK_EQ(run(script.statements()), runFresh(edited));
+    CHECK_EQ(run(script.statements()), "18\n");
+
+    // Appending touches the last statement, which is parsed again.
+    edited += "println(total + 1);\n";
+    script.update(edited);
+    CHECK_EQ(run(script.statements()), "18\n19\n");
+}
+
+void testFallbacks() {
+    IncrementalScript script;
+    script.update("i32 a = 1;\nprintln(a);\n");
+    auto before = script.statements();
+
+    // A statement that doesn't parse keeps the previous version.
+    bool threw = false;
+    try {
+        script.update("i32 a = 1;\nprintln(a +);\n");
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(script.statements() == before);
+
+    // So does unbalancing the braces, which has to relex everything.
+    threw = false;
+    try {
+        script.update("i32 a = 1;\nif (a == 1) {\nprintln(a);\n");
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(script.statements() == before);
+
+    // A comment that swallows the rest of a line.
+    script.update("i32 a = 1; // println(a);\nprintln(a + 1);\n");
+    CHECK_EQ(run(script.statements()), "2\n");
+    script.update("i32 a = 1;\nprintln(a + 1);\n");
+    CHECK_EQ(run(script.statements()), "2\n");
+}
+
+int main() {
+    functions.insert({ "println", Function { true, "println", [](FuncArgs args) {
+        Value val = args.at(0)->getValue();
+        printed += (val.type == DataType::Int32 ? std::to_string(val.intVal) : std::string("?")) + "\n";
+        return Value();
+    } } });
+
+    testEdits();
+    testBlocks();
+    testFallbacks();
+    return iodine::test::result();
+}
@@ -0,0 +1,83 @@
+#include "Check.hpp"
+#include <parser.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+Value evaluate(const std::string& txt) {
+    auto statements = parseScript(parseTokens(txt));
+    return std::dynamic_pointer_cast<ProducesValueNode>(statements.at(0))->getValue();
+}
+
+void testInline() {
+    InternedString shortString("abc");
+    CHECK(shortString.isInline());
+    CHECK_EQ(shortString.str(), "abc");
+    CHECK_EQ(shortString.size(), 3u);
+
+    InternedString longest(std::string(InternedString::maxInlineLength, 'x'));
+    CHECK(longest.isInline());
+    CHECK(!InternedString(std::string(InternedString::maxInlineLength + 1, 'x')).isInline());
+}
+
+void testInterning() {
+    size_t before = InternedString::internedCount();
+    {
+        InternedString a("a long string value");
+        InternedString b(std::string("a long ") + "string value");
+        CHECK(!a.isInline());
+        CHECK(a == b);
+        CHECK(a != InternedString("another long string"));
+        CHECK_EQ(InternedString::internedCount(), before + 1);
+
+        InternedString copy = a;
+        InternedString moved = std::move(b);
+        CHECK(copy == moved);
+        CHECK(b.isInline());
+        CHECK_EQ(b.size(), 0u);
+    }
+
+    // The last reference frees the entry.
+    CHECK_EQ(InternedString::internedCount(), before);
+}
+
+void testValues() {
+    Value a(InternedString("abc"));
+    Value b(InternedString("defghijk"));
+    Value sum = a + b;
+    CHECK(sum.type == DataType::String);
+    CHECK_EQ(sum.strVal.str(), "abcdefghijk");
+    CHECK(sum.isEqual(Value(InternedString("abcdefghijk"))).boolVal);
+    CHECK(!a.isEqual(b).boolVal);
+
+    Value copy = sum;
+    copy = a;
+    CHECK_EQ(copy.strVal.str(), "abc");
+    CHECK_EQ(sum.strVal.str(), "abcdefghijk");
+
+    bool threw = false;
+    try {
+        a + Value(1);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+void testScripts() {
+    CHECK_EQ(evaluate("\"abc\";").strVal.str(), "abc");
+    CHECK_EQ(evaluate("\"ab\" + \"cdefgh\";").strVal.str(), "abcdefgh");
+}
+
+int main() {
+    testInline();
+    testInterning();
+    testValues();
+    testScripts();
+    return iodine::test::result();
+}
@@ -0,0 +1,175 @@
+#include "Check.hpp"
+#include <LMC.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+const LMCOptions unoptimized { false, false };
+const LMCOptions optimized { true, false };
+const LMCOptions forSpeed { true, true };
+
+std::vector<int> run(const std::string& txt, const std::vector<int>& input = {}, const LMCOptions& options = optimized) {
+    LMCRunResult result = runLMC(assembleLMC(compileToLMC(parseScript(parseTokens(txt)), options)), input, 1000000);
+    CHECK(result.halted);
+    return result.output;
+}
+
+// Runs txt with every set of options, which must all print the same.
+// Optimizing mustn't make the program bigger.
+std::vector<int> runAll(const std::string& txt, const std::vector<int>& input = {}) {
+    std::vector<int> output = run(txt, input, unoptimized);
+    CHECK_EQ(run(txt, input, optimized), output);
+    CHECK_EQ(run(txt, input, forSpeed), output);
+
+    auto statements = parseScript(parseTokens(txt));
+    CHECK(compileToLMC(statements, optimized).instructions.size() <= compileToLMC(statements, unoptimized).instructions.size());
+    return output;
+}
+
+// The message compiling txt fails with, or "" if it compiles.
+std::string compileError(const std::string& txt) {
+    try {
+        assembleLMC(compileToLMC(parseScript(parseTokens(txt))));
+    } catch (std::runtime_error& e) {
+        return e.what();
+    }
+    return "";
+}
+
+std::string assembly(const std::string& txt, const LMCOptions& options) {
+    std::stringstream out;
+    writeLMCAssembly(out, compileToLMC(parseScript(parseTokens(txt)), options));
+    return out.str();
+}
+
+void testAssembly() {
+    const char* txt = "i32 a = input();\nprintln(a + 1);\n";
+    CHECK_EQ(assembly(txt, unoptimized),
+        "\tINP\n"
+        "\tSTA\tva\n"
+        "\tLDA\tva\n"
+        "\tADD\tk1\n"
+        "\tOUT\n"
+        "\tHLT\n"
+        "va\tDAT\t0\n"
+        "k1\tDAT\t1\n");
+
+    // The accumulator still holds a after the store.
+    CHECK_EQ(assembly(txt, optimized),
+        "\tINP\n"
+        "\tSTA\tva\n"
+        "\tADD\tk1\n"
+        "\tOUT\n"
+        "\tHLT\n"
+        "va\tDAT\t0\n"
+        "k1\tDAT\t1\n");
+}
+
+void testArithmetic() {
+    CHECK_EQ(runAll("i32 a = 7; i32 b = 5; println(a + b); println(a - b); println(-a);"),
+        (std::vector<int> { 12, 2, -7 }));
+    CHECK_EQ(runAll("i32 a = 3; println((a + 4) * (a - 1));"), (std::vector<int> { 14 }));
+
+    // Multiplication and division are loops, so one per program. Division
+    // truncates towards zero like the interpreter's.
+    for (int a : { 7, -7, 0 }) {
+        for (int b : { 5, -2, 1 }) {
+            std::string values = "i32 a = " + std::to_string(a) + "; i32 b = " + std::to_string(b) + ";";
+            CHECK_EQ(runAll(values + "println(a * b);"), std::vector<int> { a * b });
+            CHECK_EQ(runAll(values + "println(a / b);"), std::vector<int> { a / b });
+        }
+    }
+}
+
+void testConstants() {
+    CHECK_EQ(runAll("println((3 * 4) + 1); println(100 / 7); println(0 - (2 - 9));"), (std::vector<int> { 13, 14, 7 }));
+
+    // Multiplication and division by constants are lowered differently
+    // for each constant, with or without --speed.
+    for (int c : { 0, 1, 2, 7, 16, -3 }) {
+        for (int a : { 0, 9, -12, 999 / 16 }) {
+            std::string script = "i32 a = input(); println(a * " + std::to_string(c) + ");";
+            CHECK_EQ(runAll(script, { a }), std::vector<int> { a * c });
+            if (c != 0) {
+                script = "i32 a = input(); println(a / " + std::to_string(c) + ");";
+                CHECK_EQ(runAll(script, { a * 10 }), std::vector<int> { a * 10 / c });
+            }
+        }
+    }
+}
+
+void testControlFlow() {
+    CHECK_EQ(runAll("i32 s = 0; for (i32 i = 1; i <= 10; i = i + 1) { s = s + i; } println(s);"),
+        (std::vector<int> { 55 }));
+    CHECK_EQ(runAll("i32 n = 3; while (n > 0) { println(n); n = n - 1; }"),
+        (std::vector<int> { 3, 2, 1 }));
+    CHECK_EQ(runAll("i32 a = 2; i32 b = 3; if (a < b) { println(1); } if (a > b) { println(2); } "
+                 "if (a >= 2) { println(3); } if (b <= 2) { println(4); } if (a == b) { println(5); }"),
+        (std::vector<int> { 1, 3 }));
+}
+
+void testInput() {
+    CHECK_EQ(runAll("i32 n = input(); i32 m = input(); println(n * m);", { 21, -2 }), (std::vector<int> { -42 }));
+}
+
+void testMachine() {
+    // Stops for input and carries on once there is some.
+    LMCMachine machine(assembleLMC(compileToLMC(parseScript(parseTokens("i32 a = input();\ni32 b = input();\nprintln(a - b);\n")))));
+    machine.input.push_back(5);
+    CHECK(machine.run() == LMCStatus::NeedsInput);
+    CHECK(machine.output.empty());
+    machine.input.push_back(7);
+    CHECK(machine.run() == LMCStatus::Halted);
+    CHECK_EQ(std::vector<int>(machine.output.begin(), machine.output.end()), std::vector<int> { -2 });
+
+    uint64_t total = 0;
+    for (auto& entry : machine.lineCycles())
+        total += entry.second;
+    CHECK_EQ(total, machine.cycles);
+    CHECK_EQ(machine.lineCycles().count(3), 1u);
+
+    // Stores into code are decoded again: mailbox 3 starts as HLT and is
+    // overwritten with OUT before it runs.
+    LMCImage image;
+    int code[] = { 505, 303, 506, 0, 0, 902, 42 };
+    for (int i = 0; i < 7; i++)
+        image.mailboxes[i] = code[i];
+    image.used = 7;
+    LMCMachine modified(image);
+    CHECK(modified.run() == LMCStatus::Halted);
+    CHECK_EQ(std::vector<int>(modified.output.begin(), modified.output.end()), std::vector<int> { 42 });
+
+    LMCMachine endless(assembleLMC(compileToLMC(parseScript(parseTokens("i32 a = 0; while (a == 0) { a = 0; }")))));
+    CHECK(endless.run(1000) == LMCStatus::OutOfCycles);
+    CHECK_EQ(endless.cycles, 1000u);
+}
+
+void testErrors() {
+    CHECK_EQ(compileError("i32 a = 1;\nf32 x = 1.5;").rfind("line 2: ", 0), 0u);
+    CHECK(compileError("i32 a = sqrt(4);") != "");
+    CHECK(compileError("println(1000);") != "");
+
+    // More constants than mailboxes.
+    std::string big;
+    for (int i = 0; i < 40; i++)
+        big += "println(" + std::to_string(i) + ");";
+    CHECK(compileError(big).find("mailboxes") != std::string::npos);
+}
+
+int main() {
+    testAssembly();
+    testArithmetic();
+    testConstants();
+    testControlFlow();
+    testInput();
+    testMachine();
+    testErrors();
+    return iodine::test::result();
+}
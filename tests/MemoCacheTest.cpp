@@ -0,0 +1,120 @@
+#include "Check.hpp"
+#include <MemoCache.hpp>
+#include <parser.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+int calls = 0;
+
+// Sums its arguments and counts how often it really ran.
+Function counted() {
+    Function func { true, "sum", [](FuncArgs args) {
+        calls++;
+        int total = 0;
+        for (auto& arg : args)
+            total += arg->getValue().intVal;
+        return Value(total);
+    } };
+    func.isPure = true;
+    return func;
+}
+
+FuncArgs constants(std::initializer_list<Value> values) {
+    FuncArgs args;
+    for (auto& val : values)
+        args.push_back(makeNode<ConstValNode>(val));
+    return args;
+}
+
+void testHits() {
+    Function func = counted();
+    MemoCache cache;
+    calls = 0;
+
+    CHECK_EQ(cache.call(func, constants({ Value(1), Value(2) })).intVal, 3);
+    CHECK_EQ(cache.call(func, constants({ Value(1), Value(2) })).intVal, 3);
+    CHECK_EQ(calls, 1);
+
+    // Different values, count or types are different keys.
+    CHECK_EQ(cache.call(func, constants({ Value(2), Value(1) })).intVal, 3);
+    CHECK_EQ(cache.call(func, constants({ Value(1) })).intVal, 1);
+    cache.call(func, constants({ Value(1.0f), Value(2) }));
+    CHECK_EQ(calls, 4);
+
+    MemoCache::Stats stats = cache.stats();
+    CHECK_EQ(stats.hits, 1);
+    CHECK_EQ(stats.misses, 4);
+    CHECK_EQ(stats.entries, 4u);
+
+    // Too many arguments to cache.
+    FuncArgs many = constants({ Value(1), Value(1), Value(1), Value(1), Value(1) });
+    cache.call(func, many);
+    cache.call(func, many);
+    CHECK_EQ(calls, 6);
+    CHECK_EQ(cache.stats().misses, 4);
+
+    cache.clear();
+    CHECK_EQ(cache.stats().entries, 0u);
+    cache.call(func, constants({ Value(1), Value(2) }));
+    CHECK_EQ(calls, 7);
+}
+
+void testEviction() {
+    Function func = counted();
+    // The smallest table there is.
+    MemoCache cache(1);
+    size_t capacity = cache.stats().capacity;
+    calls = 0;
+
+    int keys = capacity * 4;
+    for (int i = 0; i < keys; i++)
+        CHECK_EQ(cache.call(func, constants({ Value(i) })).intVal, i);
+
+    MemoCache::Stats stats = cache.stats();
+    CHECK_EQ(stats.misses, keys);
+    CHECK(stats.evictions > 0);
+    CHECK(stats.entries <= capacity);
+    CHECK_EQ(stats.entries + stats.evictions, (size_t)keys);
+
+    // The latest key is still there, and evicted ones are computed again.
+    calls = 0;
+    CHECK_EQ(cache.call(func, constants({ Value(keys - 1) })).intVal, keys - 1);
+    CHECK_EQ(calls, 0);
+    for (int i = 0; i < keys; i++)
+        CHECK_EQ(cache.call(func, constants({ Value(i) })).intVal, i);
+    CHECK(calls > 0);
+}
+
+void testScripts() {
+    Function func = counted();
+    func.memo = std::make_shared<MemoCache>();
+    functions.insert({ "sum", func });
+    calls = 0;
+
+    // Arguments are evaluated once, before the lookup.
+    auto statements = parseScript(parseTokens(
+        "i32 a = 0;\n"
+        "i32 total = 0;\n"
+        "for (i32 i = 0; i < 10; i = i + 1) {\n"
+        "    total = total + sum(a + 2, 3);\n"
+        "}\n"));
+    for (auto& statement : statements)
+        evalAST(statement);
+
+    CHECK_EQ(variables.at("total").val.intVal, 50);
+    CHECK_EQ(calls, 1);
+    CHECK_EQ(func.memo->stats().hits, 9);
+}
+
+int main() {
+    testHits();
+    testEviction();
+    testScripts();
+    return iodine::test::result();
+}
@@ -0,0 +1,138 @@
+#include "Check.hpp"
+#include <Reactive.hpp>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+using namespace iodine;
+
+std::unordered_map<std::string, Variable> iodine::variables;
+std::unordered_map<std::string, Function> iodine::functions;
+
+std::string printed;
+
+const char* script =
+    "fn offset(i32 v) {\n"
+    "    return v + k;\n"
+    "}\n"
+    "i32 a = x * 2;\n"
+    "i32 b = y + 1;\n"
+    "i32 c = a + b;\n"
+    "println(c);\n"
+    "i32 big = 0;\n"
+    "if (x > 10) {\n"
+    "    big = 1;\n"
+    "}\n"
+    "i32 hundreds = x / 100;\n"
+    "i32 scaled = hundreds * 3;\n"
+    "i32 e = offset(1);\n";
+
+int global(const std::string& name) {
+    return variables.at(name).val.intVal;
+}
+
+// The globals a full run of the script leaves with these inputs.
+std::unordered_map<std::string, int> fullRun(int x, int y, int k) {
+    variables.clear();
+    ReactiveScript fresh(parseScript(parseTokens(script)));
+    fresh.setInput("x", Value(x));
+    fresh.setInput("y", Value(y));
+    fresh.setInput("k", Value(k));
+    fresh.run();
+
+    std::unordered_map<std::string, int> result;
+    for (auto& [name, var] : variables)
+        result[name] = var.val.intVal;
+    return result;
+}
+
+void checkMatchesFullRun(int x, int y, int k) {
+    auto updated = variables;
+    std::string output = printed;
+    auto expected = fullRun(x, y, k);
+    CHECK_EQ(updated.size(), expected.size());
+    for (auto& [name, value] : expected)
+        CHECK_EQ(updated[name].val.intVal, value);
+
+    // Put the updated globals back.
+    variables = updated;
+    printed = output;
+}
+
+void testUpdates() {
+    ReactiveScript reactive(parseScript(parseTokens(script)));
+
+    bool threw = false;
+    try {
+        reactive.update();
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    CHECK(reactive.setInput("x", Value(3)));
+    CHECK(reactive.setInput("y", Value(4)));
+    CHECK(reactive.setInput("k", Value(10)));
+    CHECK(!reactive.setInput("unused", Value(1)));
+    reactive.run();
+    CHECK_EQ(printed, "11\n");
+    CHECK_EQ(global("c"), 11);
+    CHECK_EQ(global("e"), 11);
+
+    // b, c and the println depend on y.
+    printed.clear();
+    reactive.setInput("y", Value(6));
+    CHECK_EQ(reactive.update(), 3u);
+    CHECK_EQ(printed, "13\n");
+    checkMatchesFullRun(3, 6, 10);
+
+    // Nothing to do without a change.
+    printed.clear();
+    CHECK_EQ(reactive.update(), 0u);
+    CHECK_EQ(printed, "");
+
+    // x reaches big through the if. hundreds stays 0, so scaled isn't rerun.
+    reactive.setInput("x", Value(20));
+    CHECK_EQ(reactive.update(), 5u);
+    CHECK_EQ(global("big"), 1);
+    CHECK_EQ(global("c"), 47);
+    checkMatchesFullRun(20, 6, 10);
+
+    reactive.setInput("x", Value(250));
+    reactive.update();
+    CHECK_EQ(global("scaled"), 6);
+    checkMatchesFullRun(250, 6, 10);
+
+    // Back under 10, big keeps the 0 from its declaration.
+    reactive.setInput("x", Value(5));
+    reactive.update();
+    CHECK_EQ(global("big"), 0);
+    checkMatchesFullRun(5, 6, 10);
+
+    // offset() reads k, so e depends on it through the call.
+    reactive.setInput("k", Value(100));
+    CHECK_EQ(reactive.update(), 1u);
+    CHECK_EQ(global("e"), 101);
+    checkMatchesFullRun(5, 6, 100);
+}
+
+void testDuplicateFunctions() {
+    bool threw = false;
+    try {
+        ReactiveScript reactive(parseScript(parseTokens("fn f() { return 1; }\nfn f() { return 2; }\n")));
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+int main() {
+    functions.insert({ "println", Function { true, "println", [](FuncArgs args) {
+        printed += std::to_string(args.at(0)->getValue().intVal) + "\n";
+        return Value();
+    } } });
+
+    testUpdates();
+    testDuplicateFunctions();
+    return iodine::test::result();
+}
@@ -0,0 +1,202 @@
+#include "Check.hpp"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Starts `scriptrunner --serve` on a socket in a temporary directory and
+// talks to it over the protocol described in Server.hpp.
+//
+// Usage: server_test SCRIPTRUNNER
+
+namespace {
+    struct Answer {
+        // "OK", or the whole line for anything else.
+        std::string status;
+        std::string output;
+        std::vector<std::string> results;
+    };
+
+    class Connection {
+    public:
+        explicit Connection(const std::string& path) {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+                throw std::runtime_error("Socket path too long: " + path);
+            strcpy(address.sun_path, path.c_str());
+
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+                std::string message = "Couldn't connect to " + path + ": " + strerror(errno);
+                if (fd >= 0)
+                    close(fd);
+                throw std::runtime_error(message);
+            }
+        }
+
+        ~Connection() { close(fd); }
+
+        void send(const std::string& data) {
+            size_t sent = 0;
+            while (sent < data.size()) {
+                ssize_t bytes = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (bytes < 0 && errno == EINTR)
+                    continue;
+                if (bytes < 0)
+                    throw std::runtime_error(std::string("send failed: ") + strerror(errno));
+                sent += bytes;
+            }
+        }
+
+        Answer receive() {
+            Answer answer;
+            std::string header = line();
+            if (header.compare(0, 3, "OK ") != 0) {
+                answer.status = header;
+                return answer;
+            }
+
+            answer.status = "OK";
+            size_t outputBytes = strtoul(header.c_str() + 3, nullptr, 10);
+            size_t results = strtoul(header.c_str() + header.rfind(' ') + 1, nullptr, 10);
+            fill(outputBytes);
+            answer.output = buffer.substr(0, outputBytes);
+            buffer.erase(0, outputBytes);
+            for (size_t i = 0; i < results; i++)
+                answer.results.push_back(line());
+            return answer;
+        }
+
+    private:
+        int fd;
+        std::string buffer;
+
+        void fill(size_t bytes) {
+            char chunk[4096];
+            while (buffer.size() < bytes) {
+                ssize_t got = read(fd, chunk, sizeof(chunk));
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got <= 0)
+                    throw std::runtime_error("Server closed the connection");
+                buffer.append(chunk, got);
+            }
+        }
+
+        std::string line() {
+            size_t end;
+            while ((end = buffer.find('\n')) == std::string::npos)
+                fill(buffer.size() + 1);
+
+            std::string result = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            return result;
+        }
+    };
+
+    void writeFile(const std::string& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << contents;
+    }
+
+    bool contains(const std::vector<std::string>& lines, const std::string& line) {
+        for (auto& candidate : lines) {
+            if (candidate == line)
+                return true;
+        }
+        return false;
+    }
+
+    std::string eval(const std::string& script, const std::vector<std::string>& bindings) {
+        std::string request = "EVAL " + script + " " + std::to_string(bindings.size()) + "\n";
+        for (auto& binding : bindings)
+            request += binding + "\n";
+        return request;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "usage: server_test SCRIPTRUNNER\n";
+        return 1;
+    }
+
+    char dirTemplate[] = "/tmp/iodine-server-test-XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    std::string socketPath = dir + "/sock";
+    std::string script = dir + "/double.iod";
+    writeFile(script, "i32 y = x * 2;\nprintln(y);\nprintln(name);\n");
+
+    pid_t server = fork();
+    if (server == 0) {
+        std::string socketArgument = "--serve=" + socketPath;
+        execl(argv[1], argv[1], socketArgument.c_str(), "--workers=2", (char*)nullptr);
+        _exit(127);
+    }
+
+    // Wait for the socket to show up.
+    struct stat info;
+    for (int i = 0; i < 500 && stat(socketPath.c_str(), &info) != 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    try {
+        Connection connection(socketPath);
+
+        connection.send(eval(script, { "i32 x 21", "string name a\\nb" }));
+        Answer answer = connection.receive();
+        CHECK_EQ(answer.status, "OK");
+        CHECK_EQ(answer.output, "42\na\nb\n");
+        CHECK(contains(answer.results, "i32 x 21"));
+        CHECK(contains(answer.results, "i32 y 42"));
+        CHECK(contains(answer.results, "string name a\\nb"));
+
+        // Requests sent together are answered in order, each with its own
+        // globals.
+        connection.send(eval(script, { "i32 x 1", "string name p" }) + eval(script, { "i32 x 2", "string name q" }));
+        CHECK_EQ(connection.receive().output, "2\np\n");
+        CHECK_EQ(connection.receive().output, "4\nq\n");
+
+        // A script that fails, one that doesn't exist, and one that changed
+        // since the server cached it.
+        connection.send(eval(script, { "i32 x 1" }));
+        CHECK_EQ(connection.receive().status.rfind("ERR ", 0), 0u);
+        connection.send(eval(dir + "/missing.iod", {}));
+        CHECK_EQ(connection.receive().status.rfind("ERR ", 0), 0u);
+
+        writeFile(script, "i32 y = x + 1000;\nprintln(y);\n");
+        connection.send(eval(script, { "i32 x 5" }));
+        CHECK_EQ(connection.receive().output, "1005\n");
+
+        // Other connections are served too.
+        Connection second(socketPath);
+        second.send(eval(script, { "i32 x 6" }));
+        CHECK_EQ(second.receive().output, "1006\n");
+    } catch (std::exception& e) {
+        std::cerr << e.what() << "\n";
+        iodine::test::failures++;
+    }
+
+    // Stops cleanly on SIGTERM and removes its socket.
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(stat(socketPath.c_str(), &info) != 0);
+
+    unlink(script.c_str());
+    unlink(socketPath.c_str());
+    rmdir(dir.c_str());
+    return iodine::test::result();
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Lints the same scripts again and again with iodine-linter and checks
+# what its cache serves: repeated runs hit and print the same findings,
+# an edited script or different options miss.
+#
+# Usage: lint-cache.sh LINTER SCRIPT
+set -u
+
+linter=$1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+mkdir "$tmp/scripts"
+cp "$2" "$tmp/scripts/a.iod"
+printf 'i32 x = 1;\nprintln(x);\n' >"$tmp/scripts/b.iod"
+
+status=0
+
+# Lints the scripts and checks how many came from the cache.
+lint() {
+    expected=$1
+    shift
+    "$linter" --cache-dir="$tmp/cache" "$@" "$tmp/scripts" >"$tmp/out" 2>"$tmp/err"
+    if ! grep -q ", $expected cached" "$tmp/err"; then
+        echo "Expected $expected cached:" >&2
+        cat "$tmp/err" >&2
+        status=1
+    fi
+}
+
+lint 0
+cp "$tmp/out" "$tmp/first"
+lint 2
+diff -u "$tmp/first" "$tmp/out" || status=1
+
+printf 'i32 x = 1;\nprintln(x);\ni32 y = 2;\n' >"$tmp/scripts/b.iod"
+lint 1
+grep -q "b.iod:3: global y is never used" "$tmp/out" || {
+    echo "Stale findings for b.iod:" >&2
+    cat "$tmp/out" >&2
+    status=1
+}
+
+lint 0 --keep-globals
+lint 2 --keep-globals
+
+exit $status
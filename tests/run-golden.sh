@@ -0,0 +1,52 @@
+#!/bin/sh
+# Runs a golden script with scriptrunner in one mode and compares what it
+# prints with NAME.MODE.out if there is one, else NAME.out. Extra
+# scriptrunner arguments for every mode go in NAME.args. Stderr is
+# compared too when there's a NAME.MODE.err.
+#
+# Usage: run-golden.sh SCRIPTRUNNER MODE SCRIPT
+set -u
+
+runner=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+mode=$2
+dir=$(dirname "$3")
+name=$(basename "$3" .iod)
+
+cd "$dir" || exit 1
+
+expected=$name.$mode.out
+[ -f "$expected" ] || expected=$name.out
+args=
+[ -f "$name.args" ] && args=$(cat "$name.args")
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+# Scripts are run by their name, which shows up in messages.
+case $mode in
+default) "$runner" $args "$name.iod" ;;
+lazy) "$runner" --lazy $args "$name.iod" ;;
+check-types) "$runner" --check-types $args "$name.iod" ;;
+dead-code) "$runner" --eliminate-dead-code $args "$name.iod" ;;
+aot) "$runner" --aot-cache="$tmp/aot" $args "$name.iod" ;;
+module)
+    # Compiling prints errors the way running does and writes no module.
+    "$runner" $args --compile="$tmp/$name.iodc" "$name.iod" 2>/dev/null
+    if [ -f "$tmp/$name.iodc" ]; then
+        "$runner" "$tmp/$name.iodc"
+    fi
+    ;;
+*)
+    echo "Unknown mode $mode" >&2
+    exit 1
+    ;;
+esac >"$tmp/out" 2>"$tmp/err"
+
+status=0
+diff -u "$expected" "$tmp/out" || status=1
+if [ -f "$name.$mode.err" ]; then
+    diff -u "$name.$mode.err" "$tmp/err" || status=1
+else
+    cat "$tmp/err" >&2
+fi
+exit $status
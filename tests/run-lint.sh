@@ -0,0 +1,21 @@
+#!/bin/sh
+# Lints a script with iodine-linter and compares what it reports with
+# NAME.lint. Finding something isn't a failure here, only a different
+# report is.
+#
+# Usage: run-lint.sh LINTER SCRIPT
+set -u
+
+linter=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(dirname "$2")
+name=$(basename "$2" .iod)
+
+cd "$dir" || exit 1
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+"$linter" --no-cache "$name.iod" >"$tmp/out" 2>/dev/null
+[ $? -le 1 ] || exit 1
+
+diff -u "$name.lint" "$tmp/out"